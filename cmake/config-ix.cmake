@@ -126,6 +126,18 @@ if(HAVE_LIBPTHREAD)
   set(LLVM_PTHREAD_LIB ${CMAKE_THREAD_LIBS_INIT})
 endif()
 
+# The runtime that Tapir lowers to when no Tapir target is given.  It does not
+# depend on the libraries installed on the build host, so that a program lowers
+# to the same runtime wherever the compiler was built.
+set(TAPIR_DEFAULT_TARGET Cilk CACHE STRING
+  "Default Tapir target: None, Serial, Cilk, OpenMP, CilkR, Qthreads or TBB")
+set(TAPIR_TARGETS_ALL None Serial Cilk OpenMP CilkR Qthreads TBB)
+set_property(CACHE TAPIR_DEFAULT_TARGET PROPERTY STRINGS ${TAPIR_TARGETS_ALL})
+list(FIND TAPIR_TARGETS_ALL "${TAPIR_DEFAULT_TARGET}" tapir_target_idx)
+if(tapir_target_idx EQUAL -1)
+  message(FATAL_ERROR "Unknown TAPIR_DEFAULT_TARGET: ${TAPIR_DEFAULT_TARGET}")
+endif()
+
 # Don't look for these libraries on Windows. Also don't look for them if we're
 # using MSan, since uninstrumented third party code may call MSan interceptors
 # like strlen, leading to false positives.
@@ -26,6 +26,7 @@ class CallSite;
 class DataLayout;
 class Function;
 class ProfileSummaryInfo;
+class TaskInfo;
 class TargetTransformInfo;
 
 namespace InlineConstants {
@@ -175,12 +176,17 @@ int getCallsiteCost(CallSite CS, const DataLayout &DL);
 ///
 /// Also note that calling this function *dynamically* computes the cost of
 /// inlining the callsite. It is an expensive, heavyweight call.
+///
+/// If \p GetTaskInfo is given, the task tree of the caller is taken from it
+/// rather than computed for each call site.
 InlineCost
 getInlineCost(CallSite CS, const InlineParams &Params,
               TargetTransformInfo &CalleeTTI,
               std::function<AssumptionCache &(Function &)> &GetAssumptionCache,
               Optional<function_ref<BlockFrequencyInfo &(Function &)>> GetBFI,
-              ProfileSummaryInfo *PSI);
+              ProfileSummaryInfo *PSI,
+              Optional<function_ref<TaskInfo &(Function &)>> GetTaskInfo =
+                  None);
 
 /// \brief Get an InlineCost with the callee explicitly specified.
 /// This allows you to calculate the cost of inlining a function via a
@@ -192,7 +198,9 @@ getInlineCost(CallSite CS, Function *Callee, const InlineParams &Params,
               TargetTransformInfo &CalleeTTI,
               std::function<AssumptionCache &(Function &)> &GetAssumptionCache,
               Optional<function_ref<BlockFrequencyInfo &(Function &)>> GetBFI,
-              ProfileSummaryInfo *PSI);
+              ProfileSummaryInfo *PSI,
+              Optional<function_ref<TaskInfo &(Function &)>> GetTaskInfo =
+                  None);
 
 /// \brief Minimal filter to detect invalid constructs for inlining.
 bool isInlineViable(Function &Callee);
@@ -0,0 +1,164 @@
+//===- TapirTaskInfo.h - Tapir task tree analysis ---------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file exposes the TaskInfo analysis, which computes the tree of Tapir
+// tasks in a function.  A task is the sub-CFG detached by a detach
+// instruction, identified by its entry block, i.e., the detached successor of
+// that detach.  Blocks outside of any detached sub-CFG belong to the task
+// rooted at the entry block of the function.
+//
+// TaskInfo answers the same queries as GetDetachedCtx, but computes the
+// answers for all blocks in one traversal of the CFG.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_ANALYSIS_TAPIRTASKINFO_H
+#define LLVM_ANALYSIS_TAPIRTASKINFO_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+
+namespace llvm {
+
+class BasicBlock;
+class DetachInst;
+class Function;
+class raw_ostream;
+class Value;
+
+/// TaskInfo - Map each basic block of a function to the task containing it
+/// and record how tasks nest.
+class TaskInfo {
+  /// The function this TaskInfo was computed for.
+  Function *F = nullptr;
+
+  /// Map from each reachable block to the entry block of its task.
+  DenseMap<const BasicBlock *, const BasicBlock *> BlockToTask;
+
+  /// Map from the entry block of each detached task to the detach that
+  /// spawns it.
+  DenseMap<const BasicBlock *, const DetachInst *> TaskToDetach;
+
+  /// Map from the entry block of each detached task to the entry block of the
+  /// task that spawns it.
+  DenseMap<const BasicBlock *, const BasicBlock *> TaskToParent;
+
+public:
+  TaskInfo() = default;
+  explicit TaskInfo(Function &F) { recalculate(F); }
+
+  TaskInfo(TaskInfo &&) = default;
+  TaskInfo &operator=(TaskInfo &&) = default;
+
+  /// Compute the task tree of function F, discarding any previous results.
+  void recalculate(Function &F);
+
+  void releaseMemory();
+
+  /// Handle invalidation explicitly.
+  bool invalidate(Function &F, const PreservedAnalyses &PA,
+                  FunctionAnalysisManager::Invalidator &);
+
+  /// Get the entry block of the task that contains BB.  This is either the
+  /// detached successor of some detach or the entry block of the function.
+  /// Return null if the traversal that computed the tree did not reach BB,
+  /// i.e., if BB is unreachable or was created after the tree was computed.
+  const BasicBlock *getTaskFor(const BasicBlock *BB) const;
+  BasicBlock *getTaskFor(BasicBlock *BB) const {
+    return const_cast<BasicBlock *>(
+        getTaskFor(const_cast<const BasicBlock *>(BB)));
+  }
+
+  /// Return true if BB is the entry block of a task, including the entry block
+  /// of the function.
+  bool isTaskEntry(const BasicBlock *BB) const {
+    return getTaskFor(BB) == BB;
+  }
+
+  /// Return true if the function detaches no tasks.
+  bool empty() const { return TaskToDetach.empty(); }
+
+  /// Return true if BB executes in some detached task.  This is false for
+  /// blocks the tree does not know about.
+  bool isDetached(const BasicBlock *BB) const {
+    return TaskToDetach.count(getTaskFor(BB));
+  }
+
+  /// Get the detach that spawns the task with entry block TaskEntry, or null
+  /// if TaskEntry is the entry block of the function.
+  const DetachInst *getDetacher(const BasicBlock *TaskEntry) const {
+    return TaskToDetach.lookup(TaskEntry);
+  }
+
+  /// Get the entry block of the task that spawns the task with entry block
+  /// TaskEntry, or null if TaskEntry is the entry block of the function.
+  const BasicBlock *getParentTask(const BasicBlock *TaskEntry) const {
+    return TaskToParent.lookup(TaskEntry);
+  }
+
+  /// Get the sync region of the detach that spawns the task with entry block
+  /// TaskEntry, or null if TaskEntry is the entry block of the function.
+  const Value *getSyncRegion(const BasicBlock *TaskEntry) const;
+
+  /// Return true if the task with entry block Inner is Outer or is nested
+  /// within Outer.
+  bool encloses(const BasicBlock *Outer, const BasicBlock *Inner) const;
+
+  void print(raw_ostream &OS) const;
+};
+
+/// \brief Analysis pass which computes a \c TaskInfo.
+class TaskAnalysis : public AnalysisInfoMixin<TaskAnalysis> {
+  friend AnalysisInfoMixin<TaskAnalysis>;
+  static AnalysisKey Key;
+
+public:
+  typedef TaskInfo Result;
+
+  TaskInfo run(Function &F, FunctionAnalysisManager &);
+};
+
+/// \brief Printer pass for the \c TaskInfo.
+class TaskInfoPrinterPass : public PassInfoMixin<TaskInfoPrinterPass> {
+  raw_ostream &OS;
+
+public:
+  explicit TaskInfoPrinterPass(raw_ostream &OS) : OS(OS) {}
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+
+/// \brief Legacy analysis pass which computes a \c TaskInfo.
+class TaskInfoWrapperPass : public FunctionPass {
+  TaskInfo TI;
+
+public:
+  static char ID; // Pass identification, replacement for typeid
+
+  TaskInfoWrapperPass() : FunctionPass(ID) {
+    initializeTaskInfoWrapperPassPass(*PassRegistry::getPassRegistry());
+  }
+
+  TaskInfo &getTaskInfo() { return TI; }
+  const TaskInfo &getTaskInfo() const { return TI; }
+
+  bool runOnFunction(Function &F) override;
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesAll();
+  }
+
+  void releaseMemory() override { TI.releaseMemory(); }
+
+  void print(raw_ostream &OS, const Module *M = nullptr) const override;
+};
+
+} // End llvm namespace
+
+#endif
@@ -392,6 +392,9 @@
 /* Patch version of the Tapir API */
 #define TAPIR_VERSION_PATCH ${TAPIR_VERSION_PATCH}
 
+/* Target that Tapir lowers to by default, named as in TapirTargetType */
+#define TAPIR_DEFAULT_TARGET ${TAPIR_DEFAULT_TARGET}
+
 /* Define to the extension used for shared libraries, say, ".so". */
 #cmakedefine LTDL_SHLIB_EXT "${LTDL_SHLIB_EXT}"
 
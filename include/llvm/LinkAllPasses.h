@@ -212,6 +212,9 @@ namespace {
       (void) llvm::createEliminateAvailableExternallyPass();
       (void) llvm::createScalarizeMaskedMemIntrinPass();
       (void) llvm::createSmallBlockPass();
+      (void) llvm::createRecursionCutoffPass();
+      (void) llvm::createSerialDispatchPass();
+      (void) llvm::createTapirLoopFusionPass();
       (void) llvm::createRedundantSpawnPass();
       (void) llvm::createSpawnRestructurePass();
       (void) llvm::createSyncEliminationPass();
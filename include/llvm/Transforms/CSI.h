@@ -16,6 +16,7 @@
 #include "llvm/Transforms/Instrumentation.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Dominators.h"
@@ -25,6 +26,8 @@
 namespace llvm {
 
 static const char *const CsiRtUnitInitName = "__csirt_unit_init";
+static const char *const CsiRtUnitInitCompressedName =
+    "__csirt_unit_init_compressed";
 static const char *const CsiRtUnitCtorName = "csirt.unit_ctor";
 static const char *const CsiFunctionBaseIdName = "__csi_unit_func_base_id";
 static const char *const CsiFunctionExitBaseIdName = "__csi_unit_func_exit_base_id";
@@ -44,6 +47,7 @@ static const char *const CsiUnitFedTableName = "__csi_unit_fed_table";
 static const char *const CsiFuncIdVariablePrefix = "__csi_func_id_";
 static const char *const CsiUnitFedTableArrayName = "__csi_unit_fed_tables";
 static const char *const CsiUnitSizeTableArrayName = "__csi_unit_size_tables";
+static const char *const CsiUnitFedStringsName = "__csi_unit_fed_strings";
 static const char *const CsiInitCallsiteToFunctionName =
     "__csi_init_callsite_to_function";
 static const char *const CsiDisableInstrumentationName =
@@ -52,6 +56,29 @@ static const char *const CsiDisableInstrumentationName =
 static const int64_t CsiCallsiteUnknownTargetId = -1;
 // See llvm/tools/clang/lib/CodeGen/CodeGenModule.h:
 static const int CsiUnitCtorPriority = 65535;
+// Number of entries in each block of a compressed table.  The runtime decodes
+// a compressed table one block at a time, so this must match
+// CSIRT_TABLE_BLOCK_SIZE in projects/csirt-compressed.
+static const unsigned CsiTableBlockSize = 64;
+
+/// Pool of the strings referenced by the compressed FED tables of a unit.
+///
+/// Each distinct string is stored once, NUL-terminated, and is referenced by
+/// its byte offset in the pool.
+class CsiStringPool {
+public:
+  /// Get the offset of the given string in the pool, adding it if necessary.
+  uint32_t intern(StringRef S);
+
+  /// Insert this pool into the given Module.
+  Constant *insertIntoModule(Module &M) const;
+
+private:
+  /// Map of string to its offset in Data.
+  StringMap<uint32_t> Offsets;
+  /// The contents of the pool.
+  std::string Data;
+};
 
 /// Maintains a mapping from CSI ID to static data for that ID.
 class ForensicTable {
@@ -123,6 +150,21 @@ public:
   /// allows the table to be indexed by global ID.
   Constant *insertIntoModule(Module &M) const;
 
+  /// Insert a compressed encoding of this FED table into the given Module.
+  ///
+  /// Each entry is encoded as a sequence of LEB128 numbers: the offset plus one
+  /// of its name in Strings, the signed difference between its line and that
+  /// of the previous entry, its column plus one, and the offset plus one of its
+  /// file name in Strings.  Zero stands for a missing name, column, or file
+  /// name.  Line differences restart at the first entry of every block of
+  /// CsiTableBlockSize entries, so the runtime can decode any entry starting
+  /// from the beginning of its block.
+  ///
+  /// \returns A pair of the encoded entries, as an i8*, and the byte offset of
+  /// each block in the encoded entries, as an i32*.
+  std::pair<Constant *, Constant *>
+  insertCompressedIntoModule(Module &M, CsiStringPool &Strings) const;
+
 private:
   struct SourceLocation {
     StringRef Name;
@@ -184,6 +226,15 @@ public:
   /// be indexed by global ID.
   Constant *insertIntoModule(Module &M) const;
 
+  /// Insert a compressed encoding of this table into the given Module.
+  ///
+  /// Each entry is encoded as the LEB128 numbers of its full IR size and its
+  /// non-empty IR size, in blocks of CsiTableBlockSize entries.
+  ///
+  /// \returns A pair of the encoded entries, as an i8*, and the byte offset of
+  /// each block in the encoded entries, as an i32*.
+  std::pair<Constant *, Constant *> insertCompressedIntoModule(Module &M) const;
+
 private:
   struct SizeInformation {
     // This count includes every IR instruction.
@@ -560,7 +611,8 @@ public:
         CsiAfterCallsite(nullptr), CsiBeforeRead(nullptr),
         CsiAfterRead(nullptr), CsiBeforeWrite(nullptr), CsiAfterWrite(nullptr),
         MemmoveFn(nullptr), MemcpyFn(nullptr), MemsetFn(nullptr),
-        InitCallsiteToFunction(nullptr), RTUnitInit(nullptr)
+        InitCallsiteToFunction(nullptr), RTUnitInit(nullptr),
+        CompressTables(false)
   {}
 
   bool run();
@@ -589,6 +641,10 @@ protected:
   void initializeTapirHooks();
   /// @}
 
+  /// Drop the hooks that the tool described by -csi-tool-hooks does not
+  /// implement, and disable the instrumentation that has no hooks left.
+  void elideUnimplementedHooks();
+
   static StructType *getUnitFedTableType(LLVMContext &C,
                                          PointerType *EntryPointerType);
   static Constant *fedTableToUnitFedTable(Module &M,
@@ -599,6 +655,14 @@ protected:
   static Constant *sizeTableToUnitSizeTable(Module &M,
                                             StructType *UnitSizeTableType,
                                             SizeTable &SzTable);
+  static StructType *getCompressedUnitFedTableType(LLVMContext &C);
+  Constant *fedTableToCompressedUnitFedTable(Module &M,
+                                             StructType *UnitFedTableType,
+                                             FrontEndDataTable &FedTable);
+  static StructType *getCompressedUnitSizeTableType(LLVMContext &C);
+  static Constant *
+  sizeTableToCompressedUnitSizeTable(Module &M, StructType *UnitSizeTableType,
+                                     SizeTable &SzTable);
   /// Initialize the front-end data table structures.
   void initializeFEDTables();
   /// Collect unit front-end data table structures for finalization.
@@ -680,6 +744,11 @@ protected:
 
   // Runtime unit initialization
   Function *RTUnitInit;
+  // Whether to emit the FED and size tables in their compressed encoding,
+  // which the runtime decodes lazily.
+  bool CompressTables;
+  // Strings referenced by the compressed FED tables.
+  CsiStringPool FEDStrings;
 
   Type *IntptrTy;
   DenseMap<StringRef, uint64_t> FuncOffsetMap;
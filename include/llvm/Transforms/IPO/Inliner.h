@@ -14,6 +14,7 @@
 #include "llvm/Analysis/CallGraphSCCPass.h"
 #include "llvm/Analysis/InlineCost.h"
 #include "llvm/Analysis/LazyCallGraph.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/Transforms/Utils/ImportedFunctionsInliningStatistics.h"
 
@@ -71,10 +72,18 @@ private:
   // Insert @llvm.lifetime intrinsics.
   bool InsertLifetime;
 
+  /// Task trees of the callers in the SCC being inlined into, each kept until
+  /// a call is inlined into its function.
+  DenseMap<Function *, std::unique_ptr<TaskInfo>> TaskInfos;
+
 protected:
   AssumptionCacheTracker *ACT;
   ProfileSummaryInfo *PSI;
   ImportedFunctionsInliningStatistics ImportedFunctionsStats;
+
+  /// Get the task tree of \p F for the inline cost analysis, computing it the
+  /// first time it is needed.
+  TaskInfo &getTaskInfo(Function &F);
 };
 
 /// The inliner pass for the new pass manager.
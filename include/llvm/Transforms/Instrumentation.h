@@ -201,6 +201,9 @@ inline ModulePass *createDataFlowSanitizerPassForJIT(
 // Insert CilkSanitizer (Cilk determinacy race detection) instrumentation
 ModulePass *createCilkSanitizerPass();
 
+// Insert Cilkscale (Cilk work/span profiling) instrumentation
+ModulePass *createCilkscalePass();
+
 // Options for comprehensive static instrumentation
 struct CSIOptions {
   bool InstrumentFuncEntryExit = true;
@@ -36,9 +36,32 @@ FunctionPass *createNestedDetachMotionPass();
 
 //===----------------------------------------------------------------------===//
 //
-// SmallBlock - Do SmallBlock Pass
+// SmallBlock - Serialize detached regions too small to pay for the spawn
+// overhead of the given Tapir target.
 //
-FunctionPass *createSmallBlockPass();
+FunctionPass *createSmallBlockPass(TapirTarget* = nullptr);
+
+//===----------------------------------------------------------------------===//
+//
+// RecursionCutoff - Call a serial clone of a recursive spawning function once
+// the recursion is small enough.
+//
+ModulePass *createRecursionCutoffPass();
+
+//===----------------------------------------------------------------------===//
+//
+// SerialDispatch - Call a serial clone of each spawning function when the
+// given Tapir target reports that spawning cannot gain parallelism.
+//
+ModulePass *createSerialDispatchPass(TapirTarget* = nullptr);
+
+//===----------------------------------------------------------------------===//
+//
+// TapirLoopFusion - Fuse adjacent Tapir loops with the same trip count, when
+// each iteration of the second loop depends only on the same iteration of the
+// first.
+//
+FunctionPass *createTapirLoopFusionPass();
 
 //===----------------------------------------------------------------------===//
 //
@@ -79,10 +79,13 @@ public:
   Function *createDetach(DetachInst &Detach,
                          ValueToValueMapTy &DetachCtxToStackFrame,
                          DominatorTree &DT, AssumptionCache &AC) override final;
+  bool shouldProcessFunction(const Function &F) override final;
   void preProcessFunction(Function &F) override final;
   void postProcessFunction(Function &F) override final;
   void postProcessHelper(Function &F) override final;
   bool processMain(Function &F) override final;
+  unsigned getSpawnCost() const override final;
+  Value *createSerialDispatchCheck(Instruction *InsertBefore) override final;
 
   struct __cilkrts_pedigree {};
   struct __cilkrts_stack_frame {};
@@ -0,0 +1,58 @@
+//===- CilkRABI.h - Interface to the CilkR runtime ----------*- C++ -*--===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the CilkRABI target, which lowers Tapir to calls into
+// CilkR, a lightweight work-stealing runtime with the following interface:
+//
+//   struct __cilkr_frame { int64_t pending; void *worker; };
+//   void __cilkr_spawn(__cilkr_frame *f, void (*fn)(void *), void *args,
+//                      size_t size);
+//   void __cilkr_sync(__cilkr_frame *f);
+//   int __cilkr_get_nworkers(void);
+//
+// Each sync region of a function gets a frame on the stack, which the
+// compiler initializes inline.  A spawn copies the arguments of the task into
+// a descriptor that the runtime pushes onto the Chase-Lev deque of the current
+// worker, and increments the pending count of the frame.  The count is
+// decremented when the task completes, whether it runs on its spawning worker
+// or on a thief.  A sync only calls into the runtime, which pops or waits for
+// the outstanding tasks, when the pending count is nonzero.
+//
+// The runtime itself lives in projects/cilkr.  CilkR is the default Tapir
+// target of builds that do not find the Cilk Plus runtime.
+//
+//===----------------------------------------------------------------------===//
+#ifndef CILKR_ABI_H_
+#define CILKR_ABI_H_
+
+#include "llvm/Transforms/Tapir/TapirUtils.h"
+
+namespace llvm {
+
+class CilkRABI : public TapirTarget {
+public:
+  CilkRABI();
+  Value *GetOrCreateWorker8(Function &F) override final;
+  void createSync(SyncInst &inst, ValueToValueMapTy &DetachCtxToStackFrame)
+    override final;
+
+  Function *createDetach(DetachInst &Detach,
+                         ValueToValueMapTy &DetachCtxToStackFrame,
+                         DominatorTree &DT, AssumptionCache &AC) override final;
+  void preProcessFunction(Function &F) override final;
+  void postProcessFunction(Function &F) override final;
+  void postProcessHelper(Function &F) override final;
+  bool processMain(Function &F) override final;
+  unsigned getSpawnCost() const override final;
+  Value *createSerialDispatchCheck(Instruction *InsertBefore) override final;
+};
+
+}  // end of llvm namespace
+
+#endif
@@ -24,8 +24,10 @@
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Transforms/Tapir/TapirUtils.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
 
 #define LS_NAME "loop-spawning"
 
@@ -54,6 +56,18 @@ public:
 
   virtual bool processLoop() = 0;
 
+  /// Return true if processLoop left the loop unchanged only because this
+  /// lowering does not support some feature of the loop, which the generic
+  /// divide-and-conquer lowering may support.
+  bool declined() const { return Declined; }
+
+  /// Record the udiv and urem instructions by which this loop, collapsed from
+  /// a nest of Tapir loops, recovers the indices of the loops in the nest from
+  /// its induction variable.
+  void setCollapsedIndices(ArrayRef<Instruction *> Indices) {
+    CollapsedIndices.assign(Indices.begin(), Indices.end());
+  }
+
   virtual ~LoopOutline() {}
 
 protected:
@@ -83,6 +97,135 @@ protected:
   /// special manner.
   BasicBlock *ExitBlock;
 
+  /// Set when this lowering declines the loop.
+  bool Declined = false;
+
+  /// Divisions that recover the indices of a collapsed loop nest.
+  SmallVector<Instruction *, 4> CollapsedIndices;
+
+// private:
+//   /// Report an analysis message to assist the user in diagnosing loops that are
+//   /// not transformed.  These are handled as LoopAccessReport rather than
+//   /// VectorizationReport because the << operator of LoopSpawningReport returns
+//   /// LoopAccessReport.
+//   void emitAnalysis(const LoopAccessReport &Message) const {
+//     emitAnalysisDiag(OrigLoop, *ORE, Message);
+//   }
+};
+
+/// DACLoopSpawning implements the transformation to spawn the iterations of a
+/// Tapir loop in a recursive divide-and-conquer fashion.
+class DACLoopSpawning : public LoopOutline {
+public:
+  // DACLoopSpawning(Loop *OrigLoop, ScalarEvolution &SE,
+  //                 LoopInfo *LI, DominatorTree *DT,
+  //                 const TargetLibraryInfo *TLI,
+  //                 const TargetTransformInfo *TTI,
+  //                 OptimizationRemarkEmitter *ORE)
+  //     : OrigLoop(OrigLoop), SE(SE), LI(LI), DT(DT),
+  //       TLI(TLI), TTI(TTI), ORE(ORE)
+  // {}
+  TapirTarget* tapirTarget;
+  DACLoopSpawning(Loop *OrigLoop, unsigned Grainsize,
+                  ScalarEvolution &SE,
+                  LoopInfo *LI, DominatorTree *DT,
+                  AssumptionCache *AC,
+                  OptimizationRemarkEmitter &ORE, TapirTarget* tapirTarget,
+                  unsigned MaxGrainsize = 2048)
+      : LoopOutline(OrigLoop, SE, LI, DT, AC, ORE),
+        tapirTarget(tapirTarget),
+        SpecifiedGrainsize(Grainsize),
+        MaxGrainsize(MaxGrainsize)
+  {}
+
+  bool processLoop();
+
+  /// Strip-mine the loop into chunks of Count iterations, where Count is a
+  /// power of 2.  The recursion then spawns whole chunks, and the original
+  /// loop runs the remaining iterations serially.
+  void setStripMineCount(unsigned Count) { StripMineCount = Count; }
+
+  virtual ~DACLoopSpawning() {}
+
+protected:
+  virtual Value* computeGrainsize(Value *Limit);
+  /// Get the grainsize that the divide-and-conquer recursion compares against
+  /// the remaining iteration count, given the grainsize argument of the helper.
+  virtual Value *getRecurGrainsize(IRBuilder<> &Builder, Argument *Grainsize) {
+    return Grainsize;
+  }
+  /// Hook to add code around a serial leaf of the recursion, which starts at
+  /// LeafEntry with iteration LeafStart and finishes before LeafExit.
+  virtual void instrumentLeaf(BasicBlock *LeafEntry, Instruction *LeafExit,
+                              Value *LeafStart, Argument *Limit,
+                              Argument *Grainsize) {}
+  /// Return true if this transformation can combine the partial results of
+  /// the reductions carried by the loop.
+  virtual bool supportsReductions() const { return true; }
+  /// Implement the spawning of the iterations of the outlined loop in Helper,
+  /// which executes iterations [CanonicalIV start, Limit].  By default, the
+  /// helper recursively divides its iterations in half.
+  virtual void implementDACIterSpawnOnHelper(Function *Helper,
+                                             BasicBlock *Preheader,
+                                             BasicBlock *Header,
+                                             PHINode *CanonicalIV,
+                                             Argument *Limit,
+                                             Argument *Grainsize,
+                                             Instruction *SyncRegion,
+                                             Instruction *LeafExit,
+                                             DominatorTree *DT,
+                                             LoopInfo *LI,
+                                             bool CanonicalIVFlagNUW = false,
+                                             bool CanonicalIVFlagNSW = false);
+  /// Serialize the outlined loop in a helper that executes a chunk of
+  /// iterations assigned to it by the runtime system, rather than spawning
+  /// them.
+  void serializeLoopOnHelper(BasicBlock *Header, Instruction *SyncRegion,
+                             Instruction *LeafExit, DominatorTree *DT);
+  /// Turn the original loop into a serial loop over the iterations from
+  /// RemStart to the loop limit that remain after the whole chunks of a
+  /// strip-mined loop.  The loop runs only if HasRemainder is true.
+  void serializeRemainder(Value *RemStart, Value *HasRemainder);
+  /// Create the call that executes the outlined loop in place of the original
+  /// loop.  Args are the arguments of the helper, where the start iteration,
+  /// loop limit, and grainsize begin at position IterArgNo.
+  virtual CallInst *createTopCall(IRBuilder<> &Builder, Function *Helper,
+                                  ArrayRef<Value *> Args, unsigned IterArgNo);
+  unsigned SpecifiedGrainsize;
+  /// Upper bound on the grainsize computed at run time, derived from the
+  /// estimated cost of one iteration of the loop.
+  unsigned MaxGrainsize;
+  /// Number of iterations in each chunk of a strip-mined loop, or 0 if the
+  /// loop is not strip-mined.
+  unsigned StripMineCount = 0;
+
+  /// A reduction carried by the Tapir loop.  Each serial leaf of the recursion
+  /// accumulates into a private copy of the reduction variable, starting from
+  /// the identity of the reduction, and the partial results are combined as
+  /// the recursion returns.
+  struct LoopReduction {
+    PHINode *Phi;
+    RecurrenceDescriptor Desc;
+    /// Value of the reduction variable on entry to the loop.
+    Value *Start;
+    /// Placeholder for, and then the helper argument through which the helper
+    /// returns its partial result.
+    Argument *Out;
+    /// Value of the reduction variable at the end of a leaf in the helper.
+    Value *LeafResult;
+  };
+  SmallVector<LoopReduction, 2> Reductions;
+
+  bool isReduction(const PHINode *PN) const {
+    return any_of(Reductions,
+                  [PN](const LoopReduction &R) { return R.Phi == PN; });
+  }
+  bool collectReductions();
+  Instruction *combineReductionsOnHelper(Function *Helper, CallInst *RecurCall,
+                                         BasicBlock *RecurCont,
+                                         PHINode *CanonicalIVStart,
+                                         Value *NextStart, Argument *Limit,
+                                         Instruction *LeafExit);
 // private:
 //   /// Report an analysis message to assist the user in diagnosing loops that are
 //   /// not transformed.  These are handled as LoopAccessReport rather than
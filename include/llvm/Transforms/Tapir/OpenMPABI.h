@@ -15,6 +15,7 @@
 #define OMP_ABI_H_
 
 #include "llvm/Transforms/Scalar.h"
+#include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
@@ -34,7 +35,9 @@
 #include "llvm/Transforms/Utils/UnifyFunctionExitNodes.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
+#include "llvm/Transforms/Tapir/LoopSpawning.h"
 #include "llvm/Transforms/Tapir/TapirUtils.h"
 #include <deque>
 
@@ -43,7 +46,13 @@ namespace llvm {
 enum OpenMPRuntimeFunction {
   OMPRTL__kmpc_fork_call,
   OMPRTL__kmpc_for_static_init_4,
+  OMPRTL__kmpc_for_static_init_4u,
+  OMPRTL__kmpc_for_static_init_8u,
   OMPRTL__kmpc_for_static_fini,
+  OMPRTL__kmpc_dispatch_init_4u,
+  OMPRTL__kmpc_dispatch_init_8u,
+  OMPRTL__kmpc_dispatch_next_4u,
+  OMPRTL__kmpc_dispatch_next_8u,
   OMPRTL__kmpc_master,
   OMPRTL__kmpc_end_master,
   OMPRTL__kmpc_omp_task_alloc,
@@ -52,10 +61,60 @@ enum OpenMPRuntimeFunction {
   OMPRTL__kmpc_global_thread_num,
   OMPRTL__kmpc_barrier,
   OMPRTL__kmpc_global_num_threads,
+  OMPRTL__kmpc_in_parallel,
+  OMPRTL_omp_get_max_threads,
 };
 
 enum OpenMPSchedType {
+  OMP_sch_static_chunked = 33,
   OMP_sch_static = 34,
+  OMP_sch_dynamic_chunked = 35,
+  OMP_sch_guided_chunked = 36,
+};
+
+/// OpenMPABILoopSpawning shares the iterations of a Tapir loop among the
+/// threads of an OpenMP parallel region, using the worksharing-loop interface
+/// of the OpenMP runtime in place of a recursion of tasks.  The loop is
+/// outlined as for DACLoopSpawning, but the helper runs its iterations
+/// serially, and each thread calls it on the chunks of iterations the runtime
+/// assigns to it.  The schedule of the iterations comes from the
+/// tapir.loop.schedule hint, and every schedule uses the grainsize as its
+/// chunk size.  Inside an active parallel region, the chunks are spawned as
+/// tasks instead.
+class OpenMPABILoopSpawning : public DACLoopSpawning {
+public:
+  OpenMPABILoopSpawning(Loop *OrigLoop, unsigned Grainsize,
+                        ScalarEvolution &SE,
+                        LoopInfo *LI, DominatorTree *DT,
+                        AssumptionCache *AC,
+                        OptimizationRemarkEmitter &ORE,
+                        TapirTarget *tapirTarget,
+                        unsigned MaxGrainsize)
+      : DACLoopSpawning(OrigLoop, Grainsize, SE, LI, DT, AC, ORE, tapirTarget,
+                        MaxGrainsize),
+        Schedule(LoopSpawningHints(OrigLoop).getSchedule())
+  {}
+
+  virtual ~OpenMPABILoopSpawning() {}
+
+protected:
+  bool supportsReductions() const override { return false; }
+  void implementDACIterSpawnOnHelper(Function *Helper,
+                                     BasicBlock *Preheader,
+                                     BasicBlock *Header,
+                                     PHINode *CanonicalIV,
+                                     Argument *Limit,
+                                     Argument *Grainsize,
+                                     Instruction *SyncRegion,
+                                     Instruction *LeafExit,
+                                     DominatorTree *DT,
+                                     LoopInfo *LI,
+                                     bool CanonicalIVFlagNUW,
+                                     bool CanonicalIVFlagNSW) override;
+  CallInst *createTopCall(IRBuilder<> &Builder, Function *Helper,
+                          ArrayRef<Value *> Args, unsigned IterArgNo) override;
+
+  LoopSpawningHints::IterationSchedule Schedule;
 };
 
 class OpenMPABI : public TapirTarget {
@@ -67,10 +126,31 @@ void createSync(SyncInst &inst, ValueToValueMapTy &DetachCtxToStackFrame) overri
 Function *createDetach(DetachInst &Detach,
                        ValueToValueMapTy &DetachCtxToStackFrame,
                        DominatorTree &DT, AssumptionCache &AC) override final;
+LoopOutline *getLoopSpawning(Loop *L, unsigned Grainsize,
+                             unsigned MaxGrainsize,
+                             ScalarEvolution &SE, LoopInfo *LI,
+                             DominatorTree *DT, AssumptionCache *AC,
+                             OptimizationRemarkEmitter &ORE) override final;
 void preProcessFunction(Function &F) override final;
 void postProcessFunction(Function &F) override final;
 void postProcessHelper(Function &F) override final;
 bool processMain(Function &F) override final;
+unsigned getSpawnCost() const override final;
+Value *createSerialDispatchCheck(Instruction *InsertBefore) override final;
+
+private:
+void findFunctionsInParallelRegions(Module &M);
+void forkParallelRegion(Function &F);
+
+/// The module that the sets below describe.
+const Module *AnalyzedModule = nullptr;
+/// Functions that are only called inside a parallel region.
+SmallPtrSet<const Function *, 16> InParallelRegion;
+/// Functions that do not spawn but fork the regions hoisted out of their
+/// callees.
+SmallVector<Function *, 4> HoistedRegionRoots;
+/// Outlined tasks, which always run inside a parallel region.
+SmallPtrSet<const Function *, 16> TaskFunctions;
 };
 
 }  // end of llvm namespace
@@ -15,6 +15,7 @@
 #ifndef LLVM_TRANSFORMS_TAPIR_OUTLINE_H
 #define LLVM_TRANSFORMS_TAPIR_OUTLINE_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Analysis/AssumptionCache.h"
@@ -72,6 +73,37 @@ Function *CreateHelper(const ValueSet &Inputs,
                        ValueMapTypeRemapper *TypeMapper = nullptr,
                        ValueMaterializer *Materializer = nullptr);
 
+/// Find the inputs in Inputs that a helper can recompute cheaply from its other
+/// inputs, rather than taking them as arguments, and add them to Remat.
+void findRematerializableInputs(const ValueSet &Inputs, ValueSet &Remat);
+
+/// Materializer for cloning blocks into a helper that does not take every
+/// input as a separate argument.  Inputs in Remat are recomputed, and inputs
+/// packed into a frame struct, which the helper takes a pointer to, are loaded,
+/// in the entry block of the helper.
+class HelperInputMaterializer final : public ValueMaterializer {
+public:
+  /// Frame, if not null, is the allocation of the frame struct in the parent,
+  /// whose fields hold Packed in order.  OldEntry is the block that CreateHelper
+  /// maps to the entry block of the helper.
+  HelperInputMaterializer(ValueToValueMapTy &VMap, const ValueSet &Remat,
+                          const BasicBlock *OldEntry, const StringRef NameSuffix,
+                          AllocaInst *Frame = nullptr,
+                          ArrayRef<Value *> Packed = None);
+
+  Value *materialize(Value *V) override;
+
+private:
+  Value *mapInput(Value *V);
+
+  ValueToValueMapTy &VMap;
+  const ValueSet &Remat;
+  const BasicBlock *OldEntry;
+  const StringRef NameSuffix;
+  AllocaInst *Frame;
+  DenseMap<const Value *, unsigned> FrameFields;
+};
+
 // Add alignment assumptions to parameters of outlined function, based on known
 // alignment data in the caller.
 void AddAlignmentAssumptions(
@@ -41,6 +41,45 @@
 
 namespace llvm {
 
+/// QthreadsABILoopSpawning hands the iterations of a Tapir loop to
+/// qt_loop_balance, which splits them evenly among the Qthreads workers and
+/// returns once all of them are done.  The loop is outlined as for
+/// DACLoopSpawning, but the helper runs its iterations serially, and the
+/// captured arguments are passed to every chunk by a pointer to one shared
+/// frame, instead of being copied into each task.
+class QthreadsABILoopSpawning : public DACLoopSpawning {
+public:
+  QthreadsABILoopSpawning(Loop *OrigLoop, unsigned Grainsize,
+                          ScalarEvolution &SE,
+                          LoopInfo *LI, DominatorTree *DT,
+                          AssumptionCache *AC,
+                          OptimizationRemarkEmitter &ORE,
+                          TapirTarget *tapirTarget,
+                          unsigned MaxGrainsize)
+      : DACLoopSpawning(OrigLoop, Grainsize, SE, LI, DT, AC, ORE, tapirTarget,
+                        MaxGrainsize)
+  {}
+
+  virtual ~QthreadsABILoopSpawning() {}
+
+protected:
+  bool supportsReductions() const override { return false; }
+  void implementDACIterSpawnOnHelper(Function *Helper,
+                                     BasicBlock *Preheader,
+                                     BasicBlock *Header,
+                                     PHINode *CanonicalIV,
+                                     Argument *Limit,
+                                     Argument *Grainsize,
+                                     Instruction *SyncRegion,
+                                     Instruction *LeafExit,
+                                     DominatorTree *DT,
+                                     LoopInfo *LI,
+                                     bool CanonicalIVFlagNUW,
+                                     bool CanonicalIVFlagNSW) override;
+  CallInst *createTopCall(IRBuilder<> &Builder, Function *Helper,
+                          ArrayRef<Value *> Args, unsigned IterArgNo) override;
+};
+
 class QthreadsABI : public TapirTarget {
 public:
   QthreadsABI();
@@ -52,10 +91,17 @@ public:
   Function *createDetach(DetachInst &Detach,
                          ValueToValueMapTy &DetachCtxToStackFrame,
                          DominatorTree &DT, AssumptionCache &AC) override final;
+  LoopOutline *getLoopSpawning(Loop *L, unsigned Grainsize,
+                               unsigned MaxGrainsize,
+                               ScalarEvolution &SE, LoopInfo *LI,
+                               DominatorTree *DT, AssumptionCache *AC,
+                               OptimizationRemarkEmitter &ORE) override final;
   void preProcessFunction(Function &F) override final;
   void postProcessFunction(Function &F) override final;
   void postProcessHelper(Function &F) override final;
   bool processMain(Function &F) override final;
+  unsigned getSpawnCost() const override final;
+  Value *createSerialDispatchCheck(Instruction *InsertBefore) override final;
 };
 
 }  // end of llvm namespace
@@ -0,0 +1,58 @@
+//===- TBBABI.h - Interface to Intel TBB through a C shim ---*- C++ -*--===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the TBBABI target, which lowers Tapir to calls into a thin
+// C shim over Intel Threading Building Blocks, in projects/tapir-tbb, so that
+// Tapir code shares the TBB scheduler with the rest of the program:
+//
+//   void __tapir_tbb_initialize(void);
+//   void __tapir_tbb_spawn(void **group, void (*fn)(void *), void *args,
+//                          size_t size);
+//   void __tapir_tbb_sync(void **group);
+//   int __tapir_tbb_max_concurrency(void);
+//
+// __tapir_tbb_initialize creates the task_arena in which the shim runs and
+// waits for all tasks.  Each sync region of a function keeps a pointer to a
+// tbb::task_group on the stack, which is null until the first spawn in the
+// region.  __tapir_tbb_spawn creates the task_group if necessary, copies the
+// arguments of the task, and passes the task to task_group::run.
+// __tapir_tbb_sync calls task_group::wait, destroys the task_group, and resets
+// the pointer to null, so a sync with no spawn since the last sync does not
+// call into the shim.  __tapir_tbb_max_concurrency returns the maximum
+// concurrency of the arena.
+//
+//===----------------------------------------------------------------------===//
+#ifndef TBB_ABI_H_
+#define TBB_ABI_H_
+
+#include "llvm/Transforms/Tapir/TapirUtils.h"
+
+namespace llvm {
+
+class TBBABI : public TapirTarget {
+public:
+  TBBABI();
+  Value *GetOrCreateWorker8(Function &F) override final;
+  void createSync(SyncInst &inst, ValueToValueMapTy &DetachCtxToStackFrame)
+    override final;
+
+  Function *createDetach(DetachInst &Detach,
+                         ValueToValueMapTy &DetachCtxToStackFrame,
+                         DominatorTree &DT, AssumptionCache &AC) override final;
+  void preProcessFunction(Function &F) override final;
+  void postProcessFunction(Function &F) override final;
+  void postProcessHelper(Function &F) override final;
+  bool processMain(Function &F) override final;
+  unsigned getSpawnCost() const override final;
+  Value *createSerialDispatchCheck(Instruction *InsertBefore) override final;
+};
+
+}  // end of llvm namespace
+
+#endif
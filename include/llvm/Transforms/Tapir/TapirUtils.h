@@ -27,6 +27,10 @@
 
 namespace llvm {
 
+class LoopOutline;
+class OptimizationRemarkEmitter;
+class ScalarEvolution;
+
 bool verifyDetachedCFG(const DetachInst &Detach, DominatorTree &DT,
                        bool error = true);
 
@@ -43,9 +47,14 @@ bool populateDetachedCFG(BasicBlock* startSearch, const DetachInst& Detach,
                          SmallPtrSetImpl<BasicBlock *> &ExitBlocks,
                          bool error = true);
 
+/// Outline the CFG detached by Detach into a helper function, and call the
+/// helper before Detach.  If PackInputs is true, the helper may take its inputs
+/// in a frame struct that the parent reuses for every spawn, so the target must
+/// ensure that the helper reads its inputs before the parent continues.
 Function *extractDetachBodyToFunction(DetachInst &Detach,
                                       DominatorTree &DT, AssumptionCache &AC,
-                                      CallInst **call = nullptr);
+                                      CallInst **call = nullptr,
+                                      bool PackInputs = false);
 
 class TapirTarget {
 public:
@@ -57,6 +66,20 @@ public:
                                  ValueToValueMapTy &DetachCtxToStackFrame,
                                  DominatorTree &DT, AssumptionCache &AC) = 0;
   virtual bool shouldProcessFunction(const Function &F);
+  //! Estimated overhead, in TTI user-cost units, of a lowered spawn and its
+  //! matching sync.  Used to decide when spawning a detached region cannot pay
+  //! off.
+  virtual unsigned getSpawnCost() const;
+  //! Emit, before \p InsertBefore, a cheap run-time check of whether spawning
+  //! cannot gain parallelism, e.g., because the runtime has a single worker.
+  virtual Value *createSerialDispatchCheck(Instruction *InsertBefore) = 0;
+  //! Return a target-specific transformation for a Tapir loop that is spawned
+  //! with the divide-and-conquer strategy, or null to use DACLoopSpawning.
+  virtual LoopOutline *getLoopSpawning(Loop *L, unsigned Grainsize,
+                                       unsigned MaxGrainsize,
+                                       ScalarEvolution &SE, LoopInfo *LI,
+                                       DominatorTree *DT, AssumptionCache *AC,
+                                       OptimizationRemarkEmitter &ORE);
   virtual void preProcessFunction(Function &F) = 0;
   virtual void postProcessFunction(Function &F) = 0;
   virtual void postProcessHelper(Function &F) = 0;
@@ -14,8 +14,10 @@
 #ifndef LLVM_TRANSFORMS_UTILS_TAPIRUTILS_H
 #define LLVM_TRANSFORMS_UTILS_TAPIRUTILS_H
 
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
 
 namespace llvm {
@@ -38,6 +40,12 @@ bool MoveStaticAllocasInBlock(
 /// to the branch instruction that replaces it.
 BranchInst* SerializeDetachedCFG(DetachInst *DI, DominatorTree *DT = nullptr);
 
+/// Return true if \p F calls llvm.detached.rethrow, which passes an exception
+/// out of a detached CFG.  SerializeDetachedCFG only turns reattaches into
+/// branches, so serializing such a CFG would leave the rethrow behind, and
+/// passes that serialize every detach of a function skip such functions.
+bool hasDetachedRethrow(const Function &F);
+
 /// Get the entry basic block to the detached context that contains
 /// the specified block.
 const BasicBlock *GetDetachedCtx(const BasicBlock *BB);
@@ -60,11 +68,27 @@ public:
   enum SpawningStrategy {
     ST_SEQ,
     ST_DAC,
+    ST_ADAPTIVE,
     ST_END,
   };
 
+  /// How a Tapir target that shares loop iterations among a fixed team of
+  /// workers, such as OpenMP, schedules the iterations.
+  enum IterationSchedule {
+    SCHED_STATIC,
+    SCHED_DYNAMIC,
+    SCHED_GUIDED,
+    SCHED_END,
+  };
+
 private:
-  enum HintKind { HK_STRATEGY, HK_GRAINSIZE };
+  enum HintKind {
+    HK_STRATEGY,
+    HK_GRAINSIZE,
+    HK_MAX_GRAINSIZE,
+    HK_SCHEDULE,
+    HK_COLLAPSE
+  };
 
   /// Hint - associates name and validation with the hint value.
   struct Hint {
@@ -82,6 +106,12 @@ private:
   Hint Strategy;
   /// Grainsize
   Hint Grainsize;
+  /// Upper bound on the grainsize computed at runtime
+  Hint MaxGrainsize;
+  /// Iteration schedule
+  Hint Schedule;
+  /// Number of perfectly nested Tapir loops to collapse
+  Hint Collapse;
 
   /// Return the loop metadata prefix.
   static inline StringRef Prefix() { return "tapir.loop."; }
@@ -93,6 +123,8 @@ public:
       return "Spawn iterations sequentially";
     case LoopSpawningHints::ST_DAC:
       return "Use divide-and-conquer";
+    case LoopSpawningHints::ST_ADAPTIVE:
+      return "Use divide-and-conquer with adaptive grainsize";
     case LoopSpawningHints::ST_END:
     default:
       return "Unknown";
@@ -113,6 +145,26 @@ public:
 
   unsigned getGrainsize() const;
 
+  /// Get the upper bound on the grainsize that the spawned loop computes at
+  /// runtime, or 0 if unspecified.
+  unsigned getMaxGrainsize() const;
+
+  IterationSchedule getSchedule() const;
+
+  /// Get the number of loops in the perfect nest of Tapir loops headed by this
+  /// loop that should be collapsed into a single iteration space, counting
+  /// this loop, or 0 if unspecified.
+  unsigned getCollapse() const;
+
+  /// Set the grainsize hint and write it back to the loop metadata.
+  void setGrainsize(unsigned G);
+
+  /// Set the maximum grainsize hint and write it back to the loop metadata.
+  void setMaxGrainsize(unsigned G);
+
+  /// Set the spawning strategy hint and write it back to the loop metadata.
+  void setStrategy(SpawningStrategy S);
+
 private:
   /// Find hints specified in the loop metadata and update local values.
   void getHintsFromMetadata();
@@ -149,6 +201,26 @@ bool isDACFor(Loop* L);
 /// otherwise.
 bool canDetach(const Function *F);
 
+/// Get the serial elision of the specified function: an internal clone in
+/// which every detach is serialized and every sync removed, and whose
+/// recursive calls call the clone itself.  The clone is created on the first
+/// request and recorded in the !tapir.serial metadata of the function, so that
+/// later requests share it.
+Function *GetOrCreateSerialClone(Function &F);
+
+/// Insert a check at the start of \p F that, when \p GetCond evaluates to
+/// true, calls \p Serial with the leading arguments of \p F and returns its
+/// result.  The block making the call is named \p Name.
+void InsertSerialGuard(Function &F, Function *Serial,
+                       function_ref<Value *(IRBuilder<> &)> GetCond,
+                       StringRef Name);
+
+/// Replace the reducer view lookup \p Lookup, a call to llvm.hyper.lookup, with
+/// the leftmost view of the reducer, which is the view that a serial execution
+/// of the program uses.  The leftmost view is stored in the reducer itself, at
+/// the offset that the __view_offset field of its Cilk hyperobject base holds.
+void lowerHyperLookupToLeftmostView(CallInst *Lookup);
+
 }  // end llvm namespace
 
 #endif
@@ -23,6 +23,7 @@
 #include "llvm/Analysis/ConstantFolding.h"
 #include "llvm/Analysis/InstructionSimplify.h"
 #include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/IR/CallingConv.h"
@@ -72,6 +73,23 @@ static cl::opt<int> ColdCallSiteRelFreq(
              "entry frequency, for a callsite to be cold in the absence of "
              "profile information."));
 
+static cl::opt<int> TapirFrameMergeBonus(
+    "inline-tapir-frame-merge-bonus", cl::Hidden, cl::init(75), cl::ZeroOrMore,
+    cl::desc("Cost bonus for inlining a spawning callee into a spawning "
+             "caller, which merges their parallel stack frames"));
+
+static cl::opt<int> TapirLiveInPenalty(
+    "inline-tapir-live-in-penalty", cl::Hidden, cl::init(15), cl::ZeroOrMore,
+    cl::desc("Cost penalty for inlining into a detached region, per pointer "
+             "argument the callee reads through, for the live-ins that "
+             "hoisting those reads would add to the outlined region"));
+
+static cl::opt<int> TapirSerialCutoffThreshold(
+    "inline-tapir-serial-cutoff-threshold", cl::Hidden, cl::init(45),
+    cl::ZeroOrMore,
+    cl::desc("Threshold for inlining the serial clone of a spawning function "
+             "into that function"));
+
 namespace {
 
 class CallAnalyzer : public InstVisitor<CallAnalyzer, bool> {
@@ -87,6 +105,9 @@ class CallAnalyzer : public InstVisitor<CallAnalyzer, bool> {
   /// Getter for BlockFrequencyInfo
   Optional<function_ref<BlockFrequencyInfo &(Function &)>> &GetBFI;
 
+  /// Getter for the task tree of the caller.
+  Optional<function_ref<TaskInfo &(Function &)>> &GetTaskInfo;
+
   /// Profile summary information.
   ProfileSummaryInfo *PSI;
 
@@ -175,6 +196,12 @@ class CallAnalyzer : public InstVisitor<CallAnalyzer, bool> {
   /// analysis.
   void updateThreshold(CallSite CS, Function &Callee);
 
+  /// Update Cost based on how inlining at CS changes the Tapir parallel
+  /// constructs of the caller: merging the stack frames of a spawning caller
+  /// and callee, and growing the live-ins of a detached region that contains
+  /// CS.
+  void updateTapirCost(CallSite CS);
+
   /// Return true if size growth is allowed when inlining the callee at CS.
   bool allowSizeGrowth(CallSite CS);
 
@@ -226,9 +253,11 @@ public:
   CallAnalyzer(const TargetTransformInfo &TTI,
                std::function<AssumptionCache &(Function &)> &GetAssumptionCache,
                Optional<function_ref<BlockFrequencyInfo &(Function &)>> &GetBFI,
+               Optional<function_ref<TaskInfo &(Function &)>> &GetTaskInfo,
                ProfileSummaryInfo *PSI, Function &Callee, CallSite CSArg,
                const InlineParams &Params)
       : TTI(TTI), GetAssumptionCache(GetAssumptionCache), GetBFI(GetBFI),
+        GetTaskInfo(GetTaskInfo),
         PSI(PSI), F(Callee), DL(F.getParent()->getDataLayout()),
         CandidateCS(CSArg), Params(Params), Threshold(Params.DefaultThreshold),
         Cost(0), IsCallerRecursive(false), IsRecursiveCall(false),
@@ -660,6 +689,73 @@ bool CallAnalyzer::isColdCallSite(CallSite CS, BlockFrequencyInfo *CallerBFI) {
   return CallSiteFreq < CallerEntryFreq * ColdProb;
 }
 
+/// \brief Return true if the given function contains a detach.
+static bool containsDetach(const Function &F) {
+  for (const BasicBlock &BB : F)
+    if (isa<DetachInst>(BB.getTerminator()))
+      return true;
+  return false;
+}
+
+/// \brief Return true if Serial is the serial clone of the spawning function
+/// Parallel, as recorded in the !tapir.serial metadata of Parallel.
+static bool isSerialCloneOf(const Function &Serial, const Function &Parallel) {
+  if (MDNode *MD = Parallel.getMetadata("tapir.serial"))
+    return mdconst::dyn_extract_or_null<Function>(MD->getOperand(0)) ==
+           &Serial;
+  return false;
+}
+
+void CallAnalyzer::updateTapirCost(CallSite CS) {
+  Function *Caller = CS.getCaller();
+  // Use the task tree of the caller that the inliner keeps across call sites.
+  // Without one, build it here, but only for callers that spawn.
+  TaskInfo LocalTI;
+  TaskInfo *TI = nullptr;
+  if (GetTaskInfo) {
+    TI = &(*GetTaskInfo)(*Caller);
+    if (TI->empty())
+      return;
+  } else {
+    if (!containsDetach(*Caller))
+      return;
+    LocalTI.recalculate(*Caller);
+    TI = &LocalTI;
+  }
+
+  // Lowering gives every spawning function its own parallel stack frame, which
+  // it must enter and leave.  Inlining a spawning callee into a spawning
+  // caller merges the two frames and saves one such pair.
+  if (containsDetach(F)) {
+    DEBUG(dbgs() << "Merging spawning frames.\n");
+    Cost -= TapirFrameMergeBonus;
+  }
+
+  // A detached region is later outlined into a helper that receives its
+  // live-ins as arguments.  Once the callee is inlined into such a region,
+  // loop-invariant reads through its pointer arguments may be hoisted out of
+  // the region, so that each such read becomes a live-in of its own.
+  if (!TI->isDetached(CS.getInstruction()->getParent()))
+    return;
+  unsigned NumReadPtrArgs = 0;
+  for (Argument &A : F.args()) {
+    if (!A.getType()->isPointerTy())
+      continue;
+    for (User *U : A.users()) {
+      if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(U))
+        if (GEP->hasAllConstantIndices() && GEP->hasOneUse())
+          U = *GEP->user_begin();
+      if (isa<LoadInst>(U)) {
+        ++NumReadPtrArgs;
+        break;
+      }
+    }
+  }
+  DEBUG(dbgs() << "Inlining into a detached region that would gain up to "
+               << NumReadPtrArgs << " live-ins.\n");
+  Cost += NumReadPtrArgs * TapirLiveInPenalty;
+}
+
 void CallAnalyzer::updateThreshold(CallSite CS, Function &Callee) {
   // If no size growth is allowed for this inlining, set Threshold to 0.
   if (!allowSizeGrowth(CS)) {
@@ -724,6 +820,14 @@ void CallAnalyzer::updateThreshold(CallSite CS, Function &Callee) {
     }
   }
 
+  // A spawning function calls its serial clone at its serial cutoff, where the
+  // cost of the call is amortized over the whole serial subcomputation.
+  // Copying the serial code into the parallel function only bloats it.
+  if (isSerialCloneOf(Callee, *Caller)) {
+    DEBUG(dbgs() << "Serial cutoff callsite.\n");
+    Threshold = std::min(Threshold, TapirSerialCutoffThreshold.getValue());
+  }
+
   // Finally, take the target-specific inlining threshold multiplier into
   // account.
   Threshold *= TTI.getInliningThresholdMultiplier();
@@ -1002,7 +1106,7 @@ bool CallAnalyzer::visitCallSite(CallSite CS) {
   // out. Pretend to inline the function, with a custom threshold.
   auto IndirectCallParams = Params;
   IndirectCallParams.DefaultThreshold = InlineConstants::IndirectCallThreshold;
-  CallAnalyzer CA(TTI, GetAssumptionCache, GetBFI, PSI, *F, CS,
+  CallAnalyzer CA(TTI, GetAssumptionCache, GetBFI, GetTaskInfo, PSI, *F, CS,
                   IndirectCallParams);
   if (CA.analyzeCall(CS)) {
     // We were able to inline the indirect call! Subtract the cost from the
@@ -1326,6 +1430,9 @@ bool CallAnalyzer::analyzeCall(CallSite CS) {
   if (F.getCallingConv() == CallingConv::Cold)
     Cost += InlineConstants::ColdccPenalty;
 
+  // Account for the parallel constructs of the caller and callee.
+  updateTapirCost(CS);
+
   // Check if we're done. This can happen due to bonuses and penalties.
   if (Cost > Threshold)
     return false;
@@ -1534,9 +1641,10 @@ InlineCost llvm::getInlineCost(
     CallSite CS, const InlineParams &Params, TargetTransformInfo &CalleeTTI,
     std::function<AssumptionCache &(Function &)> &GetAssumptionCache,
     Optional<function_ref<BlockFrequencyInfo &(Function &)>> GetBFI,
-    ProfileSummaryInfo *PSI) {
+    ProfileSummaryInfo *PSI,
+    Optional<function_ref<TaskInfo &(Function &)>> GetTaskInfo) {
   return getInlineCost(CS, CS.getCalledFunction(), Params, CalleeTTI,
-                       GetAssumptionCache, GetBFI, PSI);
+                       GetAssumptionCache, GetBFI, PSI, GetTaskInfo);
 }
 
 InlineCost llvm::getInlineCost(
@@ -1544,7 +1652,8 @@ InlineCost llvm::getInlineCost(
     TargetTransformInfo &CalleeTTI,
     std::function<AssumptionCache &(Function &)> &GetAssumptionCache,
     Optional<function_ref<BlockFrequencyInfo &(Function &)>> GetBFI,
-    ProfileSummaryInfo *PSI) {
+    ProfileSummaryInfo *PSI,
+    Optional<function_ref<TaskInfo &(Function &)>> GetTaskInfo) {
 
   // Cannot inline indirect calls.
   if (!Callee)
@@ -1578,8 +1687,8 @@ InlineCost llvm::getInlineCost(
   DEBUG(llvm::dbgs() << "      Analyzing call of " << Callee->getName()
                      << "...\n");
 
-  CallAnalyzer CA(CalleeTTI, GetAssumptionCache, GetBFI, PSI, *Callee, CS,
-                  Params);
+  CallAnalyzer CA(CalleeTTI, GetAssumptionCache, GetBFI, GetTaskInfo, PSI,
+                  *Callee, CS, Params);
   bool ShouldInline = CA.analyzeCall(CS);
 
   DEBUG(CA.dump());
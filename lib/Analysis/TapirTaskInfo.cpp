@@ -0,0 +1,168 @@
+//===- TapirTaskInfo.cpp - Tapir task tree analysis -----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the TaskInfo analysis, which maps each basic block of a
+// function to the Tapir task containing it.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Analysis/TapirTaskInfo.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "tasks"
+
+//===----------------------------------------------------------------------===//
+//  TaskInfo Implementation
+//===----------------------------------------------------------------------===//
+
+void TaskInfo::recalculate(Function &Fn) {
+  releaseMemory();
+  F = &Fn;
+  if (F->empty())
+    return;
+
+  // Traverse the CFG forwards from the entry block.  The detached successor of
+  // a detach starts a new task, and every other successor stays in the task of
+  // its predecessor.  Reattach edges are skipped, since the continuation they
+  // lead to is also reached from the detach, in the spawning task.
+  const BasicBlock *Entry = &F->getEntryBlock();
+  SmallVector<const BasicBlock *, 32> WorkList;
+  BlockToTask[Entry] = Entry;
+  WorkList.push_back(Entry);
+  while (!WorkList.empty()) {
+    const BasicBlock *BB = WorkList.pop_back_val();
+    const BasicBlock *Task = BlockToTask[BB];
+    const TerminatorInst *Term = BB->getTerminator();
+
+    if (isa<ReattachInst>(Term))
+      continue;
+
+    if (const DetachInst *DI = dyn_cast<DetachInst>(Term)) {
+      const BasicBlock *Detached = DI->getDetached();
+      if (BlockToTask.insert(std::make_pair(Detached, Detached)).second) {
+        TaskToDetach[Detached] = DI;
+        TaskToParent[Detached] = Task;
+        WorkList.push_back(Detached);
+      }
+      const BasicBlock *Continue = DI->getContinue();
+      if (BlockToTask.insert(std::make_pair(Continue, Task)).second)
+        WorkList.push_back(Continue);
+      continue;
+    }
+
+    for (const BasicBlock *Succ : successors(BB))
+      if (BlockToTask.insert(std::make_pair(Succ, Task)).second)
+        WorkList.push_back(Succ);
+  }
+}
+
+void TaskInfo::releaseMemory() {
+  F = nullptr;
+  BlockToTask.clear();
+  TaskToDetach.clear();
+  TaskToParent.clear();
+}
+
+bool TaskInfo::invalidate(Function &F, const PreservedAnalyses &PA,
+                          FunctionAnalysisManager::Invalidator &) {
+  // The task tree only depends on the CFG, so check whether the analysis, all
+  // analyses on functions, or the function's CFG have been preserved.
+  auto PAC = PA.getChecker<TaskAnalysis>();
+  return !(PAC.preserved() || PAC.preservedSet<AllAnalysesOn<Function>>() ||
+           PAC.preservedSet<CFGAnalyses>());
+}
+
+const BasicBlock *TaskInfo::getTaskFor(const BasicBlock *BB) const {
+  // Do not guess the task of a block the traversal did not reach.  A block
+  // created after the tree was computed, e.g., by a loop pass that does not
+  // invalidate function analyses, may well sit inside a detached task.
+  return BlockToTask.lookup(BB);
+}
+
+const Value *TaskInfo::getSyncRegion(const BasicBlock *TaskEntry) const {
+  if (const DetachInst *DI = getDetacher(TaskEntry))
+    return DI->getSyncRegion();
+  return nullptr;
+}
+
+bool TaskInfo::encloses(const BasicBlock *Outer,
+                        const BasicBlock *Inner) const {
+  for (const BasicBlock *T = Inner; T; T = getParentTask(T))
+    if (T == Outer)
+      return true;
+  return false;
+}
+
+void TaskInfo::print(raw_ostream &OS) const {
+  if (!F)
+    return;
+  for (const BasicBlock &BB : *F) {
+    if (!isTaskEntry(&BB))
+      continue;
+    OS << "Task at depth ";
+    unsigned Depth = 0;
+    for (const BasicBlock *T = getParentTask(&BB); T; T = getParentTask(T))
+      ++Depth;
+    OS << Depth << " with entry ";
+    BB.printAsOperand(OS, false);
+    if (const BasicBlock *Parent = getParentTask(&BB)) {
+      OS << " spawned by ";
+      Parent->printAsOperand(OS, false);
+      OS << " within ";
+      getSyncRegion(&BB)->printAsOperand(OS, false);
+    }
+    OS << ": ";
+    bool First = true;
+    for (const BasicBlock &B : *F) {
+      auto I = BlockToTask.find(&B);
+      if (I == BlockToTask.end() || I->second != &BB)
+        continue;
+      if (!First)
+        OS << ",";
+      First = false;
+      B.printAsOperand(OS, false);
+    }
+    OS << "\n";
+  }
+}
+
+//===----------------------------------------------------------------------===//
+//  TaskInfo analyses
+//===----------------------------------------------------------------------===//
+
+AnalysisKey TaskAnalysis::Key;
+
+TaskInfo TaskAnalysis::run(Function &F, FunctionAnalysisManager &) {
+  return TaskInfo(F);
+}
+
+PreservedAnalyses TaskInfoPrinterPass::run(Function &F,
+                                           FunctionAnalysisManager &AM) {
+  OS << "Tasks for function: " << F.getName() << "\n";
+  AM.getResult<TaskAnalysis>(F).print(OS);
+  return PreservedAnalyses::all();
+}
+
+char TaskInfoWrapperPass::ID = 0;
+INITIALIZE_PASS(TaskInfoWrapperPass, "tasks", "Tapir Task Information", true,
+                true)
+
+bool TaskInfoWrapperPass::runOnFunction(Function &F) {
+  TI.recalculate(F);
+  return false;
+}
+
+void TaskInfoWrapperPass::print(raw_ostream &OS, const Module *) const {
+  TI.print(OS);
+}
@@ -7,7 +7,8 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This pass implements IR lowering for the llvm.load.relative intrinsic.
+// This pass implements IR lowering for the llvm.load.relative intrinsic, and for
+// the llvm.hyper.lookup intrinsic when no Tapir target has lowered it.
 //
 //===----------------------------------------------------------------------===//
 
@@ -19,6 +20,7 @@
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
 
 using namespace llvm;
 
@@ -55,11 +57,30 @@ bool lowerLoadRelative(Function &F) {
   return Changed;
 }
 
+/// Lower the reducer view lookups that remain when no Tapir target lowered the
+/// program, i.e., when it runs serially, to the leftmost views.
+bool lowerHyperLookup(Function &F) {
+  bool Changed = false;
+  for (auto I = F.use_begin(), E = F.use_end(); I != E;) {
+    auto CI = dyn_cast<CallInst>(I->getUser());
+    ++I;
+    if (!CI || CI->getCalledValue() != &F)
+      continue;
+
+    lowerHyperLookupToLeftmostView(CI);
+    Changed = true;
+  }
+
+  return Changed;
+}
+
 bool lowerIntrinsics(Module &M) {
   bool Changed = false;
   for (Function &F : M) {
     if (F.getName().startswith("llvm.load.relative."))
       Changed |= lowerLoadRelative(F);
+    else if (F.getIntrinsicID() == Intrinsic::hyper_lookup)
+      Changed |= lowerHyperLookup(F);
   }
   return Changed;
 }
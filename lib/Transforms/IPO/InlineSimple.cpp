@@ -61,8 +61,11 @@ public:
         [&](Function &F) -> AssumptionCache & {
       return ACT->getAssumptionCache(F);
     };
+    auto GetTaskInfo = [&](Function &F) -> TaskInfo & {
+      return getTaskInfo(F);
+    };
     return llvm::getInlineCost(CS, Params, TTI, GetAssumptionCache,
-                               /*GetBFI=*/None, PSI);
+                               /*GetBFI=*/None, PSI, {GetTaskInfo});
   }
 
   bool runOnSCC(CallGraphSCC &SCC) override;
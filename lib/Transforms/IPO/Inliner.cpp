@@ -434,7 +434,8 @@ inlineCallsImpl(CallGraphSCC &SCC, CallGraph &CG,
                 bool InsertLifetime,
                 function_ref<InlineCost(CallSite CS)> GetInlineCost,
                 function_ref<AAResults &(Function &)> AARGetter,
-                ImportedFunctionsInliningStatistics &ImportedFunctionsStats) {
+                ImportedFunctionsInliningStatistics &ImportedFunctionsStats,
+                function_ref<void(Function &)> InvalidateCaller) {
   SmallPtrSet<Function *, 8> SCCFunctions;
   DEBUG(dbgs() << "Inliner visiting SCC:");
   for (CallGraphNode *Node : SCC) {
@@ -577,6 +578,7 @@ inlineCallsImpl(CallGraphSCC &SCC, CallGraph &CG,
           continue;
         }
         ++NumInlined;
+        InvalidateCaller(*Caller);
 
         // Report the inline decision.
         ORE.emit(OptimizationRemark(DEBUG_TYPE, "Inlined", DLoc, Block)
@@ -646,9 +648,19 @@ bool LegacyInlinerBase::inlineCalls(CallGraphSCC &SCC) {
   auto GetAssumptionCache = [&](Function &F) -> AssumptionCache & {
     return ACT->getAssumptionCache(F);
   };
-  return inlineCallsImpl(SCC, CG, GetAssumptionCache, PSI, TLI, InsertLifetime,
-                         [this](CallSite CS) { return getInlineCost(CS); },
-                         LegacyAARGetter(*this), ImportedFunctionsStats);
+  bool Changed = inlineCallsImpl(
+      SCC, CG, GetAssumptionCache, PSI, TLI, InsertLifetime,
+      [this](CallSite CS) { return getInlineCost(CS); }, LegacyAARGetter(*this),
+      ImportedFunctionsStats, [this](Function &F) { TaskInfos.erase(&F); });
+  TaskInfos.clear();
+  return Changed;
+}
+
+TaskInfo &LegacyInlinerBase::getTaskInfo(Function &F) {
+  std::unique_ptr<TaskInfo> &TI = TaskInfos[&F];
+  if (!TI)
+    TI = make_unique<TaskInfo>(F);
+  return *TI;
 }
 
 /// Remove now-dead linkonce functions at the end of
@@ -847,12 +859,15 @@ PreservedAnalyses InlinerPass::run(LazyCallGraph::SCC &InitialC,
     auto GetBFI = [&](Function &F) -> BlockFrequencyInfo & {
       return FAM.getResult<BlockFrequencyAnalysis>(F);
     };
+    auto GetTaskInfo = [&](Function &F) -> TaskInfo & {
+      return FAM.getResult<TaskAnalysis>(F);
+    };
 
     auto GetInlineCost = [&](CallSite CS) {
       Function &Callee = *CS.getCalledFunction();
       auto &CalleeTTI = FAM.getResult<TargetIRAnalysis>(Callee);
       return getInlineCost(CS, Params, CalleeTTI, GetAssumptionCache, {GetBFI},
-                           PSI);
+                           PSI, {GetTaskInfo});
     };
 
     // Get the remarks emission analysis for the caller.
@@ -887,6 +902,8 @@ PreservedAnalyses InlinerPass::run(LazyCallGraph::SCC &InitialC,
         continue;
       DidInline = true;
       InlinedCallees.insert(&Callee);
+      // The cost analysis of the remaining calls in F needs its new task tree.
+      FAM.invalidate<TaskAnalysis>(F);
 
       // Add any new callsites to defined functions to the worklist.
       if (!IFI.InlinedCallSites.empty()) {
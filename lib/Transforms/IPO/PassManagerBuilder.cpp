@@ -110,6 +110,20 @@ static cl::opt<bool> EnableLoopFuse(
     "enable-loop-fuse", cl::init(false), cl::Hidden,
     cl::desc("Enable the new, experimental LoopFusion Pass"));
 
+static cl::opt<bool> EnableSerialDispatch(
+    "enable-serial-dispatch", cl::init(false), cl::Hidden,
+    cl::desc("Call serial clones of spawning functions when the Tapir target "
+             "cannot run spawns in parallel"));
+
+static cl::opt<bool> EnableRecursionCutoff(
+    "enable-recursion-cutoff", cl::init(false), cl::Hidden,
+    cl::desc("Call serial clones of recursive spawning functions once an "
+             "argument that shrinks in the recursion falls below a cutoff"));
+
+static cl::opt<bool> EnableTapirLoopFusion(
+    "enable-tapir-loop-fusion", cl::init(true), cl::Hidden,
+    cl::desc("Fuse adjacent Tapir loops before loop spawning"));
+
 static cl::opt<bool>
     EnablePrepareForThinLTO("prepare-for-thinlto", cl::init(false), cl::Hidden,
                             cl::desc("Enable preparation for ThinLTO."));
@@ -716,7 +730,7 @@ void PassManagerBuilder::populateModulePassManager(
     MPM.add(createCFGSimplificationPass());
     MPM.add(createDetachUnswitchPass());
     MPM.add(createCFGSimplificationPass());
-    MPM.add(createSmallBlockPass());
+    MPM.add(createSmallBlockPass(tapirTarget));
     MPM.add(createCFGSimplificationPass());
   }
 
@@ -725,6 +739,16 @@ void PassManagerBuilder::populateModulePassManager(
     addExtensionsToPM(EP_TapirLate, MPM);
 
   if (!TapirHasBeenLowered) {
+    // Dispatch spawning functions to their serial clones at run time, and
+    // coarsen the leaves of recursive spawning functions, unless optimizing
+    // for size, since these passes clone those functions.
+    if (SizeLevel == 0) {
+      if (EnableSerialDispatch)
+        MPM.add(createSerialDispatchPass(tapirTarget));
+      if (EnableRecursionCutoff)
+        MPM.add(createRecursionCutoffPass());
+    }
+
     // First handle Tapir loops.
     MPM.add(createIndVarSimplifyPass());
 
@@ -733,6 +757,11 @@ void PassManagerBuilder::populateModulePassManager(
     // relies on the rotated form.  Disable header duplication at -Oz.
     MPM.add(createLoopRotatePass(SizeLevel == 2 ? 0 : -1));
 
+    // Fuse adjacent Tapir loops, so that loop spawning creates one
+    // divide-and-conquer recursion for them and the program syncs once.
+    if (EnableTapirLoopFusion)
+      MPM.add(createTapirLoopFusionPass());
+
     MPM.add(createLoopSpawningPass(tapirTarget));
 
     // The LoopSpawning pass may leave cruft around.  Clean it up.
@@ -18,16 +18,24 @@
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AssumptionCache.h"
 #include "llvm/Analysis/CFG.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/CaptureTracking.h"
 #include "llvm/Analysis/DetachSSA.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/Module.h"
@@ -45,6 +53,16 @@ using namespace llvm;
 
 #define DEBUG_TYPE "cilksan"
 
+static cl::opt<bool> ClPruneRaceFree(
+    "csan-prune-race-free", cl::init(false), cl::Hidden,
+    cl::desc("Do not instrument memory accesses that static analysis proves "
+             "cannot participate in a determinacy race"));
+
+static cl::opt<bool> ClCoalesceLoopAccesses(
+    "csan-coalesce-loop-accesses", cl::init(false), cl::Hidden,
+    cl::desc("Instrument the consecutive accesses of a serial loop with one "
+             "large-access hook before the loop"));
+
 STATISTIC(NumInstrumentedReads, "Number of instrumented reads");
 STATISTIC(NumInstrumentedWrites, "Number of instrumented writes");
 STATISTIC(NumAccessesWithBadSize, "Number of accesses with bad size");
@@ -53,6 +71,12 @@ STATISTIC(NumOmittedReadsBeforeWrite,
 STATISTIC(NumOmittedReadsFromConstants,
           "Number of reads from constant data");
 STATISTIC(NumOmittedNonCaptured, "Number of accesses ignored due to capturing");
+STATISTIC(NumOmittedSerial,
+          "Number of accesses ignored in strands with no parallel peer");
+STATISTIC(NumOmittedSingleStrand,
+          "Number of accesses ignored to globals accessed by one strand");
+STATISTIC(NumCoalescedLoopAccesses,
+          "Number of loop accesses instrumented as one address range");
 STATISTIC(NumInstrumentedDetaches, "Number of instrumented detaches");
 STATISTIC(NumInstrumentedDetachExits, "Number of instrumented detach exits");
 STATISTIC(NumInstrumentedSyncs, "Number of instrumented syncs");
@@ -124,7 +148,7 @@ struct CilkSanitizerImpl : public CSIImpl {
   //     : CSIImpl(M, CG), GetDSSA(GetDSSA), GetMSSA(GetMSSA) {
   CilkSanitizerImpl(Module &M, CallGraph *CG,
                     function_ref<DominatorTree &(Function &)> GetDomTree,
-                    const TargetLibraryInfo *TLI)
+                    TargetLibraryInfo *TLI)
       : CSIImpl(M, CG, GetDomTree), TLI(TLI),
         CsanFuncEntry(nullptr), CsanFuncExit(nullptr), CsanRead(nullptr),
         CsanWrite(nullptr), CsanDetach(nullptr), CsanDetachContinue(nullptr),
@@ -162,6 +186,9 @@ struct CilkSanitizerImpl : public CSIImpl {
 
   // Insert hooks at relevant program points
   bool instrumentLoadOrStore(Instruction *I, const DataLayout &DL);
+  bool instrumentLoopAccessRange(Instruction *I, DominatorTree &DT,
+                                 LoopInfo &LI, ScalarEvolution &SE,
+                                 const DataLayout &DL);
   bool instrumentAtomic(Instruction *I, const DataLayout &DL);
   bool instrumentMemIntrinsic(Instruction *I, const DataLayout &DL);
   bool instrumentCallsite(Instruction *I, DominatorTree *DT);
@@ -173,11 +200,15 @@ struct CilkSanitizerImpl : public CSIImpl {
       SmallVectorImpl<Instruction *> &All,
       const DataLayout &DL);
 
+  // Methods for static may-happen-in-parallel analysis
+  void computeParallelFunctions();
+  void computeSingleStrandGlobals();
+
 private:
   // Analysis results
   // function_ref<DetachSSA &(Function &)> GetDSSA;
   // function_ref<MemorySSA &(Function &)> GetMSSA;
-  const TargetLibraryInfo *TLI;
+  TargetLibraryInfo *TLI;
 
   // Instrumentation hooks
   Function *CsanFuncEntry, *CsanFuncExit;
@@ -190,6 +221,12 @@ private:
   // CilkSanitizer custom forensic tables
   ObjectTable LoadObj, StoreObj;
 
+  // Functions that may run logically in parallel with some strand outside of
+  // them.
+  SmallPtrSet<const Function *, 32> ParallelFunctions;
+  // Internal globals that only one strand of one function ever accesses.
+  SmallPtrSet<const GlobalVariable *, 8> SingleStrandGlobals;
+
   SmallVector<Constant *, 2> UnitObjTables;
 
 };
@@ -376,10 +413,17 @@ Constant *ObjectTable::insertIntoModule(Module &M) const {
 
 bool CilkSanitizerImpl::run() {
   initializeCsi();
+  // The CilkSanitizer runtime reads only uncompressed FED tables.
+  CompressTables = false;
   // initializeCsanFEDTables();
   initializeCsanObjectTables();
   initializeCsanHooks();
 
+  if (ClPruneRaceFree) {
+    computeParallelFunctions();
+    computeSingleStrandGlobals();
+  }
+
   for (Function &F : M) {
     DEBUG(dbgs() << "Instrumenting " << F.getName() << "\n");
     instrumentFunction(F);
@@ -627,6 +671,140 @@ static bool MightHaveDetachedUse(const AllocaInst *AI) {
   return false;
 }
 
+/// Collect the blocks of F that may run logically in parallel with another
+/// strand of F, i.e., the blocks of detached tasks, and the blocks of the
+/// continuation of each detach up to the syncs that join it.  Every function
+/// implicitly syncs before it returns, so no other block of F has a parallel
+/// peer within F.
+static void findParallelBlocks(const Function &F, const TaskInfo &TI,
+                               SmallPtrSetImpl<const BasicBlock *> &Parallel) {
+  for (const BasicBlock &BB : F) {
+    if (TI.isDetached(&BB))
+      Parallel.insert(&BB);
+
+    const DetachInst *DI = dyn_cast<DetachInst>(BB.getTerminator());
+    if (!DI)
+      continue;
+    SmallPtrSet<const BasicBlock *, 32> Visited;
+    SmallVector<const BasicBlock *, 32> WorkList;
+    WorkList.push_back(DI->getContinue());
+    while (!WorkList.empty()) {
+      const BasicBlock *CurrBB = WorkList.pop_back_val();
+      if (!Visited.insert(CurrBB).second)
+        continue;
+      Parallel.insert(CurrBB);
+
+      // Stop at the end of the enclosing task and at a sync that joins DI.
+      const TerminatorInst *Term = CurrBB->getTerminator();
+      if (isa<ReattachInst>(Term))
+        continue;
+      if (const SyncInst *SI = dyn_cast<SyncInst>(Term))
+        if (SI->getSyncRegion() == DI->getSyncRegion())
+          continue;
+      for (const BasicBlock *Succ : successors(CurrBB))
+        WorkList.push_back(Succ);
+    }
+  }
+}
+
+/// Compute the functions that may run logically in parallel with some strand
+/// outside of them.  Such a function is either called from a parallel block
+/// of some function, called from another such function, or possibly called
+/// from code we cannot see.
+void CilkSanitizerImpl::computeParallelFunctions() {
+  SmallVector<const Function *, 32> WorkList;
+  auto MarkParallel = [&](const Function *F) {
+    if (!F->isDeclaration() && ParallelFunctions.insert(F).second)
+      WorkList.push_back(F);
+  };
+
+  for (const Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    // The program starts serially in main, but any other function visible
+    // outside this module, or called indirectly, might be called from a
+    // parallel strand.
+    if ((!F.hasLocalLinkage() && F.getName() != "main") || F.hasAddressTaken())
+      MarkParallel(&F);
+
+    TaskInfo TI(const_cast<Function &>(F));
+    SmallPtrSet<const BasicBlock *, 32> Parallel;
+    findParallelBlocks(F, TI, Parallel);
+    for (const BasicBlock *BB : Parallel)
+      for (const Instruction &I : *BB)
+        if (ImmutableCallSite CS = ImmutableCallSite(&I))
+          if (const Function *Callee = CS.getCalledFunction())
+            MarkParallel(Callee);
+  }
+
+  while (!WorkList.empty()) {
+    const Function *F = WorkList.pop_back_val();
+    for (const Instruction &I : instructions(F))
+      if (ImmutableCallSite CS = ImmutableCallSite(&I))
+        if (const Function *Callee = CS.getCalledFunction())
+          MarkParallel(Callee);
+  }
+  DEBUG(dbgs() << "csan: " << ParallelFunctions.size()
+               << " functions may run in parallel\n");
+}
+
+/// Collect the loads and stores that access memory through V, and return false
+/// if the address in V escapes in some other way.
+static bool collectDirectAccesses(const Value *V,
+                                  SmallVectorImpl<const Instruction *> &Acc) {
+  for (const User *U : V->users()) {
+    if (const LoadInst *LI = dyn_cast<LoadInst>(U)) {
+      Acc.push_back(LI);
+    } else if (const StoreInst *SI = dyn_cast<StoreInst>(U)) {
+      if (SI->getValueOperand() == V)
+        return false;
+      Acc.push_back(SI);
+    } else if (isa<BitCastOperator>(U) || isa<GEPOperator>(U)) {
+      if (!collectDirectAccesses(U, Acc))
+        return false;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Compute the internal globals that only one strand of one function ever
+/// accesses.  That strand is a single task of a function that never runs in
+/// parallel with itself, and the task cannot be spawned repeatedly, so no
+/// other strand can race with it on such a global.
+void CilkSanitizerImpl::computeSingleStrandGlobals() {
+  for (const GlobalVariable &GV : M.globals()) {
+    if (!GV.hasLocalLinkage() || GV.isDeclaration())
+      continue;
+    SmallVector<const Instruction *, 8> Accesses;
+    if (!collectDirectAccesses(&GV, Accesses) || Accesses.empty())
+      continue;
+
+    const Function *F = Accesses.front()->getFunction();
+    if (ParallelFunctions.count(F))
+      continue;
+    TaskInfo TI(const_cast<Function &>(*F));
+    const BasicBlock *Task = TI.getTaskFor(Accesses.front()->getParent());
+    if (any_of(Accesses, [&](const Instruction *I) {
+          return I->getFunction() != F ||
+                 TI.getTaskFor(I->getParent()) != Task;
+        }))
+      continue;
+
+    // Each enclosing task must be spawned at most once per call to F.
+    bool SpawnedOnce = true;
+    for (const BasicBlock *T = Task; const DetachInst *DI = TI.getDetacher(T);
+         T = TI.getParentTask(T))
+      if (any_of(successors(DI->getParent()), [&](const BasicBlock *Succ) {
+            return isPotentiallyReachable(Succ, DI->getParent());
+          }))
+        SpawnedOnce = false;
+    if (SpawnedOnce)
+      SingleStrandGlobals.insert(&GV);
+  }
+}
+
 void CilkSanitizerImpl::chooseInstructionsToInstrument(
     SmallVectorImpl<Instruction *> &Local, SmallVectorImpl<Instruction *> &All,
     const DataLayout &DL) {
@@ -667,6 +845,12 @@ void CilkSanitizerImpl::chooseInstructionsToInstrument(
       NumOmittedNonCaptured++;
       continue;
     }
+    if (isa<GlobalVariable>(Obj) &&
+        SingleStrandGlobals.count(cast<GlobalVariable>(Obj))) {
+      // Only one strand ever accesses this global, so it cannot race.
+      NumOmittedSingleStrand++;
+      continue;
+    }
     All.push_back(I);
   }
   Local.clear();
@@ -691,6 +875,13 @@ bool CilkSanitizerImpl::instrumentFunction(Function &F) {
   bool HasCalls = false;
   bool MaySpawn = false;
 
+  // If F never runs in parallel with a strand outside of it, then the memory
+  // accesses outside of its parallel blocks have no parallel peer at all.
+  SmallPtrSet<const BasicBlock *, 32> ParallelBlocks;
+  bool PruneSerial = ClPruneRaceFree && !ParallelFunctions.count(&F);
+  if (PruneSerial)
+    findParallelBlocks(F, TaskInfo(F), ParallelBlocks);
+
   // TODO: Consider modifying this to choose instrumentation to insert based on
   // fibrils, not basic blocks.
   for (BasicBlock &BB : F) {
@@ -702,16 +893,27 @@ bool CilkSanitizerImpl::instrumentFunction(Function &F) {
       Syncs.push_back(SI);
 
     // Record the memory accesses in the basic block
+    bool SerialBB = PruneSerial && !ParallelBlocks.count(&BB);
     for (Instruction &Inst : BB) {
-      if (isa<LoadInst>(Inst) || isa<StoreInst>(Inst))
-        LocalLoadsAndStores.push_back(&Inst);
-      else if (isa<AtomicRMWInst>(Inst) || isa<AtomicCmpXchgInst>(Inst))
-        AtomicAccesses.push_back(&Inst);
-      else if (isa<CallInst>(Inst) || isa<InvokeInst>(Inst)) {
+      if (isa<LoadInst>(Inst) || isa<StoreInst>(Inst)) {
+        if (SerialBB)
+          NumOmittedSerial++;
+        else
+          LocalLoadsAndStores.push_back(&Inst);
+      } else if (isa<AtomicRMWInst>(Inst) || isa<AtomicCmpXchgInst>(Inst)) {
+        if (SerialBB)
+          NumOmittedSerial++;
+        else
+          AtomicAccesses.push_back(&Inst);
+      } else if (isa<CallInst>(Inst) || isa<InvokeInst>(Inst)) {
         if (CallInst *CI = dyn_cast<CallInst>(&Inst))
           maybeMarkSanitizerLibraryCallNoBuiltin(CI, TLI);
-        if (isa<MemIntrinsic>(Inst))
-          MemIntrinCalls.push_back(&Inst);
+        if (isa<MemIntrinsic>(Inst)) {
+          if (SerialBB)
+            NumOmittedSerial++;
+          else
+            MemIntrinCalls.push_back(&Inst);
+        }
         if (!isa<DbgInfoIntrinsic>(Inst)) {
           if (!isa<MemIntrinsic>(Inst))
             Callsites.push_back(&Inst);
@@ -726,8 +928,22 @@ bool CilkSanitizerImpl::instrumentFunction(Function &F) {
 
   uint64_t LocalId = getLocalFunctionID(F);
 
-  for (auto Inst : AllLoadsAndStores)
-    Res |= instrumentLoadOrStore(Inst, DL);
+  if (ClCoalesceLoopAccesses && !AllLoadsAndStores.empty()) {
+    // Build the loop analyses of F once, on the dominator tree we already
+    // have.  Each on-the-fly query of an analysis of F reruns every analysis
+    // this pass requires on F.
+    LoopInfo LI(*DT);
+    AssumptionCache AC(F);
+    ScalarEvolution SE(F, *TLI, AC, *DT, LI);
+    for (auto Inst : AllLoadsAndStores)
+      if (instrumentLoopAccessRange(Inst, *DT, LI, SE, DL))
+        Res = true;
+      else
+        Res |= instrumentLoadOrStore(Inst, DL);
+  } else {
+    for (auto Inst : AllLoadsAndStores)
+      Res |= instrumentLoadOrStore(Inst, DL);
+  }
 
   for (auto Inst : AtomicAccesses)
     Res |= instrumentAtomic(Inst, DL);
@@ -829,6 +1045,108 @@ bool CilkSanitizerImpl::instrumentLoadOrStore(Instruction *I,
   return true;
 }
 
+/// Return true if loop L runs in a single strand and cannot free memory, i.e.,
+/// it contains no Tapir instructions and no calls.
+static bool isSerialLoop(const Loop *L) {
+  for (const BasicBlock *BB : L->blocks()) {
+    const TerminatorInst *Term = BB->getTerminator();
+    if (isa<DetachInst>(Term) || isa<ReattachInst>(Term) || isa<SyncInst>(Term))
+      return false;
+    for (const Instruction &I : *BB)
+      if ((isa<CallInst>(I) || isa<InvokeInst>(I)) &&
+          !isa<DbgInfoIntrinsic>(I))
+        return false;
+  }
+  return true;
+}
+
+/// If I accesses the consecutive elements of an array in every iteration of a
+/// serial loop, instrument all of those accesses with one call to the
+/// large-access hook in the preheader of the loop.  Within a serial loop, the
+/// accesses all belong to the strand that enters the loop, so they race with
+/// exactly the same accesses as the range does.
+bool CilkSanitizerImpl::instrumentLoopAccessRange(Instruction *I,
+                                                  DominatorTree &DT,
+                                                  LoopInfo &LI,
+                                                  ScalarEvolution &SE,
+                                                  const DataLayout &DL) {
+  Loop *L = LI.getLoopFor(I->getParent());
+  if (!L)
+    return false;
+  // Require that I executes exactly once in each iteration of L, so that the
+  // backedge-taken count determines the range that I accesses.
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+  if (!Preheader || !Latch || L->getExitingBlock() != Latch ||
+      !DT.dominates(I->getParent(), Latch) || !isSerialLoop(L))
+    return false;
+
+  bool IsWrite = isa<StoreInst>(*I);
+  Value *Addr = IsWrite
+      ? cast<StoreInst>(I)->getPointerOperand()
+      : cast<LoadInst>(I)->getPointerOperand();
+  if (Addr->isSwiftError())
+    return false;
+  int NumBytesAccessed = getNumBytesAccessed(Addr, DL);
+  if (NumBytesAccessed <= 0)
+    return false;
+
+  // Only a dense stream of accesses covers its range exactly.
+  const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Addr));
+  if (!AR || AR->getLoop() != L || !AR->isAffine())
+    return false;
+  const SCEVConstant *Step =
+      dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+  if (!Step || Step->getAPInt().abs() != (uint64_t)NumBytesAccessed)
+    return false;
+  const SCEV *BTC = SE.getBackedgeTakenCount(L);
+  if (isa<SCEVCouldNotCompute>(BTC))
+    return false;
+
+  const SCEV *Low = Step->getAPInt().isNegative()
+      ? AR->evaluateAtIteration(BTC, SE)
+      : AR->getStart();
+  const SCEV *Size = SE.getMulExpr(
+      SE.getAddExpr(SE.getTruncateOrZeroExtend(BTC, IntptrTy),
+                    SE.getOne(IntptrTy)),
+      SE.getConstant(IntptrTy, NumBytesAccessed));
+  if (!isSafeToExpand(Low, SE) || !isSafeToExpand(Size, SE))
+    return false;
+
+  Instruction *InsertPt = Preheader->getTerminator();
+  SCEVExpander Expander(SE, DL, "csan.range");
+  Value *LowAddr = Expander.expandCodeFor(Low, Addr->getType(), InsertPt);
+  Value *NumBytes = Expander.expandCodeFor(Size, IntptrTy, InsertPt);
+
+  IRBuilder<> IRB(InsertPt);
+  CsiLoadStoreProperty Prop;
+  Prop.setAlignment(IsWrite ? cast<StoreInst>(I)->getAlignment()
+                            : cast<LoadInst>(I)->getAlignment());
+  Value *CsiId;
+  if (IsWrite) {
+    uint64_t LocalId = StoreFED.add(*I);
+    uint64_t StoreObjId = StoreObj.add(*I, Addr, DL);
+    assert(LocalId == StoreObjId &&
+           "Store received different ID's in FED and object tables.");
+    CsiId = StoreFED.localToGlobalId(LocalId, IRB);
+  } else {
+    uint64_t LocalId = LoadFED.add(*I);
+    uint64_t LoadObjId = LoadObj.add(*I, Addr, DL);
+    assert(LocalId == LoadObjId &&
+           "Load received different ID's in FED and object tables.");
+    CsiId = LoadFED.localToGlobalId(LocalId, IRB);
+  }
+  Value *Args[] = {CsiId,
+                   IRB.CreatePointerCast(LowAddr, IRB.getInt8PtrTy()),
+                   NumBytes,
+                   Prop.getValue(IRB)};
+  Instruction *Call = IRB.CreateCall(IsWrite ? CsanLargeWrite : CsanLargeRead,
+                                     Args);
+  Call->setDebugLoc(I->getDebugLoc());
+  NumCoalescedLoopAccesses++;
+  return true;
+}
+
 bool CilkSanitizerImpl::instrumentAtomic(Instruction *I, const DataLayout &DL) {
   IRBuilder<> IRB(I);
   CsiLoadStoreProperty Prop;
@@ -1149,7 +1467,7 @@ bool CilkSanitizer::runOnModule(Module &M) {
   // };
 
   CallGraph *CG = &getAnalysis<CallGraphWrapperPass>().getCallGraph();
-  const TargetLibraryInfo *TLI =
+  TargetLibraryInfo *TLI =
       &getAnalysis<TargetLibraryInfoWrapperPass>().getTLI();
   auto GetDomTree = [this](Function &F) -> DominatorTree & {
     return this->getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
@@ -0,0 +1,224 @@
+//===- Cilkscale.cpp - work/span profiler for Cilk/Tapir ------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Cilkscale, a work/span profiler for Cilk programs.
+//
+// This instrumentation pass inserts calls to the runtime library at the Tapir
+// constructs of a program, and at the entry and exits of the functions that
+// spawn.  The runtime measures the work between consecutive hooks with a
+// cycle counter and combines those measurements along the series-parallel
+// DAG of the execution into work and span.  It reports its results per spawn
+// site through the CSI front-end data tables.
+//
+// The runtime, in projects/cilkscale, implements the following hooks, all of
+// which take only CSI IDs:
+//
+//   __cilkscale_func_entry(func_id)
+//   __cilkscale_func_exit(func_exit_id, func_id)
+//   __cilkscale_detach(detach_id)
+//   __cilkscale_task(task_id, detach_id)
+//   __cilkscale_task_exit(task_exit_id, task_id, detach_id)
+//   __cilkscale_detach_continue(detach_continue_id, detach_id)
+//   __cilkscale_sync(sync_id)
+//
+// Functions that do not spawn need no hooks: their work accrues to the strand
+// that calls them.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/CSI.h"
+#include "llvm/Transforms/Instrumentation.h"
+#include "llvm/Transforms/Utils/EscapeEnumerator.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "cilkscale"
+
+STATISTIC(NumInstrumentedFunctions, "Number of instrumented spawning functions");
+STATISTIC(NumInstrumentedDetaches, "Number of instrumented detaches");
+STATISTIC(NumInstrumentedSyncs, "Number of instrumented syncs");
+
+namespace {
+
+struct CilkscaleImpl : public CSIImpl {
+  CilkscaleImpl(Module &M, CallGraph *CG,
+                function_ref<DominatorTree &(Function &)> GetDomTree)
+      : CSIImpl(M, CG, GetDomTree) {
+    // Cilkscale inserts its own hooks for Tapir constructs and the functions
+    // that spawn, and no others.
+    Options.InstrumentFuncEntryExit = false;
+    Options.InstrumentBasicBlocks = false;
+    Options.InstrumentMemoryAccesses = false;
+    Options.InstrumentCalls = false;
+    Options.InstrumentAtomics = false;
+    Options.InstrumentMemIntrinsics = false;
+    Options.InstrumentTapir = false;
+  }
+  bool run();
+
+  // Initialize custom hooks for Cilkscale
+  void initializeCilkscaleHooks();
+
+  // Insert hooks at relevant program points
+  bool instrumentFunction(Function &F);
+};
+
+/// Cilkscale: instrument the code in a module to measure its work and span.
+struct Cilkscale : public ModulePass {
+  static char ID; // Pass identification, replacement for typeid.
+  Cilkscale() : ModulePass(ID) {
+    initializeCilkscalePass(*PassRegistry::getPassRegistry());
+  }
+  StringRef getPassName() const override {
+    return "Cilkscale";
+  }
+  void getAnalysisUsage(AnalysisUsage &AU) const override;
+  bool runOnModule(Module &M) override;
+};
+} // namespace
+
+char Cilkscale::ID = 0;
+
+INITIALIZE_PASS_BEGIN(
+    Cilkscale, "cilkscale",
+    "Cilkscale: measures the work and span of Cilk programs.",
+    false, false)
+INITIALIZE_PASS_DEPENDENCY(CallGraphWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_END(
+    Cilkscale, "cilkscale",
+    "Cilkscale: measures the work and span of Cilk programs.",
+    false, false)
+
+void Cilkscale::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<CallGraphWrapperPass>();
+  AU.addRequired<DominatorTreeWrapperPass>();
+}
+
+ModulePass *llvm::createCilkscalePass() {
+  return new Cilkscale();
+}
+
+bool CilkscaleImpl::run() {
+  initializeCsi();
+  initializeCilkscaleHooks();
+
+  for (Function &F : M) {
+    DEBUG(dbgs() << "Instrumenting " << F.getName() << "\n");
+    instrumentFunction(F);
+  }
+
+  collectUnitFEDTables();
+  collectUnitSizeTables();
+  finalizeCsi();
+  return true;
+}
+
+void CilkscaleImpl::initializeCilkscaleHooks() {
+  LLVMContext &C = M.getContext();
+  IRBuilder<> IRB(C);
+  Type *IDType = IRB.getInt64Ty();
+  Type *RetType = IRB.getVoidTy();
+
+  CsiFuncEntry = checkCsiInterfaceFunction(
+      M.getOrInsertFunction("__cilkscale_func_entry", RetType,
+                            /* func_id */ IDType));
+  CsiFuncExit = checkCsiInterfaceFunction(
+      M.getOrInsertFunction("__cilkscale_func_exit", RetType,
+                            /* func_exit_id */ IDType,
+                            /* func_id */ IDType));
+
+  // The CSI instrumentation of detaches and syncs inserts calls to these
+  // hooks, which take the same IDs as the CSI hooks for Tapir.
+  CsiDetach = checkCsiInterfaceFunction(
+      M.getOrInsertFunction("__cilkscale_detach", RetType,
+                            /* detach_id */ IDType));
+  CsiTaskEntry = checkCsiInterfaceFunction(
+      M.getOrInsertFunction("__cilkscale_task", RetType,
+                            /* task_id */ IDType,
+                            /* detach_id */ IDType));
+  CsiTaskExit = checkCsiInterfaceFunction(
+      M.getOrInsertFunction("__cilkscale_task_exit", RetType,
+                            /* task_exit_id */ IDType,
+                            /* task_id */ IDType,
+                            /* detach_id */ IDType));
+  CsiDetachContinue = checkCsiInterfaceFunction(
+      M.getOrInsertFunction("__cilkscale_detach_continue", RetType,
+                            /* detach_continue_id */ IDType,
+                            /* detach_id */ IDType));
+  CsiSync = checkCsiInterfaceFunction(
+      M.getOrInsertFunction("__cilkscale_sync", RetType,
+                            /* sync_id */ IDType));
+}
+
+bool CilkscaleImpl::instrumentFunction(Function &F) {
+  if (F.empty() || shouldNotInstrumentFunction(F))
+    return false;
+
+  SmallVector<DetachInst *, 8> Detaches;
+  SmallVector<SyncInst *, 8> Syncs;
+  for (BasicBlock &BB : F) {
+    if (DetachInst *DI = dyn_cast<DetachInst>(BB.getTerminator()))
+      Detaches.push_back(DI);
+    else if (SyncInst *SI = dyn_cast<SyncInst>(BB.getTerminator()))
+      Syncs.push_back(SI);
+  }
+  // The work of a function that never spawns belongs to its caller's strand.
+  if (Detaches.empty())
+    return false;
+
+  DominatorTree *DT = &GetDomTree(F);
+  uint64_t LocalId = getLocalFunctionID(F);
+
+  for (DetachInst *DI : Detaches) {
+    instrumentDetach(DI, DT);
+    NumInstrumentedDetaches++;
+  }
+  for (SyncInst *SI : Syncs) {
+    instrumentSync(SI);
+    NumInstrumentedSyncs++;
+  }
+
+  // Bracket the spawning function, so that the runtime can keep the work and
+  // span of each of its frames separately.
+  IRBuilder<> IRB(&*F.getEntryBlock().getFirstInsertionPt());
+  Value *FuncId = FunctionFED.localToGlobalId(LocalId, IRB);
+  Instruction *Call = IRB.CreateCall(CsiFuncEntry, {FuncId});
+  IRB.SetInstDebugLocation(Call);
+
+  EscapeEnumerator EE(F, "cilkscale_cleanup", false);
+  while (IRBuilder<> *AtExit = EE.Next()) {
+    uint64_t ExitLocalId = FunctionExitFED.add(*AtExit->GetInsertPoint());
+    Value *ExitCsiId = FunctionExitFED.localToGlobalId(ExitLocalId, *AtExit);
+    Instruction *ExitCall =
+        AtExit->CreateCall(CsiFuncExit, {ExitCsiId, FuncId});
+    AtExit->SetInstDebugLocation(ExitCall);
+  }
+  NumInstrumentedFunctions++;
+  return true;
+}
+
+bool Cilkscale::runOnModule(Module &M) {
+  if (skipModule(M))
+    return false;
+
+  CallGraph *CG = &getAnalysis<CallGraphWrapperPass>().getCallGraph();
+  auto GetDomTree = [this](Function &F) -> DominatorTree & {
+    return this->getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+  };
+
+  return CilkscaleImpl(M, CG, GetDomTree).run();
+}
@@ -14,14 +14,20 @@
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/CaptureTracking.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Instrumentation.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
@@ -52,6 +58,16 @@ static cl::opt<bool>  ClInstrumentMemIntrinsics(
 static cl::opt<bool>  ClInstrumentTapir(
     "csi-instrument-tapir", cl::init(true),
     cl::desc("Instrument tapir constructs"), cl::Hidden);
+static cl::opt<std::string>  ClToolHooks(
+    "csi-tool-hooks", cl::init(""),
+    cl::desc("Insert only the hooks that the tool implements, as given by the "
+             "bitcode of the tool or by a file listing one hook per line"),
+    cl::Hidden);
+static cl::opt<bool>  ClCompressTables(
+    "csi-compress-tables", cl::init(false),
+    cl::desc("Emit compressed front-end data and size tables, which the "
+             "runtime decodes on demand"),
+    cl::Hidden);
 
 namespace {
 
@@ -258,6 +274,70 @@ Constant *SizeTable::insertIntoModule(Module &M) const {
   return ConstantExpr::getGetElementPtr(GV->getValueType(), GV, GepArgs);
 }
 
+/// Insert the given compressed table data and the offsets of its blocks into
+/// the given Module, as private globals whose names start with Name.
+static std::pair<Constant *, Constant *>
+insertCompressedTable(Module &M, StringRef Data, ArrayRef<uint32_t> Blocks,
+                      const Twine &Name) {
+  LLVMContext &C = M.getContext();
+  Constant *Zero = ConstantInt::get(IntegerType::get(C, 32), 0);
+  Value *GepArgs[] = {Zero, Zero};
+
+  Constant *DataArray = ConstantDataArray::getString(C, Data, false);
+  GlobalVariable *DataGV =
+    new GlobalVariable(M, DataArray->getType(), true,
+                       GlobalValue::PrivateLinkage, DataArray, Name + ".data");
+  Constant *BlocksArray = ConstantDataArray::get(C, Blocks);
+  GlobalVariable *BlocksGV =
+    new GlobalVariable(M, BlocksArray->getType(), true,
+                       GlobalValue::PrivateLinkage, BlocksArray,
+                       Name + ".blocks");
+  return std::make_pair(
+      ConstantExpr::getGetElementPtr(DataGV->getValueType(), DataGV, GepArgs),
+      ConstantExpr::getGetElementPtr(BlocksGV->getValueType(), BlocksGV,
+                                     GepArgs));
+}
+
+std::pair<Constant *, Constant *>
+SizeTable::insertCompressedIntoModule(Module &M) const {
+  std::string Data;
+  raw_string_ostream OS(Data);
+  SmallVector<uint32_t, 8> Blocks;
+
+  for (uint64_t LocalID = 0; LocalID < IdCounter; ++LocalID) {
+    if (LocalID % CsiTableBlockSize == 0)
+      Blocks.push_back(OS.tell());
+    const SizeInformation &E = LocalIdToSizeMap.find(LocalID)->second;
+    encodeULEB128(E.FullIRSize, OS);
+    encodeULEB128(E.NonEmptyIRSize, OS);
+  }
+  OS.flush();
+
+  return insertCompressedTable(M, Data, Blocks, CsiUnitSizeTableName);
+}
+
+uint32_t CsiStringPool::intern(StringRef S) {
+  auto Inserted = Offsets.insert(std::make_pair(S, (uint32_t)Data.size()));
+  if (Inserted.second) {
+    Data.append(S.begin(), S.end());
+    Data.push_back('\0');
+  }
+  return Inserted.first->second;
+}
+
+Constant *CsiStringPool::insertIntoModule(Module &M) const {
+  LLVMContext &C = M.getContext();
+  Constant *Zero = ConstantInt::get(IntegerType::get(C, 32), 0);
+  Value *GepArgs[] = {Zero, Zero};
+
+  // Data already ends with the terminator of its last string.
+  Constant *Pool = ConstantDataArray::getString(C, Data, Data.empty());
+  GlobalVariable *GV =
+    new GlobalVariable(M, Pool->getType(), true, GlobalValue::PrivateLinkage,
+                       Pool, CsiUnitFedStringsName);
+  return ConstantExpr::getGetElementPtr(GV->getValueType(), GV, GepArgs);
+}
+
 uint64_t FrontEndDataTable::add(const Function &F) {
   uint64_t ID = getId(&F);
   add(ID, F.getSubprogram());
@@ -383,6 +463,39 @@ Constant *FrontEndDataTable::insertIntoModule(Module &M) const {
   return ConstantExpr::getGetElementPtr(GV->getValueType(), GV, GepArgs);
 }
 
+std::pair<Constant *, Constant *>
+FrontEndDataTable::insertCompressedIntoModule(Module &M,
+                                              CsiStringPool &Strings) const {
+  std::string Data;
+  raw_string_ostream OS(Data);
+  SmallVector<uint32_t, 8> Blocks;
+  int64_t PrevLine = 0;
+
+  for (uint64_t LocalID = 0; LocalID < IdCounter; ++LocalID) {
+    if (LocalID % CsiTableBlockSize == 0) {
+      Blocks.push_back(OS.tell());
+      PrevLine = 0;
+    }
+    const SourceLocation &E = LocalIdToSourceLocationMap.find(LocalID)->second;
+    encodeULEB128(E.Name.empty() ? 0 : Strings.intern(E.Name) + 1, OS);
+    encodeSLEB128(E.Line - PrevLine, OS);
+    PrevLine = E.Line;
+    // Columns are -1 when unknown.
+    encodeULEB128(E.Column + 1, OS);
+    if (E.Filename.empty() && E.Directory.empty())
+      encodeULEB128(0, OS);
+    else if (E.Directory.empty())
+      encodeULEB128(Strings.intern(E.Filename) + 1, OS);
+    else
+      encodeULEB128(
+          Strings.intern((E.Directory + "/" + E.Filename).str()) + 1, OS);
+  }
+  OS.flush();
+
+  return insertCompressedTable(M, Data, Blocks,
+                               CsiUnitFedTableName + BaseId->getName());
+}
+
 /// Function entry and exit hook initialization
 void CSIImpl::initializeFuncHooks() {
   LLVMContext &C = M.getContext();
@@ -492,6 +605,119 @@ void CSIImpl::initializeTapirHooks() {
       M.getOrInsertFunction("__csi_sync", RetType, IDType));
 }
 
+/// Return true if the given hook does nothing, so that calling it is wasted.
+static bool isEmptyHook(const Function &F) {
+  const BasicBlock &Entry = F.getEntryBlock();
+  for (const Instruction &I : Entry) {
+    if (isa<DbgInfoIntrinsic>(I))
+      continue;
+    return isa<ReturnInst>(I);
+  }
+  return false;
+}
+
+/// The hooks that CSI may insert.  A tool intercepts memory intrinsics, which
+/// CSI turns into library calls, by defining the library functions.
+static const char *const CsiToolHookNames[] = {
+    "__csi_func_entry",  "__csi_func_exit",
+    "__csi_bb_entry",    "__csi_bb_exit",
+    "__csi_before_call", "__csi_after_call",
+    "__csi_before_load", "__csi_after_load",
+    "__csi_before_store", "__csi_after_store",
+    "__csi_detach",      "__csi_task",
+    "__csi_task_exit",   "__csi_detach_continue",
+    "__csi_sync",
+    "memmove",           "memcpy",
+    "memset"};
+
+static bool isCsiToolHookName(StringRef Name) {
+  return is_contained(CsiToolHookNames, Name);
+}
+
+/// Read the names of the hooks that the tool implements from the file at
+/// Path.  The file is either the bitcode of the tool, whose defined, nonempty
+/// hooks are the implemented ones, or a list of hook names, one per line.
+static void readToolHooks(StringRef Path, StringSet<> &Implemented) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+      MemoryBuffer::getFile(Path);
+  if (std::error_code EC = BufOrErr.getError())
+    report_fatal_error("CSI: cannot read tool hooks from " + Path + ": " +
+                       EC.message());
+  MemoryBuffer &Buf = **BufOrErr;
+
+  if (!isBitcode((const unsigned char *)Buf.getBufferStart(),
+                 (const unsigned char *)Buf.getBufferEnd())) {
+    for (line_iterator Line(Buf, /*SkipBlanks=*/true, '#'); !Line.is_at_eof();
+         ++Line) {
+      StringRef Name = Line->trim();
+      // A misspelled hook would silently drop instrumentation the tool needs.
+      if (!isCsiToolHookName(Name))
+        errs() << "CSI: warning: " << Path << ":" << Line.line_number()
+               << ": unknown hook '" << Name << "'\n";
+      Implemented.insert(Name);
+    }
+    return;
+  }
+
+  LLVMContext ToolContext;
+  Expected<std::unique_ptr<Module>> ToolOrErr =
+      getLazyBitcodeModule(Buf.getMemBufferRef(), ToolContext);
+  if (!ToolOrErr)
+    report_fatal_error("CSI: cannot parse tool bitcode " + Path + ": " +
+                       toString(ToolOrErr.takeError()));
+  for (Function &F : **ToolOrErr) {
+    if (F.isDeclaration() || !isCsiToolHookName(F.getName()))
+      continue;
+    if (Error Err = F.materialize())
+      report_fatal_error("CSI: cannot read tool hook " + F.getName() + ": " +
+                         toString(std::move(Err)));
+    if (!isEmptyHook(F))
+      Implemented.insert(F.getName());
+  }
+}
+
+void CSIImpl::elideUnimplementedHooks() {
+  StringSet<> Implemented;
+  readToolHooks(ClToolHooks, Implemented);
+
+  auto Elide = [&](Function *&Hook) {
+    if (!Hook || Implemented.count(Hook->getName()))
+      return;
+    if (Hook->use_empty())
+      Hook->eraseFromParent();
+    Hook = nullptr;
+  };
+  Elide(CsiFuncEntry);
+  Elide(CsiFuncExit);
+  Elide(CsiBBEntry);
+  Elide(CsiBBExit);
+  Elide(CsiBeforeCallsite);
+  Elide(CsiAfterCallsite);
+  Elide(CsiBeforeRead);
+  Elide(CsiAfterRead);
+  Elide(CsiBeforeWrite);
+  Elide(CsiAfterWrite);
+  Elide(CsiDetach);
+  Elide(CsiTaskEntry);
+  Elide(CsiTaskExit);
+  Elide(CsiDetachContinue);
+  Elide(CsiSync);
+  Elide(MemmoveFn);
+  Elide(MemcpyFn);
+  Elide(MemsetFn);
+
+  // Without any hooks in a category, skip computing its IDs and properties
+  // altogether.
+  Options.InstrumentFuncEntryExit &= CsiFuncEntry || CsiFuncExit;
+  Options.InstrumentBasicBlocks &= CsiBBEntry || CsiBBExit;
+  Options.InstrumentCalls &= CsiBeforeCallsite || CsiAfterCallsite;
+  Options.InstrumentMemoryAccesses &=
+      CsiBeforeRead || CsiAfterRead || CsiBeforeWrite || CsiAfterWrite;
+  Options.InstrumentMemIntrinsics &= MemmoveFn || MemcpyFn || MemsetFn;
+  Options.InstrumentTapir &= CsiDetach || CsiTaskEntry || CsiTaskExit ||
+                             CsiDetachContinue || CsiSync;
+}
+
 int CSIImpl::getNumBytesAccessed(Value *Addr, const DataLayout &DL) {
   Type *OrigPtrTy = Addr->getType();
   Type *OrigTy = cast<PointerType>(OrigPtrTy)->getElementType();
@@ -510,16 +736,18 @@ void CSIImpl::addLoadStoreInstrumentation(
     Type *AddrType, Value *Addr, int NumBytes, CsiLoadStoreProperty &Prop) {
   IRBuilder<> IRB(I);
   Value *PropVal = Prop.getValue(IRB);
-  insertConditionalHookCall(I, BeforeFn,
-                            {CsiId, IRB.CreatePointerCast(Addr, AddrType),
-                                IRB.getInt32(NumBytes), PropVal});
+  if (BeforeFn)
+    insertConditionalHookCall(I, BeforeFn,
+                              {CsiId, IRB.CreatePointerCast(Addr, AddrType),
+                                  IRB.getInt32(NumBytes), PropVal});
 
   BasicBlock::iterator Iter(I);
   Iter++;
   IRB.SetInsertPoint(&*Iter);
-  insertConditionalHookCall(&*Iter, AfterFn,
-                            {CsiId, IRB.CreatePointerCast(Addr, AddrType),
-                                IRB.getInt32(NumBytes), PropVal});
+  if (AfterFn)
+    insertConditionalHookCall(&*Iter, AfterFn,
+                              {CsiId, IRB.CreatePointerCast(Addr, AddrType),
+                                  IRB.getInt32(NumBytes), PropVal});
 }
 
 void CSIImpl::instrumentLoadOrStore(Instruction *I, CsiLoadStoreProperty &Prop,
@@ -534,6 +762,11 @@ void CSIImpl::instrumentLoadOrStore(Instruction *I, CsiLoadStoreProperty &Prop,
   if (NumBytes == -1)
     return; // size that we don't recognize
 
+  // Skip accesses for which the tool implements no hooks.
+  if (IsWrite ? (!CsiBeforeWrite && !CsiAfterWrite)
+              : (!CsiBeforeRead && !CsiAfterRead))
+    return;
+
   if (IsWrite) {
     uint64_t LocalId = StoreFED.add(*I);
     Value *CsiId = StoreFED.localToGlobalId(LocalId, IRB);
@@ -563,6 +796,8 @@ void CSIImpl::instrumentAtomic(Instruction *I, const DataLayout &DL) {
 bool CSIImpl::instrumentMemIntrinsic(Instruction *I) {
   IRBuilder<> IRB(I);
   if (MemSetInst *M = dyn_cast<MemSetInst>(I)) {
+    if (!MemsetFn)
+      return false;
     Instruction *Call = IRB.CreateCall(
         MemsetFn,
         {IRB.CreatePointerCast(M->getArgOperand(0), IRB.getInt8PtrTy()),
@@ -572,8 +807,11 @@ bool CSIImpl::instrumentMemIntrinsic(Instruction *I) {
     I->eraseFromParent();
     return true;
   } else if (MemTransferInst *M = dyn_cast<MemTransferInst>(I)) {
+    Function *TransferFn = isa<MemCpyInst>(M) ? MemcpyFn : MemmoveFn;
+    if (!TransferFn)
+      return false;
     Instruction *Call = IRB.CreateCall(
-        isa<MemCpyInst>(M) ? MemcpyFn : MemmoveFn,
+        TransferFn,
         {IRB.CreatePointerCast(M->getArgOperand(0), IRB.getInt8PtrTy()),
             IRB.CreatePointerCast(M->getArgOperand(1), IRB.getInt8PtrTy()),
             IRB.CreateIntCast(M->getArgOperand(2), IntptrTy, false)});
@@ -594,10 +832,12 @@ void CSIImpl::instrumentBasicBlock(BasicBlock &BB) {
   CsiBBProperty Prop;
   TerminatorInst *TI = BB.getTerminator();
   Value *PropVal = Prop.getValue(IRB);
-  insertConditionalHookCall(&*IRB.GetInsertPoint(), CsiBBEntry,
-                            {CsiId, PropVal});
-  insertConditionalHookCall(TI, CsiBBExit,
-                            {CsiId, PropVal});
+  if (CsiBBEntry)
+    insertConditionalHookCall(&*IRB.GetInsertPoint(), CsiBBEntry,
+                              {CsiId, PropVal});
+  if (CsiBBExit)
+    insertConditionalHookCall(TI, CsiBBExit,
+                              {CsiId, PropVal});
 }
 
 void CSIImpl::instrumentCallsite(Instruction *I) {
@@ -650,10 +890,13 @@ void CSIImpl::instrumentCallsite(Instruction *I) {
   CsiCallProperty Prop;
   Prop.setIsIndirect(!Called);
   Value *PropVal = Prop.getValue(IRB);
-  insertConditionalHookCall(I, CsiBeforeCallsite,
-                            {CallsiteId, FuncId, PropVal});
+  if (CsiBeforeCallsite)
+    insertConditionalHookCall(I, CsiBeforeCallsite,
+                              {CallsiteId, FuncId, PropVal});
 
   BasicBlock::iterator Iter(I);
+  if (!CsiAfterCallsite)
+    return;
   if (IsInvoke) {
     // There are two "after" positions for invokes: the normal block
     // and the exception block. This also means we have to recompute
@@ -697,8 +940,10 @@ void CSIImpl::instrumentDetach(DetachInst *DI, DominatorTree *DT) {
     IRBuilder<> IRB(DI);
     uint64_t LocalID = DetachFED.add(*DI);
     DetachID = DetachFED.localToGlobalId(LocalID, IRB);
-    Instruction *Call = IRB.CreateCall(CsiDetach, {DetachID});
-    IRB.SetInstDebugLocation(Call);
+    if (CsiDetach) {
+      Instruction *Call = IRB.CreateCall(CsiDetach, {DetachID});
+      IRB.SetInstDebugLocation(Call);
+    }
   }
 
   // Find the detached block, continuation, and associated reattaches.
@@ -711,28 +956,31 @@ void CSIImpl::instrumentDetach(DetachInst *DI, DominatorTree *DT) {
       TaskExits.push_back(Pred);
 
   // Instrument the entry and exit points of the detached task.
-  {
+  if (CsiTaskEntry || CsiTaskExit) {
     // Instrument the entry point of the detached task.
     IRBuilder<> IRB(&*DetachedBlock->getFirstInsertionPt());
     uint64_t LocalID = TaskFED.add(*DetachedBlock);
     Value *TaskID = TaskFED.localToGlobalId(LocalID, IRB);
-    Instruction *Call = IRB.CreateCall(CsiTaskEntry,
-                                       {TaskID, DetachID});
-    IRB.SetInstDebugLocation(Call);
-
-    // Instrument the exit points of the detached tasks.
-    for (BasicBlock *TaskExit : TaskExits) {
-      IRBuilder<> IRB(TaskExit->getTerminator());
-      uint64_t LocalID = TaskExitFED.add(*TaskExit->getTerminator());
-      Value *TaskExitID = TaskExitFED.localToGlobalId(LocalID, IRB);
-      Instruction *Call = IRB.CreateCall(CsiTaskExit,
-                                         {TaskExitID, TaskID, DetachID});
+    if (CsiTaskEntry) {
+      Instruction *Call = IRB.CreateCall(CsiTaskEntry,
+                                         {TaskID, DetachID});
       IRB.SetInstDebugLocation(Call);
     }
+
+    // Instrument the exit points of the detached tasks.
+    if (CsiTaskExit)
+      for (BasicBlock *TaskExit : TaskExits) {
+        IRBuilder<> IRB(TaskExit->getTerminator());
+        uint64_t LocalID = TaskExitFED.add(*TaskExit->getTerminator());
+        Value *TaskExitID = TaskExitFED.localToGlobalId(LocalID, IRB);
+        Instruction *Call = IRB.CreateCall(CsiTaskExit,
+                                           {TaskExitID, TaskID, DetachID});
+        IRB.SetInstDebugLocation(Call);
+      }
   }
 
   // Instrument the continuation of the detach.
-  {
+  if (CsiDetachContinue) {
     if (isCriticalContinueEdge(DI, 1))
       ContinueBlock = SplitCriticalEdge(
           DI, 1,
@@ -834,6 +1082,9 @@ void CSIImpl::initializeCsi() {
     initializeMemIntrinsicsHooks();
   if (Options.InstrumentTapir)
     initializeTapirHooks();
+  if (!ClToolHooks.empty())
+    elideUnimplementedHooks();
+  CompressTables = ClCompressTables;
 
   FunctionType *FnType =
     FunctionType::get(Type::getVoidTy(M.getContext()), {}, false);
@@ -873,35 +1124,55 @@ Constant *CSIImpl::fedTableToUnitFedTable(Module &M,
                              InsertedTable);
 }
 
+// Create a struct type to match the unit_compressed_fed_table_t type in
+// csirt_compressed.h.
+StructType *CSIImpl::getCompressedUnitFedTableType(LLVMContext &C) {
+  return StructType::get(IntegerType::get(C, 64),
+                         Type::getInt8PtrTy(C, 0),
+                         /* Data */ Type::getInt8PtrTy(C, 0),
+                         /* Blocks */ Type::getInt32PtrTy(C, 0));
+}
+
+Constant *CSIImpl::fedTableToCompressedUnitFedTable(
+    Module &M, StructType *UnitFedTableType, FrontEndDataTable &FedTable) {
+  Constant *NumEntries =
+    ConstantInt::get(IntegerType::get(M.getContext(), 64), FedTable.size());
+  Constant *BaseIdPtr =
+    ConstantExpr::getPointerCast(FedTable.baseId(),
+                                 Type::getInt8PtrTy(M.getContext(), 0));
+  std::pair<Constant *, Constant *> InsertedTable =
+    FedTable.insertCompressedIntoModule(M, FEDStrings);
+  return ConstantStruct::get(UnitFedTableType, NumEntries, BaseIdPtr,
+                             InsertedTable.first, InsertedTable.second);
+}
+
 void CSIImpl::collectUnitFEDTables() {
   LLVMContext &C = M.getContext();
   StructType *UnitFedTableType =
-      getUnitFedTableType(C, FrontEndDataTable::getPointerType(C));
+    CompressTables ? getCompressedUnitFedTableType(C) :
+    getUnitFedTableType(C, FrontEndDataTable::getPointerType(C));
+  auto CollectTable = [&](FrontEndDataTable &FedTable) {
+    if (CompressTables)
+      UnitFedTables.push_back(
+          fedTableToCompressedUnitFedTable(M, UnitFedTableType, FedTable));
+    else
+      UnitFedTables.push_back(
+          fedTableToUnitFedTable(M, UnitFedTableType, FedTable));
+  };
 
   // The order of the FED tables here must match the enum in csirt.c and the
   // instrumentation_counts_t in csi.h.
-  UnitFedTables.push_back(
-      fedTableToUnitFedTable(M, UnitFedTableType, FunctionFED));
-  UnitFedTables.push_back(
-      fedTableToUnitFedTable(M, UnitFedTableType, FunctionExitFED));
-  UnitFedTables.push_back(
-      fedTableToUnitFedTable(M, UnitFedTableType, BasicBlockFED));
-  UnitFedTables.push_back(
-      fedTableToUnitFedTable(M, UnitFedTableType, CallsiteFED));
-  UnitFedTables.push_back(
-      fedTableToUnitFedTable(M, UnitFedTableType, LoadFED));
-  UnitFedTables.push_back(
-      fedTableToUnitFedTable(M, UnitFedTableType, StoreFED));
-  UnitFedTables.push_back(
-      fedTableToUnitFedTable(M, UnitFedTableType, DetachFED));
-  UnitFedTables.push_back(
-      fedTableToUnitFedTable(M, UnitFedTableType, TaskFED));
-  UnitFedTables.push_back(
-      fedTableToUnitFedTable(M, UnitFedTableType, TaskExitFED));
-  UnitFedTables.push_back(
-      fedTableToUnitFedTable(M, UnitFedTableType, DetachContinueFED));
-  UnitFedTables.push_back(
-      fedTableToUnitFedTable(M, UnitFedTableType, SyncFED));
+  CollectTable(FunctionFED);
+  CollectTable(FunctionExitFED);
+  CollectTable(BasicBlockFED);
+  CollectTable(CallsiteFED);
+  CollectTable(LoadFED);
+  CollectTable(StoreFED);
+  CollectTable(DetachFED);
+  CollectTable(TaskFED);
+  CollectTable(TaskExitFED);
+  CollectTable(DetachContinueFED);
+  CollectTable(SyncFED);
 }
 
 // Create a struct type to match the unit_obj_entry_t type in csirt.c.
@@ -923,8 +1194,31 @@ Constant *CSIImpl::sizeTableToUnitSizeTable(
                              InsertedTable);
 }
 
+// Create a struct type to match the unit_compressed_size_table_t type in
+// csirt_compressed.h.
+StructType *CSIImpl::getCompressedUnitSizeTableType(LLVMContext &C) {
+  return StructType::get(IntegerType::get(C, 64),
+                         /* Data */ Type::getInt8PtrTy(C, 0),
+                         /* Blocks */ Type::getInt32PtrTy(C, 0));
+}
+
+Constant *CSIImpl::sizeTableToCompressedUnitSizeTable(
+    Module &M, StructType *UnitSizeTableType, SizeTable &SzTable) {
+  Constant *NumEntries =
+    ConstantInt::get(IntegerType::get(M.getContext(), 64), SzTable.size());
+  std::pair<Constant *, Constant *> InsertedTable =
+    SzTable.insertCompressedIntoModule(M);
+  return ConstantStruct::get(UnitSizeTableType, NumEntries,
+                             InsertedTable.first, InsertedTable.second);
+}
+
 void CSIImpl::collectUnitSizeTables() {
   LLVMContext &C = M.getContext();
+  if (CompressTables) {
+    UnitSizeTables.push_back(sizeTableToCompressedUnitSizeTable(
+        M, getCompressedUnitSizeTableType(C), BBSize));
+    return;
+  }
   StructType *UnitSizeTableType =
       getUnitSizeTableType(C, SizeTable::getPointerType(C));
 
@@ -936,19 +1230,25 @@ CallInst *CSIImpl::createRTUnitInitCall(IRBuilder<> &IRB) {
   LLVMContext &C = M.getContext();
 
   StructType *UnitFedTableType =
-      getUnitFedTableType(C, FrontEndDataTable::getPointerType(C));
+    CompressTables ? getCompressedUnitFedTableType(C) :
+    getUnitFedTableType(C, FrontEndDataTable::getPointerType(C));
   StructType *UnitSizeTableType =
-      getUnitSizeTableType(C, SizeTable::getPointerType(C));
+    CompressTables ? getCompressedUnitSizeTableType(C) :
+    getUnitSizeTableType(C, SizeTable::getPointerType(C));
 
-  // Lookup __csirt_unit_init
-  SmallVector<Type *, 4> InitArgTypes({IRB.getInt8PtrTy(),
+  // Lookup __csirt_unit_init, or __csirt_unit_init_compressed, which also
+  // takes the string pool of the compressed FED tables.
+  SmallVector<Type *, 5> InitArgTypes({IRB.getInt8PtrTy(),
         PointerType::get(UnitFedTableType, 0),
-        PointerType::get(UnitSizeTableType, 0),
-        InitCallsiteToFunction->getType()});
+        PointerType::get(UnitSizeTableType, 0)});
+  if (CompressTables)
+    InitArgTypes.push_back(IRB.getInt8PtrTy());
+  InitArgTypes.push_back(InitCallsiteToFunction->getType());
   FunctionType *InitFunctionTy =
       FunctionType::get(IRB.getVoidTy(), InitArgTypes, false);
   RTUnitInit = checkCsiInterfaceFunction(
-      M.getOrInsertFunction(CsiRtUnitInitName, InitFunctionTy));
+      M.getOrInsertFunction(CompressTables ? CsiRtUnitInitCompressedName :
+                            CsiRtUnitInitName, InitFunctionTy));
   assert(RTUnitInit);
 
   ArrayType *UnitFedTableArrayType =
@@ -970,12 +1270,14 @@ CallInst *CSIImpl::createRTUnitInitCall(IRBuilder<> &IRB) {
   Value *GepArgs[] = {Zero, Zero};
 
   // Insert call to __csirt_unit_init
-  return IRB.CreateCall(
-      RTUnitInit,
-      {IRB.CreateGlobalStringPtr(M.getName()),
-          ConstantExpr::getGetElementPtr(FEDGV->getValueType(), FEDGV, GepArgs),
-          ConstantExpr::getGetElementPtr(SizeGV->getValueType(), SizeGV, GepArgs),
-          InitCallsiteToFunction});
+  SmallVector<Value *, 5> InitArgs({IRB.CreateGlobalStringPtr(M.getName()),
+        ConstantExpr::getGetElementPtr(FEDGV->getValueType(), FEDGV, GepArgs),
+        ConstantExpr::getGetElementPtr(SizeGV->getValueType(), SizeGV,
+                                       GepArgs)});
+  if (CompressTables)
+    InitArgs.push_back(FEDStrings.insertIntoModule(M));
+  InitArgs.push_back(InitCallsiteToFunction);
+  return IRB.CreateCall(RTUnitInit, InitArgs);
 }
 
 void CSIImpl::finalizeCsi() {
@@ -1184,10 +1486,12 @@ void CSIImpl::instrumentFunction(Function &F) {
 
   // Instrument Tapir constructs.
   if (Options.InstrumentTapir) {
-    for (DetachInst *DI : Detaches)
-      instrumentDetach(DI, DT);
-    for (SyncInst *SI : Syncs)
-      instrumentSync(SI);
+    if (CsiDetach || CsiTaskEntry || CsiTaskExit || CsiDetachContinue)
+      for (DetachInst *DI : Detaches)
+        instrumentDetach(DI, DT);
+    if (CsiSync)
+      for (SyncInst *SI : Syncs)
+        instrumentSync(SI);
   }
 
   // Do this work in a separate loop after copying the iterators so that we
@@ -1219,18 +1523,20 @@ void CSIImpl::instrumentFunction(Function &F) {
     CsiFuncExitProperty FuncExitProp;
     Value *FuncId = FunctionFED.localToGlobalId(LocalId, IRB);
     Value *PropVal = FuncEntryProp.getValue(IRB);
-    insertConditionalHookCall(&*IRB.GetInsertPoint(), CsiFuncEntry,
-                              {FuncId, PropVal});
-
-    for (Instruction *I : ReturnInstructions) {
-      IRBuilder<> IRBRet(I);
-      // uint64_t ExitLocalId = FunctionExitFED.add(F);
-      uint64_t ExitLocalId = FunctionExitFED.add(*I);
-      Value *ExitCsiId = FunctionExitFED.localToGlobalId(ExitLocalId, IRBRet);
-      PropVal = FuncExitProp.getValue(IRBRet);
-      insertConditionalHookCall(I, CsiFuncExit,
-                                {ExitCsiId, FuncId, PropVal});
-    }
+    if (CsiFuncEntry)
+      insertConditionalHookCall(&*IRB.GetInsertPoint(), CsiFuncEntry,
+                                {FuncId, PropVal});
+
+    if (CsiFuncExit)
+      for (Instruction *I : ReturnInstructions) {
+        IRBuilder<> IRBRet(I);
+        // uint64_t ExitLocalId = FunctionExitFED.add(F);
+        uint64_t ExitLocalId = FunctionExitFED.add(*I);
+        Value *ExitCsiId = FunctionExitFED.localToGlobalId(ExitLocalId, IRBRet);
+        PropVal = FuncExitProp.getValue(IRBRet);
+        insertConditionalHookCall(I, CsiFuncExit,
+                                  {ExitCsiId, FuncId, PropVal});
+      }
   }
 }
 
@@ -45,6 +45,7 @@
 #include "llvm/Analysis/OptimizationDiagnosticInfo.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/ScalarEvolutionAliasAnalysis.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/CFG.h"
@@ -116,7 +117,8 @@ namespace {
 struct LoopInvariantCodeMotion {
   bool runOnLoop(Loop *L, AliasAnalysis *AA, LoopInfo *LI, DominatorTree *DT,
                  TargetLibraryInfo *TLI, ScalarEvolution *SE,
-                 OptimizationRemarkEmitter *ORE, bool DeleteAST, bool Rhino);
+                 OptimizationRemarkEmitter *ORE, TaskInfo *TI, bool DeleteAST,
+                 bool Rhino);
 
   DenseMap<Loop *, AliasSetTracker *> &getLoopToAliasSetMap() {
     return LoopToAliasSetMap;
@@ -249,12 +251,18 @@ struct LegacyLICMCommonPass : public LoopPass {
     // pass.  Function analyses need to be preserved across loop transformations
     // but ORE cannot be preserved (see comment before the pass definition).
     OptimizationRemarkEmitter ORE(L->getHeader()->getParent());
+    // Requiring the task tree would split the loop pass manager, since loop
+    // passes that run before LICM on the same loop may change the CFG.  LICM
+    // preserves the task tree, so use it when it is still valid, and otherwise
+    // let LICM build it once for the loop.
+    auto *TIWP = getAnalysisIfAvailable<TaskInfoWrapperPass>();
     return LICM.runOnLoop(L,
                           &getAnalysis<AAResultsWrapperPass>().getAAResults(),
                           &getAnalysis<LoopInfoWrapperPass>().getLoopInfo(),
                           &getAnalysis<DominatorTreeWrapperPass>().getDomTree(),
                           &getAnalysis<TargetLibraryInfoWrapperPass>().getTLI(),
-                          SE ? &SE->getSE() : nullptr, &ORE, false, Rhino);
+                          SE ? &SE->getSE() : nullptr, &ORE,
+                          TIWP ? &TIWP->getTaskInfo() : nullptr, false, Rhino);
   }
 
   /// This transformation requires natural loop information & requires that
@@ -263,6 +271,7 @@ struct LegacyLICMCommonPass : public LoopPass {
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.setPreservesCFG();
     AU.addRequired<TargetLibraryInfoWrapperPass>();
+    AU.addPreserved<TaskInfoWrapperPass>();
     getLoopAnalysisUsage(AU);
   }
 
@@ -323,8 +332,16 @@ PreservedAnalyses LICMPass::run(Loop &L, LoopAnalysisManager &AM,
     report_fatal_error("LICM: OptimizationRemarkEmitterAnalysis not "
                        "cached at a higher level");
 
+  // The task tree only depends on the CFG, which LICM preserves.  Other loop
+  // passes in the same pipeline, such as loop rotation, may change the CFG
+  // without invalidating the cached tree, so LICM checks that the tree knows
+  // all blocks of the loop before it uses it.  Without a cached tree, LICM
+  // computes the task tree itself for loops that contain a detach.
+  auto *TI = FAM.getCachedResult<TaskAnalysis>(*F);
+
   LoopInvariantCodeMotion LICM;
-  if (!LICM.runOnLoop(&L, &AR.AA, &AR.LI, &AR.DT, &AR.TLI, &AR.SE, ORE, true, Rhino))
+  if (!LICM.runOnLoop(&L, &AR.AA, &AR.LI, &AR.DT, &AR.TLI, &AR.SE, ORE, TI,
+                      true, Rhino))
     return PreservedAnalyses::all();
 
   auto PA = getLoopPassPreservedAnalyses();
@@ -376,7 +393,8 @@ bool LoopInvariantCodeMotion::runOnLoop(Loop *L, AliasAnalysis *AA,
                                         TargetLibraryInfo *TLI,
                                         ScalarEvolution *SE,
                                         OptimizationRemarkEmitter *ORE,
-                                        bool DeleteAST, bool Rhino) {
+                                        TaskInfo *TI, bool DeleteAST,
+                                        bool Rhino) {
   bool Changed = false;
 
   assert(L->isLCSSAForm(*DT) && "Loop is not in LCSSA form.");
@@ -432,13 +450,42 @@ bool LoopInvariantCodeMotion::runOnLoop(Loop *L, AliasAnalysis *AA,
 
       PredIteratorCache PIC;
 
+      // We cannot speculate loads to values that are stored in a detached
+      // context within the loop.  If the loop contains a detach, use the task
+      // tree of the function to find those stores.  If the caller has no task
+      // tree to offer, build it once here rather than walking the CFG for
+      // every store.
+      TaskInfo LocalTI;
+      bool DetachWithinLoop = llvm::any_of(L->blocks(), [](BasicBlock *BB) {
+        return isa<DetachInst>(BB->getTerminator());
+      });
+      if (!DetachWithinLoop)
+        TI = nullptr;
+      else if (!TI) {
+        LocalTI.recalculate(*L->getHeader()->getParent());
+        TI = &LocalTI;
+      }
+
+      // A task tree computed before other passes changed the CFG may not know
+      // all blocks of the loop.  Such a tree cannot tell whether a store in a
+      // new block is detached, so do not promote anything.
+      bool KnowsAllTasks =
+          !TI || llvm::all_of(L->blocks(), [&](BasicBlock *BB) {
+            return TI->getTaskFor(BB);
+          });
+      if (!KnowsAllTasks)
+        DEBUG(dbgs() << "LICM: Task tree misses blocks of loop "
+                     << L->getHeader()->getName() << ", not promoting\n");
+
       bool Promoted = false;
 
       // Loop over all of the alias sets in the tracker object.
-      for (AliasSet &AS : *CurAST)
-        Promoted |=
-            promoteLoopAccessesToScalars(AS, ExitBlocks, InsertPts, PIC, LI, DT,
-                                         TLI, L, CurAST, &SafetyInfo, ORE);
+      if (KnowsAllTasks)
+        for (AliasSet &AS : *CurAST)
+          Promoted |=
+              promoteLoopAccessesToScalars(AS, ExitBlocks, InsertPts, PIC, LI,
+                                           DT, TLI, L, CurAST, &SafetyInfo, ORE,
+                                           TI);
 
       // Once we have promoted values across the loop body we have to
       // recursively reform LCSSA as any nested loop may now have values defined
@@ -1174,7 +1221,7 @@ bool llvm::promoteLoopAccessesToScalars(
     SmallVectorImpl<Instruction *> &InsertPts, PredIteratorCache &PIC,
     LoopInfo *LI, DominatorTree *DT, const TargetLibraryInfo *TLI,
     Loop *CurLoop, AliasSetTracker *CurAST, LoopSafetyInfo *SafetyInfo,
-    OptimizationRemarkEmitter *ORE) {
+    OptimizationRemarkEmitter *ORE, const TaskInfo *TI) {
   // Verify inputs.
   assert(LI != nullptr && DT != nullptr && CurLoop != nullptr &&
          CurAST != nullptr && SafetyInfo != nullptr &&
@@ -1233,18 +1280,6 @@ bool llvm::promoteLoopAccessesToScalars(
   bool DereferenceableInPH = false;
   bool SafeToInsertStore = false;
 
-  // We cannot speculate loads to values that are stored in a detached
-  // context within the loop.  Precompute whether or not there is a
-  // detach within this loop.
-  bool DetachWithinLoop =
-    isa<DetachInst>(CurLoop->getHeader()->getTerminator());
-  if (!DetachWithinLoop)
-    for (BasicBlock *BB : CurLoop->getBlocks())
-      if (isa<DetachInst>(BB->getTerminator())) {
-        DetachWithinLoop = true;
-        break;
-      }
-
   SmallVector<Instruction *, 64> LoopUses;
   SmallPtrSet<Value *, 4> PointerMustAliases;
 
@@ -1335,11 +1370,7 @@ bool llvm::promoteLoopAccessesToScalars(
 	// -- but to preserve the serial execution, we have to avoid
 	// moving stores that are loaded.  For now, we simply avoid
 	// moving these stores.
-	//
-	// TODO: The call to GetDetachedCtx can potentially be
-	// expensive.  Optimize this analysis in the future.
-	if (DetachWithinLoop &&
-	    CurLoop->contains(GetDetachedCtx(Store->getParent())))
+	if (TI && CurLoop->contains(TI->getTaskFor(Store->getParent())))
 	  return false;
 
         // Note that we only check GuaranteedToExecute inside the store case
@@ -15,13 +15,16 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Tapir/CilkABI.h"
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/Analysis/ScalarEvolutionExpander.h"
 #include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/Transforms/Tapir/Outline.h"
 #include "llvm/Transforms/Utils/EscapeEnumerator.h"
 #include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
 #include "llvm/Transforms/Utils/TapirUtils.h"
 
 using namespace llvm;
@@ -38,6 +41,10 @@ static cl::opt<bool> fastCilk(
 
 STATISTIC(LoopsConvertedToCilkABI,
           "Number of Tapir loops converted to use the Cilk ABI for loops");
+STATISTIC(DelayedStackFrames,
+          "Number of Cilk stack frames entered after the function entry");
+STATISTIC(ReducerViewsReused,
+          "Number of reducer view lookups reused within a strand");
 
 typedef void *__CILK_JUMP_BUFFER[5];
 
@@ -95,6 +102,7 @@ typedef int (__cilkrts_get_nworkers)();
 typedef __cilkrts_worker *(__cilkrts_get_tls_worker)();
 typedef __cilkrts_worker *(__cilkrts_get_tls_worker_fast)();
 typedef __cilkrts_worker *(__cilkrts_bind_thread_1)();
+typedef void *(__cilkrts_hyper_lookup)(void *key);
 
 typedef void (cilk_func)(__cilkrts_stack_frame *);
 
@@ -152,6 +160,7 @@ DEFAULT_GET_CILKRTS_FUNC(leave_frame)
 DEFAULT_GET_CILKRTS_FUNC(get_tls_worker)
 DEFAULT_GET_CILKRTS_FUNC(get_tls_worker_fast)
 DEFAULT_GET_CILKRTS_FUNC(bind_thread_1)
+DEFAULT_GET_CILKRTS_FUNC(hyper_lookup)
 
 DEFAULT_GET_CILKRTS_FUNC(cilk_for_32)
 DEFAULT_GET_CILKRTS_FUNC(cilk_for_64)
@@ -991,23 +1000,110 @@ static AllocaInst *CreateStackFrame(Function &F) {
   return SF;
 }
 
+/// \brief Find the block in which to enter the __cilkrts_stack_frame of a
+/// spawning function.
+///
+/// The stack frame must be entered before any detach or sync in F, but paths
+/// through F that never reach a detach or sync, such as the base case of a
+/// recursive function, need not enter the frame at all.  This routine returns
+/// the nearest common dominator of all detaches and syncs in F, hoisted out of
+/// any loops so that the frame is entered at most once per invocation.
+static BasicBlock *GetStackFrameEntryBlock(Function &F, DominatorTree &DT) {
+  BasicBlock *EnterBB = nullptr;
+  for (BasicBlock &BB : F) {
+    if (!isa<DetachInst>(BB.getTerminator()) &&
+        !isa<SyncInst>(BB.getTerminator()))
+      continue;
+    if (!DT.isReachableFromEntry(&BB))
+      continue;
+    EnterBB = EnterBB ? DT.findNearestCommonDominator(EnterBB, &BB) : &BB;
+  }
+  if (!EnterBB)
+    return &F.getEntryBlock();
+
+  LoopInfo LI(DT);
+  while (Loop *L = LI.getLoopFor(EnterBB))
+    EnterBB = DT.getNode(L->getHeader())->getIDom()->getBlock();
+  return EnterBB;
+}
+
+/// \brief Insert calls to __cilk_parent_epilogue before the returns of F.
+///
+/// If the stack frame of F is entered in EnterBB, rather than in the entry
+/// block, then returns that are not dominated by EnterBB only call the epilogue
+/// if the path to that return passed through EnterBB.
+static void InsertCilkParentEpilogues(Function &F, BasicBlock *EnterBB,
+                                      DominatorTree &DT, Value *SF,
+                                      bool instrument) {
+  Module *M = F.getParent();
+  Value *args[1] = { SF };
+
+  SmallVector<ReturnInst *, 4> Returns;
+  for (BasicBlock &BB : F)
+    if (ReturnInst *RI = dyn_cast<ReturnInst>(BB.getTerminator()))
+      Returns.push_back(RI);
+
+  // Track whether the stack frame has been entered along each path.
+  LLVMContext &Ctx = F.getContext();
+  SSAUpdater FrameEntered;
+  FrameEntered.Initialize(Type::getInt1Ty(Ctx), "cilk.frame.entered");
+  if (EnterBB != &F.getEntryBlock()) {
+    FrameEntered.AddAvailableValue(&F.getEntryBlock(),
+                                   ConstantInt::getFalse(Ctx));
+    FrameEntered.AddAvailableValue(EnterBB, ConstantInt::getTrue(Ctx));
+  }
+
+  for (ReturnInst *RI : Returns) {
+    BasicBlock *RetBB = RI->getParent();
+    if (!DT.isReachableFromEntry(RetBB))
+      continue;
+    if (DT.dominates(EnterBB, RetBB)) {
+      CallInst::Create(GetCilkParentEpilogue(*M, instrument), args, "", RI);
+      continue;
+    }
+
+    Value *Entered = FrameEntered.GetValueInMiddleOfBlock(RetBB);
+    if (ConstantInt *C = dyn_cast<ConstantInt>(Entered))
+      if (C->isZero())
+        continue;
+    TerminatorInst *EpilogueTerm =
+      SplitBlockAndInsertIfThen(Entered, RI, /*Unreachable=*/false,
+                                /*BranchWeights=*/nullptr, &DT);
+    EpilogueTerm->getParent()->setName("cilk.epilogue");
+    RI->getParent()->setName("cilk.epilogue.cont");
+    CallInst::Create(GetCilkParentEpilogue(*M, instrument), args, "",
+                     EpilogueTerm);
+  }
+}
+
 Value* GetOrInitCilkStackFrame(Function& F,
                                ValueToValueMapTy &DetachCtxToStackFrame,
-                               bool Helper = true, bool instrument = false) {
+                               bool Helper = true, bool instrument = false,
+                               DominatorTree *FnDT = nullptr) {
   // Value* V = LookupStackFrame(F);
   Value *V = DetachCtxToStackFrame[&F];
   if (V) return V;
 
   AllocaInst* alloc = CreateStackFrame(F);
   DetachCtxToStackFrame[&F] = alloc;
-  BasicBlock::iterator II = F.getEntryBlock().getFirstInsertionPt();
-  AllocaInst* curinst;
-  do {
-    curinst = dyn_cast<AllocaInst>(II);
-    II++;
-  } while (curinst != alloc);
+
+  // Delay entering the stack frame until the first block that must have it.
+  DominatorTree LocalDT;
+  if (!FnDT)
+    LocalDT.recalculate(F);
+  DominatorTree &DT = FnDT ? *FnDT : LocalDT;
+  BasicBlock *EnterBB = GetStackFrameEntryBlock(F, DT);
+  BasicBlock::iterator II = EnterBB->getFirstInsertionPt();
+  if (EnterBB == &F.getEntryBlock()) {
+    AllocaInst* curinst;
+    do {
+      curinst = dyn_cast<AllocaInst>(II);
+      II++;
+    } while (curinst != alloc);
+  } else
+    ++DelayedStackFrames;
   // Value *StackSave;
-  IRBuilder<> IRB(&(F.getEntryBlock()), II);
+  IRBuilder<> IRB(EnterBB, II);
 
   // if (instrument) {
   //   Type *Int8PtrTy = IRB.getInt8PtrTy();
@@ -1040,12 +1136,7 @@ Value* GetOrInitCilkStackFrame(Function& F,
   //   IRB.CreateCall(CILK_CSI_FUNC(enter_end, *F.getParent()), end_args);
   // }
 
-  EscapeEnumerator EE(F, "cilkabi_epilogue", false);
-  while (IRBuilder<> *AtExit = EE.Next()) {
-    if (isa<ReturnInst>(AtExit->GetInsertPoint()))
-      AtExit->CreateCall(GetCilkParentEpilogue(*F.getParent(), instrument),
-                         args, "");
-  }
+  InsertCilkParentEpilogues(F, EnterBB, DT, alloc, instrument);
 
   return alloc;
 }
@@ -1080,14 +1171,10 @@ bool makeFunctionDetachable(Function &extracted,
   if (!SimpleHelper)
     DEBUG(dbgs() << "Detachable helper function itself detaches.\n");
 
-  BasicBlock::iterator II = extracted.getEntryBlock().getFirstInsertionPt();
-  AllocaInst* curinst;
-  do {
-    curinst = dyn_cast<AllocaInst>(II);
-    II++;
-  } while (curinst != SF);
   // Value *StackSave;
-  IRBuilder<> IRB(&(extracted.getEntryBlock()), II);
+  // Detach at the end of the entry block, after the helper reads any inputs
+  // from the frame of its parent, which the parent reuses once it continues.
+  IRBuilder<> IRB(extracted.getEntryBlock().getTerminator());
 
   // if (instrument) {
   //   Type *Int8PtrTy = IRB.getInt8PtrTy();
@@ -1197,11 +1284,12 @@ Function *CilkABI::createDetach(DetachInst &detach,
   //replace with branch to succesor
   //entry / cilk.spawn.savestate
   Value *SF = GetOrInitCilkStackFrame(F, DetachCtxToStackFrame,
-                                      /*isFast=*/false, false);
+                                      /*isFast=*/false, false, &DT);
   assert(SF && "null stack frame unexpected");
 
   CallInst *cal = nullptr;
-  Function *extracted = extractDetachBodyToFunction(detach, DT, AC, &cal);
+  Function *extracted = extractDetachBodyToFunction(detach, DT, AC, &cal,
+                                                    /*PackInputs=*/true);
   assert(extracted && "could not extract detach body to function");
 
   // Unlink the detached CFG in the original function.  The heavy lifting of
@@ -1271,7 +1359,125 @@ static inline void inlineCilkFunctions(Function &F) {
   }
 }
 
-void CilkABI::preProcessFunction(Function &F) {}
+/// \brief Returns true if control enters a new strand along the edges out of
+/// Pred, that is, if Pred ends with a detach or a sync.
+static bool endsStrand(const BasicBlock *Pred) {
+  const TerminatorInst *T = Pred->getTerminator();
+  return isa<DetachInst>(T) || isa<SyncInst>(T);
+}
+
+/// \brief Returns true if no path from the end of From to the start of To
+/// crosses a strand boundary.  From must dominate To.
+static bool isSameStrand(const BasicBlock *From, const BasicBlock *To) {
+  SmallVector<const BasicBlock *, 8> WorkList;
+  SmallPtrSet<const BasicBlock *, 8> Visited;
+  WorkList.push_back(To);
+  while (!WorkList.empty()) {
+    const BasicBlock *BB = WorkList.pop_back_val();
+    if (!Visited.insert(BB).second)
+      continue;
+    for (const BasicBlock *Pred : predecessors(BB)) {
+      if (endsStrand(Pred))
+        return false;
+      if (Pred != From)
+        WorkList.push_back(Pred);
+    }
+  }
+  return true;
+}
+
+/// \brief Lower the reducer view lookups in F to calls into the Cilk runtime.
+///
+/// The view of a reducer can only change at the start of a strand, after a
+/// detach or a sync.  Hence each strand looks up the view of a reducer once, at
+/// the highest block in the strand that dominates the lookups, and all lookups
+/// of that reducer dominated by the first one reuse its result.
+static bool lowerHyperLookups(Function &F) {
+  SmallVector<IntrinsicInst *, 8> Lookups;
+  for (BasicBlock *BB : ReversePostOrderTraversal<Function *>(&F))
+    for (Instruction &I : *BB)
+      if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(&I))
+        if (Intrinsic::hyper_lookup == II->getIntrinsicID())
+          Lookups.push_back(II);
+  if (Lookups.empty())
+    return false;
+
+  DominatorTree DT(F);
+  Function *LookupFn = CILKRTS_FUNC(hyper_lookup, *F.getParent());
+  DenseMap<std::pair<BasicBlock *, Value *>, CallInst *> Views;
+  for (IntrinsicInst *II : Lookups) {
+    Value *Reducer = II->getArgOperand(0);
+
+    // Find the highest block in the strand of this lookup where the reducer is
+    // available.
+    BasicBlock *Home = II->getParent();
+    for (DomTreeNode *N = DT[Home]->getIDom(); N; N = N->getIDom()) {
+      BasicBlock *Dom = N->getBlock();
+      if (Instruction *RI = dyn_cast<Instruction>(Reducer))
+        if (!DT.dominates(RI, Dom->getTerminator()))
+          break;
+      if (!isSameStrand(Dom, II->getParent()))
+        break;
+      Home = Dom;
+    }
+
+    CallInst *&View = Views[std::make_pair(Home, Reducer)];
+    if (View && DT.dominates(View, II)) {
+      DEBUG(dbgs() << "CilkABI: reusing view " << *View << "\n");
+      II->replaceAllUsesWith(View);
+      II->eraseFromParent();
+      ++ReducerViewsReused;
+      continue;
+    }
+
+    Instruction *InsertPt = II;
+    if (Home != II->getParent())
+      InsertPt = Home->getTerminator();
+    IRBuilder<> B(InsertPt);
+    CallInst *Call = B.CreateCall(LookupFn, Reducer);
+    Call->setDebugLoc(II->getDebugLoc());
+    Call->takeName(II);
+    II->replaceAllUsesWith(Call);
+    II->eraseFromParent();
+    if (!View)
+      View = Call;
+  }
+
+  // Lower any lookups left in unreachable blocks.
+  for (BasicBlock &BB : F)
+    for (auto I = BB.begin(), E = BB.end(); I != E;) {
+      IntrinsicInst *II = dyn_cast<IntrinsicInst>(&*I++);
+      if (!II || Intrinsic::hyper_lookup != II->getIntrinsicID())
+        continue;
+      CallInst *Call = IRBuilder<>(II).CreateCall(LookupFn,
+                                                  II->getArgOperand(0));
+      Call->takeName(II);
+      II->replaceAllUsesWith(Call);
+      II->eraseFromParent();
+    }
+
+  return true;
+}
+
+/// \brief Returns true if F looks up the view of some reducer.
+static bool usesHyperLookup(const Function &F) {
+  for (const BasicBlock &BB : F)
+    for (const Instruction &I : BB)
+      if (const IntrinsicInst *II = dyn_cast<IntrinsicInst>(&I))
+        if (Intrinsic::hyper_lookup == II->getIntrinsicID())
+          return true;
+  return false;
+}
+
+bool CilkABI::shouldProcessFunction(const Function &F) {
+  // Functions that use reducers must be processed to lower their view lookups,
+  // even if they do not spawn.
+  return TapirTarget::shouldProcessFunction(F) || usesHyperLookup(F);
+}
+
+void CilkABI::preProcessFunction(Function &F) {
+  lowerHyperLookups(F);
+}
 
 void CilkABI::postProcessFunction(Function &F) {
   if (!DebugABICalls)
@@ -1293,6 +1499,22 @@ bool CilkABI::processMain(Function &F) {
   return false;
 }
 
+/// \brief A spawn in the Cilk ABI costs roughly a setjmp plus pushing and
+/// popping the helper's stack frame on the worker's deque.
+unsigned CilkABI::getSpawnCost() const {
+  return 40;
+}
+
+/// \brief With a single worker, no spawned child is ever stolen.
+Value *CilkABI::createSerialDispatchCheck(Instruction *InsertBefore) {
+  Module &M = *InsertBefore->getModule();
+  IRBuilder<> B(InsertBefore);
+  Value *NWorkers = B.CreateCall(CILKRTS_FUNC(get_nworkers, M), {},
+                                 "nworkers");
+  return B.CreateICmpSLE(NWorkers, ConstantInt::get(NWorkers->getType(), 1),
+                         "single.worker");
+}
+
 /// \brief Replace the latch of the loop to check that IV is always less than or
 /// equal to the limit.
 ///
@@ -0,0 +1,238 @@
+//===- CilkRABI.cpp - Lower Tapir into CilkR runtime system calls ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the CilkRABI interface, which is used to convert Tapir
+// instructions -- detach, reattach, and sync -- to calls into the CilkR
+// runtime system.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir/CilkRABI.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ValueSymbolTable.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "cilkrabi"
+
+/// Get the type of the frame that a spawning function keeps for each of its
+/// sync regions.
+static StructType *getFrameType(Module &M) {
+  if (StructType *FrameTy = M.getTypeByName("struct.__cilkr_frame"))
+    return FrameTy;
+  LLVMContext &C = M.getContext();
+  return StructType::create(C, {Type::getInt64Ty(C), Type::getInt8PtrTy(C)},
+                            "struct.__cilkr_frame");
+}
+
+/// Get the type of the task functions that CilkR runs, void (i8*).
+static FunctionType *getTaskFnType(LLVMContext &C) {
+  return FunctionType::get(Type::getVoidTy(C), {Type::getInt8PtrTy(C)},
+                           false);
+}
+
+static Function *getSpawnFn(Module &M) {
+  LLVMContext &C = M.getContext();
+  Type *Params[] = { PointerType::getUnqual(getFrameType(M)),
+                     PointerType::getUnqual(getTaskFnType(C)),
+                     Type::getInt8PtrTy(C), Type::getInt64Ty(C) };
+  Function *F = cast<Function>(M.getOrInsertFunction(
+      "__cilkr_spawn", FunctionType::get(Type::getVoidTy(C), Params, false)));
+  F->setDoesNotThrow();
+  return F;
+}
+
+static Function *getSyncFn(Module &M) {
+  LLVMContext &C = M.getContext();
+  Function *F = cast<Function>(M.getOrInsertFunction(
+      "__cilkr_sync",
+      FunctionType::get(Type::getVoidTy(C),
+                        {PointerType::getUnqual(getFrameType(M))}, false)));
+  F->setDoesNotThrow();
+  return F;
+}
+
+static Function *getGetNWorkersFn(Module &M) {
+  LLVMContext &C = M.getContext();
+  Function *F = cast<Function>(M.getOrInsertFunction(
+      "__cilkr_get_nworkers", FunctionType::get(Type::getInt32Ty(C), false)));
+  F->setDoesNotThrow();
+  return F;
+}
+
+/// Get the frame for the given sync region, creating and initializing it if
+/// necessary.
+static Value *getOrCreateFrame(ValueToValueMapTy &DetachCtxToStackFrame,
+                               Value *SyncRegion) {
+  if (Value *Frame = DetachCtxToStackFrame[SyncRegion])
+    return Frame;
+
+  Instruction *SR = cast<Instruction>(SyncRegion);
+  Function *F = SR->getFunction();
+  Module &M = *F->getParent();
+  LLVMContext &C = M.getContext();
+  StructType *FrameTy = getFrameType(M);
+
+  IRBuilder<> B(&*F->getEntryBlock().getFirstInsertionPt());
+  AllocaInst *Frame = B.CreateAlloca(FrameTy, nullptr, "__cilkr_frame");
+
+  // Initialize the frame where the sync region starts, which dominates every
+  // spawn and sync in the region.
+  B.SetInsertPoint(SR->getNextNode());
+  B.CreateStore(ConstantInt::get(Type::getInt64Ty(C), 0),
+                B.CreateStructGEP(FrameTy, Frame, 0));
+  B.CreateStore(Constant::getNullValue(Type::getInt8PtrTy(C)),
+                B.CreateStructGEP(FrameTy, Frame, 1));
+
+  DetachCtxToStackFrame[SyncRegion] = Frame;
+  return Frame;
+}
+
+CilkRABI::CilkRABI() {}
+
+static const StringRef worker8_name = "cilkr_nworker8";
+
+/// \brief Get/Create the worker count for the spawning function.  The count is
+/// computed once in the entry block and shared by every loop of the function.
+Value *CilkRABI::GetOrCreateWorker8(Function &F) {
+  if (Value *W8 = F.getValueSymbolTable()->lookup(worker8_name))
+    return W8;
+  IRBuilder<> B(F.getEntryBlock().getFirstNonPHIOrDbgOrLifetime());
+  Value *P0 = B.CreateCall(getGetNWorkersFn(*F.getParent()));
+  return B.CreateMul(P0, ConstantInt::get(P0->getType(), 8), worker8_name);
+}
+
+/// \brief Lower a sync to a check of the pending count of the frame, which
+/// calls into the runtime only if some spawned task may be outstanding.
+void CilkRABI::createSync(SyncInst &SI,
+                          ValueToValueMapTy &DetachCtxToStackFrame) {
+  Module &M = *SI.getModule();
+  Value *Frame = getOrCreateFrame(DetachCtxToStackFrame, SI.getSyncRegion());
+  StructType *FrameTy = getFrameType(M);
+
+  IRBuilder<> B(&SI);
+  LoadInst *Pending = B.CreateAlignedLoad(
+      B.CreateStructGEP(FrameTy, Frame, 0), 8, "pending");
+  Pending->setAtomic(AtomicOrdering::Acquire);
+  Value *Outstanding =
+    B.CreateICmpNE(Pending, ConstantInt::get(Pending->getType(), 0));
+  TerminatorInst *SyncTerm = SplitBlockAndInsertIfThen(Outstanding, &SI,
+                                                       false);
+  SyncTerm->getParent()->setName("cilkr.sync");
+  SI.getParent()->setName("cilkr.sync.cont");
+  CallInst::Create(getSyncFn(M), {Frame}, "", SyncTerm)
+    ->setDebugLoc(SI.getDebugLoc());
+
+  ReplaceInstWithInst(&SI, BranchInst::Create(SI.getSuccessor(0)));
+}
+
+/// \brief Lower a detach to a spawn of a task that loads the inputs of the
+/// detached CFG from a copy of an argument struct and calls the helper
+/// function outlined from the CFG.
+Function *CilkRABI::createDetach(DetachInst &Detach,
+                                 ValueToValueMapTy &DetachCtxToStackFrame,
+                                 DominatorTree &DT, AssumptionCache &AC) {
+  BasicBlock *Detacher = Detach.getParent();
+  Function &F = *Detacher->getParent();
+  BasicBlock *Spawned = Detach.getDetached();
+  BasicBlock *Continue = Detach.getContinue();
+  Module &M = *F.getParent();
+  LLVMContext &C = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+
+  Value *Frame = getOrCreateFrame(DetachCtxToStackFrame,
+                                  Detach.getSyncRegion());
+
+  CallInst *Call = nullptr;
+  Function *Helper = extractDetachBodyToFunction(Detach, DT, AC, &Call);
+  assert(Helper && Call && "Failed to outline detached CFG.");
+
+  // Gather the inputs of the helper in a struct, which the runtime copies
+  // into the task.  The struct only lives until the spawn returns, so a
+  // single alloca in the entry block serves every spawn of the detach.
+  SmallVector<Type *, 8> ArgTys;
+  for (Value *Arg : Call->arg_operands())
+    ArgTys.push_back(Arg->getType());
+  StructType *ArgsTy = StructType::create(ArgTys, Helper->getName().str() +
+                                          ".args");
+
+  Function *Task = Function::Create(getTaskFnType(C),
+                                    GlobalValue::InternalLinkage,
+                                    Helper->getName() + ".cilkr", &M);
+  Task->setDoesNotThrow();
+  {
+    Argument *ArgsPtr = &*Task->arg_begin();
+    ArgsPtr->setName("args");
+    BasicBlock *Entry = BasicBlock::Create(C, "entry", Task);
+    IRBuilder<> B(Entry);
+    Value *Args = B.CreateBitCast(ArgsPtr, PointerType::getUnqual(ArgsTy));
+    SmallVector<Value *, 8> HelperArgs;
+    for (unsigned i = 0, e = ArgTys.size(); i != e; ++i)
+      HelperArgs.push_back(B.CreateLoad(B.CreateStructGEP(ArgsTy, Args, i)));
+    CallInst *HelperCall = B.CreateCall(Helper, HelperArgs);
+    HelperCall->setCallingConv(Helper->getCallingConv());
+    B.CreateRetVoid();
+  }
+
+  IRBuilder<> B(&*F.getEntryBlock().getFirstInsertionPt());
+  AllocaInst *Args = B.CreateAlloca(ArgsTy, nullptr, "cilkr.args");
+  B.SetInsertPoint(Call);
+  for (unsigned i = 0, e = ArgTys.size(); i != e; ++i)
+    B.CreateStore(Call->getArgOperand(i), B.CreateStructGEP(ArgsTy, Args, i));
+  Value *SpawnArgs[] = {
+    Frame, Task, B.CreateBitCast(Args, Type::getInt8PtrTy(C)),
+    ConstantInt::get(Type::getInt64Ty(C), DL.getTypeAllocSize(ArgsTy)) };
+  B.CreateCall(getSpawnFn(M), SpawnArgs)->setDebugLoc(Detach.getDebugLoc());
+  Call->eraseFromParent();
+
+  // Replace the detach with a branch to the continuation.
+  ReplaceInstWithInst(&Detach, BranchInst::Create(Continue));
+
+  // Rewrite phis in the detached block.
+  {
+    BasicBlock::iterator BI = Spawned->begin();
+    while (PHINode *P = dyn_cast<PHINode>(BI)) {
+      P->removeIncomingValue(Detacher);
+      ++BI;
+    }
+  }
+
+  return Helper;
+}
+
+void CilkRABI::preProcessFunction(Function &F) {}
+
+void CilkRABI::postProcessFunction(Function &F) {}
+
+void CilkRABI::postProcessHelper(Function &F) {}
+
+/// \brief The runtime starts its workers on the first spawn, so main needs no
+/// setup.
+bool CilkRABI::processMain(Function &F) {
+  return false;
+}
+
+/// \brief A spawn in CilkR copies the arguments into a task descriptor and
+/// pushes it on the worker's deque, without saving any register state.
+unsigned CilkRABI::getSpawnCost() const {
+  return 25;
+}
+
+/// \brief With a single worker, no task is ever stolen.
+Value *CilkRABI::createSerialDispatchCheck(Instruction *InsertBefore) {
+  IRBuilder<> B(InsertBefore);
+  Value *NWorkers = B.CreateCall(getGetNWorkersFn(*InsertBefore->getModule()),
+                                 {}, "nworkers");
+  return B.CreateICmpSLE(NWorkers, ConstantInt::get(NWorkers->getType(), 1),
+                         "single.worker");
+}
@@ -15,13 +15,17 @@
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/LoopIterator.h"
 #include "llvm/Analysis/OptimizationDiagnosticInfo.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/TapirTaskInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Config/config.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
@@ -62,20 +66,84 @@ using namespace llvm;
 STATISTIC(LoopsAnalyzed, "Number of Tapir loops analyzed");
 STATISTIC(LoopsConvertedToDAC,
           "Number of Tapir loops converted to divide-and-conquer iteration spawning");
+STATISTIC(LoopsStripMined,
+          "Number of divide-and-conquer Tapir loops strip-mined into chunks");
+STATISTIC(LoopsBuffered,
+          "Number of Tapir loops with unknown trip counts spawned over buffers");
+STATISTIC(LoopsCollapsed,
+          "Number of nested Tapir loops collapsed into their parent Tapir loops");
 
 static cl::opt<TapirTargetType> ClTapirTarget(
     "ls-tapir-target", cl::desc("Target runtime for Tapir"),
-    cl::init(TapirTargetType::Cilk),
+    cl::init(TapirTargetType::TAPIR_DEFAULT_TARGET),
     cl::values(clEnumValN(TapirTargetType::None,
                           "none", "None"),
                clEnumValN(TapirTargetType::Serial,
                           "serial", "Serial code"),
                clEnumValN(TapirTargetType::Cilk,
                           "cilk", "Cilk Plus"),
+               clEnumValN(TapirTargetType::CilkR,
+                          "cilkr", "CilkR"),
                clEnumValN(TapirTargetType::OpenMP,
                           "openmp", "OpenMP"),
                clEnumValN(TapirTargetType::Qthreads,
-                          "qthreads", "Qthreads")));
+                          "qthreads", "Qthreads"),
+               clEnumValN(TapirTargetType::TBB,
+                          "tbb", "Intel TBB")));
+
+static cl::opt<bool> ClCostGrainsize(
+    "ls-cost-grainsize", cl::init(true), cl::Hidden,
+    cl::desc("Derive the maximum grainsize of a Tapir loop from the estimated "
+             "cost of its body"));
+
+static cl::opt<unsigned> ClLeafCost(
+    "ls-target-leaf-cost", cl::init(10000), cl::Hidden,
+    cl::desc("Target cost, in TTI user-cost units, of the serial leaf of a "
+             "divide-and-conquer Tapir loop"));
+
+static cl::opt<unsigned> ClMaxGrainsize(
+    "ls-max-grainsize", cl::init(2048), cl::Hidden,
+    cl::desc("Upper bound on the grainsize computed for a Tapir loop"));
+
+static cl::opt<unsigned> ClAdaptiveLeafCycles(
+    "ls-adaptive-leaf-cycles", cl::init(20000), cl::Hidden,
+    cl::desc("Target duration, in cycles, of a serial leaf of a Tapir loop "
+             "spawned with the adaptive strategy"));
+
+static cl::opt<bool> ClCollapseNests(
+    "ls-collapse-nests", cl::init(false), cl::Hidden,
+    cl::desc("Collapse perfectly nested Tapir loops into a single iteration "
+             "space when their loop hints do not specify a collapse depth"));
+
+static cl::opt<bool> ClStripMine(
+    "ls-strip-mine", cl::init(true), cl::Hidden,
+    cl::desc("Strip-mine divide-and-conquer Tapir loops into chunks of the "
+             "vector width times the interleave factor, so that the serial "
+             "leaves vectorize without a remainder"));
+
+static cl::opt<unsigned> ClStripMineCount(
+    "ls-strip-mine-count", cl::init(0), cl::Hidden,
+    cl::desc("Number of iterations in each chunk of a strip-mined Tapir loop "
+             "(rounded down to a power of 2), overriding the count derived "
+             "from the target"));
+
+static cl::opt<bool> ClBufferLoops(
+    "ls-buffer-loops", cl::init(false), cl::Hidden,
+    cl::desc("Spawn the iterations of divide-and-conquer Tapir loops with "
+             "unknown trip counts, such as traversals of linked lists, over a "
+             "buffer of the values that each iteration uses.  Each full "
+             "buffer is synced before the walk resumes"));
+
+static cl::opt<bool> ClBufferSequentialLoops(
+    "ls-buffer-sequential-loops", cl::init(false), cl::Hidden,
+    cl::desc("Also spawn Tapir loops with unknown trip counts and no "
+             "divide-and-conquer hint over buffers, rather than in iteration "
+             "order"));
+
+static cl::opt<unsigned> ClBufferSize(
+    "ls-buffer-size", cl::init(512), cl::Hidden,
+    cl::desc("Number of iterations of a Tapir loop with an unknown trip count "
+             "to buffer before spawning them"));
 
 namespace {
 // /// \brief This modifies LoopAccessReport to initialize message with
@@ -115,6 +183,13 @@ static void emitMissedWarning(Function *F, Loop *L,
               << "Tapir loop not transformed: "
               << "failed to use divide-and-conquer loop spawning");
     break;
+  case LoopSpawningHints::ST_ADAPTIVE:
+    ORE->emit(DiagnosticInfoOptimizationFailure(
+                  DEBUG_TYPE, "FailedRequestedSpawning",
+                  L->getStartLoc(), L->getHeader())
+              << "Tapir loop not transformed: "
+              << "failed to use adaptive divide-and-conquer loop spawning");
+    break;
   case LoopSpawningHints::ST_SEQ:
     ORE->emit(DiagnosticInfoOptimizationFailure(
                   DEBUG_TYPE, "SpawningDisabled",
@@ -132,55 +207,38 @@ static void emitMissedWarning(Function *F, Loop *L,
   }
 }
 
-/// DACLoopSpawning implements the transformation to spawn the iterations of a
-/// Tapir loop in a recursive divide-and-conquer fashion.
-class DACLoopSpawning : public LoopOutline {
+/// AdaptiveDACLoopSpawning spawns the iterations of a Tapir loop in a recursive
+/// divide-and-conquer fashion, like DACLoopSpawning, but selects the grainsize
+/// at run time.  Each serial leaf of the recursion measures its own duration
+/// and resizes subsequent leaves to take about ClAdaptiveLeafCycles cycles.
+///
+/// The current grainsize is kept in a private global variable per loop, so
+/// later executions of the loop start from the grainsize calibrated by earlier
+/// ones.  A grainsize of 0, the initial value unless a grainsize hint is given,
+/// splits the loop into single iterations until the first leaf completes.
+/// Concurrent leaves update the grainsize with relaxed atomic operations.
+class AdaptiveDACLoopSpawning : public DACLoopSpawning {
 public:
-  // DACLoopSpawning(Loop *OrigLoop, ScalarEvolution &SE,
-  //                 LoopInfo *LI, DominatorTree *DT,
-  //                 const TargetLibraryInfo *TLI,
-  //                 const TargetTransformInfo *TTI,
-  //                 OptimizationRemarkEmitter *ORE)
-  //     : OrigLoop(OrigLoop), SE(SE), LI(LI), DT(DT),
-  //       TLI(TLI), TTI(TTI), ORE(ORE)
-  // {}
-  TapirTarget* tapirTarget;
-  DACLoopSpawning(Loop *OrigLoop, unsigned Grainsize,
-                  ScalarEvolution &SE,
-                  LoopInfo *LI, DominatorTree *DT,
-                  AssumptionCache *AC,
-                  OptimizationRemarkEmitter &ORE, TapirTarget* tapirTarget)
-      : LoopOutline(OrigLoop, SE, LI, DT, AC, ORE),
-        tapirTarget(tapirTarget),
-        SpecifiedGrainsize(Grainsize)
+  AdaptiveDACLoopSpawning(Loop *OrigLoop, unsigned InitialGrainsize,
+                          ScalarEvolution &SE,
+                          LoopInfo *LI, DominatorTree *DT,
+                          AssumptionCache *AC,
+                          OptimizationRemarkEmitter &ORE,
+                          TapirTarget* tapirTarget)
+      : DACLoopSpawning(OrigLoop, 0, SE, LI, DT, AC, ORE, tapirTarget),
+        InitialGrainsize(InitialGrainsize)
   {}
 
-  bool processLoop();
-
-  virtual ~DACLoopSpawning() {}
+  virtual ~AdaptiveDACLoopSpawning() {}
 
 protected:
-  Value* computeGrainsize(Value *Limit);
-  void implementDACIterSpawnOnHelper(Function *Helper,
-                                     BasicBlock *Preheader,
-                                     BasicBlock *Header,
-                                     PHINode *CanonicalIV,
-                                     Argument *Limit,
-                                     Argument *Grainsize,
-                                     Instruction *SyncRegion,
-                                     DominatorTree *DT,
-                                     LoopInfo *LI,
-                                     bool CanonicalIVFlagNUW = false,
-                                     bool CanonicalIVFlagNSW = false);
-  unsigned SpecifiedGrainsize;
-// private:
-//   /// Report an analysis message to assist the user in diagnosing loops that are
-//   /// not transformed.  These are handled as LoopAccessReport rather than
-//   /// VectorizationReport because the << operator of LoopSpawningReport returns
-//   /// LoopAccessReport.
-//   void emitAnalysis(const LoopAccessReport &Message) const {
-//     emitAnalysisDiag(OrigLoop, *ORE, Message);
-//   }
+  Value* computeGrainsize(Value *Limit) override;
+  Value *getRecurGrainsize(IRBuilder<> &Builder, Argument *Grainsize) override;
+  void instrumentLeaf(BasicBlock *LeafEntry, Instruction *LeafExit,
+                      Value *LeafStart, Argument *Limit,
+                      Argument *Grainsize) override;
+
+  unsigned InitialGrainsize;
 };
 
 struct LoopSpawningImpl {
@@ -206,13 +264,21 @@ struct LoopSpawningImpl {
                    DominatorTree &DT,
                    AssumptionCache &AC,
                    OptimizationRemarkEmitter &ORE,
-                   TapirTarget* tapirTarget)
-      : F(F), LI(LI), SE(SE), DT(DT), AC(AC), ORE(ORE), tapirTarget(tapirTarget) {}
+                   TapirTarget* tapirTarget,
+                   const TargetTransformInfo *TTI = nullptr,
+                   BlockFrequencyInfo *BFI = nullptr)
+      : F(F), LI(LI), SE(SE), DT(DT), AC(AC), ORE(ORE),
+        tapirTarget(tapirTarget), TTI(TTI), BFI(BFI) {}
 
   bool run();
 
 private:
   void addTapirLoop(Loop *L, SmallVectorImpl<Loop *> &V);
+  unsigned estimateIterationCost(const Loop *L) const;
+  unsigned estimateMaxGrainsize(const Loop *L) const;
+  unsigned getStripMineCount(const Loop *L) const;
+  bool collapseNestedTapirLoop(Loop *L);
+  Loop *bufferTapirLoop(Loop *L);
   bool processLoop(Loop *L);
 
   Function &F;
@@ -229,6 +295,18 @@ private:
   OptimizationRemarkEmitter &ORE;
 
   TapirTarget* tapirTarget;
+
+  const TargetTransformInfo *TTI;
+  BlockFrequencyInfo *BFI;
+
+  /// Maximum grainsizes estimated for the Tapir loops in this function.  These
+  /// estimates are computed before any loop is transformed, while the analyses
+  /// still describe the original CFG.
+  DenseMap<const Loop *, unsigned> MaxGrainsizes;
+
+  /// Divisions by which each collapsed Tapir loop recovers the indices of the
+  /// loops in its nest.
+  DenseMap<const Loop *, SmallVector<Instruction *, 4>> CollapsedIndices;
 };
 } // end anonymous namespace
 
@@ -281,7 +359,10 @@ Value* LoopOutline::canonicalizeLoopLatch(PHINode *IV, Value *Limit) {
   assert(LatchBr && LatchBr->isConditional() &&
          "Latch does not terminate with a conditional branch.");
   Builder.SetInsertPoint(Latch->getTerminator());
-  Builder.CreateCondBr(NewCondition, Header, ExitBlock);
+  BranchInst *NewLatchBr = Builder.CreateCondBr(NewCondition, Header, ExitBlock);
+  // Keep the loop ID, which carries the hints for this loop.
+  NewLatchBr->setMetadata(LLVMContext::MD_loop,
+                          LatchBr->getMetadata(LLVMContext::MD_loop));
 
   // Erase the old conditional branch.
   Value *OldCond = LatchBr->getCondition();
@@ -313,14 +394,14 @@ void LoopOutline::unlinkLoop() {
   Preheader->getTerminator()->replaceUsesOfWith(L->getHeader(),
                                                 ExitBlock);
 
-  // Rewrite phis in the exit block to get their inputs from
-  // the preheader instead of the exiting block.
+  // Rewrite phis in the exit block to get their inputs from the preheader as
+  // well as the exiting block, which is now unreachable but remains a
+  // predecessor of the exit block.
   BasicBlock::iterator BI = ExitBlock->begin();
   while (PHINode *P = dyn_cast<PHINode>(BI)) {
     int j = P->getBasicBlockIndex(Latch);
     assert(j >= 0 && "Can't find exiting block in exit block's phi node!");
-    P->setIncomingBlock(j, Preheader);
-    P->removeIncomingValue(Latch);
+    P->addIncoming(P->getIncomingValue(j), Preheader);
     ++BI;
   }
 
@@ -337,12 +418,11 @@ void LoopOutline::unlinkLoop() {
 ///
 /// The grainsize is computed by the following equation:
 ///
-///     Grainsize = min(2048, ceil(Limit / (8 * workers)))
+///     Grainsize = min(MaxGrainsize, ceil(Limit / (8 * workers)))
 ///
-/// This computation is inserted into the preheader of the loop.
-///
-/// TODO: This method is the only method that depends on the CilkABI.
-/// Generalize this method for other grainsize calculations and to query TLI.
+/// where MaxGrainsize is derived from the estimated cost of a loop iteration
+/// (2048 if no estimate is available).  This computation is inserted into the
+/// preheader of the loop.
 Value* DACLoopSpawning::computeGrainsize(Value *Limit) {
   Loop *L = OrigLoop;
 
@@ -361,13 +441,90 @@ Value* DACLoopSpawning::computeGrainsize(Value *Limit) {
                                          ConstantInt::get(Limit->getType(), 1)),
                        Workers8);
   // Compute min
-  Value *LargeLoopVal = ConstantInt::get(Limit->getType(), 2048);
+  Value *LargeLoopVal = ConstantInt::get(Limit->getType(), MaxGrainsize);
   Value *Cmp = Builder.CreateICmpULT(LargeLoopVal, SmallLoopVal);
   Grainsize = Builder.CreateSelect(Cmp, LargeLoopVal, SmallLoopVal);
 
   return Grainsize;
 }
 
+/// \brief Create the variable that holds the grainsize of the loop.
+///
+/// The returned global is passed to the helper in place of a grainsize value.
+Value* AdaptiveDACLoopSpawning::computeGrainsize(Value *Limit) {
+  Function *F = OrigLoop->getHeader()->getParent();
+  Module *M = F->getParent();
+  Type *Ty = Limit->getType();
+
+  GlobalVariable *GrainsizeVar =
+    new GlobalVariable(*M, Ty, /*isConstant=*/false,
+                       GlobalValue::PrivateLinkage,
+                       ConstantInt::get(Ty, InitialGrainsize),
+                       F->getName() + ".ls.grainsize");
+  GrainsizeVar->setAlignment(M->getDataLayout().getABITypeAlignment(Ty));
+  return GrainsizeVar;
+}
+
+/// \brief Read the current grainsize of the loop.
+Value *AdaptiveDACLoopSpawning::getRecurGrainsize(IRBuilder<> &Builder,
+                                                  Argument *Grainsize) {
+  const DataLayout &DL = Grainsize->getParent()->getParent()->getDataLayout();
+  Type *Ty = Grainsize->getType()->getPointerElementType();
+  LoadInst *Load = Builder.CreateAlignedLoad(Grainsize,
+                                             DL.getABITypeAlignment(Ty),
+                                             "grainsize");
+  Load->setAtomic(AtomicOrdering::Monotonic);
+  return Load;
+}
+
+/// Insert a read of the cycle counter.
+static Value *getCycleCount(IRBuilder<> &Builder, Module *M) {
+  Function *ReadCycleCounter =
+    Intrinsic::getDeclaration(M, Intrinsic::readcyclecounter);
+  return Builder.CreateCall(ReadCycleCounter);
+}
+
+/// \brief Time a serial leaf of the recursion and update the grainsize.
+///
+/// The new grainsize is the number of iterations that would execute in
+/// ClAdaptiveLeafCycles cycles, at the rate measured for this leaf:
+///
+///     Grainsize = (Limit - LeafStart + 1) * ClAdaptiveLeafCycles / Elapsed
+void AdaptiveDACLoopSpawning::instrumentLeaf(BasicBlock *LeafEntry,
+                                             Instruction *LeafExit,
+                                             Value *LeafStart,
+                                             Argument *Limit,
+                                             Argument *Grainsize) {
+  Module *M = LeafEntry->getModule();
+  const DataLayout &DL = M->getDataLayout();
+  Type *Int64Ty = Type::getInt64Ty(M->getContext());
+  Type *Ty = Limit->getType();
+
+  IRBuilder<> Builder(&*LeafEntry->getFirstInsertionPt());
+  Value *StartCycles = getCycleCount(Builder, M);
+
+  Builder.SetInsertPoint(LeafExit);
+  Value *Elapsed = Builder.CreateSub(getCycleCount(Builder, M), StartCycles,
+                                     "leafcycles");
+  // Guard against a zero or wrapped-around measurement.
+  Value *One = ConstantInt::get(Int64Ty, 1);
+  Elapsed = Builder.CreateSelect(Builder.CreateICmpEQ(Elapsed,
+                                                      ConstantInt::get(Int64Ty,
+                                                                       0)),
+                                 One, Elapsed);
+  Value *Iters = Builder.CreateZExtOrTrunc(
+      Builder.CreateAdd(Builder.CreateSub(Limit, LeafStart),
+                        ConstantInt::get(Ty, 1)),
+      Int64Ty, "leafiters");
+  Value *NewGrainsize = Builder.CreateUDiv(
+      Builder.CreateMul(Iters, ConstantInt::get(Int64Ty, ClAdaptiveLeafCycles)),
+      Elapsed);
+  StoreInst *Store =
+    Builder.CreateAlignedStore(Builder.CreateZExtOrTrunc(NewGrainsize, Ty),
+                               Grainsize, DL.getABITypeAlignment(Ty));
+  Store->setAtomic(AtomicOrdering::Monotonic);
+}
+
 /// \brief Method to help convertLoopToDACIterSpawn convert the Tapir
 /// loop cloned into function Helper to spawn its iterations in a
 /// parallel divide-and-conquer fashion.
@@ -411,6 +568,7 @@ void DACLoopSpawning::implementDACIterSpawnOnHelper(Function *Helper,
                                                     Argument *Limit,
                                                     Argument *Grainsize,
                                                     Instruction *SyncRegion,
+                                                    Instruction *LeafExit,
                                                     DominatorTree *DT,
                                                     LoopInfo *LI,
                                                     bool CanonicalIVFlagNUW,
@@ -435,7 +593,7 @@ void DACLoopSpawning::implementDACIterSpawnOnHelper(Function *Helper,
     // the split block later.
     DACHead = SplitBlock(Preheader, Preheader->getTerminator(), DT, LI);
 
-  BasicBlock *RecurHead, *RecurDet, *RecurCont;
+  BasicBlock *RecurHead, *RecurDet, *RecurCont, *LeafEntry;
   Value *IterCount;
   Value *CanonicalIVInput;
   PHINode *CanonicalIVStart;
@@ -450,13 +608,15 @@ void DACLoopSpawning::implementDACIterSpawnOnHelper(Function *Helper,
     CanonicalIVInput->replaceAllUsesWith(CanonicalIVStart);
     IterCount = Builder.CreateSub(Limit, CanonicalIVStart,
                                   "itercount");
-    Value *IterCountCmp = Builder.CreateICmpUGT(IterCount, Grainsize);
+    Value *IterCountCmp =
+      Builder.CreateICmpUGT(IterCount, getRecurGrainsize(Builder, Grainsize));
     TerminatorInst *RecurTerm =
       SplitBlockAndInsertIfThen(IterCountCmp, PreheaderOrigFront,
                                 /*Unreachable=*/false,
                                 /*BranchWeights=*/nullptr,
                                 DT);
     RecurHead = RecurTerm->getParent();
+    LeafEntry = PreheaderOrigFront->getParent();
     // Create skeleton of divide-and-conquer recursion:
     // DACHead -> RecurHead -> RecurDet -> RecurCont -> DACHead
     RecurDet = SplitBlock(RecurHead, RecurHead->getTerminator(),
@@ -471,14 +631,22 @@ void DACLoopSpawning::implementDACIterSpawnOnHelper(Function *Helper,
   Value *MidIter, *MidIterPlusOne;
   {
     IRBuilder<> Builder(&(RecurHead->front()));
-    MidIter = Builder.CreateAdd(CanonicalIVStart,
-                                Builder.CreateLShr(IterCount, 1,
-                                                   "halfcount"),
-                                "miditer",
+    Value *HalfCount = Builder.CreateLShr(IterCount, 1, "halfcount");
+    // Split a strip-mined loop between chunks, so that every leaf runs whole
+    // chunks.
+    if (StripMineCount > 1)
+      HalfCount = Builder.CreateAdd(
+          Builder.CreateAnd(HalfCount,
+                            ConstantInt::get(IterCount->getType(),
+                                             ~uint64_t(StripMineCount - 1))),
+          ConstantInt::get(IterCount->getType(), StripMineCount - 1),
+          "halfcount.chunks");
+    MidIter = Builder.CreateAdd(CanonicalIVStart, HalfCount, "miditer",
                                 CanonicalIVFlagNUW, CanonicalIVFlagNSW);
   }
 
   // Create recursive call in RecurDet.
+  CallInst *RecurCall;
   {
     // Create input array for recursive call.
     IRBuilder<> Builder(&(RecurDet->front()));
@@ -508,7 +676,7 @@ void DACLoopSpawning::implementDACIterSpawnOnHelper(Function *Helper,
       });
 
     // Create call instruction.
-    CallInst *RecurCall = Builder.CreateCall(Helper, RecurInputs.getArrayRef());
+    RecurCall = Builder.CreateCall(Helper, RecurInputs.getArrayRef());
     RecurCall->setDebugLoc(Header->getTerminator()->getDebugLoc());
     // Use a fast calling convention for the helper.
     RecurCall->setCallingConv(CallingConv::Fast);
@@ -547,6 +715,256 @@ void DACLoopSpawning::implementDACIterSpawnOnHelper(Function *Helper,
     RI->setDebugLoc(Header->getTerminator()->getDebugLoc());
     RecurDet->getTerminator()->eraseFromParent();
   }
+
+  // The leaf of a strip-mined loop runs whole chunks.  Recompute its last
+  // iteration so that its trip count is evidently a multiple of the chunk
+  // size, and the vectorizer's remainder loop folds away.
+  if (StripMineCount > 1) {
+    IRBuilder<> Builder(&*LeafEntry->getFirstInsertionPt());
+    Value *LeafEnd = Builder.CreateAdd(
+        CanonicalIVStart,
+        Builder.CreateOr(IterCount, ConstantInt::get(IterCount->getType(),
+                                                     StripMineCount - 1)),
+        "leafend");
+    for (User *U : CanonicalIV->users())
+      if (ICmpInst *Cmp = dyn_cast<ICmpInst>(U))
+        if (Cmp->getOperand(1) == Limit)
+          Cmp->setOperand(1, LeafEnd);
+  }
+
+  if (!Reductions.empty())
+    LeafExit = combineReductionsOnHelper(Helper, RecurCall, RecurCont,
+                                         CanonicalIVStart, MidIterPlusOne,
+                                         Limit, LeafExit);
+
+  instrumentLeaf(LeafEntry, LeafExit, CanonicalIVStart, Limit, Grainsize);
+}
+
+/// Get the identity of the reduction described by RD on values of type Ty.
+static Constant *getReductionIdentity(RecurrenceDescriptor &RD, Type *Ty) {
+  switch (RD.getRecurrenceKind()) {
+  case RecurrenceDescriptor::RK_IntegerMinMax: {
+    unsigned BitWidth = Ty->getIntegerBitWidth();
+    switch (RD.getMinMaxRecurrenceKind()) {
+    case RecurrenceDescriptor::MRK_UIntMin:
+      return ConstantInt::get(Ty, APInt::getMaxValue(BitWidth));
+    case RecurrenceDescriptor::MRK_UIntMax:
+      return ConstantInt::get(Ty, APInt::getMinValue(BitWidth));
+    case RecurrenceDescriptor::MRK_SIntMin:
+      return ConstantInt::get(Ty, APInt::getSignedMaxValue(BitWidth));
+    case RecurrenceDescriptor::MRK_SIntMax:
+      return ConstantInt::get(Ty, APInt::getSignedMinValue(BitWidth));
+    default:
+      llvm_unreachable("Unknown integer min/max recurrence kind");
+    }
+  }
+  case RecurrenceDescriptor::RK_FloatMinMax:
+    // Float min/max reductions are only recognized without NaNs, so the
+    // infinities serve as identities.
+    return ConstantFP::getInfinity(
+        Ty, RD.getMinMaxRecurrenceKind() == RecurrenceDescriptor::MRK_FloatMax);
+  default:
+    return RecurrenceDescriptor::getRecurrenceIdentity(RD.getRecurrenceKind(),
+                                                       Ty);
+  }
+}
+
+/// Combine two partial results, Left and Right, of the reduction described by
+/// RD.
+static Value *createReductionOp(IRBuilder<> &Builder, RecurrenceDescriptor &RD,
+                                Value *Left, Value *Right) {
+  RecurrenceDescriptor::RecurrenceKind Kind = RD.getRecurrenceKind();
+  if (RecurrenceDescriptor::RK_IntegerMinMax == Kind ||
+      RecurrenceDescriptor::RK_FloatMinMax == Kind)
+    return RecurrenceDescriptor::createMinMaxOp(
+        Builder, RD.getMinMaxRecurrenceKind(), Left, Right);
+
+  Value *Op = Builder.CreateBinOp(
+      (Instruction::BinaryOps)RecurrenceDescriptor::getRecurrenceBinOp(Kind),
+      Left, Right, "red");
+  // Combining the partial results of a floating-point reduction reassociates
+  // it, which the reduction has been checked to allow.
+  if (isa<FPMathOperator>(Op)) {
+    FastMathFlags FMF;
+    FMF.setUnsafeAlgebra();
+    cast<Instruction>(Op)->setFastMathFlags(FMF);
+  }
+  return Op;
+}
+
+/// Find the reductions carried by the Tapir loop.  A reduction is supported if
+/// it is updated only in the serial part of each iteration, i.e., in the header
+/// before the detach or in the latch, and if the reduction operation may be
+/// reassociated.  Returns false if the loop carries a reduction that is not
+/// supported.
+bool DACLoopSpawning::collectReductions() {
+  Loop *L = OrigLoop;
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+
+  using namespace ore;
+
+  for (BasicBlock::iterator II = Header->begin(); isa<PHINode>(II); ++II) {
+    PHINode *PN = cast<PHINode>(II);
+    // Induction variables are handled separately.
+    if (SE.isSCEVable(PN->getType()) && isa<SCEVAddRecExpr>(SE.getSCEV(PN)))
+      continue;
+
+    RecurrenceDescriptor RD;
+    if (!RecurrenceDescriptor::isReductionPHI(PN, L, RD))
+      continue;
+
+    if (RD.hasUnsafeAlgebra() || RD.getRecurrenceType() != PN->getType()) {
+      DEBUG(dbgs() << "LS reduction cannot be reassociated: " << *PN << "\n");
+      ORE.emit(OptimizationRemarkAnalysis(LS_NAME, "UnsafeReduction", PN)
+               << "cannot reassociate the reduction "
+               << NV("PHINode", PN));
+      return false;
+    }
+
+    // Check that the reduction is not updated within the detached body of the
+    // loop.
+    SmallVector<Instruction *, 8> Worklist;
+    SmallPtrSet<Instruction *, 8> Visited;
+    Worklist.push_back(PN);
+    while (!Worklist.empty()) {
+      Instruction *I = Worklist.pop_back_val();
+      if (!Visited.insert(I).second)
+        continue;
+      if (!L->contains(I))
+        continue;
+      if (I->getParent() != Header && I->getParent() != Latch) {
+        DEBUG(dbgs() << "LS reduction updated in detached body: " << *I
+                     << "\n");
+        ORE.emit(OptimizationRemarkAnalysis(LS_NAME, "DetachedReduction", PN)
+                 << "reduction " << NV("PHINode", PN)
+                 << " is updated within the detached loop body");
+        return false;
+      }
+      for (User *U : I->users())
+        Worklist.push_back(cast<Instruction>(U));
+    }
+
+    DEBUG(dbgs() << "LS found reduction " << *PN << "\n");
+    ORE.emit(OptimizationRemarkAnalysis(LS_NAME, "Reduction", PN)
+             << "found reduction " << NV("PHINode", PN));
+    Reductions.push_back({PN, RD, PN->getIncomingValueForBlock(Preheader),
+                          nullptr, nullptr});
+  }
+  return true;
+}
+
+/// Rewrite the divide-and-conquer recursion in the helper to combine the
+/// partial results of the loop's reductions.
+///
+/// Each spawned recursive call needs its own storage for its partial results.
+/// Hence, rather than spawning repeatedly in a loop, the helper spawns the
+/// first half of its iterations and calls itself on the second half, after
+/// which it combines both results:
+///
+/// void Helper(iter_t start, iter_t end, iter_t grain, ..., T *out) {
+///   T left = identity, right;
+///   if (end - start > grain) {
+///     iter_t miditer = start + (end - start) / 2;
+///     spawn Helper(start, miditer, grain, ..., &left);
+///     Helper(miditer + 1, end, grain, ..., &right);
+///     partial = right;
+///   } else {
+///     T acc = identity;
+///     ... Loop Body, accumulating into acc ...
+///     partial = acc;
+///   }
+///   sync;
+///   *out = left OP partial;
+/// }
+///
+/// Returns the new end of the serial leaf.
+Instruction *DACLoopSpawning::combineReductionsOnHelper(
+    Function *Helper, CallInst *RecurCall, BasicBlock *RecurCont,
+    PHINode *CanonicalIVStart, Value *NextStart, Argument *Limit,
+    Instruction *LeafExit) {
+  LLVMContext &C = Helper->getContext();
+  BasicBlock *SyncBlock = LeafExit->getParent();
+  BasicBlock *LeafLatch = SyncBlock->getSinglePredecessor();
+  assert(LeafLatch && "Sync block of helper has multiple predecessors.");
+  assert(isa<SyncInst>(SyncBlock->getTerminator()) &&
+         "Sync block of helper is not terminated by a sync.");
+  BasicBlock *HelperReturn = SyncBlock->getTerminator()->getSuccessor(0);
+
+  // Give the serial leaf its own exit block, since the sync block will also
+  // be reached from the recursive case.
+  BasicBlock *LeafEnd = BasicBlock::Create(C, "leaf.end", Helper, SyncBlock);
+  BranchInst *LeafEndBr = BranchInst::Create(SyncBlock, LeafEnd);
+  LeafLatch->getTerminator()->replaceUsesOfWith(SyncBlock, LeafEnd);
+
+  // Create private storage for the partial results of the two halves of the
+  // recursion.  The left result is initialized to the identity, so that it
+  // may be combined unconditionally.
+  SmallVector<AllocaInst *, 2> LeftSlots, RightSlots;
+  {
+    BasicBlock &Entry = Helper->getEntryBlock();
+    IRBuilder<> Builder(&*Entry.getFirstInsertionPt());
+    for (LoopReduction &R : Reductions) {
+      Type *Ty = R.Phi->getType();
+      LeftSlots.push_back(Builder.CreateAlloca(Ty, nullptr,
+                                               R.Phi->getName() + ".left"));
+      RightSlots.push_back(Builder.CreateAlloca(Ty, nullptr,
+                                                R.Phi->getName() + ".right"));
+    }
+    Builder.SetInsertPoint(Entry.getTerminator());
+    for (unsigned i = 0, e = Reductions.size(); i != e; ++i)
+      Builder.CreateStore(getReductionIdentity(Reductions[i].Desc,
+                                               Reductions[i].Phi->getType()),
+                          LeftSlots[i]);
+  }
+
+  // The spawned recursive call returns its result in the left slot.
+  for (unsigned i = 0, e = Reductions.size(); i != e; ++i)
+    RecurCall->setArgOperand(Reductions[i].Out->getArgNo(), LeftSlots[i]);
+
+  // Replace the backedge of the recursion with a call on the second half of
+  // the iterations.
+  SmallVector<Value *, 4> RightVals;
+  {
+    unsigned StartIdx =
+      Helper->hasParamAttribute(0, Attribute::StructRet) ? 1 : 0;
+    SmallVector<Value *, 8> RightArgs(RecurCall->arg_begin(),
+                                      RecurCall->arg_end());
+    RightArgs[StartIdx] = NextStart;
+    RightArgs[StartIdx + 1] = Limit;
+    for (unsigned i = 0, e = Reductions.size(); i != e; ++i)
+      RightArgs[Reductions[i].Out->getArgNo()] = RightSlots[i];
+
+    CanonicalIVStart->removeIncomingValue(RecurCont);
+    RecurCont->getTerminator()->eraseFromParent();
+    IRBuilder<> Builder(RecurCont);
+    CallInst *RightCall = Builder.CreateCall(Helper, RightArgs);
+    RightCall->setDebugLoc(RecurCall->getDebugLoc());
+    RightCall->setCallingConv(CallingConv::Fast);
+    for (AllocaInst *Slot : RightSlots)
+      RightVals.push_back(Builder.CreateLoad(Slot));
+    Builder.CreateBr(SyncBlock);
+  }
+
+  // After the sync, combine the result of the spawned call with the result of
+  // either the serial leaf or the second recursive call.
+  {
+    IRBuilder<> Builder(&SyncBlock->front());
+    IRBuilder<> CombineBuilder(&*HelperReturn->getFirstInsertionPt());
+    for (unsigned i = 0, e = Reductions.size(); i != e; ++i) {
+      LoopReduction &R = Reductions[i];
+      PHINode *Partial = Builder.CreatePHI(R.Phi->getType(), 2,
+                                           R.Phi->getName() + ".partial");
+      Partial->addIncoming(R.LeafResult, LeafEnd);
+      Partial->addIncoming(RightVals[i], RecurCont);
+      Value *Left = CombineBuilder.CreateLoad(LeftSlots[i]);
+      CombineBuilder.CreateStore(
+          createReductionOp(CombineBuilder, R.Desc, Left, Partial), R.Out);
+    }
+  }
+
+  return LeafEndBr;
 }
 
 /// Helper routine to get all exit blocks of a loop that are unreachable.
@@ -607,6 +1025,168 @@ static Type *getWiderType(const DataLayout &DL, Type *Ty0, Type *Ty1) {
   return Ty1;
 }
 
+void DACLoopSpawning::serializeLoopOnHelper(BasicBlock *Header,
+                                            Instruction *SyncRegion,
+                                            Instruction *LeafExit,
+                                            DominatorTree *DT) {
+  SerializeDetachedCFG(cast<DetachInst>(Header->getTerminator()), DT);
+
+  // Nothing is left for the sync at the exit of the helper to wait on.
+  ReplaceInstWithInst(LeafExit,
+                      BranchInst::Create(cast<SyncInst>(LeafExit)
+                                         ->getSuccessor(0)));
+  if (SyncRegion->use_empty())
+    SyncRegion->eraseFromParent();
+}
+
+/// Create a loop ID that carries the given llvm.loop hints.
+static MDNode *createLoopID(LLVMContext &C,
+                            ArrayRef<std::pair<StringRef, unsigned>> Hints) {
+  SmallVector<Metadata *, 4> MDs;
+  // Reserve the first operand for the loop ID itself.
+  MDs.push_back(nullptr);
+  for (const auto &H : Hints) {
+    Metadata *Vals[] = {
+      MDString::get(C, H.first),
+      ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(C), H.second))
+    };
+    MDs.push_back(MDNode::get(C, Vals));
+  }
+  MDNode *LoopID = MDNode::getDistinct(C, MDs);
+  LoopID->replaceOperandWith(0, LoopID);
+  return LoopID;
+}
+
+void DACLoopSpawning::serializeRemainder(Value *RemStart,
+                                         Value *HasRemainder) {
+  Loop *L = OrigLoop;
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+
+  // Invalidate the analysis of the old loop.
+  SE.forgetLoop(L);
+
+  // All IV's of the loop are canonical by this point.  Start them at the first
+  // remaining iteration.
+  for (PHINode &PN : Header->phis())
+    PN.setIncomingValue(PN.getBasicBlockIndex(Preheader), RemStart);
+
+  // Skip the loop if no iterations remain.
+  ReplaceInstWithInst(Preheader->getTerminator(),
+                      BranchInst::Create(Header, ExitBlock, HasRemainder));
+  if (DT)
+    DT->changeImmediateDominator(ExitBlock, Preheader);
+
+  SerializeDetachedCFG(cast<DetachInst>(Header->getTerminator()), DT);
+
+  // The remainder runs fewer iterations than a chunk, so do not vectorize it.
+  LLVMContext &C = Header->getContext();
+  Latch->getTerminator()->setMetadata(
+      LLVMContext::MD_loop,
+      createLoopID(C, { std::make_pair("llvm.loop.vectorize.width", 1U),
+                        std::make_pair("llvm.loop.interleave.count", 1U) }));
+}
+
+CallInst *DACLoopSpawning::createTopCall(IRBuilder<> &Builder,
+                                         Function *Helper,
+                                         ArrayRef<Value *> Args,
+                                         unsigned IterArgNo) {
+  CallInst *TopCall = Builder.CreateCall(Helper, Args);
+  // Use a fast calling convention for the helper.
+  TopCall->setCallingConv(CallingConv::Fast);
+  // TopCall->setCallingConv(Helper->getCallingConv());
+  return TopCall;
+}
+
+/// Step the indices that a collapsed loop nest recovers from the canonical IV
+/// of the loop, Indices, instead of dividing at every iteration.  Each udiv
+/// and urem of a value by the same trip count is replaced by a pair of PHI
+/// nodes, which start at the quotient and remainder of the value on entry to
+/// the loop.  The remainder increments with the value and wraps around at the
+/// trip count, which carries into the quotient.
+static void stepCollapsedIndices(BasicBlock *Header, BasicBlock *Latch,
+                                 PHINode *CanonicalIV,
+                                 ArrayRef<Instruction *> Indices) {
+  BasicBlock *Entry = nullptr;
+  for (BasicBlock *Pred : predecessors(Header))
+    if (Pred != Latch) {
+      if (Entry)
+        return;
+      Entry = Pred;
+    }
+  if (!Entry)
+    return;
+
+  SmallPtrSet<Instruction *, 4> Pending(Indices.begin(), Indices.end());
+  // Each counter is a PHI node that increments when its condition holds.
+  SmallVector<std::pair<PHINode *, Value *>, 4> Counters;
+  Counters.push_back(
+      std::make_pair(CanonicalIV, ConstantInt::getTrue(Header->getContext())));
+  while (!Counters.empty()) {
+    PHINode *Counter;
+    Value *Inc;
+    std::tie(Counter, Inc) = Counters.pop_back_val();
+
+    // Pair the divisions of the counter by their divisors.
+    MapVector<Value *, std::pair<Instruction *, Instruction *>> DivRems;
+    for (User *U : Counter->users()) {
+      Instruction *I = dyn_cast<Instruction>(U);
+      if (!I || !Pending.count(I) || I->getOperand(0) != Counter)
+        continue;
+      auto &DivRem = DivRems[I->getOperand(1)];
+      if (I->getOpcode() == Instruction::UDiv)
+        DivRem.first = I;
+      else
+        DivRem.second = I;
+    }
+
+    Type *Ty = Counter->getType();
+    for (auto &CountDivRem : DivRems) {
+      Value *Count = CountDivRem.first;
+      Instruction *Div = CountDivRem.second.first;
+      Instruction *Rem = CountDivRem.second.second;
+
+      // Divide the value of the counter on entry to the loop.
+      IRBuilder<> B(Entry->getTerminator());
+      Value *Start = Counter->getIncomingValueForBlock(Entry);
+      Value *DivStart = B.CreateUDiv(Start, Count, "collapse.idx.start");
+      Value *RemStart = B.CreateURem(Start, Count, "collapse.inner.idx.start");
+      PHINode *DivPN = PHINode::Create(Ty, 2, "collapse.idx",
+                                       Header->getFirstNonPHI());
+      PHINode *RemPN = PHINode::Create(Ty, 2, "collapse.inner.idx",
+                                       Header->getFirstNonPHI());
+
+      // Step the remainder, and carry into the quotient when it wraps around.
+      B.SetInsertPoint(Latch->getTerminator());
+      Value *RemInc = B.CreateAdd(RemPN, B.CreateZExt(Inc, Ty),
+                                  "collapse.inner.idx.inc");
+      Value *Wrap = B.CreateICmpEQ(RemInc, Count, "collapse.wrap");
+      Value *RemNext = B.CreateSelect(Wrap, ConstantInt::get(Ty, 0), RemInc,
+                                      "collapse.inner.idx.next");
+      Value *DivNext = B.CreateAdd(DivPN, B.CreateZExt(Wrap, Ty),
+                                   "collapse.idx.next");
+      DivPN->addIncoming(DivStart, Entry);
+      DivPN->addIncoming(DivNext, Latch);
+      RemPN->addIncoming(RemStart, Entry);
+      RemPN->addIncoming(RemNext, Latch);
+
+      for (auto &OldNew : { std::make_pair(Div, DivPN),
+                            std::make_pair(Rem, RemPN) }) {
+        Instruction *Old = OldNew.first;
+        if (!Old)
+          continue;
+        OldNew.second->takeName(Old);
+        Old->replaceAllUsesWith(OldNew.second);
+        Pending.erase(Old);
+        Old->eraseFromParent();
+      }
+      // Indices of loops further out in the nest divide the quotient.
+      Counters.push_back(std::make_pair(DivPN, Wrap));
+    }
+  }
+}
+
 /// Top-level call to convert loop to spawn its iterations in a
 /// divide-and-conquer fashion.
 bool DACLoopSpawning::processLoop() {
@@ -700,6 +1280,22 @@ bool DACLoopSpawning::processLoop() {
   // ORE.emit(OptimizationRemarkAnalysis(LS_NAME, "LoopLimit", L->getStartLoc(),
   //                                     Header)
   //          << "loop limit: " << NV("Limit", Limit));
+
+  /// Find the reductions carried by the loop.
+  if (!collectReductions()) {
+    DEBUG(dbgs() << "LS loop carries an unsupported reduction.\n");
+    return false;
+  }
+  if (!Reductions.empty() && !supportsReductions()) {
+    DEBUG(dbgs() << "LS cannot combine the reductions of this loop.\n");
+    ORE.emit(OptimizationRemarkAnalysis(LS_NAME, "UnsupportedReduction",
+                                        L->getStartLoc(), Header)
+             << "reductions are not supported by the loop lowering of this "
+             << "Tapir target");
+    Declined = true;
+    return false;
+  }
+
   /// Determine the type of the canonical IV.
   Type *CanonicalIVTy = Limit->getType();
   {
@@ -707,9 +1303,11 @@ bool DACLoopSpawning::processLoop() {
     for (BasicBlock::iterator II = Header->begin(); isa<PHINode>(II); ++II) {
       PHINode *PN = cast<PHINode>(II);
       if (PN->getType()->isFloatingPointTy()) continue;
+      if (isReduction(PN)) continue;
       CanonicalIVTy = getWiderType(DL, PN->getType(), CanonicalIVTy);
     }
-    Limit = SE.getNoopOrAnyExtend(Limit, CanonicalIVTy);
+    // The limit is an unsigned iteration count.
+    Limit = SE.getNoopOrZeroExtend(Limit, CanonicalIVTy);
   }
   /// Clean up the loop's induction variables.
   PHINode *CanonicalIV = canonicalizeIVs(CanonicalIVTy);
@@ -732,6 +1330,14 @@ bool DACLoopSpawning::processLoop() {
   for (BasicBlock::iterator II = Header->begin(); isa<PHINode>(II); ++II) {
     PHINode *PN = cast<PHINode>(II);
     if (CanonicalIV == PN) continue;
+    if (isReduction(PN)) continue;
+    if (!SE.isSCEVable(PN->getType())) {
+      ORE.emit(OptimizationRemarkAnalysis(LS_NAME, "NoSCEV", PN)
+               << "could not compute scalar evolution of "
+               << NV("PHINode", PN));
+      CanRemoveIVs = false;
+      continue;
+    }
     // dbgs() << "IV " << *PN;
     const SCEV *S = SE.getSCEV(PN);
     // dbgs() << " SCEV " << *S << "\n";
@@ -742,6 +1348,12 @@ bool DACLoopSpawning::processLoop() {
                << "could not compute scalar evolution of "
                << NV("PHINode", PN));
       CanRemoveIVs = false;
+    } else if (!isa<SCEVAddRecExpr>(S) && !SE.isLoopInvariant(S, L)) {
+      // The PHI cannot be recomputed from the canonical IV.
+      ORE.emit(OptimizationRemarkAnalysis(LS_NAME, "LoopCarriedPHI", PN)
+               << "found a loop-carried value that is not an IV or a "
+               << "reduction: " << NV("PHINode", PN));
+      CanRemoveIVs = false;
     }
   }
 
@@ -766,6 +1378,7 @@ bool DACLoopSpawning::processLoop() {
     for (BasicBlock::iterator II = Header->begin(); isa<PHINode>(II); ++II) {
       PHINode *PN = cast<PHINode>(II);
       if (PN == CanonicalIV) continue;
+      if (isReduction(PN)) continue;
       const SCEV *S = SE.getSCEV(PN);
       DEBUG(dbgs() << "Removing the IV " << *PN << " (" << *S << ")\n");
       ORE.emit(OptimizationRemarkAnalysis(LS_NAME, "RemoveIV", PN)
@@ -787,6 +1400,7 @@ bool DACLoopSpawning::processLoop() {
   bool AllCanonical = true;
   for (BasicBlock::iterator II = Header->begin(); isa<PHINode>(II); ++II) {
     PHINode *PN = cast<PHINode>(II);
+    if (isReduction(PN)) continue;
     DEBUG({
         const SCEVAddRecExpr *PNSCEV =
           dyn_cast<const SCEVAddRecExpr>(SE.getSCEV(PN));
@@ -827,6 +1441,13 @@ bool DACLoopSpawning::processLoop() {
   if (!AllCanonical)
     return false;
 
+  // Strip-mine the loop only if the original loop can run the remaining
+  // iterations serially after the recursion.
+  if (!Reductions.empty() || !HandledExits.empty() ||
+      isa<PHINode>(ExitBlock->begin()) ||
+      Log2_32(StripMineCount) + 1 >= CanonicalIVTy->getIntegerBitWidth())
+    StripMineCount = 0;
+
   // Insert the computation for the loop limit into the Preheader.
   Value *LimitVar = Exp.expandCodeFor(Limit, CanonicalIVTy,
                                       Preheader->getTerminator());
@@ -847,6 +1468,21 @@ bool DACLoopSpawning::processLoop() {
   else
     GrainVar = ConstantInt::get(LimitVar->getType(), SpecifiedGrainsize);
 
+  // Round the grainsize of a strip-mined loop up to whole chunks.
+  if (StripMineCount > 1) {
+    Type *Ty = LimitVar->getType();
+    if (ConstantInt *CI = dyn_cast<ConstantInt>(GrainVar)) {
+      GrainVar = ConstantInt::get(Ty, alignTo(CI->getZExtValue(),
+                                              StripMineCount));
+    } else {
+      IRBuilder<> Builder(Preheader->getTerminator());
+      GrainVar = Builder.CreateAnd(
+          Builder.CreateAdd(GrainVar, ConstantInt::get(Ty, StripMineCount - 1)),
+          ConstantInt::get(Ty, ~uint64_t(StripMineCount - 1)),
+          "grainsize.chunks");
+    }
+  }
+
   DEBUG(dbgs() << "GrainVar: " << *GrainVar << "\n");
   // emitAnalysis(LoopSpawningReport()
   //              << "grainsize value " << *GrainVar << "\n");
@@ -854,6 +1490,13 @@ bool DACLoopSpawning::processLoop() {
   //                                     L->getStartLoc(), Header)
   //          << "grainsize: " << NV("Grainsize", GrainVar));
 
+  // Each serial leaf of the recursion starts its reductions at the identity.
+  // The values on entry to the loop are combined with the result of the helper
+  // afterwards.
+  for (LoopReduction &R : Reductions)
+    R.Phi->setIncomingValue(R.Phi->getBasicBlockIndex(Preheader),
+                            getReductionIdentity(R.Desc, R.Phi->getType()));
+
   /// Clone the loop into a new function.
 
   // Get the inputs and outputs for the Loop blocks.
@@ -1012,6 +1655,17 @@ bool DACLoopSpawning::processLoop() {
         for (Value *V : BodyInputs)
           dbgs() << "Remaining body input: " << *V << "\n";
       });
+
+    // Add an argument through which the helper returns the result of each
+    // reduction.  The results of the reductions are the only values the loop
+    // may produce.
+    for (LoopReduction &R : Reductions) {
+      R.Out = new Argument(PointerType::getUnqual(R.Phi->getType()),
+                           R.Phi->getName() + ".out");
+      Inputs.insert(R.Out);
+      BodyOutputs.remove(R.Desc.getLoopExitInstr());
+    }
+
     for (Value *V : BodyOutputs)
       dbgs() << "EL output: " << *V << "\n";
     assert(0 == BodyOutputs.size() &&
@@ -1043,10 +1697,16 @@ bool DACLoopSpawning::processLoop() {
     // Use a fast calling convention for the helper.
     Helper->setCallingConv(CallingConv::Fast);
     // Helper->setCallingConv(Header->getParent()->getCallingConv());
+
+    for (LoopReduction &R : Reductions) {
+      R.LeafResult = VMap[R.Desc.getLoopExitInstr()];
+      R.Out = cast<Argument>(VMap[R.Out]);
+    }
   }
 
   // Add a sync to the helper's return.
   BasicBlock *HelperHeader = cast<BasicBlock>(VMap[Header]);
+  SyncInst *NewSync;
   {
     BasicBlock *HelperExit = cast<BasicBlock>(VMap[ExitBlock]);
     assert(isa<ReturnInst>(HelperExit->getTerminator()));
@@ -1054,7 +1714,7 @@ bool DACLoopSpawning::processLoop() {
                                            HelperExit->getTerminator(),
                                            DT, LI);
     IRBuilder<> Builder(&(HelperExit->front()));
-    SyncInst *NewSync = Builder.CreateSync(
+    NewSync = Builder.CreateSync(
         NewHelperExit,
         cast<Instruction>(VMap[InputSyncRegion]));
     // Set debug info of new sync to match that of terminator of the header of
@@ -1158,10 +1818,46 @@ bool DACLoopSpawning::processLoop() {
                                 cast<Argument>(VMap[InputMap[LimitVar]]),
                                 cast<Argument>(VMap[InputMap[GrainVar]]),
                                 cast<Instruction>(VMap[InputSyncRegion]),
+                                NewSync,
                                 /*DT=*/nullptr, /*LI=*/nullptr,
                                 CanonicalSCEV->getNoWrapFlags(SCEV::FlagNUW),
                                 CanonicalSCEV->getNoWrapFlags(SCEV::FlagNSW));
 
+  // Step the indices of a collapsed loop nest through each serial leaf.  The
+  // vectorizer cannot widen the stepped indices, so the leaves of a
+  // strip-mined loop keep dividing the IV.
+  if (!CollapsedIndices.empty() && StripMineCount <= 1) {
+    SmallVector<Instruction *, 4> HelperIndices;
+    for (Instruction *I : CollapsedIndices)
+      if (Value *V = VMap.lookup(I))
+        HelperIndices.push_back(cast<Instruction>(V));
+    stepCollapsedIndices(cast<BasicBlock>(VMap[Header]),
+                         cast<BasicBlock>(VMap[Latch]), NewCanonicalIV,
+                         HelperIndices);
+  }
+
+  // The serial leaves of a strip-mined loop run whole chunks of independent
+  // iterations.  Ask the vectorizer to vectorize them, without checking for
+  // dependences between iterations.
+  if (StripMineCount > 1) {
+    LLVMContext &C = M->getContext();
+    MDNode *LeafLoopID =
+      createLoopID(C, { std::make_pair("llvm.loop.vectorize.enable", 1U) });
+    cast<BasicBlock>(VMap[Latch])->getTerminator()->setMetadata(
+        LLVMContext::MD_loop, LeafLoopID);
+    for (BasicBlock *BB : L->blocks())
+      for (Instruction &I : *cast<BasicBlock>(VMap[BB])) {
+        if (!I.mayReadOrWriteMemory())
+          continue;
+        MDNode *Parallel =
+          I.getMetadata(LLVMContext::MD_mem_parallel_loop_access);
+        I.setMetadata(LLVMContext::MD_mem_parallel_loop_access,
+                      Parallel ? MDNode::concatenate(
+                                     Parallel, MDNode::get(C, LeafLoopID))
+                               : LeafLoopID);
+      }
+  }
+
   if (verifyFunction(*Helper, &dbgs()))
     return false;
 
@@ -1215,6 +1911,7 @@ bool DACLoopSpawning::processLoop() {
                           Preheader->getTerminator(), AC, DT);
 
   // Add call to new helper function in original function.
+  Value *HasChunk = nullptr, *RemStart = nullptr, *HasRemainder = nullptr;
   {
     // Setup arguments for call.
     SmallVector<Value *, 4> TopCallArgs;
@@ -1222,16 +1919,50 @@ bool DACLoopSpawning::processLoop() {
     if (SRetInput)
       TopCallArgs.push_back(SRetInput);
     // Add start iteration 0.
+    unsigned IterArgNo = TopCallArgs.size();
     assert(CanonicalSCEV->getStart()->isZero() &&
            "Canonical IV does not start at zero.");
     TopCallArgs.push_back(ConstantInt::get(CanonicalIV->getType(), 0));
-    // Add loop limit.
-    TopCallArgs.push_back(LimitVar);
+    // Add loop limit.  The recursion for a strip-mined loop runs only the
+    // whole chunks of iterations.
+    if (StripMineCount > 1) {
+      IRBuilder<> Builder(Preheader->getTerminator());
+      Type *Ty = LimitVar->getType();
+      Constant *ChunkMask = ConstantInt::get(Ty, StripMineCount - 1);
+      HasChunk = Builder.CreateICmpUGE(LimitVar, ChunkMask, "haschunk");
+      Value *ChunksLimit = Builder.CreateAdd(
+          Builder.CreateAnd(Builder.CreateSub(LimitVar, ChunkMask),
+                            ConstantInt::get(Ty, ~uint64_t(StripMineCount - 1))),
+          ChunkMask, "chunkslimit");
+      RemStart = Builder.CreateSelect(
+          HasChunk, Builder.CreateAdd(ChunksLimit, ConstantInt::get(Ty, 1)),
+          ConstantInt::get(Ty, 0), "remstart");
+      // Iterations remain if there is no whole chunk, or if the chunks end
+      // before the limit.  Comparing RemStart with LimitVar instead would fail
+      // when the chunks end at the largest value of the type, where RemStart
+      // wraps to zero.
+      HasRemainder = Builder.CreateOr(
+          Builder.CreateNot(HasChunk),
+          Builder.CreateICmpNE(ChunksLimit, LimitVar), "hasremainder");
+      TopCallArgs.push_back(ChunksLimit);
+    } else
+      TopCallArgs.push_back(LimitVar);
     // Add grainsize.
     TopCallArgs.push_back(GrainVar);
     // Add the rest of the arguments.
     for (Value *V : BodyInputs)
       TopCallArgs.push_back(V);
+    // Add storage for the results of the reductions.
+    SmallVector<AllocaInst *, 2> ReductionSlots;
+    {
+      IRBuilder<> Builder(&*F->getEntryBlock().getFirstInsertionPt());
+      for (LoopReduction &R : Reductions) {
+        AllocaInst *Slot = Builder.CreateAlloca(R.Phi->getType(), nullptr,
+                                                R.Phi->getName() + ".red");
+        ReductionSlots.push_back(Slot);
+        TopCallArgs.push_back(Slot);
+      }
+    }
     DEBUG({
         for (Value *TCArg : TopCallArgs)
           dbgs() << "Top call arg: " << *TCArg << "\n";
@@ -1239,15 +1970,30 @@ bool DACLoopSpawning::processLoop() {
 
     // Create call instruction.
     IRBuilder<> Builder(Preheader->getTerminator());
-    CallInst *TopCall = Builder.CreateCall(Helper,
-                                           ArrayRef<Value *>(TopCallArgs));
-
-    // Use a fast calling convention for the helper.
-    TopCall->setCallingConv(CallingConv::Fast);
-    // TopCall->setCallingConv(Helper->getCallingConv());
+    CallInst *TopCall = createTopCall(Builder, Helper, TopCallArgs,
+                                      IterArgNo);
     TopCall->setDebugLoc(Header->getTerminator()->getDebugLoc());
+    // Call the helper only if the loop has a whole chunk of iterations.
+    if (StripMineCount > 1)
+      TopCall->moveBefore(SplitBlockAndInsertIfThen(HasChunk, TopCall, false,
+                                                    nullptr, DT, LI));
     // // Update CG graph with the call we just added.
     // CG[F]->addCalledFunction(TopCall, CG[Helper]);
+
+    // Combine the result of each reduction with its value on entry to the
+    // loop, and use that in place of the value the loop produced.
+    for (unsigned i = 0, e = Reductions.size(); i != e; ++i) {
+      LoopReduction &R = Reductions[i];
+      Value *Result = Builder.CreateLoad(ReductionSlots[i]);
+      Value *Final = createReductionOp(Builder, R.Desc, R.Start, Result);
+      Instruction *ExitInstr = R.Desc.getLoopExitInstr();
+      for (auto UI = ExitInstr->use_begin(), UE = ExitInstr->use_end();
+           UI != UE;) {
+        Use &U = *UI++;
+        if (!L->contains(cast<Instruction>(U.getUser())))
+          U.set(Final);
+      }
+    }
   }
 
   // Remove sync of loop in parent.
@@ -1291,7 +2037,11 @@ bool DACLoopSpawning::processLoop() {
 
   ++LoopsConvertedToDAC;
 
-  unlinkLoop();
+  if (StripMineCount > 1) {
+    ++LoopsStripMined;
+    serializeRemainder(RemStart, HasRemainder);
+  } else
+    unlinkLoop();
 
   return Helper;
 }
@@ -1329,6 +2079,485 @@ void LoopSpawningImpl::addTapirLoop(Loop *L, SmallVectorImpl<Loop *> &V) {
     addTapirLoop(InnerL, V);
 }
 
+/// Estimate the cost of executing one iteration of the Tapir loop L, in TTI
+/// user-cost units.  The cost of each block in the loop is weighted by its
+/// frequency relative to the loop header.  When the function carries profile
+/// data, these frequencies come from the measured branch weights, so the
+/// estimate accounts for the observed trip counts of inner loops and for the
+/// paths actually taken through the body.
+unsigned LoopSpawningImpl::estimateIterationCost(const Loop *L) const {
+  uint64_t HeaderFreq = BFI->getBlockFreq(L->getHeader()).getFrequency();
+  if (!HeaderFreq)
+    return 0;
+
+  uint64_t Cost = 0;
+  for (const BasicBlock *BB : L->blocks()) {
+    uint64_t BBCost = 0;
+    for (const Instruction &I : *BB)
+      BBCost += TTI->getUserCost(&I);
+    uint64_t BBFreq = BFI->getBlockFreq(BB).getFrequency();
+    Cost += (BBCost * BBFreq + HeaderFreq - 1) / HeaderFreq;
+    if (Cost >= UINT_MAX)
+      return UINT_MAX;
+  }
+  return Cost;
+}
+
+/// Estimate the largest grainsize worth using for the Tapir loop L, such that
+/// a serial leaf of the divide-and-conquer recursion costs about
+/// ClLeafCost.  Returns 0 if no estimate is available.
+unsigned LoopSpawningImpl::estimateMaxGrainsize(const Loop *L) const {
+  if (!ClCostGrainsize || !TTI || !BFI)
+    return 0;
+
+  unsigned IterCost = estimateIterationCost(L);
+  if (!IterCost)
+    return 0;
+
+  unsigned Grainsize = (ClLeafCost + IterCost - 1) / IterCost;
+  return std::max(1U, std::min(Grainsize, (unsigned)ClMaxGrainsize));
+}
+
+/// Get the number of iterations in each chunk of the strip-mined Tapir loop L,
+/// or 0 if L should not be strip-mined.  A chunk covers the vector width,
+/// based on the widest type L loads or stores, times the interleave factor
+/// of the target, which is how many iterations the vectorizer runs at once.
+/// Only innermost loops without calls are strip-mined, since the vectorizer
+/// cannot vectorize anything else.
+unsigned LoopSpawningImpl::getStripMineCount(const Loop *L) const {
+  if (!ClStripMine || !L->empty())
+    return 0;
+  for (const BasicBlock *BB : L->blocks())
+    for (const Instruction &I : *BB)
+      if ((isa<CallInst>(I) || isa<InvokeInst>(I)) && !isa<IntrinsicInst>(I))
+        return 0;
+  if (ClStripMineCount)
+    return PowerOf2Floor(ClStripMineCount);
+  if (!TTI)
+    return 0;
+
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  uint64_t WidestType = 0;
+  for (const BasicBlock *BB : L->blocks())
+    for (const Instruction &I : *BB) {
+      Type *Ty;
+      if (const LoadInst *LdI = dyn_cast<LoadInst>(&I))
+        Ty = LdI->getType();
+      else if (const StoreInst *StI = dyn_cast<StoreInst>(&I))
+        Ty = StI->getValueOperand()->getType();
+      else
+        continue;
+      WidestType = std::max(WidestType, DL.getTypeSizeInBits(Ty));
+    }
+  if (!WidestType)
+    return 0;
+
+  unsigned VF = TTI->getRegisterBitWidth(true) / WidestType;
+  if (VF <= 1)
+    return 0;
+  return PowerOf2Floor(VF * TTI->getMaxInterleaveFactor(VF));
+}
+
+/// Return the Tapir loop nested in the Tapir loop L, if that loop is the only
+/// loop in the body of L.
+static Loop *getNestedTapirLoop(const Loop *L) {
+  if (1 != L->getSubLoops().size())
+    return nullptr;
+  Loop *Inner = L->getSubLoops().front();
+  if (!isCanonicalTapirLoop(Inner))
+    return nullptr;
+  return Inner;
+}
+
+/// Return true if BB contains only PHI nodes, debug intrinsics, and its
+/// terminator.
+static bool hasOnlyPHIsAndTerminator(const BasicBlock *BB) {
+  for (const Instruction &I : *BB)
+    if (!isa<PHINode>(I) && !isa<DbgInfoIntrinsic>(I) &&
+        !isa<TerminatorInst>(I))
+      return false;
+  return true;
+}
+
+/// Collapse the Tapir loop perfectly nested in the Tapir loop L into L, such
+/// that L iterates over the linearized product of the two iteration spaces.
+/// Each iteration of the collapsed loop recovers the induction variables of
+/// both loops from its linear index and then executes the body of the nested
+/// loop.  The outlined loop divides the linear index only where each serial
+/// leaf starts, and steps the recovered indices from there.  The code of L
+/// around the nested loop must be free of side effects, and the trip count of
+/// the nested loop must be invariant in L.  An invariant guard around the
+/// nested loop is hoisted out of L.  Returns true if the nest was collapsed.
+bool LoopSpawningImpl::collapseNestedTapirLoop(Loop *L) {
+  Loop *Inner = getNestedTapirLoop(L);
+  if (!Inner)
+    return false;
+
+  using namespace ore;
+
+  BasicBlock *Header = L->getHeader();
+  auto Missed = [&](StringRef RemarkName, const char *Msg) {
+    DEBUG(dbgs() << "LS: Cannot collapse nested Tapir loop: " << Msg << "\n");
+    ORE.emit(OptimizationRemarkAnalysis(LS_NAME, RemarkName,
+                                        L->getStartLoc(), Header)
+             << "cannot collapse nested Tapir loop: " << Msg);
+    return false;
+  };
+
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+  BasicBlock *Exit = L->getExitBlock();
+  BasicBlock *InnerHeader = Inner->getHeader();
+  BasicBlock *InnerPreheader = Inner->getLoopPreheader();
+  BasicBlock *InnerLatch = Inner->getLoopLatch();
+  BasicBlock *InnerExit = Inner->getExitBlock();
+  if (!Preheader || !Exit || !InnerPreheader || !InnerExit)
+    return Missed("CollapseNotSimplified", "loops are not in simplified form");
+
+  DetachInst *Detach = cast<DetachInst>(Header->getTerminator());
+  DetachInst *InnerDetach = cast<DetachInst>(InnerHeader->getTerminator());
+  Value *SyncRegion = Detach->getSyncRegion();
+  Instruction *InnerSyncRegion =
+    dyn_cast<Instruction>(InnerDetach->getSyncRegion());
+  BasicBlock *Body = Detach->getDetached();
+  BasicBlock *InnerBody = InnerDetach->getDetached();
+  if (!hasOnlyPHIsAndTerminator(Header) ||
+      !hasOnlyPHIsAndTerminator(InnerHeader) ||
+      isa<PHINode>(Body->front()) || isa<PHINode>(InnerBody->front()) ||
+      isa<PHINode>(Latch->front()))
+    return Missed("CollapseComplexLoop", "loop header or latch is not simple");
+
+  // Walk the blocks from the body of L to the nested loop.  These blocks are
+  // executed once per iteration of the collapsed loop, so they must not have
+  // side effects.  At most one branch among them may skip the nested loop, on
+  // a condition that is invariant in L.
+  SmallPtrSet<BasicBlock *, 8> PreBlocks;
+  BranchInst *GuardBr = nullptr;
+  BasicBlock *GuardTaken = nullptr, *GuardSkipped = nullptr;
+  bool GuardOnTrue = true;
+  for (BasicBlock *BB = Body; BB != InnerHeader; ) {
+    if (!L->contains(BB) || Inner->contains(BB) || !PreBlocks.insert(BB).second)
+      return Missed("CollapseNotPerfect", "loops are not perfectly nested");
+    for (Instruction &I : *BB) {
+      if (&I == InnerSyncRegion || isa<TerminatorInst>(I))
+        continue;
+      if (isa<AllocaInst>(I) || I.mayHaveSideEffects())
+        return Missed("CollapseNotPerfect",
+                      "code around nested loop has side effects");
+    }
+    BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+    if (!BI)
+      return Missed("CollapseNotPerfect", "loops are not perfectly nested");
+    if (BI->isUnconditional()) {
+      BB = BI->getSuccessor(0);
+      continue;
+    }
+    if (GuardBr)
+      return Missed("CollapseNotPerfect", "nested loop has multiple guards");
+    GuardBr = BI;
+    if (DT.dominates(BI->getSuccessor(0), InnerPreheader)) {
+      GuardTaken = BI->getSuccessor(0);
+      GuardSkipped = BI->getSuccessor(1);
+    } else if (DT.dominates(BI->getSuccessor(1), InnerPreheader)) {
+      GuardTaken = BI->getSuccessor(1);
+      GuardSkipped = BI->getSuccessor(0);
+      GuardOnTrue = false;
+    } else {
+      return Missed("CollapseNotPerfect", "loops are not perfectly nested");
+    }
+    BB = GuardTaken;
+  }
+  if (!InnerSyncRegion || !PreBlocks.count(InnerSyncRegion->getParent()))
+    return Missed("CollapseNotPerfect",
+                  "nested loop does not start its own sync region");
+
+  // The remaining blocks of L outside of the nested loop, which wait for the
+  // nested loop and reattach, are removed.
+  SmallVector<BasicBlock *, 8> PostBlocks;
+  SmallPtrSet<BasicBlock *, 8> PostSet;
+  for (BasicBlock *BB : L->blocks())
+    if (BB != Header && BB != Latch && !Inner->contains(BB) &&
+        !PreBlocks.count(BB)) {
+      PostBlocks.push_back(BB);
+      PostSet.insert(BB);
+    }
+  if (!PostSet.count(InnerExit) ||
+      (GuardSkipped && !PostSet.count(GuardSkipped)))
+    return Missed("CollapseNotPerfect", "loops are not perfectly nested");
+  auto IsUsedOnlyIn = [](const Instruction &I,
+                         function_ref<bool(const BasicBlock *)> Pred) {
+    for (const User *U : I.users())
+      if (!Pred(cast<Instruction>(U)->getParent()))
+        return false;
+    return true;
+  };
+  for (BasicBlock *BB : PostBlocks)
+    for (Instruction &I : *BB) {
+      if (isa<BranchInst>(I))
+        continue;
+      if (SyncInst *SI = dyn_cast<SyncInst>(&I)) {
+        if (SI->getSyncRegion() == InnerSyncRegion)
+          continue;
+      } else if (ReattachInst *RI = dyn_cast<ReattachInst>(&I)) {
+        if (RI->getSyncRegion() == SyncRegion && RI->getSuccessor(0) == Latch)
+          continue;
+      } else if (!I.mayHaveSideEffects() &&
+                 IsUsedOnlyIn(I, [&](const BasicBlock *UseBB) {
+                     return PostSet.count(UseBB); })) {
+        continue;
+      }
+      return Missed("CollapseNotPerfect",
+                    "code after nested loop has side effects");
+    }
+
+  // The latches only compute the next values of the induction variables.
+  SmallVector<Instruction *, 8> DeadLatchInsts;
+  for (Instruction &I : *Latch) {
+    if (isa<TerminatorInst>(I))
+      continue;
+    if (I.mayHaveSideEffects() ||
+        !IsUsedOnlyIn(I, [&](const BasicBlock *UseBB) {
+            return UseBB == Latch || UseBB == Header; }))
+      return Missed("CollapseComplexLoop", "loop latch is not simple");
+    DeadLatchInsts.push_back(&I);
+  }
+  for (Instruction &I : *InnerLatch)
+    if (!isa<TerminatorInst>(I) &&
+        (I.mayHaveSideEffects() ||
+         !IsUsedOnlyIn(I, [&](const BasicBlock *UseBB) {
+             return UseBB == InnerLatch || UseBB == InnerHeader ||
+               PostSet.count(UseBB); })))
+      return Missed("CollapseComplexLoop", "nested loop latch is not simple");
+  for (BasicBlock::iterator II = Exit->begin(); isa<PHINode>(II); ++II) {
+    Value *V = cast<PHINode>(II)->getIncomingValueForBlock(Latch);
+    if (Instruction *I = dyn_cast<Instruction>(V))
+      if (L->contains(I))
+        return Missed("CollapseLiveOut", "loop computes a live-out value");
+  }
+
+  // Only the nested loop, its reattaches, and its sync may use its sync
+  // region.
+  for (const User *U : InnerSyncRegion->users()) {
+    const Instruction *I = cast<Instruction>(U);
+    if (I == InnerDetach || PostSet.count(I->getParent()) ||
+        (isa<ReattachInst>(I) && I->getParent() != InnerHeader &&
+         cast<ReattachInst>(I)->getSuccessor(0) == InnerLatch))
+      continue;
+    return Missed("CollapseNotPerfect",
+                  "nested loop shares its sync region");
+  }
+
+  // The guard must be computable before L.
+  Instruction *GuardInst = nullptr;
+  if (GuardBr) {
+    GuardInst = dyn_cast<Instruction>(GuardBr->getCondition());
+    if (GuardInst && L->contains(GuardInst) &&
+        (!L->hasLoopInvariantOperands(GuardInst) ||
+         !isSafeToSpeculativelyExecute(GuardInst)))
+      return Missed("CollapseVariantGuard",
+                    "guard of nested loop varies with the outer loop");
+    if (LI.getLoopFor(Exit) != L->getParentLoop())
+      return Missed("CollapseComplexLoop", "loop exit leaves its parent loop");
+  }
+
+  // Get the trip counts.  The trip count of the nested loop must not depend on
+  // the iteration of L.
+  const SCEV *Limit = SE.getExitCount(L, Latch);
+  const SCEV *InnerLimit = SE.getExitCount(Inner, InnerLatch);
+  if (isa<SCEVCouldNotCompute>(Limit) || isa<SCEVCouldNotCompute>(InnerLimit))
+    return Missed("CollapseUnknownLimit", "could not compute loop limits");
+  if (!SE.isLoopInvariant(InnerLimit, L) || !isSafeToExpand(InnerLimit, SE) ||
+      !isSafeToExpand(Limit, SE))
+    return Missed("CollapseVariantLimit",
+                  "limit of nested loop varies with the outer loop");
+
+  // Get the induction variables of both loops, which must be affine.  The
+  // induction variables of the nested loop must not depend on the iteration
+  // of L.
+  SmallVector<std::pair<PHINode *, const SCEVAddRecExpr *>, 4> IVs, InnerIVs;
+  for (Loop *CurL : { L, Inner }) {
+    auto &CurIVs = (CurL == L) ? IVs : InnerIVs;
+    for (BasicBlock::iterator II = CurL->getHeader()->begin();
+         isa<PHINode>(II); ++II) {
+      PHINode *PN = cast<PHINode>(II);
+      const SCEVAddRecExpr *AR = nullptr;
+      if (SE.isSCEVable(PN->getType()))
+        AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(PN));
+      if (!AR || AR->getLoop() != CurL || !AR->isAffine() ||
+          !SE.isLoopInvariant(AR->getStart(), L) ||
+          !SE.isLoopInvariant(AR->getStepRecurrence(SE), L) ||
+          !isSafeToExpand(AR->getStart(), SE) ||
+          !isSafeToExpand(AR->getStepRecurrence(SE), SE))
+        return Missed("CollapseNonAffineIV",
+                      "loop carries a value that is not an affine IV");
+      CurIVs.push_back(std::make_pair(PN, AR));
+    }
+  }
+
+  // The index of the collapsed loop must not overflow.  The last index is
+  // Limit * (InnerLimit + 1) + InnerLimit.
+  LLVMContext &Ctx = Header->getContext();
+  uint64_t Bits = std::max<uint64_t>(
+      { 64, SE.getTypeSizeInBits(Limit->getType()),
+        SE.getTypeSizeInBits(InnerLimit->getType()) });
+  IntegerType *IdxTy = IntegerType::get(Ctx, Bits);
+  Limit = SE.getZeroExtendExpr(Limit, IdxTy);
+  InnerLimit = SE.getZeroExtendExpr(InnerLimit, IdxTy);
+  {
+    APInt Max = SE.getUnsignedRangeMax(Limit);
+    APInt InnerMax = SE.getUnsignedRangeMax(InnerLimit);
+    bool MulOverflow, AddOverflow;
+    APInt Last = Max.umul_ov(InnerMax + 1, MulOverflow);
+    Last = Last.uadd_ov(InnerMax, AddOverflow);
+    if (InnerMax.isMaxValue() || MulOverflow || AddOverflow)
+      return Missed("CollapseOverflow",
+                    "collapsed iteration space might overflow");
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Collapse the loops.
+
+  DEBUG(dbgs() << "LS: Collapsing nested Tapir loop " << *Inner);
+  SE.forgetLoop(L);
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  SCEVExpander Exp(SE, DL, "collapse");
+
+  // Hoist the guard out of L, so that the collapsed loop is skipped when the
+  // nested loop would not run.
+  if (GuardBr) {
+    if (GuardInst && L->contains(GuardInst))
+      GuardInst->moveBefore(Preheader->getTerminator());
+    Value *Cond = GuardBr->getCondition();
+    ReplaceInstWithInst(GuardBr, BranchInst::Create(GuardTaken));
+
+    BasicBlock *GuardBlock = Preheader;
+    Preheader = SplitEdge(GuardBlock, Header, &DT, &LI);
+    BasicBlock *NewExit = SplitBlockPredecessors(Exit, { Latch }, ".collapse",
+                                                 &DT, &LI);
+    for (BasicBlock::iterator II = Exit->begin(); isa<PHINode>(II); ++II) {
+      PHINode *PN = cast<PHINode>(II);
+      Value *V = PN->getIncomingValueForBlock(NewExit);
+      if (PHINode *NewPN = dyn_cast<PHINode>(V))
+        if (NewPN->getParent() == NewExit)
+          V = NewPN->getIncomingValueForBlock(Latch);
+      PN->addIncoming(V, GuardBlock);
+    }
+    BranchInst *GuardBlockBr = cast<BranchInst>(GuardBlock->getTerminator());
+    if (GuardOnTrue)
+      ReplaceInstWithInst(GuardBlockBr,
+                          BranchInst::Create(Preheader, Exit, Cond));
+    else
+      ReplaceInstWithInst(GuardBlockBr,
+                          BranchInst::Create(Exit, Preheader, Cond));
+    Exit = NewExit;
+    DT.recalculate(F);
+  }
+
+  // Compute the trip count of the nested loop and the limit of the collapsed
+  // loop.
+  Instruction *PreheaderTerm = Preheader->getTerminator();
+  const SCEV *InnerCount = SE.getAddExpr(InnerLimit, SE.getOne(IdxTy));
+  Value *InnerCountVal = Exp.expandCodeFor(InnerCount, IdxTy, PreheaderTerm);
+  Value *LimitVal = Exp.expandCodeFor(
+      SE.getAddExpr(SE.getMulExpr(Limit, InnerCount), InnerLimit), IdxTy,
+      PreheaderTerm);
+
+  // Create the induction variable of the collapsed loop, and replace the latch
+  // of L to test it against the new limit.
+  PHINode *IV = PHINode::Create(IdxTy, 2, "collapse.iv", &Header->front());
+  IV->addIncoming(ConstantInt::get(IdxTy, 0), Preheader);
+  BranchInst *LatchBr = cast<BranchInst>(Latch->getTerminator());
+  IRBuilder<> B(LatchBr);
+  Value *IVNext = B.CreateAdd(IV, ConstantInt::get(IdxTy, 1),
+                              "collapse.iv.next", /*HasNUW=*/true);
+  Value *Cond = B.CreateICmpULT(IV, LimitVal, "collapse.cond");
+  BranchInst *NewLatchBr = B.CreateCondBr(Cond, Header, Exit);
+  NewLatchBr->copyMetadata(*LatchBr);
+  LatchBr->eraseFromParent();
+  IV->addIncoming(IVNext, Latch);
+
+  // Recover the indices of the iterations of both loops at the start of the
+  // body, and compute the induction variables of both loops from them.
+  B.SetInsertPoint(&*Body->getFirstInsertionPt());
+  Value *Idx = B.CreateUDiv(IV, InnerCountVal, "collapse.idx");
+  Value *InnerIdx = B.CreateURem(IV, InnerCountVal, "collapse.inner.idx");
+  CollapsedIndices[L].push_back(cast<Instruction>(Idx));
+  CollapsedIndices[L].push_back(cast<Instruction>(InnerIdx));
+  for (auto &IdxIVs : { std::make_pair(Idx, &IVs),
+                        std::make_pair(InnerIdx, &InnerIVs) })
+    for (auto &PNAR : *IdxIVs.second) {
+      PHINode *PN = PNAR.first;
+      const SCEV *It = SE.getTruncateOrZeroExtend(
+          SE.getUnknown(IdxIVs.first), SE.getEffectiveSCEVType(PN->getType()));
+      Value *NewIV = Exp.expandCodeFor(PNAR.second->evaluateAtIteration(It, SE),
+                                       PN->getType(), &*B.GetInsertPoint());
+      if (!NewIV->hasName())
+        NewIV->takeName(PN);
+      PN->replaceAllUsesWith(NewIV);
+    }
+  for (auto &PNAR : IVs)
+    PNAR.first->eraseFromParent();
+  for (Instruction *I : DeadLatchInsts)
+    I->dropAllReferences();
+  for (Instruction *I : DeadLatchInsts)
+    I->eraseFromParent();
+
+  // Enter the body of the nested loop directly, and reattach its iterations to
+  // the latch of the collapsed loop.
+  InnerPreheader->getTerminator()->replaceUsesOfWith(InnerHeader, InnerBody);
+  SmallVector<BasicBlock *, 4> InnerReattaches;
+  for (BasicBlock *Pred : predecessors(InnerLatch))
+    if (Pred != InnerHeader)
+      InnerReattaches.push_back(Pred);
+  for (BasicBlock *Pred : InnerReattaches)
+    ReplaceInstWithInst(Pred->getTerminator(),
+                        ReattachInst::Create(Latch, SyncRegion));
+
+  // Remove the header and latch of the nested loop, and the blocks that waited
+  // for it.
+  SmallVector<BasicBlock *, 8> DeadBlocks(PostBlocks.begin(), PostBlocks.end());
+  DeadBlocks.push_back(InnerHeader);
+  DeadBlocks.push_back(InnerLatch);
+  for (BasicBlock *BB : DeadBlocks)
+    LI.removeBlock(BB);
+  for (BasicBlock *BB : DeadBlocks)
+    BB->dropAllReferences();
+  for (BasicBlock *BB : DeadBlocks)
+    BB->eraseFromParent();
+  assert(InnerSyncRegion->use_empty() && "Sync region of nested loop in use.");
+  InnerSyncRegion->eraseFromParent();
+
+  // Move the blocks and subloops of the nested loop into L, and remove the
+  // nested loop.
+  for (BasicBlock *BB : Inner->blocks())
+    if (LI.getLoopFor(BB) == Inner)
+      LI.changeLoopFor(BB, L);
+  while (!Inner->empty())
+    L->addChildLoop(Inner->removeChildLoop(std::prev(Inner->end())));
+  L->removeChildLoop(find(*L, Inner));
+  LI.addTopLevelLoop(Inner);
+  LI.markAsRemoved(Inner);
+
+  DT.recalculate(F);
+  SE.forgetLoop(L);
+
+  // The grainsize estimated for the nested loop applies to the collapsed loop.
+  auto InnerGrainsize = MaxGrainsizes.find(Inner);
+  if (InnerGrainsize != MaxGrainsizes.end()) {
+    unsigned G = InnerGrainsize->second;
+    MaxGrainsizes.erase(InnerGrainsize);
+    MaxGrainsizes[L] = G;
+  } else {
+    MaxGrainsizes.erase(L);
+  }
+
+  ++LoopsCollapsed;
+  ORE.emit(OptimizationRemark(LS_NAME, "CollapsedNest", L->getStartLoc(),
+                              Header)
+           << "collapsed nested Tapir loop");
+  return true;
+}
+
 #ifndef NDEBUG
 /// \return string containing a file name and a line # for the given loop.
 static std::string getDebugLocString(const Loop *L) {
@@ -1359,6 +2588,15 @@ bool LoopSpawningImpl::run() {
 
   LoopsAnalyzed += Worklist.size();
 
+  // Estimate the grainsizes of all Tapir loops before transforming any of
+  // them.  Estimate the grainsizes of perfectly nested Tapir loops as well,
+  // in case they are collapsed into the loops around them.
+  for (Loop *L : Worklist)
+    if (LoopSpawningHints(L).getStrategy() == LoopSpawningHints::ST_DAC)
+      for (Loop *N = L; N; N = getNestedTapirLoop(N))
+        if (unsigned G = estimateMaxGrainsize(N))
+          MaxGrainsizes[N] = G;
+
   // Now walk the identified inner loops.
   bool Changed = false;
   while (!Worklist.empty())
@@ -1372,6 +2610,195 @@ bool LoopSpawningImpl::run() {
   return Changed;
 }
 
+/// Prepare the Tapir loop L, whose trip count is unknown, for spawning its
+/// iterations in divide-and-conquer fashion.  L is turned into a serial loop
+/// that walks the iteration space and records, in a buffer, the values that
+/// each detached body uses.  A counted Tapir loop nested in L then spawns the
+/// recorded bodies whenever the buffer fills up and after the walk ends.
+/// Return the counted Tapir loop, or null if L cannot be transformed.
+Loop *LoopSpawningImpl::bufferTapirLoop(Loop *L) {
+  BasicBlock *Header = L->getHeader();
+  auto Missed = [&](StringRef RemarkName, const char *Msg) -> Loop * {
+    DEBUG(dbgs() << "LS: Cannot buffer Tapir loop: " << Msg << "\n");
+    ORE.emit(OptimizationRemarkAnalysis(LS_NAME, RemarkName,
+                                        L->getStartLoc(), Header)
+             << "cannot buffer iterations of Tapir loop: " << Msg);
+    return nullptr;
+  };
+
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+  BasicBlock *Exit = L->getExitBlock();
+  if (!Preheader || !Exit || L->getExitingBlock() != Latch)
+    return Missed("BufferNotSimplified", "loop is not in simplified form");
+  BranchInst *LatchBr = dyn_cast<BranchInst>(Latch->getTerminator());
+  DetachInst *Detach = cast<DetachInst>(Header->getTerminator());
+  BasicBlock *Body = Detach->getDetached();
+  Value *SyncRegion = Detach->getSyncRegion();
+  if (!LatchBr || !LatchBr->isConditional() || isa<PHINode>(Latch->front()) ||
+      isa<PHINode>(Body->front()))
+    return Missed("BufferComplexLoop", "loop header or latch is not simple");
+
+  // The remaining blocks of L form the detached body.  The body may use values
+  // computed in the header, which are recorded in the buffer, but nothing
+  // outside the body may use the values it computes.
+  SmallPtrSet<BasicBlock *, 16> BodyBlocks;
+  for (BasicBlock *BB : L->blocks())
+    if (BB != Header && BB != Latch)
+      BodyBlocks.insert(BB);
+  SetVector<Instruction *> Recorded;
+  for (BasicBlock *BB : BodyBlocks)
+    for (Instruction &I : *BB) {
+      for (Value *Op : I.operands())
+        if (Instruction *OpI = dyn_cast<Instruction>(Op))
+          if (OpI->getParent() == Header)
+            Recorded.insert(OpI);
+      for (User *U : I.users())
+        if (!BodyBlocks.count(cast<Instruction>(U)->getParent()))
+          return Missed("BufferLiveOut", "loop body computes a live-out value");
+    }
+  for (Instruction *I : Recorded)
+    if (I->getType()->isTokenTy())
+      return Missed("BufferComplexLoop", "loop body uses a token");
+  SmallVector<ReattachInst *, 4> Reattaches;
+  for (BasicBlock *Pred : predecessors(Latch))
+    if (Pred != Header)
+      Reattaches.push_back(cast<ReattachInst>(Pred->getTerminator()));
+
+  DEBUG(dbgs() << "LS: Buffering " << Recorded.size()
+               << " values per iteration of Tapir loop " << *L);
+  SE.forgetLoop(L);
+
+  LLVMContext &Ctx = Header->getContext();
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  IntegerType *IdxTy = Type::getInt64Ty(Ctx);
+  Constant *Zero = ConstantInt::get(IdxTy, 0);
+  Constant *One = ConstantInt::get(IdxTy, 1);
+  MDNode *LoopID = L->getLoopID();
+
+  // Allocate the buffer once, at the start of the task that contains L.  If L
+  // is nested in a detached task, such as the body of another Tapir loop, the
+  // outliner moves the buffer into the entry of that task's helper, so that
+  // each parallel instance of L gets its own buffer.
+  SmallVector<Type *, 4> FieldTys;
+  for (Instruction *I : Recorded)
+    FieldTys.push_back(I->getType());
+  ArrayType *BufTy = ArrayType::get(StructType::get(Ctx, FieldTys),
+                                    ClBufferSize);
+  AllocaInst *Buf = nullptr;
+  if (!Recorded.empty()) {
+    BasicBlock *Task = TaskInfo(F).getTaskFor(Preheader);
+    Buf = new AllocaInst(BufTy, DL.getAllocaAddrSpace(), "ls.buffer",
+                         &*Task->getFirstInsertionPt());
+  }
+  auto GetSlot = [&](IRBuilder<> &B, Value *Idx, unsigned Field) {
+    Value *Idxs[] = { Zero, Idx, ConstantInt::get(Type::getInt32Ty(Ctx),
+                                                  Field) };
+    return B.CreateInBoundsGEP(BufTy, Buf, Idxs);
+  };
+
+  BasicBlock *FlushPH = BasicBlock::Create(Ctx, "ls.flush.preheader", &F,
+                                           Exit);
+  BasicBlock *FlushHeader = BasicBlock::Create(Ctx, "ls.flush.detach", &F,
+                                               Exit);
+  BasicBlock *FlushLatch = BasicBlock::Create(Ctx, "ls.flush.inc", &F, Exit);
+  BasicBlock *FlushExit = BasicBlock::Create(Ctx, "ls.flush.exit", &F, Exit);
+  BasicBlock *Backedge = BasicBlock::Create(Ctx, "ls.buffer.next", &F, Exit);
+
+  // Record the values used by the body of each iteration, instead of
+  // detaching the body.
+  PHINode *Count = PHINode::Create(IdxTy, 2, "ls.buffered", &Header->front());
+  Value *NextCount;
+  {
+    IRBuilder<> B(Detach);
+    for (unsigned i = 0, e = Recorded.size(); i != e; ++i)
+      B.CreateStore(Recorded[i], GetSlot(B, Count, i));
+    NextCount = B.CreateAdd(Count, One, "ls.buffered.next", true, true);
+    ReplaceInstWithInst(Detach, BranchInst::Create(Latch));
+  }
+
+  // Flush the buffer when it is full or the walk ends.
+  bool ContinueOnTrue = LatchBr->getSuccessor(0) == Header;
+  Value *Cond = LatchBr->getCondition();
+  {
+    IRBuilder<> B(LatchBr);
+    Value *Full = B.CreateICmpEQ(NextCount, ConstantInt::get(IdxTy,
+                                                             ClBufferSize),
+                                 "ls.buffer.full");
+    Value *Done = ContinueOnTrue ? B.CreateNot(Cond) : Cond;
+    Value *Flush = B.CreateOr(Done, Full, "ls.flush");
+    ReplaceInstWithInst(LatchBr, BranchInst::Create(FlushPH, Backedge, Flush));
+  }
+  for (PHINode &PN : Exit->phis())
+    PN.setIncomingBlock(PN.getBasicBlockIndex(Latch), FlushExit);
+
+  // The walk continues from the single latch of the serial loop.
+  for (PHINode &PN : Header->phis())
+    if (&PN != Count)
+      PN.setIncomingBlock(PN.getBasicBlockIndex(Latch), Backedge);
+  {
+    PHINode *Reset = PHINode::Create(IdxTy, 2, "ls.buffered.reset", Backedge);
+    Reset->addIncoming(NextCount, Latch);
+    Reset->addIncoming(Zero, FlushExit);
+    BranchInst::Create(Header, Backedge);
+    Count->addIncoming(Zero, Preheader);
+    Count->addIncoming(Reset, Backedge);
+  }
+
+  // Build the counted Tapir loop over the buffer, which detaches the original
+  // body with the values recorded for each iteration.
+  BranchInst::Create(FlushHeader, FlushPH);
+  {
+    IRBuilder<> B(FlushHeader);
+    PHINode *Idx = B.CreatePHI(IdxTy, 2, "ls.flush.iv");
+    for (unsigned i = 0, e = Recorded.size(); i != e; ++i) {
+      Instruction *I = Recorded[i];
+      Value *Replay = B.CreateLoad(GetSlot(B, Idx, i),
+                                   I->getName() + ".buffered");
+      for (auto UI = I->use_begin(), UE = I->use_end(); UI != UE; ) {
+        Use &U = *UI++;
+        if (BodyBlocks.count(cast<Instruction>(U.getUser())->getParent()))
+          U.set(Replay);
+      }
+    }
+    DetachInst::Create(Body, FlushLatch, SyncRegion, FlushHeader);
+    B.SetInsertPoint(FlushLatch);
+    Value *NextIdx = B.CreateAdd(Idx, One, "ls.flush.iv.next", true, true);
+    Value *FlushDone = B.CreateICmpEQ(NextIdx, NextCount, "ls.flush.done");
+    B.CreateCondBr(FlushDone, FlushExit, FlushHeader)
+      ->setMetadata(LLVMContext::MD_loop, LoopID);
+    Idx->addIncoming(Zero, FlushPH);
+    Idx->addIncoming(NextIdx, FlushLatch);
+  }
+  for (ReattachInst *RI : Reattaches)
+    RI->setSuccessor(0, FlushLatch);
+  BranchInst::Create(ContinueOnTrue ? Backedge : Exit,
+                     ContinueOnTrue ? Exit : Backedge, Cond, FlushExit);
+
+  // Update the loop info.  The counted loop takes over the body of L, along
+  // with any loops in the body.
+  Loop *FlushLoop = new Loop();
+  SmallVector<Loop *, 4> SubLoops(L->begin(), L->end());
+  for (Loop *SubL : SubLoops) {
+    L->removeChildLoop(find(*L, SubL));
+    FlushLoop->addChildLoop(SubL);
+  }
+  L->addChildLoop(FlushLoop);
+  FlushLoop->addBasicBlockToLoop(FlushHeader, LI);
+  FlushLoop->addBasicBlockToLoop(FlushLatch, LI);
+  for (BasicBlock *BB : BodyBlocks) {
+    FlushLoop->addBlockEntry(BB);
+    if (LI.getLoopFor(BB) == L)
+      LI.changeLoopFor(BB, FlushLoop);
+  }
+  for (BasicBlock *BB : { FlushPH, FlushExit, Backedge })
+    L->addBasicBlockToLoop(BB, LI);
+  DT.recalculate(F);
+
+  ++LoopsBuffered;
+  return FlushLoop;
+}
+
 // Top-level routine to process a given loop.
 bool LoopSpawningImpl::processLoop(Loop *L) {
 #ifndef NDEBUG
@@ -1385,6 +2812,29 @@ bool LoopSpawningImpl::processLoop(Loop *L) {
                << L->getHeader()->getParent()->getName() << "\" from "
         << DebugLocStr << ": " << *L << "\n");
 
+  // Spawn a Tapir loop whose trip count is unknown by way of a counted Tapir
+  // loop over a buffer of its iterations.
+  bool Buffered = false;
+  if (ClBufferLoops && isa<SCEVCouldNotCompute>(SE.getBackedgeTakenCount(L))) {
+    LoopSpawningHints::SpawningStrategy Strategy =
+      LoopSpawningHints(L).getStrategy();
+    if (Strategy == LoopSpawningHints::ST_DAC ||
+        (Strategy == LoopSpawningHints::ST_SEQ && ClBufferSequentialLoops)) {
+      DebugLoc DLoc = L->getStartLoc();
+      BasicBlock *Header = L->getHeader();
+      if (Loop *FlushLoop = bufferTapirLoop(L)) {
+        ORE.emit(OptimizationRemarkAnalysis(LS_NAME, "BufferedIterations",
+                                            DLoc, Header)
+                 << "buffering iterations of Tapir loop with unknown trip "
+                 << "count");
+        L = FlushLoop;
+        Buffered = true;
+        if (Strategy == LoopSpawningHints::ST_SEQ)
+          LoopSpawningHints(L).setStrategy(LoopSpawningHints::ST_DAC);
+      }
+    }
+  }
+
   LoopSpawningHints Hints(L);
 
   DEBUG(dbgs() << "LS: Loop hints:"
@@ -1420,12 +2870,69 @@ bool LoopSpawningImpl::processLoop(Loop *L) {
   case LoopSpawningHints::ST_DAC:
     DEBUG(dbgs() << "LS: Hints dictate DAC spawning.\n");
     {
+      // Collapse perfectly nested Tapir loops into this loop, so that a single
+      // recursion spawns all of their iterations.
+      unsigned Collapse = Hints.getCollapse();
+      if (!Collapse && ClCollapseNests)
+        Collapse = UINT_MAX;
+      bool Collapsed = false;
+      for (unsigned Depth = 1; Depth < Collapse; ++Depth) {
+        if (!collapseNestedTapirLoop(L))
+          break;
+        Collapsed = true;
+      }
+
       DebugLoc DLoc = L->getStartLoc();
       BasicBlock *Header = L->getHeader();
-      DACLoopSpawning DLS(L, Hints.getGrainsize(), SE, &LI, &DT, &AC, ORE, tapirTarget);
+      unsigned SpecifiedGrainsize = Hints.getGrainsize();
+      unsigned MaxGrainsize = ClMaxGrainsize;
+      if (SpecifiedGrainsize) {
+        // A fixed grainsize needs no bound.
+      } else if (unsigned G = Hints.getMaxGrainsize()) {
+        MaxGrainsize = G;
+      } else if (MaxGrainsizes.count(L)) {
+        MaxGrainsize = MaxGrainsizes[L];
+        DEBUG(dbgs() << "LS: Estimated maximum grainsize " << MaxGrainsize
+                     << "\n");
+        ORE.emit(OptimizationRemarkAnalysis(LS_NAME, "EstimatedGrainsize",
+                                            DLoc, Header)
+                 << "estimated maximum grainsize: "
+                 << NV("Grainsize", MaxGrainsize));
+        // Record the estimate on the loop, where it can be inspected, or
+        // copied into the source to pin it.  It is kept apart from the
+        // grainsize hint, which would replace the runtime computation.
+        Hints.setMaxGrainsize(MaxGrainsize);
+      }
+      auto CreateDAC = [&]() {
+        DACLoopSpawning *DAC =
+          new DACLoopSpawning(L, SpecifiedGrainsize, SE, &LI, &DT, &AC, ORE,
+                              tapirTarget, MaxGrainsize);
+        DAC->setStripMineCount(getStripMineCount(L));
+        DAC->setCollapsedIndices(CollapsedIndices.lookup(L));
+        return DAC;
+      };
+      // Let the Tapir target supply its own lowering of the loop.
+      std::unique_ptr<LoopOutline> DLS;
+      if (tapirTarget)
+        DLS.reset(tapirTarget->getLoopSpawning(L, SpecifiedGrainsize,
+                                               MaxGrainsize, SE, &LI, &DT, &AC,
+                                               ORE));
+      if (DLS)
+        DLS->setCollapsedIndices(CollapsedIndices.lookup(L));
+      else
+        DLS.reset(CreateDAC());
       // CilkABILoopSpawning DLS(L, SE, &LI, &DT, &AC, ORE);
       // DACLoopSpawning DLS(L, SE, LI, DT, TLI, TTI, ORE);
-      if (DLS.processLoop()) {
+      bool Spawned = DLS->processLoop();
+      if (!Spawned && DLS->declined()) {
+        // The lowering of the Tapir target does not handle this loop, so fall
+        // back to spawning its iterations with a generic recursion, which the
+        // target lowers as it does any other detach.
+        DEBUG(dbgs() << "LS: Falling back to generic DAC spawning.\n");
+        DLS.reset(CreateDAC());
+        Spawned = DLS->processLoop();
+      }
+      if (Spawned) {
         DEBUG({
             if (verifyFunction(*L->getHeader()->getParent())) {
               dbgs() << "Transformed function is invalid.\n";
@@ -1442,6 +2949,37 @@ bool LoopSpawningImpl::processLoop(Loop *L) {
                                           Header)
                  << "cannot spawn iterations using divide-and-conquer");
         emitMissedWarning(F, L, Hints, &ORE);
+        return Collapsed || Buffered;
+      }
+    }
+    break;
+  case LoopSpawningHints::ST_ADAPTIVE:
+    DEBUG(dbgs() << "LS: Hints dictate adaptive DAC spawning.\n");
+    {
+      DebugLoc DLoc = L->getStartLoc();
+      BasicBlock *Header = L->getHeader();
+      AdaptiveDACLoopSpawning DLS(L, Hints.getGrainsize(), SE, &LI, &DT, &AC,
+                                  ORE, tapirTarget);
+      if (DLS.processLoop()) {
+        DEBUG({
+            if (verifyFunction(*L->getHeader()->getParent())) {
+              dbgs() << "Transformed function is invalid.\n";
+              return false;
+            }
+          });
+        // Report success.
+        ORE.emit(OptimizationRemark(LS_NAME, "AdaptiveDACSpawning", DLoc,
+                                    Header)
+                 << "spawning iterations using divide-and-conquer with "
+                 << "adaptive grainsize");
+        return true;
+      } else {
+        // Report failure.
+        ORE.emit(OptimizationRemarkMissed(LS_NAME, "NoAdaptiveDACSpawning",
+                                          DLoc, Header)
+                 << "cannot spawn iterations using adaptive "
+                 << "divide-and-conquer");
+        emitMissedWarning(F, L, Hints, &ORE);
         return false;
       }
     }
@@ -1506,9 +3044,12 @@ PreservedAnalyses LoopSpawningPass::run(Function &F,
   auto &AC = AM.getResult<AssumptionAnalysis>(F);
   auto &ORE =
     AM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+  auto &TTI = AM.getResult<TargetIRAnalysis>(F);
+  auto &BFI = AM.getResult<BlockFrequencyAnalysis>(F);
   // OptimizationRemarkEmitter ORE(F);
 
-  bool Changed = LoopSpawningImpl(F, LI, SE, DT, AC, ORE, tapirTarget).run();
+  bool Changed = LoopSpawningImpl(F, LI, SE, DT, AC, ORE, tapirTarget,
+                                  &TTI, &BFI).run();
 
   AM.invalidate<ScalarEvolutionAnalysis>(F);
 
@@ -1554,13 +3095,17 @@ struct LoopSpawning : public FunctionPass {
     auto &AC = getAnalysis<AssumptionCacheTracker>().getAssumptionCache(F);
     auto &ORE =
       getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+    auto &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+    auto &BFI = getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI();
     // OptimizationRemarkEmitter ORE(F);
 
-    return LoopSpawningImpl(F, LI, SE, DT, AC, ORE, tapirTarget).run();
+    return LoopSpawningImpl(F, LI, SE, DT, AC, ORE, tapirTarget,
+                            &TTI, &BFI).run();
   }
 
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.addRequired<AssumptionCacheTracker>();
+    AU.addRequired<BlockFrequencyInfoWrapperPass>();
     AU.addRequiredID(LoopSimplifyID);
     AU.addRequiredID(LCSSAID);
     AU.addRequired<DominatorTreeWrapperPass>();
@@ -1581,6 +3126,7 @@ char LoopSpawning::ID = 0;
 static const char ls_name[] = "Loop Spawning";
 INITIALIZE_PASS_BEGIN(LoopSpawning, LS_NAME, ls_name, false, false)
 INITIALIZE_PASS_DEPENDENCY(AssumptionCacheTracker)
+INITIALIZE_PASS_DEPENDENCY(BlockFrequencyInfoWrapperPass)
 INITIALIZE_PASS_DEPENDENCY(LoopSimplify)
 INITIALIZE_PASS_DEPENDENCY(LCSSAWrapperPass)
 INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
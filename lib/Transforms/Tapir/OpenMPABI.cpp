@@ -15,6 +15,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Tapir/OpenMPABI.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Transforms/Tapir/Outline.h"
@@ -27,6 +30,10 @@ using namespace llvm;
 
 #define DEBUG_TYPE "ompabi"
 
+/// Metadata that marks a function that forks a parallel region when it needs
+/// one, and so must not be run inside a region of its own.
+static const char OMPForksRegionMD[] = "omp.forks.region";
+
 StructType *IdentTy = nullptr;
 FunctionType *Kmpc_MicroTy = nullptr;
 Constant *DefaultOpenMPPSource = nullptr;
@@ -100,6 +107,8 @@ Constant *createRuntimeFunction(OpenMPRuntimeFunction Function,
   auto *VoidPtrTy = Type::getInt8PtrTy(M->getContext());
   auto *Int32Ty = Type::getInt32Ty(M->getContext());
   auto *Int32PtrTy = Type::getInt32PtrTy(M->getContext());
+  auto *Int64Ty = Type::getInt64Ty(M->getContext());
+  auto *Int64PtrTy = Type::getInt64PtrTy(M->getContext());
   // TODO double check for how SizeTy get created. Eventually, it get emitted
   // as i64 on my machine.
   auto *SizeTy = Type::getInt64Ty(M->getContext());
@@ -123,6 +132,24 @@ Constant *createRuntimeFunction(OpenMPRuntimeFunction Function,
     RTLFn = M->getOrInsertFunction("__kmpc_for_static_init_4", FnTy);
     break;
   }
+  case OMPRTL__kmpc_for_static_init_4u: {
+    Type *TypeParams[] = {IdentTyPtrTy, Int32Ty,    Int32Ty,
+                          Int32PtrTy,   Int32PtrTy, Int32PtrTy,
+                          Int32PtrTy,   Int32Ty,    Int32Ty};
+    FunctionType *FnTy =
+      FunctionType::get(VoidTy, TypeParams, /*isVarArg*/ false);
+    RTLFn = M->getOrInsertFunction("__kmpc_for_static_init_4u", FnTy);
+    break;
+  }
+  case OMPRTL__kmpc_for_static_init_8u: {
+    Type *TypeParams[] = {IdentTyPtrTy, Int32Ty,    Int32Ty,
+                          Int32PtrTy,   Int64PtrTy, Int64PtrTy,
+                          Int64PtrTy,   Int64Ty,    Int64Ty};
+    FunctionType *FnTy =
+      FunctionType::get(VoidTy, TypeParams, /*isVarArg*/ false);
+    RTLFn = M->getOrInsertFunction("__kmpc_for_static_init_8u", FnTy);
+    break;
+  }
   case OMPRTL__kmpc_for_static_fini: {
     Type *TypeParams[] = {IdentTyPtrTy, Int32Ty};
     FunctionType *FnTy =
@@ -130,6 +157,38 @@ Constant *createRuntimeFunction(OpenMPRuntimeFunction Function,
     RTLFn = M->getOrInsertFunction("__kmpc_for_static_fini", FnTy);
     break;
   }
+  case OMPRTL__kmpc_dispatch_init_4u: {
+    Type *TypeParams[] = {IdentTyPtrTy, Int32Ty, Int32Ty,
+                          Int32Ty,      Int32Ty, Int32Ty, Int32Ty};
+    FunctionType *FnTy =
+        FunctionType::get(VoidTy, TypeParams, /*isVarArg*/ false);
+    RTLFn = M->getOrInsertFunction("__kmpc_dispatch_init_4u", FnTy);
+    break;
+  }
+  case OMPRTL__kmpc_dispatch_init_8u: {
+    Type *TypeParams[] = {IdentTyPtrTy, Int32Ty, Int32Ty,
+                          Int64Ty,      Int64Ty, Int64Ty, Int64Ty};
+    FunctionType *FnTy =
+        FunctionType::get(VoidTy, TypeParams, /*isVarArg*/ false);
+    RTLFn = M->getOrInsertFunction("__kmpc_dispatch_init_8u", FnTy);
+    break;
+  }
+  case OMPRTL__kmpc_dispatch_next_4u: {
+    Type *TypeParams[] = {IdentTyPtrTy, Int32Ty,    Int32PtrTy,
+                          Int32PtrTy,   Int32PtrTy, Int32PtrTy};
+    FunctionType *FnTy =
+        FunctionType::get(Int32Ty, TypeParams, /*isVarArg*/ false);
+    RTLFn = M->getOrInsertFunction("__kmpc_dispatch_next_4u", FnTy);
+    break;
+  }
+  case OMPRTL__kmpc_dispatch_next_8u: {
+    Type *TypeParams[] = {IdentTyPtrTy, Int32Ty,    Int32PtrTy,
+                          Int64PtrTy,   Int64PtrTy, Int64PtrTy};
+    FunctionType *FnTy =
+        FunctionType::get(Int32Ty, TypeParams, /*isVarArg*/ false);
+    RTLFn = M->getOrInsertFunction("__kmpc_dispatch_next_8u", FnTy);
+    break;
+  }
   case OMPRTL__kmpc_master: {
     Type *TypeParams[] = {IdentTyPtrTy, Int32Ty};
     FunctionType *FnTy =
@@ -183,6 +242,13 @@ Constant *createRuntimeFunction(OpenMPRuntimeFunction Function,
     RTLFn = M->getOrInsertFunction("__kmpc_barrier", FnTy);
     break;
   }
+  case OMPRTL__kmpc_in_parallel: {
+    Type *TypeParams[] = {IdentTyPtrTy};
+    FunctionType *FnTy =
+        FunctionType::get(Int32Ty, TypeParams, /*isVarArg=*/false);
+    RTLFn = M->getOrInsertFunction("__kmpc_in_parallel", FnTy);
+    break;
+  }
   case OMPRTL__kmpc_global_num_threads: {
     Type *TypeParams[] = {IdentTyPtrTy};
     FunctionType *FnTy =
@@ -190,6 +256,11 @@ Constant *createRuntimeFunction(OpenMPRuntimeFunction Function,
     RTLFn = M->getOrInsertFunction("__kmpc_global_num_threads", FnTy);
     break;
   }
+  case OMPRTL_omp_get_max_threads: {
+    FunctionType *FnTy = FunctionType::get(Int32Ty, /*isVarArg=*/false);
+    RTLFn = M->getOrInsertFunction("omp_get_max_threads", FnTy);
+    break;
+  }
   }
   return RTLFn;
 }
@@ -603,6 +674,7 @@ Function *llvm::OpenMPABI::createDetach(DetachInst &detach,
   CallInst *cal = nullptr;
   Function *extracted = extractDetachBodyToFunction(detach, DT, AC, &cal);
   extracted = formatFunctionToTask(extracted, cal);
+  TaskFunctions.insert(extracted);
 
   // Replace the detach with a branch to the continuation.
   BranchInst *ContinueBr = BranchInst::Create(Continue);
@@ -619,196 +691,630 @@ Function *llvm::OpenMPABI::createDetach(DetachInst &detach,
   return extracted;
 }
 
+cl::opt<bool> fastOpenMP("fast-openmp", cl::init(false), cl::Hidden,
+                       cl::desc("Assume that functions whose callers are not "
+                                "all known are called inside a parallel "
+                                "region, and never fork one for them"));
+
 void llvm::OpenMPABI::preProcessFunction(Function &F) {
   auto M = (Module *)F.getParent();
   getOrCreateIdentTy(M);
   getOrCreateDefaultLocation(M);
+  if (AnalyzedModule != M) {
+    findFunctionsInParallelRegions(*M);
+    // TapirToTarget does not process the callers that a region is hoisted into
+    // unless they spawn themselves, so fork their regions now.
+    if (!fastOpenMP)
+      for (Function *Root : HoistedRegionRoots)
+        forkParallelRegion(*Root);
+  }
 }
 
+/// Return true if every use of \p F is a direct call, so that the functions
+/// that run its body are all known.
+static bool hasOnlyKnownCallers(const Function &F) {
+  if (!F.hasLocalLinkage() || F.use_empty())
+    return false;
+  for (const Use &U : F.uses()) {
+    ImmutableCallSite CS(U.getUser());
+    if (!CS || !CS.isCallee(&U))
+      return false;
+  }
+  return true;
+}
 
-cl::opt<bool> fastOpenMP("fast-openmp", cl::init(false), cl::Hidden,
-                       cl::desc("Attempt faster OpenMP implementation, assuming parallel outside set"));
+/// Return true if \p BB throws, catches, or cleans up after an exception.
+static bool hasEH(const BasicBlock &BB) {
+  for (const Instruction &I : BB)
+    if (I.isEHPad() || isa<InvokeInst>(I) || isa<ResumeInst>(I) ||
+        isa<CatchReturnInst>(I) || isa<CleanupReturnInst>(I))
+      return true;
+  return false;
+}
+
+static bool hasEH(const Function &F) {
+  return any_of(F, [](const BasicBlock &BB) { return hasEH(BB); });
+}
+
+/// Find where to fork the parallel regions of the module.  A function that
+/// spawns must run inside a parallel region.  If its callers are all known, its
+/// region is hoisted into them, and so on up the call graph, so that the
+/// region is forked by the outermost callers, those whose callers are not all
+/// known.  A spawning function called in a loop of serial code thus forks the
+/// thread team once, around the loop, rather than once per call.  Functions
+/// that fork their own worksharing regions are left alone.  An exception that
+/// leaves a region would unwind through __kmpc_fork_call, so regions are not
+/// hoisted out of or into functions with exception-handling code.
+///
+/// This analysis runs on the Tapir form of the module, before any function is
+/// lowered.
+void llvm::OpenMPABI::findFunctionsInParallelRegions(Module &M) {
+  AnalyzedModule = &M;
+  InParallelRegion.clear();
+  HoistedRegionRoots.clear();
+  TaskFunctions.clear();
+
+  SmallSetVector<Function *, 16> NeedsRegion;
+  for (Function &F : M)
+    if (canDetach(&F) && !F.getMetadata(OMPForksRegionMD))
+      NeedsRegion.insert(&F);
+
+  // NeedsRegion grows as regions are hoisted into callers.
+  for (unsigned I = 0; I != NeedsRegion.size(); ++I) {
+    Function *F = NeedsRegion[I];
+    if (!hasOnlyKnownCallers(*F) || hasEH(*F) ||
+        any_of(F->users(), [](const User *U) {
+          return hasEH(*cast<Instruction>(U)->getFunction());
+        })) {
+      // F forks the region.  TapirToTarget processes F if it spawns.
+      if (!canDetach(F))
+        HoistedRegionRoots.push_back(F);
+      continue;
+    }
+    InParallelRegion.insert(F);
+    for (const Use &U : F->uses()) {
+      Function *Caller = cast<Instruction>(U.getUser())->getFunction();
+      if (!Caller->getMetadata(OMPForksRegionMD))
+        NeedsRegion.insert(Caller);
+    }
+  }
+}
+
+/// Run the body of a spawning function inside a parallel region, unless the
+/// region is hoisted into its callers.
 void llvm::OpenMPABI::postProcessFunction(Function &F) {
+  // Tasks, and functions that are only called inside a parallel region, spawn
+  // into the enclosing team.
+  if (TaskFunctions.count(&F) || InParallelRegion.count(&F))
+    return;
+  // Functions that run worksharing loops fork their own regions.
+  if (F.getMetadata(OMPForksRegionMD))
+    return;
+  // The remaining functions have callers that are not all known.
   if (fastOpenMP) return;
 
-  auto& Context = F.getContext();
-  DataLayout DL(F.getParent());
+  forkParallelRegion(F);
+}
 
-  std::vector<CallInst*> tasks;
-  for (BasicBlock& BB : F) {
-    for(Instruction& I : BB) {
-      if (CallInst* cal = dyn_cast_or_null<CallInst>(&I)){
-        if (cal->getCalledFunction()->getName()=="__kmpc_omp_task_alloc") {
-            tasks.push_back(cal);
-        }
-      }
+/// Return true if \p I spawns a task, waits for tasks, or calls a function that
+/// spawns into the region of its caller.
+static bool
+spawnsIntoRegion(const Instruction &I,
+                 const SmallPtrSetImpl<const Function *> &InParallelRegion) {
+  ImmutableCallSite CS(&I);
+  if (!CS || !CS.getCalledFunction())
+    return false;
+  const Function *Callee = CS.getCalledFunction();
+  if (InParallelRegion.count(Callee))
+    return true;
+  StringRef Name = Callee->getName();
+  return Name == "__kmpc_omp_task_alloc" || Name == "__kmpc_omp_task" ||
+         Name == "__kmpc_omp_taskwait";
+}
+
+/// Find the smallest single-entry, single-exit region of \p F that contains
+/// every spawn and sync of \p F and every loop around them, so that the serial
+/// code before the first spawn and after the last sync stays outside of the
+/// region.  The entry of the region is put first in \p RegionBlocks.  Returns
+/// false if \p F has no such region.
+static bool
+findSpawningRegion(Function &F,
+                   const SmallPtrSetImpl<const Function *> &InParallelRegion,
+                   SmallVectorImpl<BasicBlock *> &RegionBlocks) {
+  DominatorTree DT(F);
+  PostDominatorTree PDT;
+  PDT.recalculate(F);
+  LoopInfo LI(DT);
+
+  // The region starts where the first spawn, or the loop around it, is
+  // entered, and it ends where the last sync, or the loop around it, is left.
+  SmallVector<BasicBlock *, 8> Starts, Ends;
+  for (BasicBlock &BB : F) {
+    if (none_of(BB, [&](const Instruction &I) {
+          return spawnsIntoRegion(I, InParallelRegion);
+        }))
+      continue;
+    Loop *L = LI.getLoopFor(&BB);
+    if (!L) {
+      Starts.push_back(&BB);
+      Ends.push_back(&BB);
+      continue;
     }
+    while (L->getParentLoop())
+      L = L->getParentLoop();
+    Starts.push_back(L->getHeader());
+    SmallVector<BasicBlock *, 4> Exits;
+    L->getExitBlocks(Exits);
+    if (Exits.empty())
+      return false;
+    Ends.append(Exits.begin(), Exits.end());
+  }
+  if (Starts.empty())
+    return false;
+  BasicBlock *Start = Starts.front();
+  for (BasicBlock *BB : Starts)
+    Start = DT.findNearestCommonDominator(Start, BB);
+  BasicBlock *End = Ends.front();
+  for (BasicBlock *BB : Ends)
+    if (!(End = PDT.findNearestCommonDominator(End, BB)))
+      return false;
+
+  // End the region after the last spawn or sync in End, if any.
+  BasicBlock *RegionExit = End;
+  Instruction *Last = nullptr;
+  for (Instruction &I : *End)
+    if (spawnsIntoRegion(I, InParallelRegion))
+      Last = &I;
+  if (Last) {
+    if (isa<TerminatorInst>(Last))
+      return false;
+    RegionExit = End->splitBasicBlock(std::next(Last->getIterator()),
+                                      "omp.region.exit");
   }
 
-  SmallVector<BasicBlock *, 32> Todo;
-  SmallPtrSet<BasicBlock *, 4> Visited;
-  SmallVector<BasicBlock*, 32>VisitedVec;
-  for(auto a : tasks) {
-    a->getParent()->splitBasicBlock(a);
-    Todo.push_back(a->getParent());
+  // Start the region on entry to the outermost loop around Start, or else at
+  // the first spawn or sync in Start, if any, or else at its terminator.
+  BasicBlock *RegionEntry;
+  if (Loop *L = LI.getLoopFor(Start)) {
+    while (L->getParentLoop())
+      L = L->getParentLoop();
+    SmallVector<BasicBlock *, 4> Outside;
+    for (BasicBlock *Pred : predecessors(L->getHeader()))
+      if (!L->contains(Pred))
+        Outside.push_back(Pred);
+    RegionEntry = SplitBlockPredecessors(L->getHeader(), Outside,
+                                         ".omp.region");
+    if (!RegionEntry)
+      return false;
+  } else {
+    auto First = find_if(*Start, [&](const Instruction &I) {
+      return spawnsIntoRegion(I, InParallelRegion);
+    });
+    if (First == Start->end())
+      First = Start->getTerminator()->getIterator();
+    RegionEntry = Start->splitBasicBlock(First, "omp.region");
   }
 
-  while (Todo.size() > 0) {
-    BasicBlock *BB = Todo.pop_back_val();
-    if (!Visited.insert(BB).second)
-      continue;
-    VisitedVec.push_back(BB);
-    bool foundsync = false;
-    for(Instruction& I : *BB) {
-      if (CallInst* cal = dyn_cast_or_null<CallInst>(&I)){
-        if (cal->getCalledFunction()->getName()=="__kmpc_omp_taskwait") {
-            foundsync = true;
-            BB->splitBasicBlock(++BasicBlock::iterator(cal));
-            break;
-        }
-      }
-    }
+  // Collect the region, and check that it is only entered at its entry and
+  // only left to its exit, and that no exception enters or leaves it.
+  SmallPtrSet<BasicBlock *, 32> InRegion;
+  RegionBlocks.push_back(RegionEntry);
+  InRegion.insert(RegionEntry);
+  for (unsigned I = 0; I != RegionBlocks.size(); ++I)
+    for (BasicBlock *Succ : successors(RegionBlocks[I]))
+      if (Succ != RegionExit && InRegion.insert(Succ).second)
+        RegionBlocks.push_back(Succ);
+  for (BasicBlock *BB : RegionBlocks) {
+    if (hasEH(*BB) || isa<ReturnInst>(BB->getTerminator()))
+      return false;
+    for (BasicBlock *Pred : predecessors(BB))
+      if (InRegion.count(Pred) == (BB == RegionEntry))
+        return false;
+  }
+  return true;
+}
 
-    if (!foundsync) {
-      for (BasicBlock *Succ : successors(BB)) {
-        Todo.push_back(Succ);
-      }
+/// Run the spawning part of \p F inside a parallel region.  The region spans
+/// from the first spawn of the function to its last sync, including any loop
+/// around them, so the function forks the thread team at most once, however
+/// many tasks it and its callees spawn.  If no such region can be outlined,
+/// the region covers the whole function, from after its static allocas to its
+/// return.  The master thread runs the region and the other threads of the
+/// team execute its tasks.  If the function is called while a parallel region
+/// is already active, it runs the region directly and spawns into the active
+/// one.  No region is forked around exception-handling code, whose exceptions
+/// would unwind through the OpenMP runtime; its tasks then run serially.
+void llvm::OpenMPABI::forkParallelRegion(Function &F) {
+  Module *M = F.getParent();
+  LLVMContext &Context = F.getContext();
+
+  // Find the single return of the function.  TapirToTarget has unified the
+  // returns of spawning functions, but not those of the callers that regions
+  // are hoisted into.
+  SmallVector<ReturnInst *, 4> Returns;
+  for (BasicBlock &BB : F)
+    if (ReturnInst *RI = dyn_cast<ReturnInst>(BB.getTerminator()))
+      Returns.push_back(RI);
+  if (Returns.empty()) return;
+  ReturnInst *Ret = Returns.front();
+  if (Returns.size() > 1) {
+    BasicBlock *RetBB = BasicBlock::Create(Context, "omp.return", &F);
+    PHINode *PN = nullptr;
+    if (!F.getReturnType()->isVoidTy())
+      PN = PHINode::Create(F.getReturnType(), Returns.size(), "omp.retval",
+                           RetBB);
+    Ret = ReturnInst::Create(Context, PN, RetBB);
+    for (ReturnInst *RI : Returns) {
+      if (PN)
+        PN->addIncoming(RI->getReturnValue(), RI->getParent());
+      ReplaceInstWithInst(RI, BranchInst::Create(RetBB));
     }
   }
 
-  for(int i=1; i<VisitedVec.size(); i++) {
-      for (auto P : predecessors(VisitedVec[i])) {
-        if (Visited.count(P) == 0) {
-          std::swap(VisitedVec[0], VisitedVec[i]);
-          break;
-        }
-      }
+  SmallVector<BasicBlock *, 32> RegionBlocks;
+  if (!findSpawningRegion(F, InParallelRegion, RegionBlocks)) {
+    RegionBlocks.clear();
+    if (hasEH(F)) {
+      DEBUG(dbgs() << "OpenMP: not forking a parallel region around the "
+                   << "exception-handling code of " << F.getName() << "\n");
+      return;
+    }
+    // Leave the static allocas and the thread ID in the entry block, and the
+    // return in its own block, outside of the region.
+    BasicBlock *Entry = &F.getEntryBlock();
+    Value *ThreadID = OpenMPThreadIDLoadMap.lookup(&F);
+    BasicBlock::iterator SplitPt = Entry->begin();
+    while (isa<AllocaInst>(SplitPt) || &*SplitPt == ThreadID)
+      ++SplitPt;
+    if (Ret->getParent() == Entry && Ret == &*SplitPt)
+      return;
+    Entry->splitBasicBlock(SplitPt, "omp.region");
+    BasicBlock *Exit =
+        Ret->getParent()->splitBasicBlock(Ret, "omp.region.exit");
+    RegionBlocks.push_back(Entry->getSingleSuccessor());
+    for (BasicBlock &BB : F)
+      if (&BB != Entry && &BB != Exit && &BB != RegionBlocks.front())
+        RegionBlocks.push_back(&BB);
   }
 
-  CodeExtractor RegionExtractor(VisitedVec);
+  // Aggregate the inputs and outputs of the region, so that the region takes
+  // at most one pointer argument.
+  CodeExtractor RegionExtractor(RegionBlocks, /*DT=*/nullptr,
+                                /*AggregateArgs=*/true);
   Function *RegionFn = RegionExtractor.extractCodeRegion();
+  if (!RegionFn) {
+    DEBUG(dbgs() << "OpenMP: could not extract the parallel region of "
+                 << F.getName() << "\n");
+    return;
+  }
+  assert(RegionFn->hasOneUse() && "Parallel region called more than once.");
+  CallInst *RegionCall = cast<CallInst>(RegionFn->user_back());
 
-  std::vector<Type *> FnParams;
-  std::vector<StringRef> FnArgNames;
-  std::vector<AttributeSet> FnArgAttrs;
-
-  auto *Int32PtrTy = PointerType::getUnqual(Type::getInt32Ty(Context));
-  FnParams.push_back(Int32PtrTy);
-  FnParams.push_back(Int32PtrTy);
+  // Create the microtask, in which the master thread runs the region.
+  auto *Int32Ty = Type::getInt32Ty(Context);
+  auto *Int32PtrTy = PointerType::getUnqual(Int32Ty);
+  SmallVector<Type *, 3> FnParams = {Int32PtrTy, Int32PtrTy};
+  for (Argument &Arg : RegionFn->args())
+    FnParams.push_back(Arg.getType());
+  auto *OMPRegionFnTy = FunctionType::get(Type::getVoidTy(Context), FnParams,
+                                          false);
+  Function *OMPRegionFn = Function::Create(OMPRegionFnTy,
+                                           GlobalValue::InternalLinkage,
+                                           RegionFn->getName() + ".OMP", M);
+  {
+    Function::arg_iterator ArgIt = OMPRegionFn->arg_begin();
+    Argument *GTIDArg = &*ArgIt++;
+    GTIDArg->setName(".global_tid.");
+    (&*ArgIt++)->setName(".bound_tid.");
+    SmallVector<Value *, 1> RegionArgs;
+    for (; ArgIt != OMPRegionFn->arg_end(); ++ArgIt)
+      RegionArgs.push_back(&*ArgIt);
+
+    BasicBlock *MicroEntry = BasicBlock::Create(Context, "entry", OMPRegionFn);
+    BasicBlock *MasterBB = BasicBlock::Create(Context, "omp.master",
+                                              OMPRegionFn);
+    BasicBlock *MicroExit = BasicBlock::Create(Context, "omp.master.done",
+                                               OMPRegionFn);
+    IRBuilder<> B(MicroEntry);
+    Value *GTID = B.CreateLoad(GTIDArg, "gtid");
+    Value *IsMaster = emitRuntimeCall(
+        createRuntimeFunction(OMPRTL__kmpc_master, M),
+        {DefaultOpenMPLocation, GTID}, "", B);
+    B.CreateCondBr(B.CreateICmpNE(IsMaster, ConstantInt::get(Int32Ty, 0)),
+                   MasterBB, MicroExit);
+    B.SetInsertPoint(MasterBB);
+    B.CreateCall(RegionFn, RegionArgs);
+    emitRuntimeCall(createRuntimeFunction(OMPRTL__kmpc_end_master, M),
+                    {DefaultOpenMPLocation, GTID}, "", B);
+    B.CreateBr(MicroExit);
+    B.SetInsertPoint(MicroExit);
+    B.CreateRetVoid();
+  }
 
-  FnArgNames.push_back(".global_tid.");
-  FnArgNames.push_back(".bound_tid.");
+  // Fork the region unless a parallel region is already active.
+  IRBuilder<> B(RegionCall);
+  Value *InParallel = emitRuntimeCall(
+      createRuntimeFunction(OMPRTL__kmpc_in_parallel, M),
+      {DefaultOpenMPLocation}, "", B);
+  TerminatorInst *ThenTerm, *ElseTerm;
+  SplitBlockAndInsertIfThenElse(
+      B.CreateICmpNE(InParallel, ConstantInt::get(Int32Ty, 0)), RegionCall,
+      &ThenTerm, &ElseTerm);
+  RegionCall->moveBefore(ThenTerm);
 
-  //FnArgAttrs.push_back(AttributeSet::get(Context, 1, Attribute::NoAlias));
-  //FnArgAttrs.push_back(AttributeSet::get(Context, 2, Attribute::NoAlias));
+  std::vector<Value *> OMPRegionFnArgs = {
+      DefaultOpenMPLocation,
+      ConstantInt::getSigned(Int32Ty, RegionFn->arg_size()),
+      ConstantExpr::getBitCast(OMPRegionFn, getKmpc_MicroPointerTy(Context))};
+  for (Value *Arg : RegionCall->arg_operands())
+    OMPRegionFnArgs.push_back(Arg);
+  B.SetInsertPoint(ElseTerm);
+  emitRuntimeCall(createRuntimeFunction(OMPRTL__kmpc_fork_call, M),
+                  OMPRegionFnArgs, "", B);
+}
 
-  int ArgOffset = 2;
+void llvm::OpenMPABI::postProcessHelper(Function &F) {}
 
-  // For RegionFn argument add a corresponding argument to the new function.
-  bool first = true;
-  for (auto &Arg : RegionFn->args()) {
-    if (first) {
-      first = false;
-      continue;
-    }
-    FnParams.push_back(Arg.getType());
-    FnArgNames.push_back(Arg.getName());
-
-    // Allow speculative loading from shared data.
-    if (Arg.getType()->isPointerTy()) {
-      AttrBuilder B;
-      B.addDereferenceableAttr(
-          DL.getTypeAllocSize(Arg.getType()->getPointerElementType()));
-      //FnArgAttrs.push_back(AttributeSet::get(Context, ++ArgOffset, B));
-    } else {
-      //FnArgAttrs.push_back(AttributeSet());
-      ++ArgOffset;
-    }
-  }
+bool llvm::OpenMPABI::processMain(Function &F) { 
+  return false; 
+}
 
-  // Create the function and set its argument properties.
-  auto *VoidTy = Type::getVoidTy(Context);
-    auto *OMPRegionFnTy = FunctionType::get(VoidTy, FnParams, false);
-    auto Name = RegionFn->getName() + ".OMP";
-    Function *OMPRegionFn = dyn_cast<Function>(
-        F.getParent()->getOrInsertFunction(Name.str(), OMPRegionFnTy));
-
-    // If this is an outermost region, skip the first 2 arguments (global_tid and
-    // bound_tid) ...
-    auto OMPArgIt = OMPRegionFn->arg_begin();
-    Value* tmp = OMPArgIt;
-    ++OMPArgIt;
-    ++OMPArgIt;
-
-    // ... then map corresponding arguments in RegionFn and OMPRegionFn
-
-    auto *EntryBB = BasicBlock::Create(Context, "entry", OMPRegionFn, nullptr);
-    IRBuilder<> IRBuilder0(EntryBB);
-    tmp = IRBuilder0.CreateLoad(tmp);
-
-    ValueToValueMapTy VMap;
-    for (auto &Arg : RegionFn->args()) {
-      if(tmp) {
-        VMap[&Arg] = tmp;
-        tmp = nullptr;
-      } else {
-        VMap[&Arg] = &*OMPArgIt;
-        ++OMPArgIt;
-      }
-    }
+/// \brief An OpenMP task is heap-allocated by __kmpc_omp_task_alloc and its
+/// shared variables are copied in before it is enqueued.
+unsigned llvm::OpenMPABI::getSpawnCost() const {
+  return 200;
+}
 
-  	SmallVector< ReturnInst *,5> retinsts;
-    CloneFunctionInto(OMPRegionFn, RegionFn, VMap, false, retinsts);
-    IRBuilder0.CreateBr(OMPRegionFn->getBasicBlockList().getNextNode(*EntryBB));
-
-  auto FindCallToExtractedFn = [](Function *SpawningFn,
-                                    Function *ExtractedFn) {
-      // Find the call instruction to the extracted region function: RegionFn.
-      CallInst *ExtractedFnCI = nullptr;
-      for (auto &BB : *SpawningFn) {
-        if (CallInst *CI = dyn_cast<CallInst>(BB.begin())) {
-          // NOTE: I use pointer equality here, is that fine?
-          if (ExtractedFn == CI->getCalledFunction()) {
-            ExtractedFnCI = CI;
-            break;
-          }
-        }
-      }
+/// \brief With a single thread in the team of the parallel region, every task
+/// is executed by the thread that created it.
+Value *llvm::OpenMPABI::createSerialDispatchCheck(Instruction *InsertBefore) {
+  IRBuilder<> B(InsertBefore);
+  Value *NThreads = emitRuntimeCall(
+      createRuntimeFunction(OMPRTL_omp_get_max_threads,
+                            InsertBefore->getModule()),
+      {}, "nthreads", B);
+  return B.CreateICmpSLE(NThreads, ConstantInt::get(NThreads->getType(), 1),
+                         "single.worker");
+}
 
-      assert(ExtractedFnCI != nullptr &&
-             "Couldn't find the call to the extracted region function!");
+LoopOutline *llvm::OpenMPABI::getLoopSpawning(Loop *L, unsigned Grainsize,
+                                              unsigned MaxGrainsize,
+                                              ScalarEvolution &SE,
+                                              LoopInfo *LI, DominatorTree *DT,
+                                              AssumptionCache *AC,
+                                              OptimizationRemarkEmitter &ORE) {
+  return new OpenMPABILoopSpawning(L, Grainsize, SE, LI, DT, AC, ORE, this,
+                                   MaxGrainsize);
+}
 
-      return ExtractedFnCI;
-    };
-  auto *ExtractedFnCI = FindCallToExtractedFn(&F, RegionFn);
+/// Each call to the helper executes the chunk of iterations it is given
+/// serially, so serialize the detach in the header of the outlined loop.
+void llvm::OpenMPABILoopSpawning::implementDACIterSpawnOnHelper(
+    Function *Helper, BasicBlock *Preheader, BasicBlock *Header,
+    PHINode *CanonicalIV, Argument *Limit, Argument *Grainsize,
+    Instruction *SyncRegion, Instruction *LeafExit, DominatorTree *DT,
+    LoopInfo *LI, bool CanonicalIVFlagNUW, bool CanonicalIVFlagNSW) {
+  serializeLoopOnHelper(Header, SyncRegion, LeafExit, DT);
+}
 
-  IRBuilder<> b(ExtractedFnCI);
+/// Replace the call to the helper with a call to a new function that runs the
+/// loop.  If no parallel region is active, that function forks a parallel
+/// region, whose threads share the iterations of the loop.  The arguments of
+/// the helper are passed to the outlined parallel region through a closure,
+/// and each thread calls the helper on the chunks of iterations that the
+/// runtime assigns to it.  Inside an active parallel region, a fork would run
+/// the loop on a single thread, and only some threads of the team may reach
+/// the loop, so the function instead spawns each chunk of iterations as a
+/// task into that region.
+CallInst *llvm::OpenMPABILoopSpawning::createTopCall(IRBuilder<> &Builder,
+                                                     Function *Helper,
+                                                     ArrayRef<Value *> Args,
+                                                     unsigned IterArgNo) {
+  Function *F = Builder.GetInsertBlock()->getParent();
+  Module *M = F->getParent();
+  LLVMContext &C = M->getContext();
+  getOrCreateIdentTy(M);
+  Value *Loc = getOrCreateDefaultLocation(M);
+
+  // Create the function that runs the loop, which takes the arguments of the
+  // helper.  The function forks its own region when it needs one.
+  SmallVector<Type *, 8> ArgTys;
+  for (Value *V : Args)
+    ArgTys.push_back(V->getType());
+  Function *Top = Function::Create(
+      FunctionType::get(Type::getVoidTy(C), ArgTys, false),
+      GlobalValue::InternalLinkage, Helper->getName() + ".omp.loop", M);
+  Top->setMetadata(OMPForksRegionMD, MDNode::get(C, {}));
+  SmallVector<Value *, 8> TopArgs;
+  for (Argument &Arg : Top->args())
+    TopArgs.push_back(&Arg);
+  BasicBlock *TopEntry = BasicBlock::Create(C, "entry", Top);
+  BasicBlock *ForkBB = BasicBlock::Create(C, "omp.fork", Top);
+  BasicBlock *SpawnBB = BasicBlock::Create(C, "omp.spawn", Top);
+  IRBuilder<> TopBuilder(TopEntry);
+
+  // Store the arguments of the helper in a closure.
+  StructType *ClosureTy = StructType::create(ArgTys,
+                                             Helper->getName().str() + ".args");
+  AllocaInst *Closure = TopBuilder.CreateAlloca(ClosureTy, nullptr,
+                                                Helper->getName() + ".args");
+  Value *SyncRegion = TopBuilder.CreateCall(
+      Intrinsic::getDeclaration(M, Intrinsic::syncregion_start), {},
+      "syncreg");
+  Value *InParallel = emitRuntimeCall(
+      createRuntimeFunction(OMPRTL__kmpc_in_parallel, M), {Loc}, "",
+      TopBuilder);
+  TopBuilder.CreateCondBr(
+      TopBuilder.CreateICmpNE(InParallel,
+                              ConstantInt::get(InParallel->getType(), 0)),
+      SpawnBB, ForkBB);
+
+  // Inside an active region, spawn a task for each chunk of at least the
+  // grainsize iterations, and wait for the tasks.
+  {
+    Type *IterTy = Args[IterArgNo]->getType();
+    BasicBlock *ChunkBB = BasicBlock::Create(C, "omp.spawn.chunk", Top);
+    BasicBlock *ChunkBodyBB = BasicBlock::Create(C, "omp.spawn.body", Top);
+    BasicBlock *ChunkIncBB = BasicBlock::Create(C, "omp.spawn.inc", Top);
+    BasicBlock *ChunkEndBB = BasicBlock::Create(C, "omp.spawn.end", Top);
+    BasicBlock *SyncedBB = BasicBlock::Create(C, "omp.spawn.synced", Top);
+    IRBuilder<> B(SpawnBB);
+    Value *Limit = TopArgs[IterArgNo + 1];
+    Value *Grain = TopArgs[IterArgNo + 2];
+    Grain = B.CreateSelect(
+        B.CreateICmpEQ(Grain, ConstantInt::get(IterTy, 0)),
+        ConstantInt::get(IterTy, 1), Grain, "grainsize");
+    B.CreateBr(ChunkBB);
+    B.SetInsertPoint(ChunkBB);
+    PHINode *Lower = B.CreatePHI(IterTy, 2, "chunk.lb");
+    Value *Upper = B.CreateAdd(Lower, B.CreateSub(Grain,
+                                                  ConstantInt::get(IterTy, 1)));
+    Upper = B.CreateSelect(B.CreateOr(B.CreateICmpULT(Upper, Lower),
+                                      B.CreateICmpUGT(Upper, Limit)),
+                           Limit, Upper, "chunk.ub");
+    DetachInst::Create(ChunkBodyBB, ChunkIncBB, SyncRegion, ChunkBB);
+    B.SetInsertPoint(ChunkBodyBB);
+    SmallVector<Value *, 8> HelperArgs(TopArgs.begin(), TopArgs.end());
+    HelperArgs[IterArgNo] = Lower;
+    HelperArgs[IterArgNo + 1] = Upper;
+    B.CreateCall(Helper, HelperArgs)->setCallingConv(Helper->getCallingConv());
+    ReattachInst::Create(ChunkIncBB, SyncRegion, ChunkBodyBB);
+    B.SetInsertPoint(ChunkIncBB);
+    Lower->addIncoming(TopArgs[IterArgNo], SpawnBB);
+    Lower->addIncoming(B.CreateAdd(Upper, ConstantInt::get(IterTy, 1)),
+                       ChunkIncBB);
+    B.CreateCondBr(B.CreateICmpUGE(Upper, Limit), ChunkEndBB, ChunkBB);
+    SyncInst::Create(SyncedBB, SyncRegion, ChunkEndBB);
+    ReturnInst::Create(C, SyncedBB);
+  }
 
-  auto *Int32Ty = Type::getInt32Ty(Context);
-  std::vector<Value *> OMPRegionFnArgs = {
-      DefaultOpenMPLocation,
-      ConstantInt::getSigned(Int32Ty, RegionFn->arg_size()),
-      b.CreateBitCast(OMPRegionFn, getKmpc_MicroPointerTy(Context))};
+  // Otherwise, fork a parallel region that shares the iterations.
+  IRBuilder<> ForkBuilder(ForkBB);
+  for (unsigned i = 0, e = Args.size(); i != e; ++i)
+    ForkBuilder.CreateStore(TopArgs[i],
+                            ForkBuilder.CreateStructGEP(ClosureTy, Closure,
+                                                        i));
+
+  // Create the outlined parallel region.
+  Type *Int32Ty = Type::getInt32Ty(C);
+  Type *Int32PtrTy = PointerType::getUnqual(Int32Ty);
+  Type *MicroParams[] = {Int32PtrTy, Int32PtrTy,
+                         PointerType::getUnqual(ClosureTy)};
+  FunctionType *MicroTy = FunctionType::get(Type::getVoidTy(C), MicroParams,
+                                            false);
+  Function *Micro = Function::Create(MicroTy, GlobalValue::InternalLinkage,
+                                     Helper->getName() + ".OMP", M);
+  Function::arg_iterator MicroArg = Micro->arg_begin();
+  Argument *GTIDArg = &*MicroArg++;
+  GTIDArg->setName(".global_tid.");
+  (&*MicroArg++)->setName(".bound_tid.");
+  Argument *ClosureArg = &*MicroArg;
+  ClosureArg->setName("closure");
+
+  BasicBlock *Entry = BasicBlock::Create(C, "entry", Micro);
+  IRBuilder<> B(Entry);
+  Value *GTID = B.CreateLoad(GTIDArg, "gtid");
+  SmallVector<Value *, 8> HelperArgs;
+  for (unsigned i = 0, e = Args.size(); i != e; ++i)
+    HelperArgs.push_back(B.CreateLoad(B.CreateStructGEP(ClosureTy, ClosureArg,
+                                                        i)));
+
+  // The runtime works on 32-bit or 64-bit unsigned iteration spaces.
+  Type *IterTy = HelperArgs[IterArgNo]->getType();
+  bool Use64 = IterTy->getIntegerBitWidth() > 32;
+  Type *RTIterTy = Use64 ? Type::getInt64Ty(C) : Int32Ty;
+  Value *UpperBound = B.CreateZExt(HelperArgs[IterArgNo + 1], RTIterTy);
+  Value *Chunk = B.CreateZExt(HelperArgs[IterArgNo + 2], RTIterTy);
+  Chunk = B.CreateSelect(B.CreateICmpEQ(Chunk, ConstantInt::get(RTIterTy, 0)),
+                         ConstantInt::get(RTIterTy, 1), Chunk, "chunk");
+  AllocaInst *LastIter = B.CreateAlloca(Int32Ty, nullptr, "last");
+  AllocaInst *LowerPtr = B.CreateAlloca(RTIterTy, nullptr, "lb");
+  AllocaInst *UpperPtr = B.CreateAlloca(RTIterTy, nullptr, "ub");
+  AllocaInst *StridePtr = B.CreateAlloca(RTIterTy, nullptr, "stride");
+  B.CreateStore(ConstantInt::get(Int32Ty, 0), LastIter);
+  B.CreateStore(ConstantInt::get(RTIterTy, 0), LowerPtr);
+  B.CreateStore(UpperBound, UpperPtr);
+  B.CreateStore(ConstantInt::get(RTIterTy, 1), StridePtr);
+
+  // Call the helper on the chunk [lb, ub] assigned to this thread.
+  auto EmitChunk = [&](IRBuilder<> &B) {
+    Value *Lower = B.CreateLoad(LowerPtr);
+    Value *Upper = B.CreateLoad(UpperPtr);
+    HelperArgs[IterArgNo] = B.CreateTrunc(Lower, IterTy);
+    HelperArgs[IterArgNo + 1] = B.CreateTrunc(Upper, IterTy);
+    CallInst *Call = B.CreateCall(Helper, HelperArgs);
+    Call->setCallingConv(Helper->getCallingConv());
+  };
 
-  std::vector<Value *> OMPNestedRegionFnArgs;
-  auto ArgIt = ExtractedFnCI->arg_begin();
-  ++ArgIt;
-  // Append the rest of the region's arguments.
-  while (ArgIt != ExtractedFnCI->arg_end()) {
-    OMPRegionFnArgs.push_back(ArgIt->get());
-    ++ArgIt;
+  if (LoopSpawningHints::SCHED_STATIC == Schedule) {
+    // The runtime deals out chunks of the grainsize round-robin, and gives
+    // each thread its first chunk and the stride to its next one.
+    Value *InitFn = createRuntimeFunction(
+        Use64 ? OMPRTL__kmpc_for_static_init_8u :
+        OMPRTL__kmpc_for_static_init_4u, M);
+    emitRuntimeCall(InitFn, {Loc, GTID,
+                             ConstantInt::get(Int32Ty, OMP_sch_static_chunked),
+                             LastIter, LowerPtr, UpperPtr, StridePtr,
+                             ConstantInt::get(RTIterTy, 1), Chunk}, "", B);
+    BasicBlock *Cond = BasicBlock::Create(C, "omp.static.cond", Micro);
+    BasicBlock *Body = BasicBlock::Create(C, "omp.static.body", Micro);
+    BasicBlock *Exit = BasicBlock::Create(C, "omp.static.exit", Micro);
+    B.CreateBr(Cond);
+    B.SetInsertPoint(Cond);
+    // The runtime does not clamp the upper bound of the last chunk.
+    Value *Upper = B.CreateLoad(UpperPtr);
+    B.CreateStore(B.CreateSelect(B.CreateICmpUGT(Upper, UpperBound),
+                                 UpperBound, Upper), UpperPtr);
+    B.CreateCondBr(B.CreateICmpULE(B.CreateLoad(LowerPtr),
+                                   B.CreateLoad(UpperPtr)), Body, Exit);
+    B.SetInsertPoint(Body);
+    EmitChunk(B);
+    Value *Stride = B.CreateLoad(StridePtr);
+    B.CreateStore(B.CreateAdd(B.CreateLoad(LowerPtr), Stride), LowerPtr);
+    B.CreateStore(B.CreateAdd(B.CreateLoad(UpperPtr), Stride), UpperPtr);
+    B.CreateBr(Cond);
+    B.SetInsertPoint(Exit);
+    emitRuntimeCall(createRuntimeFunction(OMPRTL__kmpc_for_static_fini, M),
+                    {Loc, GTID}, "", B);
+    B.CreateRetVoid();
+  } else {
+    // Threads repeatedly ask the runtime for chunks of at least the grainsize.
+    OpenMPSchedType Sched =
+      (LoopSpawningHints::SCHED_GUIDED == Schedule) ? OMP_sch_guided_chunked :
+      OMP_sch_dynamic_chunked;
+    Value *InitFn = createRuntimeFunction(
+        Use64 ? OMPRTL__kmpc_dispatch_init_8u :
+        OMPRTL__kmpc_dispatch_init_4u, M);
+    emitRuntimeCall(InitFn, {Loc, GTID, ConstantInt::get(Int32Ty, Sched),
+                             ConstantInt::get(RTIterTy, 0), UpperBound,
+                             ConstantInt::get(RTIterTy, 1), Chunk}, "", B);
+    BasicBlock *Next = BasicBlock::Create(C, "omp.dispatch.next", Micro);
+    BasicBlock *Body = BasicBlock::Create(C, "omp.dispatch.body", Micro);
+    BasicBlock *Exit = BasicBlock::Create(C, "omp.dispatch.exit", Micro);
+    B.CreateBr(Next);
+    B.SetInsertPoint(Next);
+    Value *NextFn = createRuntimeFunction(
+        Use64 ? OMPRTL__kmpc_dispatch_next_8u :
+        OMPRTL__kmpc_dispatch_next_4u, M);
+    Value *More = emitRuntimeCall(NextFn, {Loc, GTID, LastIter, LowerPtr,
+                                           UpperPtr, StridePtr}, "", B);
+    B.CreateCondBr(B.CreateICmpNE(More, ConstantInt::get(Int32Ty, 0)),
+                   Body, Exit);
+    B.SetInsertPoint(Body);
+    EmitChunk(B);
+    B.CreateBr(Next);
+    B.SetInsertPoint(Exit);
+    B.CreateRetVoid();
   }
 
-  auto ForkRTFn = createRuntimeFunction(
-      OpenMPRuntimeFunction::OMPRTL__kmpc_fork_call, F.getParent());
-  // Replace the old call with __kmpc_fork_call
-  auto *ForkCall = emitRuntimeCall(ForkRTFn, OMPRegionFnArgs, "", b);
-  ExtractedFnCI->eraseFromParent();
-  RegionFn->eraseFromParent();
-}
-
-void llvm::OpenMPABI::postProcessHelper(Function &F) {}
+  // Fork the parallel region.  The threads join before __kmpc_fork_call
+  // returns, which takes the place of the sync of the loop.
+  Value *ForkFn = createRuntimeFunction(OMPRTL__kmpc_fork_call, M);
+  emitRuntimeCall(ForkFn, {Loc, ConstantInt::get(Int32Ty, 1),
+                           ForkBuilder.CreateBitCast(
+                               Micro, getKmpc_MicroPointerTy(C)),
+                           Closure}, "", ForkBuilder);
+  ForkBuilder.CreateRetVoid();
 
-bool llvm::OpenMPABI::processMain(Function &F) { 
-  return false; 
+  return Builder.CreateCall(Top, Args);
 }
@@ -13,8 +13,10 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Tapir/Outline.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
@@ -367,6 +369,79 @@ Function *llvm::CreateHelper(const ValueSet &Inputs,
   return NewFunc;
 }
 
+/// Return true if the input I is cheap to recompute in a helper, i.e., it is a
+/// simple arithmetic or address computation that cannot trap or access memory.
+static bool isCheapToRematerialize(const Instruction *I) {
+  if (!isa<CastInst>(I) && !isa<GetElementPtrInst>(I) &&
+      !isa<BinaryOperator>(I) && !isa<CmpInst>(I))
+    return false;
+  return !I->mayReadOrWriteMemory() && isSafeToSpeculativelyExecute(I);
+}
+
+// Find the inputs that a helper can recompute from its other inputs.  An input
+// is recomputed only if all of its operands are constants or inputs themselves,
+// so that recomputing it never adds an argument.
+void llvm::findRematerializableInputs(const ValueSet &Inputs,
+                                      ValueSet &Remat) {
+  for (Value *V : Inputs) {
+    Instruction *I = dyn_cast<Instruction>(V);
+    if (!I || !isCheapToRematerialize(I))
+      continue;
+    if (all_of(I->operands(), [&](const Value *Op) {
+          return isa<Constant>(Op) || Inputs.count(const_cast<Value *>(Op));
+        }))
+      Remat.insert(I);
+  }
+}
+
+HelperInputMaterializer::HelperInputMaterializer(
+    ValueToValueMapTy &VMap, const ValueSet &Remat, const BasicBlock *OldEntry,
+    const StringRef NameSuffix, AllocaInst *Frame, ArrayRef<Value *> Packed)
+    : VMap(VMap), Remat(Remat), OldEntry(OldEntry), NameSuffix(NameSuffix),
+      Frame(Frame) {
+  for (unsigned i = 0, e = Packed.size(); i != e; ++i)
+    FrameFields[Packed[i]] = i;
+}
+
+/// Get the value of input V in the helper, materializing it if necessary.
+Value *HelperInputMaterializer::mapInput(Value *V) {
+  if (Value *NewV = VMap.lookup(V))
+    return NewV;
+  Value *NewV = materialize(V);
+  assert(NewV && "Input of helper is neither passed nor materialized.");
+  VMap[V] = NewV;
+  return NewV;
+}
+
+Value *HelperInputMaterializer::materialize(Value *V) {
+  bool IsPacked = FrameFields.count(V);
+  if (!IsPacked && !Remat.count(V))
+    return nullptr;
+
+  // CreateHelper maps OldEntry to the entry block of the helper before cloning
+  // any blocks into it, and terminates that block afterwards.
+  BasicBlock *Entry = cast<BasicBlock>(VMap[OldEntry]);
+  IRBuilder<> B(Entry);
+
+  if (IsPacked) {
+    StructType *FrameTy = cast<StructType>(Frame->getAllocatedType());
+    Value *Field = B.CreateStructGEP(FrameTy, VMap[Frame], FrameFields[V]);
+    return B.CreateLoad(Field, V->getName() + NameSuffix);
+  }
+
+  // Recompute the instruction from the values of its operands in the helper.
+  // The debug location of the instruction belongs to the parent, so drop it.
+  Instruction *I = cast<Instruction>(V);
+  Instruction *NewI = I->clone();
+  for (Use &Op : NewI->operands())
+    if (!isa<Constant>(Op))
+      Op.set(mapInput(Op.get()));
+  NewI->setDebugLoc(DebugLoc());
+  if (I->hasName())
+    return B.Insert(NewI, I->getName() + NameSuffix);
+  return B.Insert(NewI);
+}
+
 // Add alignment assumptions to parameters of outlined function, based on known
 // alignment data in the caller.
 void llvm::AddAlignmentAssumptions(
@@ -376,6 +451,9 @@ void llvm::AddAlignmentAssumptions(
   for (Value *ArgVal : Inputs) {
     // Ignore arguments to non-pointer types
     if (!ArgVal->getType()->isPointerTy()) continue;
+    // Ignore placeholder arguments, which have no value in the caller.
+    if (isa<Argument>(ArgVal) && !cast<Argument>(ArgVal)->getParent())
+      continue;
     Argument *Arg = cast<Argument>(VMap[ArgVal]);
     // Ignore arguments to non-pointer types
     if (!Arg->getType()->isPointerTy()) continue;
@@ -38,6 +38,9 @@ typedef void (qt_sinc_expect_t)(sync_t* s, size_t incr);
 typedef void (qt_sinc_submit_t)(sync_t* s, void* val); 
 typedef void (qt_sinc_wait_t)(sync_t* s, void* target); 
 typedef void (qt_sinc_destroy_t)(sync_t* s);  
+typedef void (*qt_loop_f)(size_t startat, size_t stopat, void *arg);
+typedef void (qt_loop_balance_t)(size_t start, size_t stop, qt_loop_f func,
+                                 void *argptr);
 
 #define QTHREAD_FUNC(name, CGF) get_##name(CGF)
 
@@ -58,6 +61,7 @@ DEFAULT_GET_QTHREAD_FUNC(qt_sinc_expect)
 DEFAULT_GET_QTHREAD_FUNC(qt_sinc_submit)
 DEFAULT_GET_QTHREAD_FUNC(qt_sinc_wait)
 DEFAULT_GET_QTHREAD_FUNC(qt_sinc_destroy)
+DEFAULT_GET_QTHREAD_FUNC(qt_loop_balance)
 
 QthreadsABI::QthreadsABI() { }
 QthreadsABI::~QthreadsABI() { }
@@ -267,3 +271,110 @@ bool QthreadsABI::processMain(Function &F) {
   return true;
 }
 
+/// \brief qthread_fork_copyargs copies the argument struct into a new qthread
+/// and the sinc is updated on both the spawn and the return.
+unsigned QthreadsABI::getSpawnCost() const {
+  return 150;
+}
+
+/// \brief With a single worker, every forked qthread runs after its parent
+/// blocks on the sinc.
+Value *QthreadsABI::createSerialDispatchCheck(Instruction *InsertBefore) {
+  Module &M = *InsertBefore->getModule();
+  IRBuilder<> B(InsertBefore);
+  Value *NWorkers = B.CreateCall(QTHREAD_FUNC(qthread_num_workers, M), {},
+                                 "nworkers");
+  return B.CreateICmpULE(NWorkers, ConstantInt::get(NWorkers->getType(), 1),
+                         "single.worker");
+}
+
+
+LoopOutline *QthreadsABI::getLoopSpawning(Loop *L, unsigned Grainsize,
+                                          unsigned MaxGrainsize,
+                                          ScalarEvolution &SE, LoopInfo *LI,
+                                          DominatorTree *DT,
+                                          AssumptionCache *AC,
+                                          OptimizationRemarkEmitter &ORE) {
+  return new QthreadsABILoopSpawning(L, Grainsize, SE, LI, DT, AC, ORE, this,
+                                     MaxGrainsize);
+}
+
+/// Each call to the helper executes the chunk of iterations it is given
+/// serially.
+void QthreadsABILoopSpawning::implementDACIterSpawnOnHelper(
+    Function *Helper, BasicBlock *Preheader, BasicBlock *Header,
+    PHINode *CanonicalIV, Argument *Limit, Argument *Grainsize,
+    Instruction *SyncRegion, Instruction *LeafExit, DominatorTree *DT,
+    LoopInfo *LI, bool CanonicalIVFlagNUW, bool CanonicalIVFlagNSW) {
+  serializeLoopOnHelper(Header, SyncRegion, LeafExit, DT);
+}
+
+/// Replace the call to the helper with a call to qt_loop_balance.  The
+/// arguments of the helper are stored once in a frame on the stack of the
+/// caller, which qt_loop_balance passes by pointer to a wrapper around the
+/// helper for each chunk of iterations.  qt_loop_balance returns once every
+/// chunk is done, which takes the place of the sync of the loop.
+CallInst *QthreadsABILoopSpawning::createTopCall(IRBuilder<> &Builder,
+                                                 Function *Helper,
+                                                 ArrayRef<Value *> Args,
+                                                 unsigned IterArgNo) {
+  Function *F = Builder.GetInsertBlock()->getParent();
+  Module *M = F->getParent();
+  LLVMContext &C = M->getContext();
+  Function *LoopBalance = QTHREAD_FUNC(qt_loop_balance, *M);
+  FunctionType *ChunkFnTy = cast<FunctionType>(
+      TypeBuilder<qt_loop_f, false>::get(C)->getPointerElementType());
+  Type *SizeTy = ChunkFnTy->getParamType(0);
+
+  // Store the arguments of the helper in the shared frame.
+  SmallVector<Type *, 8> ArgTys;
+  for (Value *V : Args)
+    ArgTys.push_back(V->getType());
+  StructType *FrameTy = StructType::create(ArgTys,
+                                           Helper->getName().str() + ".args");
+  AllocaInst *Frame;
+  {
+    IRBuilder<> AllocaBuilder(&*F->getEntryBlock().getFirstInsertionPt());
+    Frame = AllocaBuilder.CreateAlloca(FrameTy, nullptr,
+                                       Helper->getName() + ".args");
+  }
+  for (unsigned i = 0, e = Args.size(); i != e; ++i)
+    Builder.CreateStore(Args[i], Builder.CreateStructGEP(FrameTy, Frame, i));
+
+  // Create the wrapper that runs the chunk [startat, stopat).
+  Function *ChunkFn = Function::Create(ChunkFnTy, GlobalValue::InternalLinkage,
+                                       Helper->getName() + ".qt", M);
+  ChunkFn->addFnAttr(Attribute::NoUnwind);
+  Function::arg_iterator ChunkArg = ChunkFn->arg_begin();
+  Argument *StartAt = &*ChunkArg++;
+  StartAt->setName("startat");
+  Argument *StopAt = &*ChunkArg++;
+  StopAt->setName("stopat");
+  Argument *FramePtr = &*ChunkArg;
+  FramePtr->setName("frame");
+  {
+    IRBuilder<> B(BasicBlock::Create(C, "entry", ChunkFn));
+    Value *ChunkFrame = B.CreateBitCast(FramePtr,
+                                        PointerType::getUnqual(FrameTy));
+    SmallVector<Value *, 8> HelperArgs;
+    for (unsigned i = 0, e = Args.size(); i != e; ++i)
+      HelperArgs.push_back(B.CreateLoad(B.CreateStructGEP(FrameTy, ChunkFrame,
+                                                          i)));
+    // The helper takes the last iteration of its chunk.
+    Type *IterTy = Args[IterArgNo]->getType();
+    HelperArgs[IterArgNo] = B.CreateZExtOrTrunc(StartAt, IterTy);
+    HelperArgs[IterArgNo + 1] = B.CreateZExtOrTrunc(
+        B.CreateSub(StopAt, ConstantInt::get(SizeTy, 1)), IterTy);
+    CallInst *Call = B.CreateCall(Helper, HelperArgs);
+    Call->setCallingConv(Helper->getCallingConv());
+    B.CreateRetVoid();
+  }
+
+  // The loop runs iterations [0, limit].
+  Value *Stop = Builder.CreateAdd(
+      Builder.CreateZExtOrTrunc(Args[IterArgNo + 1], SizeTy),
+      ConstantInt::get(SizeTy, 1));
+  return Builder.CreateCall(
+      LoopBalance, {ConstantInt::get(SizeTy, 0), Stop, ChunkFn,
+                    Builder.CreateBitCast(Frame, Type::getInt8PtrTy(C))});
+}
@@ -0,0 +1,335 @@
+//===- RecursionCutoff.cpp - Serialize the leaves of recursive spawns -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass coarsens divide-and-conquer functions that spawn recursively.  For
+// each function that spawns and calls itself, the pass creates a serial clone
+// with every detach serialized, and it guards the parallel function so that it
+// calls the serial clone once the recursion is small enough.
+//
+// The recursion is small enough when an argument that shrinks on every
+// recursive call, as determined by ScalarEvolution, falls below a cutoff.  If
+// no such argument exists, the recursion depth is threaded through a clone of
+// the function instead, provided a depth cutoff is given.  The cutoff comes
+// from the function's !tapir.recursion.cutoff metadata, if present, or from the
+// command line.  Since any shrinking argument, including a depth that counts
+// down, is taken as the size, the pass only runs in the standard pipeline when
+// enabled with -enable-recursion-cutoff.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir.h"
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "recursion-cutoff"
+
+STATISTIC(SizeCutoffs, "Number of recursive functions cut off by size");
+STATISTIC(DepthCutoffs, "Number of recursive functions cut off by depth");
+
+static cl::opt<unsigned> ClSizeCutoff(
+    "rc-size-cutoff", cl::init(16), cl::Hidden,
+    cl::desc("Size below which a recursive spawning function calls its serial "
+             "clone"));
+
+static cl::opt<unsigned> ClDepthCutoff(
+    "rc-depth-cutoff", cl::init(0), cl::Hidden,
+    cl::desc("Recursion depth at which a recursive spawning function without "
+             "a size argument calls its serial clone (0 = disabled)"));
+
+/// Returns the cutoff specified in the !tapir.recursion.cutoff metadata of
+/// \p F, or 0 if there is none.
+static unsigned getCutoffHint(const Function &F) {
+  if (MDNode *MD = F.getMetadata("tapir.recursion.cutoff"))
+    if (MD->getNumOperands() == 1)
+      if (ConstantInt *C = mdconst::dyn_extract<ConstantInt>(MD->getOperand(0)))
+        return C->getZExtValue();
+  return 0;
+}
+
+/// Returns true if \p V divides \p Formal by a constant greater than 1.
+static bool isDivisionOf(const Value *V, const Argument *Formal) {
+  const BinaryOperator *BO = dyn_cast<BinaryOperator>(V);
+  if (!BO || BO->getOperand(0) != Formal)
+    return false;
+  const ConstantInt *C = dyn_cast<ConstantInt>(BO->getOperand(1));
+  if (!C)
+    return false;
+  switch (BO->getOpcode()) {
+  case Instruction::UDiv:
+    return C->getValue().ugt(1);
+  case Instruction::SDiv:
+    return C->getValue().sgt(1);
+  case Instruction::LShr:
+  case Instruction::AShr:
+    return !C->isZero();
+  default:
+    return false;
+  }
+}
+
+/// Returns true if \p Actual, passed for \p Formal in a recursive call, is
+/// smaller than \p Formal.
+static bool isShrinkingArg(Value *Actual, Argument *Formal,
+                           ScalarEvolution &SE) {
+  // Recognize the halving of a signed size, n / 2 and n - n / 2, which
+  // ScalarEvolution cannot reason about.
+  if (isDivisionOf(Actual, Formal))
+    return true;
+  if (BinaryOperator *BO = dyn_cast<BinaryOperator>(Actual))
+    if (BO->getOpcode() == Instruction::Sub && BO->getOperand(0) == Formal &&
+        isDivisionOf(BO->getOperand(1), Formal))
+      return true;
+
+  if (Actual->getType() != Formal->getType() ||
+      !SE.isSCEVable(Formal->getType()))
+    return false;
+  const SCEV *Diff = SE.getMinusSCEV(SE.getSCEV(Formal), SE.getSCEV(Actual));
+  return !Diff->isZero() && SE.isKnownNonNegative(Diff);
+}
+
+/// Returns an integer argument of \p F that shrinks in every call in
+/// \p RecursiveCalls, or nullptr if there is none.
+static Argument *findSizeArg(Function &F, ArrayRef<CallSite> RecursiveCalls,
+                             ScalarEvolution &SE) {
+  for (Argument &Arg : F.args()) {
+    if (!Arg.getType()->isIntegerTy())
+      continue;
+    if (all_of(RecursiveCalls, [&](CallSite CS) {
+          return isShrinkingArg(CS.getArgument(Arg.getArgNo()), &Arg, SE);
+        }))
+      return &Arg;
+  }
+  return nullptr;
+}
+
+/// Returns true if the size argument \p Size holds an unsigned value.  Size is
+/// unsigned if it is zero-extended, divided with unsigned operations in the
+/// recursive calls \p RecursiveCalls, or compared with unsigned predicates.
+static bool isUnsignedSize(Argument *Size, ArrayRef<CallSite> RecursiveCalls) {
+  if (Size->hasAttribute(Attribute::ZExt))
+    return true;
+  if (Size->hasAttribute(Attribute::SExt))
+    return false;
+
+  auto GetSignedness = [](const Value *V) -> Optional<bool> {
+    if (const BinaryOperator *BO = dyn_cast<BinaryOperator>(V))
+      switch (BO->getOpcode()) {
+      case Instruction::UDiv:
+      case Instruction::LShr:
+        return true;
+      case Instruction::SDiv:
+      case Instruction::AShr:
+        return false;
+      default:
+        break;
+      }
+    if (const ICmpInst *Cmp = dyn_cast<ICmpInst>(V))
+      if (Cmp->isRelational())
+        return Cmp->isUnsigned();
+    return None;
+  };
+  for (CallSite CS : RecursiveCalls) {
+    Value *Actual = CS.getArgument(Size->getArgNo());
+    if (BinaryOperator *BO = dyn_cast<BinaryOperator>(Actual))
+      if (BO->getOpcode() == Instruction::Sub && BO->getOperand(0) == Size)
+        Actual = BO->getOperand(1);
+    if (Optional<bool> Unsigned = GetSignedness(Actual))
+      return *Unsigned;
+  }
+  for (const User *U : Size->users())
+    if (Optional<bool> Unsigned = GetSignedness(U))
+      return *Unsigned;
+  return false;
+}
+
+/// Create a clone of \p F that takes the depth of the recursion as an
+/// additional, final argument.
+static Function *createDepthClone(Function &F) {
+  FunctionType *FTy = F.getFunctionType();
+  SmallVector<Type *, 8> Params(FTy->param_begin(), FTy->param_end());
+  Params.push_back(Type::getInt32Ty(F.getContext()));
+  FunctionType *DepthFTy =
+    FunctionType::get(FTy->getReturnType(), Params, FTy->isVarArg());
+
+  Function *Depth = Function::Create(DepthFTy, GlobalValue::InternalLinkage,
+                                     F.getName() + ".depth", F.getParent());
+  ValueToValueMapTy VMap;
+  Function::arg_iterator DestI = Depth->arg_begin();
+  for (Argument &Arg : F.args()) {
+    DestI->setName(Arg.getName());
+    VMap[&Arg] = &*DestI++;
+  }
+  DestI->setName("depth");
+
+  SmallVector<ReturnInst *, 8> Returns;
+  CloneFunctionInto(Depth, &F, VMap, /*ModuleLevelChanges=*/false, Returns);
+  Depth->setVisibility(GlobalValue::DefaultVisibility);
+  Depth->setDLLStorageClass(GlobalValue::DefaultStorageClass);
+  return Depth;
+}
+
+/// Replace the recursive call \p CS with a call to \p NewCallee that passes
+/// \p ExtraArg after the original arguments.
+static void redirectRecursiveCall(CallSite CS, Function *NewCallee,
+                                  Value *ExtraArg) {
+  Instruction *Call = CS.getInstruction();
+  SmallVector<Value *, 8> Args(CS.arg_begin(), CS.arg_end());
+  Args.push_back(ExtraArg);
+
+  CallSite NewCS;
+  if (InvokeInst *II = dyn_cast<InvokeInst>(Call)) {
+    NewCS = InvokeInst::Create(NewCallee, II->getNormalDest(),
+                               II->getUnwindDest(), Args, "", Call);
+  } else {
+    CallInst *NewCI = CallInst::Create(NewCallee, Args, "", Call);
+    NewCI->setTailCallKind(cast<CallInst>(Call)->getTailCallKind());
+    NewCS = NewCI;
+  }
+  NewCS.setCallingConv(CS.getCallingConv());
+  NewCS.setAttributes(CS.getAttributes());
+  NewCS->setDebugLoc(Call->getDebugLoc());
+  NewCS->takeName(Call);
+  Call->replaceAllUsesWith(NewCS.getInstruction());
+  Call->eraseFromParent();
+}
+
+namespace {
+struct RecursionCutoff : public ModulePass {
+  static char ID; // Pass identification, replacement for typeid
+  RecursionCutoff() : ModulePass(ID) {
+    initializeRecursionCutoffPass(*PassRegistry::getPassRegistry());
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+  }
+
+  bool runOnModule(Module &M) override;
+
+private:
+  bool processFunction(Function &F);
+};
+}
+
+bool RecursionCutoff::processFunction(Function &F) {
+  if (F.isDeclaration() || F.isVarArg() || F.isInterposable() ||
+      hasDetachedRethrow(F))
+    return false;
+
+  // Find the recursive calls of a function that spawns.
+  bool Spawns = false;
+  SmallVector<CallSite, 4> RecursiveCalls;
+  for (BasicBlock &BB : F) {
+    if (isa<DetachInst>(BB.getTerminator()))
+      Spawns = true;
+    for (Instruction &I : BB) {
+      CallSite CS(&I);
+      if (!CS)
+        continue;
+      if (CS.getCalledFunction() == &F)
+        RecursiveCalls.push_back(CS);
+    }
+  }
+  if (!Spawns || RecursiveCalls.empty())
+    return false;
+
+  unsigned Hint = getCutoffHint(F);
+  ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
+  if (Argument *Size = findSizeArg(F, RecursiveCalls, SE)) {
+    unsigned Cutoff = Hint ? Hint : ClSizeCutoff;
+    DEBUG(dbgs() << "RecursionCutoff: serializing " << F.getName()
+          << " below size " << Cutoff << " of argument " << *Size << "\n");
+    Function *Serial = GetOrCreateSerialClone(F);
+    bool Unsigned = isUnsignedSize(Size, RecursiveCalls);
+    InsertSerialGuard(F, Serial, [&](IRBuilder<> &B) {
+        Constant *Limit = ConstantInt::get(Size->getType(), Cutoff);
+        return Unsigned ? B.CreateICmpULT(Size, Limit, "size.cutoff")
+                        : B.CreateICmpSLT(Size, Limit, "size.cutoff");
+      }, "serial.cutoff");
+    ++SizeCutoffs;
+    return true;
+  }
+
+  unsigned Cutoff = Hint ? Hint : ClDepthCutoff;
+  if (!Cutoff)
+    return false;
+  DEBUG(dbgs() << "RecursionCutoff: serializing " << F.getName()
+        << " below depth " << Cutoff << "\n");
+  Function *Serial = GetOrCreateSerialClone(F);
+  Function *Depth = createDepthClone(F);
+  Type *Int32Ty = Type::getInt32Ty(F.getContext());
+
+  // Thread the depth of the recursion through the depth clone.
+  for (CallSite CS : RecursiveCalls)
+    redirectRecursiveCall(CS, Depth, ConstantInt::get(Int32Ty, 1));
+  Argument *DepthArg = &*std::prev(Depth->arg_end());
+  SmallVector<CallSite, 4> DepthCalls;
+  for (Instruction &I : instructions(Depth))
+    if (CallSite CS = CallSite(&I))
+      if (CS.getCalledFunction() == &F)
+        DepthCalls.push_back(CS);
+  for (CallSite CS : DepthCalls) {
+    IRBuilder<> B(CS.getInstruction());
+    redirectRecursiveCall(
+        CS, Depth, B.CreateAdd(DepthArg, ConstantInt::get(Int32Ty, 1)));
+  }
+
+  // The serial clone does not take the depth, so the guard passes it all but
+  // the last argument of the depth clone.
+  InsertSerialGuard(*Depth, Serial, [&](IRBuilder<> &B) {
+      return B.CreateICmpUGE(DepthArg, ConstantInt::get(Int32Ty, Cutoff),
+                             "depth.cutoff");
+    }, "serial.cutoff");
+  ++DepthCutoffs;
+  return true;
+}
+
+bool RecursionCutoff::runOnModule(Module &M) {
+  if (skipModule(M))
+    return false;
+
+  // Collect the functions first, since the pass adds clones to the module.
+  SmallVector<Function *, 16> Functions;
+  for (Function &F : M)
+    Functions.push_back(&F);
+
+  bool Changed = false;
+  for (Function *F : Functions)
+    Changed |= processFunction(*F);
+  return Changed;
+}
+
+char RecursionCutoff::ID = 0;
+static const char RC_NAME[] = "recursion-cutoff";
+static const char rc_name[] = "Cut off recursive spawning";
+INITIALIZE_PASS_BEGIN(RecursionCutoff, RC_NAME, rc_name, false, false)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
+INITIALIZE_PASS_END(RecursionCutoff, RC_NAME, rc_name, false, false)
+
+namespace llvm {
+ModulePass *createRecursionCutoffPass() {
+  return new RecursionCutoff();
+}
+}
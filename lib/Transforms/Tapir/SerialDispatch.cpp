@@ -0,0 +1,202 @@
+//===- SerialDispatch.cpp - Dispatch spawning functions to serial clones --===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass avoids the overhead of the runtime protocol for spawns that cannot
+// gain parallelism.  For each function that spawns, the pass creates a serial
+// elision of the function and moves the body of the function into a parallel
+// clone.  The function itself becomes an entry point that checks a condition
+// provided by the Tapir target, e.g., that the runtime has a single worker,
+// and calls the serial elision if the condition holds and the parallel clone
+// otherwise.  Within the serial elisions and the parallel clones, calls to
+// spawning functions call the serial elisions and parallel clones directly, so
+// that neither a serial nor a parallel execution checks the condition more
+// than once.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir.h"
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Config/config.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Tapir/TapirUtils.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "serial-dispatch"
+
+STATISTIC(FunctionsDispatched, "Number of spawning functions dispatched to "
+          "serial clones");
+STATISTIC(CallsRedirected, "Number of calls in serial and parallel clones "
+          "redirected to clones");
+
+static cl::opt<TapirTargetType> ClTapirTarget(
+    "sd-tapir-target", cl::desc("Target runtime for Tapir"),
+    cl::init(TapirTargetType::TAPIR_DEFAULT_TARGET),
+    cl::values(clEnumValN(TapirTargetType::None,
+                          "none", "None"),
+               clEnumValN(TapirTargetType::Serial,
+                          "serial", "Serial code"),
+               clEnumValN(TapirTargetType::Cilk,
+                          "cilk", "Cilk Plus"),
+               clEnumValN(TapirTargetType::CilkR,
+                          "cilkr", "CilkR"),
+               clEnumValN(TapirTargetType::OpenMP,
+                          "openmp", "OpenMP"),
+               clEnumValN(TapirTargetType::Qthreads,
+                          "qthreads", "Qthreads"),
+               clEnumValN(TapirTargetType::TBB,
+                          "tbb", "Intel TBB")));
+
+/// Returns true if a serial clone of \p F can replace calls to \p F.
+static bool canDispatch(const Function &F) {
+  if (F.isDeclaration() || F.isVarArg() || F.isInterposable() ||
+      hasDetachedRethrow(F))
+    return false;
+
+  for (const BasicBlock &BB : F)
+    if (isa<DetachInst>(BB.getTerminator()))
+      return true;
+  return false;
+}
+
+/// Move the body of \p F into a new internal function, and make \p F call that
+/// function.  Return the new function.
+static Function *moveBodyToParallelClone(Function &F) {
+  Function *Parallel = Function::Create(F.getFunctionType(),
+                                        GlobalValue::InternalLinkage,
+                                        F.getName() + ".parallel",
+                                        F.getParent());
+  Parallel->copyAttributesFrom(&F);
+  Parallel->setVisibility(GlobalValue::DefaultVisibility);
+  Parallel->setDLLStorageClass(GlobalValue::DefaultStorageClass);
+  Parallel->copyMetadata(&F, 0);
+  // A subprogram describes only one function.
+  F.setSubprogram(nullptr);
+
+  Parallel->getBasicBlockList().splice(Parallel->begin(),
+                                       F.getBasicBlockList());
+  SmallVector<Value *, 8> Args;
+  for (auto ArgPair : zip(F.args(), Parallel->args())) {
+    Argument &Arg = std::get<0>(ArgPair), &ParArg = std::get<1>(ArgPair);
+    ParArg.setName(Arg.getName());
+    Arg.replaceAllUsesWith(&ParArg);
+    Args.push_back(&Arg);
+  }
+
+  IRBuilder<> B(BasicBlock::Create(F.getContext(), "entry", &F));
+  CallInst *Call = B.CreateCall(Parallel, Args);
+  Call->setCallingConv(F.getCallingConv());
+  AttributeList Attrs = F.getAttributes();
+  SmallVector<AttributeSet, 8> ParamAttrs;
+  for (Argument &Arg : F.args())
+    ParamAttrs.push_back(Attrs.getParamAttributes(Arg.getArgNo()));
+  Call->setAttributes(AttributeList::get(F.getContext(), AttributeSet(),
+                                         Attrs.getRetAttributes(),
+                                         ParamAttrs));
+  if (F.getReturnType()->isVoidTy())
+    B.CreateRetVoid();
+  else
+    B.CreateRet(Call);
+  return Parallel;
+}
+
+/// Make the calls in \p F to functions in \p Clones call their clones instead.
+static void redirectCalls(Function &F,
+                          const MapVector<Function *, Function *> &Clones) {
+  for (Instruction &I : instructions(F)) {
+    CallSite CS(&I);
+    if (!CS)
+      continue;
+    Function *Callee = CS.getCalledFunction();
+    if (!Callee || Callee == &F)
+      continue;
+    Function *Clone = Clones.lookup(Callee);
+    if (!Clone || Clone == Callee)
+      continue;
+    CS.setCalledFunction(Clone);
+    ++CallsRedirected;
+  }
+}
+
+namespace {
+struct SerialDispatch : public ModulePass {
+  static char ID; // Pass identification, replacement for typeid
+  TapirTarget* tapirTarget;
+  explicit SerialDispatch(TapirTarget* tapirTarget = nullptr)
+      : ModulePass(ID), tapirTarget(tapirTarget) {
+    if (!this->tapirTarget)
+      this->tapirTarget = getTapirTargetFromType(ClTapirTarget);
+
+    initializeSerialDispatchPass(*PassRegistry::getPassRegistry());
+  }
+
+  bool runOnModule(Module &M) override;
+};
+}
+
+bool SerialDispatch::runOnModule(Module &M) {
+  if (skipModule(M))
+    return false;
+
+  // Without a parallel runtime, there is nothing to dispatch on.
+  if (!tapirTarget)
+    return false;
+
+  // Create the serial clones first, so that each clone can call the others.
+  MapVector<Function *, Function *> SerialClones, ParallelClones;
+  for (Function &F : M)
+    if (canDispatch(F))
+      SerialClones[&F] = nullptr;
+  if (SerialClones.empty())
+    return false;
+  for (auto &FS : SerialClones)
+    FS.second = GetOrCreateSerialClone(*FS.first);
+  for (auto &FS : SerialClones)
+    ParallelClones[FS.first] = moveBodyToParallelClone(*FS.first);
+
+  for (auto &FS : SerialClones) {
+    Function *F = FS.first, *Serial = FS.second;
+
+    // A serial clone calls the serial clones of the functions it calls, and a
+    // parallel clone calls the parallel clones, including itself.
+    redirectCalls(*Serial, SerialClones);
+    redirectCalls(*ParallelClones[F], ParallelClones);
+
+    DEBUG(dbgs() << "SerialDispatch: dispatching " << F->getName() << " to "
+          << Serial->getName() << "\n");
+    InsertSerialGuard(*F, Serial, [&](IRBuilder<> &B) {
+        return tapirTarget->createSerialDispatchCheck(&*B.GetInsertPoint());
+      }, "serial.dispatch");
+    ++FunctionsDispatched;
+  }
+  return true;
+}
+
+char SerialDispatch::ID = 0;
+static const char SD_NAME[] = "serial-dispatch";
+static const char sd_name[] = "Dispatch spawning functions to serial clones";
+INITIALIZE_PASS(SerialDispatch, SD_NAME, sd_name, false, false)
+
+namespace llvm {
+ModulePass *createSerialDispatchPass(TapirTarget* tapirTarget) {
+  return new SerialDispatch(tapirTarget);
+}
+}
@@ -1,9 +1,32 @@
+//===- SmallBlock.cpp - Serialize detached regions that are too small -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass coarsens fine-grained parallelism by serializing detached regions
+// whose estimated serial cost is below the overhead of spawning them with the
+// selected Tapir target.
+//
+//===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Tapir.h"
 
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Config/config.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Function.h"
@@ -13,45 +36,155 @@
 
 using namespace llvm;
 
+#define DEBUG_TYPE "smallblock"
+
+STATISTIC(DetachesSerialized, "Number of detached regions serialized");
+
+static cl::opt<TapirTargetType> ClTapirTarget(
+    "sb-tapir-target", cl::desc("Target runtime for Tapir"),
+    cl::init(TapirTargetType::TAPIR_DEFAULT_TARGET),
+    cl::values(clEnumValN(TapirTargetType::None,
+                          "none", "None"),
+               clEnumValN(TapirTargetType::Serial,
+                          "serial", "Serial code"),
+               clEnumValN(TapirTargetType::Cilk,
+                          "cilk", "Cilk Plus"),
+               clEnumValN(TapirTargetType::CilkR,
+                          "cilkr", "CilkR"),
+               clEnumValN(TapirTargetType::OpenMP,
+                          "openmp", "OpenMP"),
+               clEnumValN(TapirTargetType::Qthreads,
+                          "qthreads", "Qthreads"),
+               clEnumValN(TapirTargetType::TBB,
+                          "tbb", "Intel TBB")));
+
+static cl::opt<unsigned> ClSpawnCost(
+    "sb-spawn-cost", cl::init(0), cl::Hidden,
+    cl::desc("Override the estimated cost of a spawn reported by the Tapir "
+             "target (default = use the target's cost)"));
+
 namespace {
 struct SmallBlock : public FunctionPass {
-  static const int threshold = 10;
   static char ID; // Pass identification, replacement for typeid
-  SmallBlock() : FunctionPass(ID) {
+  TapirTarget* tapirTarget;
+  explicit SmallBlock(TapirTarget* tapirTarget = nullptr)
+      : FunctionPass(ID), tapirTarget(tapirTarget) {
+    if (!this->tapirTarget)
+      this->tapirTarget = getTapirTargetFromType(ClTapirTarget);
+
     initializeSmallBlockPass(*PassRegistry::getPassRegistry());
   }
 
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequired<TargetTransformInfoWrapperPass>();
   }
 
-  bool attemptSmallBlock(DetachInst* det, DominatorTree& DT) {
-    //TODO generalize to handle if/etc (generally things without loops)
-    //TODO cost model
-    BasicBlock* current = det->getDetached();
-    size_t cost = 0;
-    while(current) {
-        for(Instruction& I : *current) {
-            if (isa<TerminatorInst>(&I)) break;
-            if (!isConstantOperation(&I, /*bool allowsyncregion=*/true))
-                return false;
-            cost += 1;
+  DominatorTree *DT;
+  LoopInfo *LI;
+  ScalarEvolution *SE;
+  const TargetTransformInfo *TTI;
+
+  /// Get the cost of a call to \p Callee, including the cost of executing
+  /// \p Callee itself, stopping once the cost reaches \p Threshold.  Only
+  /// callees without loops or calls of their own are costed; for any other
+  /// callee, \p Threshold is returned.
+  uint64_t getCalleeCost(const Function *Callee, uint64_t Threshold) {
+    if (!Callee || Callee->isDeclaration() || Callee->isInterposable())
+      return Threshold;
+
+    SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 4> Backedges;
+    FindFunctionBackedges(*Callee, Backedges);
+    if (!Backedges.empty())
+      return Threshold;
+
+    uint64_t Cost = 0;
+    for (const BasicBlock &BB : *Callee) {
+      if (isa<DetachInst>(BB.getTerminator()))
+        return Threshold;
+      for (const Instruction &I : BB) {
+        if (ImmutableCallSite CS = ImmutableCallSite(&I)) {
+          const Function *F = CS.getCalledFunction();
+          if (!F || TTI->isLoweredToCall(F))
+            return Threshold;
         }
-        auto term = current->getTerminator();
-        if (term->getNumSuccessors() != 1) return false;
-        if (isa<BranchInst>(term)) {
-            current = term->getSuccessor(0);
-            cost += 1;
-        } else if (isa<ReattachInst>(term)) {
-            break;
-        } else {
-            return false;
+        Cost += TTI->getUserCost(&I);
+        if (Cost >= Threshold)
+          return Threshold;
+      }
+    }
+    return Cost;
+  }
+
+  /// Estimate the serial cost of the region detached by \p Det, stopping once
+  /// the cost reaches \p Threshold.  Instructions inside loops in the region
+  /// are weighted by the maximum trip counts of those loops.  \p Threshold is
+  /// returned for regions containing nested spawns, loops without a constant
+  /// maximum trip count, calls that cannot be costed, or exceptional exits.
+  uint64_t getDetachedRegionCost(DetachInst *Det, uint64_t Threshold) {
+    SmallPtrSet<BasicBlock *, 32> FunctionPieces;
+    SmallVector<ReattachInst *, 8> Reattaches;
+    SmallPtrSet<BasicBlock *, 4> ExitBlocks;
+    if (!populateDetachedCFG(*Det, *DT, FunctionPieces, Reattaches, ExitBlocks,
+                             /*error=*/false))
+      return Threshold;
+    if (Reattaches.empty() || !ExitBlocks.empty())
+      return Threshold;
+
+    uint64_t Cost = 0;
+    for (BasicBlock *BB : FunctionPieces) {
+      if (isa<DetachInst>(BB->getTerminator()))
+        return Threshold;
+
+      // Scale the cost of this block by the trip counts of the loops in the
+      // region that contain it.
+      uint64_t Trips = 1;
+      for (Loop *L = LI->getLoopFor(BB);
+           L && FunctionPieces.count(L->getHeader()); L = L->getParentLoop()) {
+        unsigned MaxTrips = SE->getSmallConstantMaxTripCount(L);
+        if (!MaxTrips)
+          return Threshold;
+        Trips *= MaxTrips;
+        if (Trips >= Threshold)
+          return Threshold;
+      }
+
+      for (Instruction &I : *BB) {
+        uint64_t InstCost = TTI->getUserCost(&I);
+        if (ImmutableCallSite CS = ImmutableCallSite(&I)) {
+          const Function *Callee = CS.getCalledFunction();
+          if (!Callee)
+            return Threshold;
+          if (TTI->isLoweredToCall(Callee))
+            InstCost += getCalleeCost(Callee, Threshold);
         }
+        Cost += InstCost * Trips;
+        if (Cost >= Threshold)
+          return Threshold;
+      }
     }
-    if (cost > 20) {
+    return Cost;
+  }
+
+  bool attemptSmallBlock(DetachInst* det, unsigned SpawnCost) {
+    // Leave the spawns of Tapir loops to LoopSpawning, which coarsens them on
+    // its own.
+    if (Loop *L = LI->getLoopFor(det->getParent()))
+      if (L->getHeader() == det->getParent() &&
+          LoopSpawningHints(L).getStrategy() != LoopSpawningHints::ST_SEQ)
         return false;
-    }
-    SerializeDetachedCFG(det, &DT);
+
+    uint64_t Cost = getDetachedRegionCost(det, SpawnCost);
+    if (Cost >= SpawnCost)
+      return false;
+
+    DEBUG(dbgs() << "SmallBlock: serializing detach in "
+          << det->getParent()->getName() << " with cost " << Cost
+          << " (spawn cost " << SpawnCost << ")\n");
+    SerializeDetachedCFG(det, DT);
+    ++DetachesSerialized;
     return true;
   }
 
@@ -59,25 +192,32 @@ struct SmallBlock : public FunctionPass {
     if (skipFunction(F))
       return false;
 
-    bool DetachingFunction = false;
-    for (BasicBlock &BB : F)
-      if (isa<DetachInst>(BB.getTerminator()))
-        DetachingFunction = true;
+    unsigned SpawnCost = ClSpawnCost;
+    if (!ClSpawnCost.getNumOccurrences()) {
+      // Without a parallel runtime, there is no spawn overhead to weigh.
+      if (!tapirTarget)
+        return false;
+      SpawnCost = tapirTarget->getSpawnCost();
+    }
 
-    if (!DetachingFunction)
+    // Collect the detaches in post order, so that nested detaches are
+    // considered before the detaches that enclose them.
+    SmallVector<DetachInst *, 8> Detaches;
+    for (BasicBlock *BB : post_order(&F))
+      if (DetachInst *DI = dyn_cast<DetachInst>(BB->getTerminator()))
+        Detaches.push_back(DI);
+
+    if (Detaches.empty())
       return false;
 
-    auto &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    SE = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+    TTI = &getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
 
-    //TODO motion non memory ops
     bool Changed = false;
-    tryMotion:
-    for (BasicBlock &BB : F)
-      if (auto det = dyn_cast<DetachInst>(BB.getTerminator())) {
-        bool b = attemptSmallBlock(det, DT);
-        Changed |= b;
-        if (b) goto tryMotion;
-      }
+    for (DetachInst *DI : Detaches)
+      Changed |= attemptSmallBlock(DI, SpawnCost);
 
     return Changed;
   }
@@ -91,10 +231,13 @@ static const char LS_NAME[] = "smallblock";
 static const char ls_name[] = "Small Block Elimination";
 INITIALIZE_PASS_BEGIN(SmallBlock, LS_NAME, ls_name, false, false)
 INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(TargetTransformInfoWrapperPass)
 INITIALIZE_PASS_END(SmallBlock, LS_NAME, ls_name, false, false)
 
 namespace llvm {
-FunctionPass *createSmallBlockPass() {
-  return new SmallBlock();
+FunctionPass *createSmallBlockPass(TapirTarget* tapirTarget) {
+  return new SmallBlock(tapirTarget);
 }
 }
@@ -0,0 +1,226 @@
+//===- TBBABI.cpp - Lower Tapir into calls to the TBB shim ----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the TBBABI interface, which is used to convert Tapir
+// instructions -- detach, reattach, and sync -- to calls into a C shim over the
+// task_group and task_arena interfaces of Intel TBB.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir/TBBABI.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "tbbabi"
+
+/// Get the type of the task functions that the shim runs, void (i8*).
+static FunctionType *getTaskFnType(LLVMContext &C) {
+  return FunctionType::get(Type::getVoidTy(C), {Type::getInt8PtrTy(C)},
+                           false);
+}
+
+static Function *getInitializeFn(Module &M) {
+  LLVMContext &C = M.getContext();
+  Function *F = cast<Function>(M.getOrInsertFunction(
+      "__tapir_tbb_initialize", FunctionType::get(Type::getVoidTy(C), false)));
+  F->setDoesNotThrow();
+  return F;
+}
+
+static Function *getSpawnFn(Module &M) {
+  LLVMContext &C = M.getContext();
+  Type *Params[] = { PointerType::getUnqual(Type::getInt8PtrTy(C)),
+                     PointerType::getUnqual(getTaskFnType(C)),
+                     Type::getInt8PtrTy(C), Type::getInt64Ty(C) };
+  Function *F = cast<Function>(M.getOrInsertFunction(
+      "__tapir_tbb_spawn",
+      FunctionType::get(Type::getVoidTy(C), Params, false)));
+  F->setDoesNotThrow();
+  return F;
+}
+
+static Function *getSyncFn(Module &M) {
+  LLVMContext &C = M.getContext();
+  Function *F = cast<Function>(M.getOrInsertFunction(
+      "__tapir_tbb_sync",
+      FunctionType::get(Type::getVoidTy(C),
+                        {PointerType::getUnqual(Type::getInt8PtrTy(C))},
+                        false)));
+  F->setDoesNotThrow();
+  return F;
+}
+
+static Function *getMaxConcurrencyFn(Module &M) {
+  LLVMContext &C = M.getContext();
+  Function *F = cast<Function>(M.getOrInsertFunction(
+      "__tapir_tbb_max_concurrency",
+      FunctionType::get(Type::getInt32Ty(C), false)));
+  F->setDoesNotAccessMemory();
+  F->setDoesNotThrow();
+  return F;
+}
+
+/// Get the task_group pointer for the given sync region, creating it and
+/// setting it to null if necessary.
+static Value *getOrCreateTaskGroup(ValueToValueMapTy &DetachCtxToStackFrame,
+                                   Value *SyncRegion) {
+  if (Value *Group = DetachCtxToStackFrame[SyncRegion])
+    return Group;
+
+  Instruction *SR = cast<Instruction>(SyncRegion);
+  Function *F = SR->getFunction();
+  Type *GroupTy = Type::getInt8PtrTy(F->getContext());
+
+  IRBuilder<> B(&*F->getEntryBlock().getFirstInsertionPt());
+  AllocaInst *Group = B.CreateAlloca(GroupTy, nullptr, "tbb.task_group");
+
+  // The task_group is created on the first spawn in the sync region.
+  B.SetInsertPoint(SR->getNextNode());
+  B.CreateStore(Constant::getNullValue(GroupTy), Group);
+
+  DetachCtxToStackFrame[SyncRegion] = Group;
+  return Group;
+}
+
+TBBABI::TBBABI() {}
+
+static const StringRef worker8_name = "tbb_nworker8";
+
+/// \brief Get/Create the worker count for the spawning function.
+Value *TBBABI::GetOrCreateWorker8(Function &F) {
+  IRBuilder<> B(F.getEntryBlock().getFirstNonPHIOrDbgOrLifetime());
+  Value *P0 = B.CreateCall(getMaxConcurrencyFn(*F.getParent()));
+  return B.CreateMul(P0, ConstantInt::get(P0->getType(), 8), worker8_name);
+}
+
+/// \brief Lower a sync to a wait on the task_group of the sync region, if a
+/// task_group was created since the last sync.
+void TBBABI::createSync(SyncInst &SI,
+                        ValueToValueMapTy &DetachCtxToStackFrame) {
+  Module &M = *SI.getModule();
+  Value *Group = getOrCreateTaskGroup(DetachCtxToStackFrame,
+                                      SI.getSyncRegion());
+
+  IRBuilder<> B(&SI);
+  Value *Spawned = B.CreateIsNotNull(B.CreateLoad(Group), "tbb.spawned");
+  TerminatorInst *SyncTerm = SplitBlockAndInsertIfThen(Spawned, &SI, false);
+  SyncTerm->getParent()->setName("tbb.wait");
+  SI.getParent()->setName("tbb.wait.cont");
+  CallInst::Create(getSyncFn(M), {Group}, "", SyncTerm)
+    ->setDebugLoc(SI.getDebugLoc());
+
+  ReplaceInstWithInst(&SI, BranchInst::Create(SI.getSuccessor(0)));
+}
+
+/// \brief Lower a detach to a task_group::run of a task that loads the inputs
+/// of the detached CFG from a copy of an argument struct and calls the helper
+/// function outlined from the CFG.
+Function *TBBABI::createDetach(DetachInst &Detach,
+                               ValueToValueMapTy &DetachCtxToStackFrame,
+                               DominatorTree &DT, AssumptionCache &AC) {
+  BasicBlock *Detacher = Detach.getParent();
+  Function &F = *Detacher->getParent();
+  BasicBlock *Spawned = Detach.getDetached();
+  BasicBlock *Continue = Detach.getContinue();
+  Module &M = *F.getParent();
+  LLVMContext &C = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+
+  Value *Group = getOrCreateTaskGroup(DetachCtxToStackFrame,
+                                      Detach.getSyncRegion());
+
+  CallInst *Call = nullptr;
+  Function *Helper = extractDetachBodyToFunction(Detach, DT, AC, &Call);
+  assert(Helper && Call && "Failed to outline detached CFG.");
+
+  // Gather the inputs of the helper in a struct, which the shim copies into
+  // the functor it passes to task_group::run.
+  SmallVector<Type *, 8> ArgTys;
+  for (Value *Arg : Call->arg_operands())
+    ArgTys.push_back(Arg->getType());
+  StructType *ArgsTy = StructType::create(ArgTys, Helper->getName().str() +
+                                          ".args");
+
+  Function *Task = Function::Create(getTaskFnType(C),
+                                    GlobalValue::InternalLinkage,
+                                    Helper->getName() + ".tbb", &M);
+  Task->setDoesNotThrow();
+  {
+    Argument *ArgsPtr = &*Task->arg_begin();
+    ArgsPtr->setName("args");
+    BasicBlock *Entry = BasicBlock::Create(C, "entry", Task);
+    IRBuilder<> B(Entry);
+    Value *Args = B.CreateBitCast(ArgsPtr, PointerType::getUnqual(ArgsTy));
+    SmallVector<Value *, 8> HelperArgs;
+    for (unsigned i = 0, e = ArgTys.size(); i != e; ++i)
+      HelperArgs.push_back(B.CreateLoad(B.CreateStructGEP(ArgsTy, Args, i)));
+    CallInst *HelperCall = B.CreateCall(Helper, HelperArgs);
+    HelperCall->setCallingConv(Helper->getCallingConv());
+    B.CreateRetVoid();
+  }
+
+  IRBuilder<> B(&*F.getEntryBlock().getFirstInsertionPt());
+  AllocaInst *Args = B.CreateAlloca(ArgsTy, nullptr, "tbb.args");
+  B.SetInsertPoint(Call);
+  for (unsigned i = 0, e = ArgTys.size(); i != e; ++i)
+    B.CreateStore(Call->getArgOperand(i), B.CreateStructGEP(ArgsTy, Args, i));
+  Value *SpawnArgs[] = {
+    Group, Task, B.CreateBitCast(Args, Type::getInt8PtrTy(C)),
+    ConstantInt::get(Type::getInt64Ty(C), DL.getTypeAllocSize(ArgsTy)) };
+  B.CreateCall(getSpawnFn(M), SpawnArgs)->setDebugLoc(Detach.getDebugLoc());
+  Call->eraseFromParent();
+
+  // Replace the detach with a branch to the continuation.
+  ReplaceInstWithInst(&Detach, BranchInst::Create(Continue));
+
+  // Rewrite phis in the detached block.
+  {
+    BasicBlock::iterator BI = Spawned->begin();
+    while (PHINode *P = dyn_cast<PHINode>(BI)) {
+      P->removeIncomingValue(Detacher);
+      ++BI;
+    }
+  }
+
+  return Helper;
+}
+
+void TBBABI::preProcessFunction(Function &F) {}
+
+void TBBABI::postProcessFunction(Function &F) {}
+
+void TBBABI::postProcessHelper(Function &F) {}
+
+/// \brief Set up the task_arena before main runs any Tapir code.
+bool TBBABI::processMain(Function &F) {
+  CallInst::Create(getInitializeFn(*F.getParent()), "",
+                   F.getEntryBlock().getFirstNonPHIOrDbg());
+  return true;
+}
+
+/// \brief task_group::run allocates a task and the shim copies the argument
+/// struct into it.
+unsigned TBBABI::getSpawnCost() const {
+  return 120;
+}
+
+/// \brief With a concurrency of one, the arena runs every task on the thread
+/// that waits for it.
+Value *TBBABI::createSerialDispatchCheck(Instruction *InsertBefore) {
+  IRBuilder<> B(InsertBefore);
+  Value *NWorkers = B.CreateCall(
+      getMaxConcurrencyFn(*InsertBefore->getModule()), {}, "nworkers");
+  return B.CreateICmpSLE(NWorkers, ConstantInt::get(NWorkers->getType(), 1),
+                         "single.worker");
+}
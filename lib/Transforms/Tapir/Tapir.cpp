@@ -32,6 +32,9 @@ void llvm::initializeTapirOpts(PassRegistry &Registry) {
   initializeDetachUnswitchPass(Registry);
   initializeNestedDetachMotionPass(Registry);
   initializeSmallBlockPass(Registry);
+  initializeRecursionCutoffPass(Registry);
+  initializeSerialDispatchPass(Registry);
+  initializeTapirLoopFusionPass(Registry);
   initializeLowerTapirToTargetPass(Registry);
 }
 
@@ -0,0 +1,539 @@
+//===- TapirLoopFusion.cpp - Fuse adjacent Tapir loops --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass fuses adjacent Tapir loops that run the same number of iterations
+// and are separated only by a sync, when iteration i of the second loop
+// depends only on iteration i of the first.  Each iteration of the fused loop
+// runs the body of the first loop and then the body of the second, so the
+// program joins one parallel loop instead of two, and LoopSpawning creates one
+// divide-and-conquer recursion instead of two.
+//
+// The pass uses dependence analysis to dismiss pairs of accesses in the two
+// loops that are independent.  For the remaining pairs, the pass requires that
+// both accesses address the same location in corresponding iterations, and
+// that different iterations access disjoint locations.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Tapir.h"
+
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "tapir-loop-fusion"
+
+STATISTIC(LoopsFused, "Number of Tapir loops fused into the preceding loop");
+STATISTIC(SyncsRemoved, "Number of syncs removed after fusing Tapir loops");
+
+namespace {
+class TapirLoopFusionImpl {
+public:
+  TapirLoopFusionImpl(Function &F, LoopInfo &LI, DominatorTree &DT,
+                      ScalarEvolution &SE, DependenceInfo &DI,
+                      OptimizationRemarkEmitter &ORE)
+      : F(F), LI(LI), DT(DT), SE(SE), DI(DI), ORE(ORE) {}
+
+  bool run();
+
+private:
+  /// Get the Tapir loop that runs next after the Tapir loop \p L1, if control
+  /// passes from the exit of \p L1 to the preheader of that loop with no
+  /// effects other than a sync of \p L1, and if that loop runs only after
+  /// \p L1 runs.  Collect the blocks on the way in \p Path.
+  Loop *getAdjacentTapirLoop(Loop *L1, SmallVectorImpl<BasicBlock *> &Path);
+
+  /// Fuse the Tapir loop \p L2 into the Tapir loop \p L1 that precedes it.
+  bool fuse(Loop *L1, Loop *L2, ArrayRef<BasicBlock *> Path);
+
+  /// Returns true if iteration i of \p L2 depends only on iteration i of \p L1,
+  /// assuming the loops run the same number of iterations.
+  bool dependencesAllowFusion(Loop *L1, Loop *L2, StringRef &Reason);
+
+  /// Try to fuse a Tapir loop among \p Loops with the Tapir loop after it.
+  bool fuseSiblings(const std::vector<Loop *> &Loops);
+
+  Function &F;
+  LoopInfo &LI;
+  DominatorTree &DT;
+  ScalarEvolution &SE;
+  DependenceInfo &DI;
+  OptimizationRemarkEmitter &ORE;
+};
+} // end anonymous namespace
+
+/// Get the blocks of the detached body of the canonical Tapir loop \p L, that
+/// is, all of its blocks other than the header and the latch.
+static void getBodyBlocks(const Loop *L, SmallVectorImpl<BasicBlock *> &Body) {
+  for (BasicBlock *BB : L->blocks())
+    if (BB != L->getHeader() && BB != L->getLoopLatch())
+      Body.push_back(BB);
+}
+
+/// Get the pointer operand of the load or store \p I.
+static Value *getPointerOperand(Instruction *I) {
+  if (LoadInst *LdI = dyn_cast<LoadInst>(I))
+    return LdI->getPointerOperand();
+  return cast<StoreInst>(I)->getPointerOperand();
+}
+
+Loop *TapirLoopFusionImpl::getAdjacentTapirLoop(
+    Loop *L1, SmallVectorImpl<BasicBlock *> &Path) {
+  BasicBlock *Preheader = L1->getLoopPreheader();
+  BasicBlock *Latch = L1->getLoopLatch();
+  BasicBlock *Exit = L1->getExitBlock();
+  if (!Preheader || !Exit || Exit->getSinglePredecessor() != Latch)
+    return nullptr;
+  Value *SyncRegion =
+    cast<DetachInst>(L1->getHeader()->getTerminator())->getSyncRegion();
+  Loop *Parent = L1->getParentLoop();
+
+  // A conditional branch to the preheader of L1 decides whether L1 runs.  The
+  // same branch condition decides branches after L1.
+  BasicBlock *Guard = Preheader->getSinglePredecessor();
+  Value *GuardCond = nullptr;
+  bool GuardTaken = false;
+  if (Guard)
+    if (BranchInst *GuardBr = dyn_cast<BranchInst>(Guard->getTerminator()))
+      if (GuardBr->isConditional() &&
+          GuardBr->getSuccessor(0) != GuardBr->getSuccessor(1)) {
+        GuardCond = GuardBr->getCondition();
+        GuardTaken = (GuardBr->getSuccessor(0) == Preheader);
+      }
+
+  // Follow the path of the exit of L1 to the next loop.
+  SmallPtrSet<BasicBlock *, 8> Visited;
+  int LastGuardedBranch = -1;
+  BasicBlock *BB = Exit;
+  Loop *L2 = nullptr;
+  const unsigned MaxPathLength = 8;
+  while (!L2) {
+    if (Path.size() == MaxPathLength || !Visited.insert(BB).second ||
+        LI.getLoopFor(BB) != Parent)
+      return nullptr;
+    Path.push_back(BB);
+
+    for (Instruction &I : *BB) {
+      if (isa<TerminatorInst>(I))
+        break;
+      if (I.mayReadOrWriteMemory() || I.mayHaveSideEffects() ||
+          isa<AllocaInst>(I))
+        return nullptr;
+    }
+
+    BasicBlock *Next = nullptr;
+    TerminatorInst *TI = BB->getTerminator();
+    if (SyncInst *SI = dyn_cast<SyncInst>(TI)) {
+      if (SI->getSyncRegion() != SyncRegion)
+        return nullptr;
+      Next = SI->getSuccessor(0);
+    } else if (BranchInst *BI = dyn_cast<BranchInst>(TI)) {
+      if (BI->isUnconditional())
+        Next = BI->getSuccessor(0);
+      else if (GuardCond && BI->getCondition() == GuardCond) {
+        Next = BI->getSuccessor(GuardTaken ? 0 : 1);
+        LastGuardedBranch = Path.size() - 1;
+      } else
+        return nullptr;
+    } else
+      return nullptr;
+
+    if (Loop *NextLoop = LI.getLoopFor(Next))
+      if (NextLoop->getHeader() == Next)
+        L2 = NextLoop;
+    BB = Next;
+  }
+
+  if (L2->getParentLoop() != Parent || L2->getLoopPreheader() != Path.back() ||
+      !isCanonicalTapirLoop(L2))
+    return nullptr;
+
+  // L2 must run only if L1 runs.  Every block on the path that control can
+  // enter other than from L1 must therefore be followed by a branch on the
+  // condition that guards L1, and that condition must not change in between.
+  for (unsigned i = 1, e = Path.size(); i != e; ++i) {
+    BasicBlock *PathBB = Path[i];
+    if (PathBB->getSinglePredecessor() == Path[i - 1])
+      continue;
+    if (LastGuardedBranch < static_cast<int>(i) ||
+        !DT.dominates(Guard, PathBB))
+      return nullptr;
+  }
+  return L2;
+}
+
+bool TapirLoopFusionImpl::dependencesAllowFusion(Loop *L1, Loop *L2,
+                                                 StringRef &Reason) {
+  SmallVector<Instruction *, 8> Accesses1, Accesses2;
+  for (Loop *L : { L1, L2 }) {
+    SmallVector<BasicBlock *, 8> Body;
+    getBodyBlocks(L, Body);
+    for (BasicBlock *BB : Body)
+      for (Instruction &I : *BB) {
+        if (!I.mayReadOrWriteMemory())
+          continue;
+        bool Simple = false;
+        if (LoadInst *LdI = dyn_cast<LoadInst>(&I))
+          Simple = LdI->isSimple();
+        else if (StoreInst *StI = dyn_cast<StoreInst>(&I))
+          Simple = StI->isSimple();
+        if (!Simple) {
+          Reason = "loop body contains an instruction that may access memory "
+                   "other than a simple load or store";
+          return false;
+        }
+        (L == L1 ? Accesses1 : Accesses2).push_back(&I);
+      }
+  }
+
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  for (Instruction *Src : Accesses1)
+    for (Instruction *Dst : Accesses2) {
+      if (!Src->mayWriteToMemory() && !Dst->mayWriteToMemory())
+        continue;
+      if (!DI.depends(Src, Dst, true))
+        continue;
+
+      // Both accesses must address the same location in corresponding
+      // iterations, and stride over locations that do not overlap.
+      const SCEVAddRecExpr *SrcAR = dyn_cast<SCEVAddRecExpr>(
+          SE.getSCEV(getPointerOperand(Src)));
+      const SCEVAddRecExpr *DstAR = dyn_cast<SCEVAddRecExpr>(
+          SE.getSCEV(getPointerOperand(Dst)));
+      Reason = "iterations of the second loop depend on other iterations of "
+               "the first loop";
+      if (!SrcAR || !DstAR || SrcAR->getLoop() != L1 ||
+          DstAR->getLoop() != L2 || !SrcAR->isAffine() || !DstAR->isAffine())
+        return false;
+      if (SrcAR->getStart() != DstAR->getStart() ||
+          SrcAR->getStepRecurrence(SE) != DstAR->getStepRecurrence(SE) ||
+          !SE.isLoopInvariant(SrcAR->getStart(), L1) ||
+          !SE.isLoopInvariant(DstAR->getStart(), L2))
+        return false;
+
+      const SCEVConstant *Step =
+        dyn_cast<SCEVConstant>(SrcAR->getStepRecurrence(SE));
+      uint64_t SrcSize = DL.getTypeStoreSize(
+          getPointerOperand(Src)->getType()->getPointerElementType());
+      uint64_t DstSize = DL.getTypeStoreSize(
+          getPointerOperand(Dst)->getType()->getPointerElementType());
+      if (!Step || SrcSize != DstSize ||
+          Step->getAPInt().abs().ult(SrcSize))
+        return false;
+    }
+  return true;
+}
+
+bool TapirLoopFusionImpl::fuse(Loop *L1, Loop *L2, ArrayRef<BasicBlock *> Path) {
+  BasicBlock *Header1 = L1->getHeader();
+  BasicBlock *Latch1 = L1->getLoopLatch();
+  BasicBlock *Preheader1 = L1->getLoopPreheader();
+  BasicBlock *Header2 = L2->getHeader();
+  BasicBlock *Latch2 = L2->getLoopLatch();
+  BasicBlock *Preheader2 = L2->getLoopPreheader();
+  BasicBlock *Exit2 = L2->getExitBlock();
+  DetachInst *Detach1 = cast<DetachInst>(Header1->getTerminator());
+  DetachInst *Detach2 = cast<DetachInst>(Header2->getTerminator());
+  BasicBlock *Body2 = Detach2->getDetached();
+  Value *SyncRegion1 = Detach1->getSyncRegion();
+  Value *SyncRegion2 = Detach2->getSyncRegion();
+
+  auto Missed = [&](StringRef Msg) {
+    ORE.emit(OptimizationRemarkMissed(DEBUG_TYPE, "NotFused",
+                                      L2->getStartLoc(), Header2)
+             << "cannot fuse Tapir loop with the preceding Tapir loop: "
+             << Msg);
+    return false;
+  };
+
+  if (LoopSpawningHints(L1).getStrategy() !=
+      LoopSpawningHints(L2).getStrategy())
+    return Missed("loops use different spawning strategies");
+
+  if (!Exit2 || Exit2->getSinglePredecessor() != Latch2 ||
+      isa<PHINode>(Exit2->begin()) || Body2->getSinglePredecessor() != Header2)
+    return Missed("second loop is not in simplified form");
+
+  const SCEV *TripCount1 = SE.getBackedgeTakenCount(L1);
+  const SCEV *TripCount2 = SE.getBackedgeTakenCount(L2);
+  if (isa<SCEVCouldNotCompute>(TripCount1) || TripCount1 != TripCount2)
+    return Missed("loops do not run the same number of iterations");
+
+  // The body of L2 must end in reattaches to its latch.
+  SmallVector<BasicBlock *, 8> Body;
+  getBodyBlocks(L2, Body);
+  for (BasicBlock *BB : Body) {
+    TerminatorInst *TI = BB->getTerminator();
+    if (isa<ReattachInst>(TI)) {
+      if (TI->getSuccessor(0) != Latch2)
+        return Missed("second loop has an unsupported detached body");
+    } else if (!isa<BranchInst>(TI))
+      return Missed("second loop has an unsupported detached body");
+  }
+
+  // Only the body of L2 may use the header and latch of L2, which fusion
+  // removes.
+  for (BasicBlock *BB : { Header2, Latch2 })
+    for (Instruction &I : *BB) {
+      if (!isa<TerminatorInst>(I) && I.mayHaveSideEffects())
+        return Missed("second loop has side effects outside its body");
+      for (User *U : I.users())
+        if (!L2->contains(cast<Instruction>(U)->getParent()))
+          return Missed("values of the second loop are used after it");
+    }
+
+  // The IVs of L2 become IVs of L1.
+  SmallVector<std::pair<PHINode *, const SCEV *>, 4> IVs;
+  for (PHINode &PN : Header2->phis()) {
+    if (!SE.isSCEVable(PN.getType()))
+      return Missed("second loop has an unsupported induction variable");
+    const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&PN));
+    if (!AR || AR->getLoop() != L2 || !AR->isAffine() ||
+        !SE.isLoopInvariant(AR->getStart(), L1) ||
+        !SE.isLoopInvariant(AR->getStepRecurrence(SE), L1) ||
+        !isSafeToExpand(AR->getStart(), SE) ||
+        !isSafeToExpand(AR->getStepRecurrence(SE), SE))
+      return Missed("second loop has an unsupported induction variable");
+    const SCEV *Available = SE.getAddRecExpr(AR->getStart(),
+                                             AR->getStepRecurrence(SE),
+                                             L1, SCEV::FlagAnyWrap);
+    if (SCEVExprContains(Available, [&](const SCEV *S) {
+          if (const SCEVUnknown *U = dyn_cast<SCEVUnknown>(S))
+            if (Instruction *I = dyn_cast<Instruction>(U->getValue()))
+              return !DT.dominates(I, Preheader1->getTerminator());
+          return false;
+        }))
+      return Missed("second loop has an unsupported induction variable");
+    IVs.push_back(std::make_pair(&PN, Available));
+  }
+  for (PHINode &PN : Header1->phis())
+    SE.getSCEV(&PN);
+
+  // The body of L2 moves before the path between the loops, so the values it
+  // uses from that path must be recomputed before L1.
+  SmallPtrSet<BasicBlock *, 8> PathBlocks(Path.begin(), Path.end());
+  SmallSetVector<Instruction *, 8> Needed;
+  SmallVector<Instruction *, 8> Worklist;
+  for (BasicBlock *BB : Body)
+    for (Instruction &I : *BB)
+      for (Value *Op : I.operands())
+        if (Instruction *OpI = dyn_cast<Instruction>(Op))
+          Worklist.push_back(OpI);
+  while (!Worklist.empty()) {
+    Instruction *I = Worklist.pop_back_val();
+    if (L2->contains(I->getParent()) ||
+        DT.dominates(I, Preheader1->getTerminator()) || Needed.count(I))
+      continue;
+    if (!PathBlocks.count(I->getParent()) || isa<PHINode>(I) ||
+        !isSafeToSpeculativelyExecute(I) || I->mayReadFromMemory())
+      return Missed("second loop uses values computed after the first loop");
+    Needed.insert(I);
+    for (Value *Op : I->operands())
+      if (Instruction *OpI = dyn_cast<Instruction>(Op))
+        Worklist.push_back(OpI);
+  }
+
+  StringRef Reason;
+  if (!dependencesAllowFusion(L1, L2, Reason))
+    return Missed(Reason);
+
+  DEBUG(dbgs() << "TapirLoopFusion: fusing " << *L2 << " into " << *L1);
+  ORE.emit(OptimizationRemark(DEBUG_TYPE, "Fused", L1->getStartLoc(), Header1)
+           << "fused Tapir loop with the next Tapir loop");
+
+  SE.forgetLoop(L2);
+  for (BasicBlock *BB : Body)
+    for (Instruction &I : *BB)
+      SE.forgetValue(&I);
+
+  // Recompute the values the body of L2 needs before L1, in the order of the
+  // path.
+  ValueToValueMapTy VMap;
+  for (BasicBlock *BB : Path)
+    for (Instruction &I : *BB) {
+      if (!Needed.count(&I))
+        continue;
+      Instruction *Clone = I.clone();
+      Clone->setName(I.getName() + ".fused");
+      Clone->insertBefore(Preheader1->getTerminator());
+      RemapInstruction(Clone, VMap,
+                       RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+      VMap[&I] = Clone;
+    }
+  for (BasicBlock *BB : Body)
+    for (Instruction &I : *BB)
+      RemapInstruction(&I, VMap,
+                       RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+
+  // Run the body of L2 after the body of L1 in each iteration of L1.
+  SmallVector<BasicBlock *, 4> Reattaches1, Reattaches2;
+  for (BasicBlock *Pred : predecessors(Latch1))
+    if (Pred != Header1)
+      Reattaches1.push_back(Pred);
+  for (BasicBlock *Pred : predecessors(Latch2))
+    if (Pred != Header2)
+      Reattaches2.push_back(Pred);
+  for (BasicBlock *BB : Reattaches1)
+    ReplaceInstWithInst(BB->getTerminator(), BranchInst::Create(Body2));
+  for (BasicBlock *BB : Reattaches2)
+    ReplaceInstWithInst(BB->getTerminator(),
+                        ReattachInst::Create(Latch1, SyncRegion1));
+  ReplaceInstWithInst(Preheader2->getTerminator(), BranchInst::Create(Exit2));
+
+  // Move the body and subloops of L2 into L1, and remove L2.
+  LI.removeBlock(Header2);
+  LI.removeBlock(Latch2);
+  for (BasicBlock *BB : L2->blocks()) {
+    if (LI.getLoopFor(BB) == L2)
+      LI.changeLoopFor(BB, L1);
+    L1->addBlockEntry(BB);
+  }
+  while (!L2->empty())
+    L1->addChildLoop(L2->removeChildLoop(std::prev(L2->end())));
+  if (Loop *Parent = L2->getParentLoop()) {
+    Parent->removeChildLoop(find(*Parent, L2));
+    LI.addTopLevelLoop(L2);
+  }
+  LI.markAsRemoved(L2);
+  DT.recalculate(F);
+
+  // Rewrite the IVs of L2 in terms of L1.
+  SCEVExpander Exp(SE, F.getParent()->getDataLayout(), "fused");
+  Instruction *InsertPt = &*Body2->getFirstInsertionPt();
+  for (auto &IV : IVs) {
+    Value *V = Exp.expandCodeFor(IV.second, IV.first->getType(), InsertPt);
+    IV.first->replaceAllUsesWith(V);
+  }
+
+  Header2->dropAllReferences();
+  Latch2->dropAllReferences();
+  Header2->eraseFromParent();
+  Latch2->eraseFromParent();
+
+  // The sync region of L2 no longer has any tasks, so its syncs do nothing.
+  if (SyncRegion2 != SyncRegion1 &&
+      all_of(SyncRegion2->users(), [](User *U) { return isa<SyncInst>(U); })) {
+    SmallVector<SyncInst *, 2> Syncs;
+    for (User *U : SyncRegion2->users())
+      Syncs.push_back(cast<SyncInst>(U));
+    for (SyncInst *SI : Syncs) {
+      ReplaceInstWithInst(SI, BranchInst::Create(SI->getSuccessor(0)));
+      ++SyncsRemoved;
+    }
+    cast<Instruction>(SyncRegion2)->eraseFromParent();
+  }
+  DT.recalculate(F);
+
+  ++LoopsFused;
+  return true;
+}
+
+bool TapirLoopFusionImpl::fuseSiblings(const std::vector<Loop *> &Loops) {
+  for (Loop *L : Loops)
+    if (fuseSiblings(L->getSubLoops()))
+      return true;
+
+  for (Loop *L1 : Loops) {
+    if (!isCanonicalTapirLoop(L1))
+      continue;
+    SmallVector<BasicBlock *, 8> Path;
+    if (Loop *L2 = getAdjacentTapirLoop(L1, Path))
+      if (fuse(L1, L2, Path))
+        return true;
+  }
+  return false;
+}
+
+bool TapirLoopFusionImpl::run() {
+  // Fusion changes the loop nest, so start over after each fusion.
+  bool Changed = false;
+  while (fuseSiblings(std::vector<Loop *>(LI.begin(), LI.end())))
+    Changed = true;
+  return Changed;
+}
+
+namespace {
+struct TapirLoopFusion : public FunctionPass {
+  /// Pass identification, replacement for typeid
+  static char ID;
+
+  explicit TapirLoopFusion() : FunctionPass(ID) {
+    initializeTapirLoopFusionPass(*PassRegistry::getPassRegistry());
+  }
+
+  bool runOnFunction(Function &F) override {
+    if (skipFunction(F))
+      return false;
+
+    bool DetachingFunction = false;
+    for (BasicBlock &BB : F)
+      if (isa<DetachInst>(BB.getTerminator()))
+        DetachingFunction = true;
+
+    if (!DetachingFunction)
+      return false;
+
+    auto &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    auto &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    auto &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+    auto &DI = getAnalysis<DependenceAnalysisWrapperPass>().getDI();
+    auto &ORE =
+      getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+
+    return TapirLoopFusionImpl(F, LI, DT, SE, DI, ORE).run();
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequiredID(LoopSimplifyID);
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequired<DependenceAnalysisWrapperPass>();
+    AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+  }
+};
+}
+
+char TapirLoopFusion::ID = 0;
+static const char tlf_name[] = "Fuse adjacent Tapir loops";
+INITIALIZE_PASS_BEGIN(TapirLoopFusion, DEBUG_TYPE, tlf_name, false, false)
+INITIALIZE_PASS_DEPENDENCY(LoopSimplify)
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(DependenceAnalysisWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(OptimizationRemarkEmitterWrapperPass)
+INITIALIZE_PASS_END(TapirLoopFusion, DEBUG_TYPE, tlf_name, false, false)
+
+namespace llvm {
+FunctionPass *createTapirLoopFusionPass() {
+  return new TapirLoopFusion();
+}
+}
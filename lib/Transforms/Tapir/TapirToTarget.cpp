@@ -12,11 +12,16 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Config/config.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Tapir.h"
 #include "llvm/Transforms/Tapir/TapirUtils.h"
+#include "llvm/Transforms/Utils/TapirUtils.h"
 
 #define DEBUG_TYPE "tapir2target"
 
@@ -24,15 +29,19 @@ using namespace llvm;
 
 static cl::opt<TapirTargetType> ClTapirTarget(
     "tapir-target", cl::desc("Target runtime for Tapir"),
-    cl::init(TapirTargetType::Cilk),
+    cl::init(TapirTargetType::TAPIR_DEFAULT_TARGET),
     cl::values(clEnumValN(TapirTargetType::None,
                           "none", "None"),
                clEnumValN(TapirTargetType::Serial,
                           "serial", "Serial code"),
                clEnumValN(TapirTargetType::Cilk,
                           "cilk", "Cilk Plus"),
+               clEnumValN(TapirTargetType::CilkR,
+                          "cilkr", "CilkR"),
                clEnumValN(TapirTargetType::Qthreads,
                           "qthreads", "Qthreads"),
+               clEnumValN(TapirTargetType::TBB,
+                          "tbb", "Intel TBB"),
                clEnumValN(TapirTargetType::OpenMP,
                           "openmp", "OpenMP")));
 
@@ -62,6 +71,7 @@ struct LowerTapirToTarget : public ModulePass {
 private:
   ValueToValueMapTy DetachCtxToStackFrame;
   bool unifyReturns(Function &F);
+  bool lowerRemainingHyperLookups(Module &M);
   SmallVectorImpl<Function *> *processFunction(Function &F, DominatorTree &DT,
                                                AssumptionCache &AC);
 };
@@ -114,6 +124,39 @@ bool LowerTapirToTarget::unifyReturns(Function &F) {
   return true;
 }
 
+/// Reject the reducer view lookups that the target does not lower itself.
+/// Only the Cilk Plus target supports reducers.  Using the leftmost view of
+/// each reducer instead would race whenever two strands that use the reducer
+/// run in parallel, even in functions that do not spawn, since those may be
+/// called from parallel strands.  Programs that run serially never get here:
+/// PreISelIntrinsicLowering lowers their lookups to the leftmost views.
+bool LowerTapirToTarget::lowerRemainingHyperLookups(Module &M) {
+  Function *LookupFn =
+      M.getFunction(Intrinsic::getName(Intrinsic::hyper_lookup));
+  if (!LookupFn)
+    return false;
+
+  bool Changed = false;
+  for (Function &F : M) {
+    SmallVector<CallInst *, 4> Lookups;
+    for (Instruction &I : instructions(F))
+      if (CallInst *CI = dyn_cast<CallInst>(&I))
+        if (CI->getCalledValue() == LookupFn)
+          Lookups.push_back(CI);
+    if (Lookups.empty())
+      continue;
+
+    F.getContext().diagnose(DiagnosticInfoUnsupported(
+        F, "reducers are not supported by this Tapir target",
+        Lookups.front()->getDebugLoc()));
+    // Keep the module valid in case the diagnostic handler returns.
+    for (CallInst *CI : Lookups)
+      lowerHyperLookupToLeftmostView(CI);
+    Changed = true;
+  }
+  return Changed;
+}
+
 SmallVectorImpl<Function *> *LowerTapirToTarget::processFunction(
     Function &F, DominatorTree &DT, AssumptionCache &AC) {
   if (unifyReturns(F))
@@ -205,7 +248,7 @@ bool LowerTapirToTarget::runOnModule(Module &M) {
   }
 
   if (WorkList.empty() && !MainFunc)
-    return false;
+    return lowerRemainingHyperLookups(M);
 
   bool Changed = false;
   std::unique_ptr<SmallVectorImpl<Function *>> NewHelpers;
@@ -224,6 +267,7 @@ bool LowerTapirToTarget::runOnModule(Module &M) {
       if (tapirTarget->shouldProcessFunction(*Helper))
         WorkList.push_back(Helper);
   }
+  Changed |= lowerRemainingHyperLookups(M);
   return Changed;
 }
 
@@ -12,9 +12,12 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Transforms/Tapir/CilkABI.h"
+#include "llvm/Transforms/Tapir/CilkRABI.h"
 #include "llvm/Transforms/Tapir/OpenMPABI.h"
 #include "llvm/Transforms/Tapir/QthreadsABI.h"
+#include "llvm/Transforms/Tapir/TBBABI.h"
 #include "llvm/Transforms/Tapir/Outline.h"
 #include "llvm/Transforms/Utils/EscapeEnumerator.h"
 #include "llvm/Transforms/Utils/Local.h"
@@ -24,14 +27,27 @@ using namespace llvm;
 
 #define DEBUG_TYPE "tapir"
 
+// The x86-64 System V calling convention passes six integer arguments in
+// registers.  Further inputs go on the stack at every spawn anyway, whereas the
+// frame is allocated once and filled in place.
+static cl::opt<unsigned> ClMaxHelperArgs(
+    "tapir-max-helper-args", cl::init(6), cl::Hidden,
+    cl::desc("Maximum number of inputs that a helper outlined from a detached "
+             "CFG takes as separate arguments, when the Tapir target allows "
+             "packing the rest into a frame struct passed by pointer"));
+
 TapirTarget *llvm::getTapirTargetFromType(TapirTargetType Type) {
   switch(Type) {
   case TapirTargetType::Cilk:
     return new CilkABI();
+  case TapirTargetType::CilkR:
+    return new CilkRABI();
   case TapirTargetType::OpenMP:
     return new OpenMPABI();
   case TapirTargetType::Qthreads:
     return new QthreadsABI();
+  case TapirTargetType::TBB:
+    return new TBBABI();
   case TapirTargetType::None:
   case TapirTargetType::Serial:
   default:
@@ -236,7 +252,8 @@ bool llvm::populateDetachedCFG(
 Function *llvm::extractDetachBodyToFunction(DetachInst &detach,
                                             DominatorTree &DT,
                                             AssumptionCache &AC,
-                                            CallInst **call) {
+                                            CallInst **call,
+                                            bool PackInputs) {
   BasicBlock *Detacher = detach.getParent();
   Function &F = *(Detacher->getParent());
 
@@ -288,9 +305,9 @@ Function *llvm::extractDetachBodyToFunction(DetachInst &detach,
   findInputsOutputs(functionPieces, BodyInputs, Outputs, &ExitBlocks, &DT);
   assert(Outputs.empty() &&
          "All results from detached CFG should be passed by memory already.");
+  Value *SRetInput = nullptr;
   {
     // Scan for any sret parameters in BodyInputs and add them first.
-    Value *SRetInput = nullptr;
     if (F.hasStructRetAttr()) {
       Function::arg_iterator ArgIter = F.arg_begin();
       if (F.hasParamAttribute(0, Attribute::StructRet))
@@ -312,18 +329,51 @@ Function *llvm::extractDetachBodyToFunction(DetachInst &detach,
 	Inputs.insert(V);
   }
 
+  // Recompute cheap inputs in the helper, rather than passing them.  If many
+  // inputs remain and the caller allows it, pack them into a frame struct and
+  // pass the helper a pointer to it.  The parent allocates the frame once, so
+  // that spawns in a loop reuse it, and the caller must ensure that the helper
+  // reads the frame before the parent can continue.
+  ValueSet Remat, Args;
+  SmallVector<Value *, 8> Packed;
+  findRematerializableInputs(Inputs, Remat);
+  for (Value *V : Inputs)
+    if (!Remat.count(V))
+      Args.insert(V);
+  AllocaInst *Frame = nullptr;
+  if (PackInputs &&
+      Args.size() - (SRetInput ? 1 : 0) > ClMaxHelperArgs) {
+    SmallVector<Type *, 8> FieldTys;
+    for (Value *V : Args)
+      if (V != SRetInput) {
+        Packed.push_back(V);
+        FieldTys.push_back(V->getType());
+      }
+    StructType *FrameTy = StructType::create(
+        FieldTys, (F.getName() + "_" + Spawned->getName() + ".frame").str());
+    IRBuilder<> B(&*F.getEntryBlock().getFirstInsertionPt());
+    Frame = B.CreateAlloca(FrameTy, nullptr, "spawn.frame");
+    Args.clear();
+    if (SRetInput)
+      Args.insert(SRetInput);
+    Args.insert(Frame);
+  }
+  DEBUG(dbgs() << "rematerialized inputs: " << Remat.size()
+               << ", packed inputs: " << Packed.size() << "\n");
+
   // Clone the detached CFG into a helper function.
   ValueToValueMapTy VMap;
   Function *extracted;
   {
     SmallVector<ReturnInst *, 4> Returns;  // Ignore returns cloned.
     std::vector<BasicBlock *> blocks(functionPieces.begin(), functionPieces.end());
+    HelperInputMaterializer Mat(VMap, Remat, Detacher, ".cilk", Frame, Packed);
 
-    extracted = CreateHelper(Inputs, Outputs, blocks,
+    extracted = CreateHelper(Args, Outputs, blocks,
                              Spawned, Detacher, Continue,
                              VMap, F.getParent(),
                              F.getSubprogram() != nullptr, Returns, ".cilk",
-                             &ExitBlocks, nullptr, nullptr, nullptr, nullptr);
+                             &ExitBlocks, nullptr, nullptr, nullptr, &Mat);
 
     assert(Returns.empty() && "Returns cloned when cloning detached CFG.");
 
@@ -334,14 +384,34 @@ Function *llvm::extractDetachBodyToFunction(DetachInst &detach,
 
   // Add alignment assumptions to arguments of helper, based on alignment of
   // values in old function.
-  AddAlignmentAssumptions(&F, Inputs, VMap, &detach, &AC, &DT);
+  AddAlignmentAssumptions(&F, Args, VMap, &detach, &AC, &DT);
+  // Pointers loaded from the frame get the same alignment data, as metadata.
+  for (Value *V : Packed) {
+    if (!V->getType()->isPointerTy())
+      continue;
+    LoadInst *Load = dyn_cast_or_null<LoadInst>(VMap.lookup(V));
+    if (!Load)
+      continue;
+    unsigned Align = getKnownAlignment(V, F.getParent()->getDataLayout(),
+                                       &detach, &AC, &DT);
+    if (Align > 1) {
+      LLVMContext &C = F.getContext();
+      Load->setMetadata(LLVMContext::MD_align,
+                        MDNode::get(C, ConstantAsMetadata::get(ConstantInt::get(
+                                           Type::getInt64Ty(C), Align))));
+    }
+  }
 
   // Add call to new helper function in original function.
   CallInst *TopCall;
   {
-    // Create call instruction.
+    // Create call instruction, after filling in the frame.
     IRBuilder<> Builder(&detach);
-    TopCall = Builder.CreateCall(extracted, Inputs.getArrayRef());
+    if (Frame)
+      for (unsigned i = 0, e = Packed.size(); i != e; ++i)
+        Builder.CreateStore(Packed[i], Builder.CreateStructGEP(
+                                           Frame->getAllocatedType(), Frame, i));
+    TopCall = Builder.CreateCall(extracted, Args.getArrayRef());
     // Use a fast calling convention for the helper.
     TopCall->setCallingConv(CallingConv::Fast);
     TopCall->setDebugLoc(detach.getDebugLoc());
@@ -394,6 +464,19 @@ bool TapirTarget::shouldProcessFunction(const Function &F) {
   return false;
 }
 
+unsigned TapirTarget::getSpawnCost() const {
+  return 100;
+}
+
+LoopOutline *TapirTarget::getLoopSpawning(Loop *L, unsigned Grainsize,
+                                          unsigned MaxGrainsize,
+                                          ScalarEvolution &SE, LoopInfo *LI,
+                                          DominatorTree *DT,
+                                          AssumptionCache *AC,
+                                          OptimizationRemarkEmitter &ORE) {
+  return nullptr;
+}
+
 bool llvm::isConstantMemoryFreeOperation(Instruction* I, bool allowsyncregion) {
   if (auto call = dyn_cast<CallInst>(I)) {
     auto id = call->getCalledFunction()->getIntrinsicID();
@@ -12,10 +12,15 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Utils/TapirUtils.h"
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/Local.h"
 
 using namespace llvm;
@@ -244,6 +249,17 @@ BranchInst *llvm::SerializeDetachedCFG(DetachInst *DI, DominatorTree *DT) {
   return ReplacementBr;
 }
 
+/// hasDetachedRethrow - Return true if the function calls
+/// llvm.detached.rethrow.
+///
+bool llvm::hasDetachedRethrow(const Function &F) {
+  for (const Instruction &I : instructions(F))
+    if (const IntrinsicInst *II = dyn_cast<IntrinsicInst>(&I))
+      if (Intrinsic::detached_rethrow == II->getIntrinsicID())
+        return true;
+  return false;
+}
+
 /// GetDetachedCtx - Get the entry basic block to the detached context
 /// that contains the specified block.
 ///
@@ -325,6 +341,9 @@ bool llvm::isCriticalContinueEdge(const TerminatorInst *TI, unsigned SuccNum) {
 llvm::LoopSpawningHints::LoopSpawningHints(const Loop *L)
     : Strategy("spawn.strategy", ST_SEQ, HK_STRATEGY),
       Grainsize("grainsize", 0, HK_GRAINSIZE),
+      MaxGrainsize("grainsize.max", 0, HK_MAX_GRAINSIZE),
+      Schedule("schedule", SCHED_STATIC, HK_SCHEDULE),
+      Collapse("collapse", 0, HK_COLLAPSE),
       TheLoop(L) {
   // Populate values with existing loop metadata.
   getHintsFromMetadata();
@@ -339,6 +358,34 @@ unsigned llvm::LoopSpawningHints::getGrainsize() const {
   return Grainsize.Value;
 }
 
+unsigned llvm::LoopSpawningHints::getMaxGrainsize() const {
+  return MaxGrainsize.Value;
+}
+
+LoopSpawningHints::IterationSchedule
+llvm::LoopSpawningHints::getSchedule() const {
+  return (IterationSchedule)Schedule.Value;
+}
+
+unsigned llvm::LoopSpawningHints::getCollapse() const {
+  return Collapse.Value;
+}
+
+void llvm::LoopSpawningHints::setGrainsize(unsigned G) {
+  Grainsize.Value = G;
+  writeHintsToMetadata(Grainsize);
+}
+
+void llvm::LoopSpawningHints::setMaxGrainsize(unsigned G) {
+  MaxGrainsize.Value = G;
+  writeHintsToMetadata(MaxGrainsize);
+}
+
+void llvm::LoopSpawningHints::setStrategy(SpawningStrategy S) {
+  Strategy.Value = S;
+  writeHintsToMetadata(Strategy);
+}
+
 void llvm::LoopSpawningHints::getHintsFromMetadata() {
   MDNode *LoopID = TheLoop->getLoopID();
   if (!LoopID)
@@ -386,7 +433,8 @@ void llvm::LoopSpawningHints::setHint(StringRef Name, Metadata *Arg) {
     return;
   unsigned Val = C->getZExtValue();
 
-  Hint *Hints[] = {&Strategy, &Grainsize};
+  Hint *Hints[] = {&Strategy, &Grainsize, &MaxGrainsize, &Schedule,
+                   &Collapse};
   for (auto H : Hints) {
     if (Name == H->Name) {
       if (H->validate(Val))
@@ -459,6 +507,12 @@ bool llvm::LoopSpawningHints::Hint::validate(unsigned Val) {
     return (Val < ST_END);
   case HK_GRAINSIZE:
     return true;
+  case HK_MAX_GRAINSIZE:
+    return (Val > 0);
+  case HK_SCHEDULE:
+    return (Val < SCHED_END);
+  case HK_COLLAPSE:
+    return true;
   }
   return false;
 }
@@ -541,7 +595,13 @@ bool llvm::isDACFor(Loop* L) {
   // TODO: Use a more precise detection of cilk_for loops.
   for (BasicBlock* BB : L->blocks())
     if (isa<DetachInst>(BB->getTerminator()))
-      return LoopSpawningHints(L).getStrategy() == LoopSpawningHints::ST_DAC;
+      switch (LoopSpawningHints(L).getStrategy()) {
+      case LoopSpawningHints::ST_DAC:
+      case LoopSpawningHints::ST_ADAPTIVE:
+        return true;
+      default:
+        return false;
+      }
   return false;
 }
 
@@ -554,3 +614,121 @@ bool llvm::canDetach(const Function *F) {
   return false;
 }
 
+
+/// GetOrCreateSerialClone - Get the serial elision of the given function,
+/// creating it if necessary.
+Function *llvm::GetOrCreateSerialClone(Function &F) {
+  if (MDNode *MD = F.getMetadata("tapir.serial"))
+    if (Function *Serial = mdconst::dyn_extract_or_null<Function>(
+            MD->getOperand(0)))
+      return Serial;
+
+  ValueToValueMapTy VMap;
+  Function *Serial = CloneFunction(&F, VMap);
+  Serial->setName(F.getName() + ".serial");
+  Serial->setLinkage(GlobalValue::InternalLinkage);
+  Serial->setVisibility(GlobalValue::DefaultVisibility);
+  Serial->setDLLStorageClass(GlobalValue::DefaultStorageClass);
+  Serial->setComdat(nullptr);
+
+  SmallVector<Instruction *, 8> SyncRegions;
+  for (Instruction &I : instructions(Serial)) {
+    CallSite CS(&I);
+    if (!CS)
+      continue;
+    if (CS.getCalledFunction() == &F)
+      CS.setCalledFunction(Serial);
+    else if (const IntrinsicInst *II = dyn_cast<IntrinsicInst>(&I))
+      if (Intrinsic::syncregion_start == II->getIntrinsicID())
+        SyncRegions.push_back(&I);
+  }
+
+  // Serialize the detaches, innermost first.
+  DominatorTree DT(*Serial);
+  SmallVector<DetachInst *, 8> Detaches;
+  SmallVector<SyncInst *, 8> Syncs;
+  for (BasicBlock *BB : post_order(Serial)) {
+    if (DetachInst *DI = dyn_cast<DetachInst>(BB->getTerminator()))
+      Detaches.push_back(DI);
+    else if (SyncInst *SI = dyn_cast<SyncInst>(BB->getTerminator()))
+      Syncs.push_back(SI);
+  }
+  for (DetachInst *DI : Detaches)
+    SerializeDetachedCFG(DI, &DT);
+
+  // With nothing left to sync, the syncs and their sync regions are dead.
+  for (SyncInst *SI : Syncs)
+    ReplaceInstWithInst(SI, BranchInst::Create(SI->getSuccessor(0)));
+  for (Instruction *SR : SyncRegions)
+    if (SR->use_empty())
+      SR->eraseFromParent();
+
+  F.setMetadata("tapir.serial",
+                MDNode::get(F.getContext(), ValueAsMetadata::get(Serial)));
+  return Serial;
+}
+
+/// InsertSerialGuard - Make the given function call its serial version when
+/// the condition computed by GetCond holds.
+void llvm::InsertSerialGuard(Function &F, Function *Serial,
+                             function_ref<Value *(IRBuilder<> &)> GetCond,
+                             StringRef Name) {
+  // Insert the guard after the static allocas in the entry block.
+  BasicBlock::iterator InsertPt = F.getEntryBlock().begin();
+  while (isa<AllocaInst>(InsertPt))
+    ++InsertPt;
+
+  IRBuilder<> B(&*InsertPt);
+  Value *Cond = GetCond(B);
+  TerminatorInst *ThenTerm =
+    SplitBlockAndInsertIfThen(Cond, &*InsertPt, /*Unreachable=*/true);
+  ThenTerm->getParent()->setName(Name);
+
+  B.SetInsertPoint(ThenTerm);
+  SmallVector<Value *, 8> Args;
+  AttributeList Attrs = F.getAttributes();
+  SmallVector<AttributeSet, 8> ParamAttrs;
+  for (Argument &Arg : F.args()) {
+    if (Args.size() == Serial->arg_size())
+      break;
+    Args.push_back(&Arg);
+    ParamAttrs.push_back(Attrs.getParamAttributes(Arg.getArgNo()));
+  }
+  CallInst *Call = B.CreateCall(Serial, Args);
+  Call->setCallingConv(F.getCallingConv());
+  Call->setAttributes(AttributeList::get(F.getContext(), AttributeSet(),
+                                         Attrs.getRetAttributes(),
+                                         ParamAttrs));
+  if (F.getReturnType()->isVoidTy())
+    B.CreateRetVoid();
+  else
+    B.CreateRet(Call);
+  ThenTerm->eraseFromParent();
+}
+
+void llvm::lowerHyperLookupToLeftmostView(CallInst *Lookup) {
+  LLVMContext &C = Lookup->getContext();
+  const DataLayout &DL = Lookup->getModule()->getDataLayout();
+  // struct __cilkrts_hyperobject_base {
+  //   cilk_c_monoid __c_monoid;  // Five function pointers.
+  //   unsigned long long __flags;
+  //   ptrdiff_t __view_offset;
+  //   size_t __view_size;
+  // };
+  Type *FnPtrTy = Type::getInt8PtrTy(C);
+  Type *IntPtrTy = DL.getIntPtrType(C);
+  StructType *BaseTy = StructType::get(
+      C, {FnPtrTy, FnPtrTy, FnPtrTy, FnPtrTy, FnPtrTy, Type::getInt64Ty(C),
+          IntPtrTy, IntPtrTy});
+
+  IRBuilder<> B(Lookup);
+  Value *Reducer = Lookup->getArgOperand(0);
+  Value *Base = B.CreateBitCast(Reducer, BaseTy->getPointerTo());
+  Value *Offset = B.CreateLoad(B.CreateStructGEP(BaseTy, Base, 6),
+                               "view.offset");
+  Value *View = B.CreateInBoundsGEP(B.getInt8Ty(), Reducer, Offset);
+  View = B.CreateBitCast(View, Lookup->getType());
+  View->takeName(Lookup);
+  Lookup->replaceAllUsesWith(View);
+  Lookup->eraseFromParent();
+}
@@ -0,0 +1,59 @@
+/*===- cilkr.h - Interface of the CilkR work-stealing runtime -----*- C -*-===*\
+|*                                                                            *|
+|*                     The LLVM Compiler Infrastructure                       *|
+|*                                                                            *|
+|* This file is distributed under the University of Illinois Open Source      *|
+|* License. See LICENSE.TXT for details.                                      *|
+|*                                                                            *|
+|*===----------------------------------------------------------------------===*|
+|*                                                                            *|
+|* This file declares the interface of CilkR, the lightweight work-stealing   *|
+|* runtime that the cilkr Tapir target lowers to.  The compiler allocates a   *|
+|* frame for each sync region on the stack and initializes it inline.  A      *|
+|* spawn copies the arguments of the task into a descriptor on the deque of   *|
+|* the current worker.  A sync only calls into the runtime when tasks of the  *|
+|* frame are pending.                                                         *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#ifndef CILKR_CILKR_H
+#define CILKR_CILKR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The frame of a sync region.  The compiler zeroes both fields where the sync
+ * region starts.  The pending count is the number of spawned tasks of the
+ * region that have not completed, and is read with acquire ordering by the
+ * inline check of each sync. */
+typedef struct __cilkr_frame {
+  int64_t pending;
+  void *worker;
+} __cilkr_frame;
+
+/* Spawn a task that calls fn on a copy of the size bytes at args.  The copy is
+ * made before __cilkr_spawn returns, so args may be reused afterwards.  A
+ * thread must sync every task it spawns before it exits. */
+void __cilkr_spawn(__cilkr_frame *f, void (*fn)(void *), void *args,
+                   size_t size);
+
+/* Wait until every task spawned with f has completed.  The calling worker
+ * runs tasks, from its own deque or stolen from other workers, while it
+ * waits. */
+void __cilkr_sync(__cilkr_frame *f);
+
+/* Get the number of workers the runtime runs tasks on.  The count is taken
+ * from the CILK_NWORKERS environment variable, if set, and otherwise is the
+ * number of online processors.  The workers themselves start on the first
+ * spawn. */
+int __cilkr_get_nworkers(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CILKR_CILKR_H */
@@ -0,0 +1,437 @@
+/*===- cilkr.c - The CilkR work-stealing runtime ------------------*- C -*-===*\
+|*                                                                            *|
+|*                     The LLVM Compiler Infrastructure                       *|
+|*                                                                            *|
+|* This file is distributed under the University of Illinois Open Source      *|
+|* License. See LICENSE.TXT for details.                                      *|
+|*                                                                            *|
+|*===----------------------------------------------------------------------===*|
+|*                                                                            *|
+|* This file implements CilkR, the runtime that the cilkr Tapir target        *|
+|* lowers to.  Each worker owns a Chase-Lev deque of task descriptors.  A     *|
+|* worker pushes and takes tasks at the bottom of its deque without locking,  *|
+|* and thieves steal from the top.  As in the THE protocol of Cilk-5, the     *|
+|* owner and the thieves only synchronize when they race for the last task    *|
+|* of a deque, which they resolve with a compare-and-swap on the top index.   *|
+|*                                                                            *|
+|* The background workers start on the first spawn.  A thread that spawns    *|
+|* without being a worker, such as the main thread, claims a worker of its    *|
+|* own, and thieves steal from it like from any other worker.  The thread     *|
+|* gives the worker back when it exits, for the next such thread to reuse.    *|
+|*                                                                            *|
+|* A sync runs tasks until the pending count of its frame drops to zero, so   *|
+|* a thread never blocks while work is available.  The tasks it takes from    *|
+|* its own deque are children of the frame it waits for.  The tasks it        *|
+|* steals are arbitrary and run on top of the waiting frames, so a worker     *|
+|* only nests a bounded number of them on its stack.                          *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "cilkr/cilkr.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CILKR_MAX_WORKERS 256
+#define CILKR_INITIAL_DEQUE_SIZE 256
+#define CILKR_CACHE_LINE 64
+/* Largest number of stolen tasks that a worker runs nested on its stack while
+ * it waits at syncs. */
+#define CILKR_MAX_STEAL_DEPTH 16
+/* Size in bytes of the blocks that workers keep to store small tasks in, and
+ * the number of free blocks that a worker keeps. */
+#define CILKR_TASK_BLOCK 256
+#define CILKR_POOL_TASKS 256
+/* Number of rounds of failed steals after which an idle worker sleeps. */
+#define CILKR_IDLE_ROUNDS 64
+/* Longest time, in nanoseconds, that an idle worker sleeps before it looks
+ * for work again. */
+#define CILKR_IDLE_NSEC 1000000
+
+/* A spawned task.  The arguments of the task follow the descriptor.  A task
+ * whose arguments fit is stored in a block of CILKR_TASK_BLOCK bytes, which
+ * the worker that runs the task keeps for later spawns. */
+typedef struct task {
+  void (*fn)(void *);
+  __cilkr_frame *frame;
+  struct task *next_free;
+  int pooled;
+} task;
+
+#define TASK_ARGS_OFFSET                                                       \
+  ((sizeof(task) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+static void *task_args(task *t) { return (char *)t + TASK_ARGS_OFFSET; }
+
+/* The circular array of a deque.  A deque that outgrows its array copies it
+ * into one twice as large.  Thieves may still read the old array, so it is
+ * kept alive through the prev link until no thief is stealing from the
+ * deque. */
+typedef struct task_array {
+  int64_t size;
+  struct task_array *prev;
+  _Atomic(task *) buf[];
+} task_array;
+
+typedef struct deque {
+  _Alignas(CILKR_CACHE_LINE) _Atomic int64_t top;
+  _Alignas(CILKR_CACHE_LINE) _Atomic int64_t bottom;
+  _Atomic(task_array *) array;
+  /* Number of thieves stealing from the deque. */
+  _Alignas(CILKR_CACHE_LINE) _Atomic int thieves;
+} deque;
+
+typedef struct worker {
+  deque d;
+  unsigned rand_state;
+  /* Number of stolen tasks running nested in syncs on this worker. */
+  unsigned steal_depth;
+  /* The free task blocks of this worker. */
+  task *free_tasks;
+  unsigned nfree;
+  /* Whether a thread runs on this worker. */
+  _Atomic int claimed;
+} worker;
+
+static _Atomic(worker *) workers[CILKR_MAX_WORKERS];
+static _Atomic int nslots;
+static _Atomic int nworkers;
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static pthread_key_t release_key;
+static _Thread_local worker *current;
+
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static _Atomic int nidle;
+
+static void fatal(const char *msg) {
+  fprintf(stderr, "cilkr: %s\n", msg);
+  abort();
+}
+
+static task_array *new_task_array(int64_t size) {
+  task_array *a = malloc(sizeof(task_array) + size * sizeof(_Atomic(task *)));
+  if (!a)
+    fatal("out of memory");
+  a->size = size;
+  a->prev = NULL;
+  return a;
+}
+
+/* Copy the tasks in [t, b) of the full array a into an array twice as large,
+ * and make that the array of q. */
+static task_array *grow(deque *q, task_array *a, int64_t t, int64_t b) {
+  task_array *n = new_task_array(a->size * 2);
+  for (int64_t i = t; i < b; ++i)
+    atomic_store_explicit(
+        &n->buf[i & (n->size - 1)],
+        atomic_load_explicit(&a->buf[i & (a->size - 1)], memory_order_relaxed),
+        memory_order_relaxed);
+  n->prev = a;
+  atomic_store_explicit(&q->array, n, memory_order_seq_cst);
+  return n;
+}
+
+/* Free the arrays of q that grow replaced, unless a thief may still read them.
+ * A thief that starts to steal after the check loads the current array. */
+static void reclaim_arrays(deque *q) {
+  task_array *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+  if (!a->prev || atomic_load_explicit(&q->thieves, memory_order_seq_cst))
+    return;
+  for (task_array *p = a->prev, *prev; p; p = prev) {
+    prev = p->prev;
+    free(p);
+  }
+  a->prev = NULL;
+}
+
+static void push(deque *q, task *x) {
+  int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+  int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+  task_array *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+  if (b - t > a->size - 1) {
+    a = grow(q, a, t, b);
+    reclaim_arrays(q);
+  }
+  atomic_store_explicit(&a->buf[b & (a->size - 1)], x, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+}
+
+/* Take the most recently pushed task of the deque of the current worker. */
+static task *take(deque *q) {
+  int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+  task_array *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+  atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t t = atomic_load_explicit(&q->top, memory_order_relaxed);
+  if (t > b) {
+    /* The deque is empty. */
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    return NULL;
+  }
+  task *x = atomic_load_explicit(&a->buf[b & (a->size - 1)],
+                                 memory_order_relaxed);
+  if (t == b) {
+    /* This is the last task, which a thief may be stealing as well. */
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+      x = NULL;
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+  }
+  return x;
+}
+
+/* Steal the oldest task of the deque of another worker. */
+static task *steal_from(deque *q) {
+  task *x = NULL;
+  atomic_fetch_add_explicit(&q->thieves, 1, memory_order_seq_cst);
+  int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+  if (t < b) {
+    task_array *a = atomic_load_explicit(&q->array, memory_order_seq_cst);
+    x = atomic_load_explicit(&a->buf[t & (a->size - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+      x = NULL;
+  }
+  atomic_fetch_sub_explicit(&q->thieves, 1, memory_order_release);
+  return x;
+}
+
+/* Try to steal a task from each other worker once, starting at a random
+ * victim. */
+static task *steal(worker *w) {
+  int n = atomic_load_explicit(&nslots, memory_order_acquire);
+  w->rand_state = w->rand_state * 1103515245u + 12345u;
+  int start = (int)((w->rand_state >> 16) % (unsigned)n);
+  for (int i = 0; i < n; ++i) {
+    worker *victim = atomic_load_explicit(&workers[(start + i) % n],
+                                          memory_order_acquire);
+    if (!victim || victim == w)
+      continue;
+    task *x = steal_from(&victim->d);
+    if (x)
+      return x;
+  }
+  return NULL;
+}
+
+static worker *new_worker(void) {
+  int id = atomic_fetch_add(&nslots, 1);
+  if (id >= CILKR_MAX_WORKERS)
+    fatal("too many threads spawn tasks at once");
+  worker *w = aligned_alloc(CILKR_CACHE_LINE,
+                            (sizeof(worker) + CILKR_CACHE_LINE - 1) &
+                                ~(size_t)(CILKR_CACHE_LINE - 1));
+  if (!w)
+    fatal("out of memory");
+  atomic_init(&w->d.top, 0);
+  atomic_init(&w->d.bottom, 0);
+  atomic_init(&w->d.array, new_task_array(CILKR_INITIAL_DEQUE_SIZE));
+  atomic_init(&w->d.thieves, 0);
+  w->rand_state = (unsigned)id * 2654435761u + 1;
+  w->steal_depth = 0;
+  w->free_tasks = NULL;
+  w->nfree = 0;
+  atomic_init(&w->claimed, 1);
+  atomic_store_explicit(&workers[id], w, memory_order_release);
+  return w;
+}
+
+/* Claim the worker of a thread that has exited, or else a new one.  Workers
+ * are never freed, since thieves may read their deques at any time. */
+static worker *claim_worker(void) {
+  int n = atomic_load_explicit(&nslots, memory_order_acquire);
+  for (int i = 0; i < n && i < CILKR_MAX_WORKERS; ++i) {
+    worker *w = atomic_load_explicit(&workers[i], memory_order_acquire);
+    int unclaimed = 0;
+    if (w && atomic_compare_exchange_strong(&w->claimed, &unclaimed, 1))
+      return w;
+  }
+  return new_worker();
+}
+
+/* Give back the worker of a thread that spawned tasks, when the thread exits.
+ * The thread has synced all of its tasks, so the deque is empty. */
+static void release_worker(void *arg) {
+  worker *w = arg;
+  reclaim_arrays(&w->d);
+  current = NULL;
+  atomic_store_explicit(&w->claimed, 0, memory_order_release);
+}
+
+static task *alloc_task(worker *w, size_t size) {
+  task *t;
+  if (TASK_ARGS_OFFSET + size > CILKR_TASK_BLOCK) {
+    t = malloc(TASK_ARGS_OFFSET + size);
+    if (!t)
+      fatal("out of memory");
+    t->pooled = 0;
+    return t;
+  }
+  if ((t = w->free_tasks)) {
+    w->free_tasks = t->next_free;
+    --w->nfree;
+    return t;
+  }
+  t = malloc(CILKR_TASK_BLOCK);
+  if (!t)
+    fatal("out of memory");
+  t->pooled = 1;
+  return t;
+}
+
+static void free_task(worker *w, task *t) {
+  if (!t->pooled || w->nfree >= CILKR_POOL_TASKS) {
+    free(t);
+    return;
+  }
+  t->next_free = w->free_tasks;
+  w->free_tasks = t;
+  ++w->nfree;
+}
+
+/* Run the task t on the worker w and free it.  The pending count of the frame
+ * of t is decremented last, since the frame may go away as soon as it drops
+ * to zero. */
+static void run_task(worker *w, task *t) {
+  __cilkr_frame *f = t->frame;
+  t->fn(task_args(t));
+  free_task(w, t);
+  __atomic_fetch_sub(&f->pending, 1, __ATOMIC_RELEASE);
+}
+
+/* Sleep until a task is spawned, or for a short while.  A spawn that races
+ * with a worker falling asleep may not wake it, so the sleep is bounded. */
+static void idle_wait(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_nsec += CILKR_IDLE_NSEC;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec += 1;
+    ts.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&idle_lock);
+  atomic_fetch_add(&nidle, 1);
+  pthread_cond_timedwait(&idle_cond, &idle_lock, &ts);
+  atomic_fetch_sub(&nidle, 1);
+  pthread_mutex_unlock(&idle_lock);
+}
+
+static void wake_idle(void) {
+  if (atomic_load_explicit(&nidle, memory_order_relaxed) == 0)
+    return;
+  pthread_mutex_lock(&idle_lock);
+  pthread_cond_signal(&idle_cond);
+  pthread_mutex_unlock(&idle_lock);
+}
+
+static void *worker_main(void *arg) {
+  (void)arg;
+  worker *w = current = claim_worker();
+  unsigned failures = 0;
+  for (;;) {
+    task *t = take(&w->d);
+    if (!t)
+      t = steal(w);
+    if (t) {
+      run_task(w, t);
+      failures = 0;
+    } else if (++failures < CILKR_IDLE_ROUNDS) {
+      sched_yield();
+    } else {
+      reclaim_arrays(&w->d);
+      idle_wait();
+      failures = 0;
+    }
+  }
+  return NULL;
+}
+
+static void start_workers(void) {
+  if (pthread_key_create(&release_key, release_worker))
+    fatal("cannot create thread key");
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  /* The thread that spawns first works as well. */
+  for (int i = 1, n = __cilkr_get_nworkers(); i < n; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, worker_main, NULL))
+      fatal("cannot start worker thread");
+  }
+  pthread_attr_destroy(&attr);
+}
+
+static worker *get_worker(void) {
+  worker *w = current;
+  if (__builtin_expect(w != NULL, 1))
+    return w;
+  pthread_once(&start_once, start_workers);
+  w = current = claim_worker();
+  pthread_setspecific(release_key, w);
+  return w;
+}
+
+int __cilkr_get_nworkers(void) {
+  int n = atomic_load_explicit(&nworkers, memory_order_acquire);
+  if (n)
+    return n;
+  const char *env = getenv("CILK_NWORKERS");
+  n = env ? atoi(env) : 0;
+  if (n <= 0) {
+    long procs = sysconf(_SC_NPROCESSORS_ONLN);
+    n = procs > 0 ? (int)procs : 1;
+  }
+  /* Leave slots for the threads that spawn without being workers. */
+  if (n > CILKR_MAX_WORKERS / 2)
+    n = CILKR_MAX_WORKERS / 2;
+  int expected = 0;
+  if (!atomic_compare_exchange_strong(&nworkers, &expected, n))
+    return expected;
+  return n;
+}
+
+void __cilkr_spawn(__cilkr_frame *f, void (*fn)(void *), void *args,
+                   size_t size) {
+  worker *w = get_worker();
+  task *t = alloc_task(w, size);
+  t->fn = fn;
+  t->frame = f;
+  memcpy(task_args(t), args, size);
+  /* The compiler reads the frame with plain loads and atomic loads, so update
+   * it with the atomic builtins rather than through _Atomic types. */
+  f->worker = w;
+  __atomic_fetch_add(&f->pending, 1, __ATOMIC_RELAXED);
+  push(&w->d, t);
+  wake_idle();
+}
+
+void __cilkr_sync(__cilkr_frame *f) {
+  worker *w = get_worker();
+  while (__atomic_load_n(&f->pending, __ATOMIC_ACQUIRE) != 0) {
+    task *t = take(&w->d);
+    if (t) {
+      run_task(w, t);
+    } else if (w->steal_depth < CILKR_MAX_STEAL_DEPTH && (t = steal(w))) {
+      ++w->steal_depth;
+      run_task(w, t);
+      --w->steal_depth;
+    } else {
+      sched_yield();
+    }
+  }
+  reclaim_arrays(&w->d);
+}
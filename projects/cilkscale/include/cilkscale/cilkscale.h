@@ -0,0 +1,66 @@
+/*===- cilkscale.h - Interface of the Cilkscale runtime -----------*- C -*-===*\
+|*                                                                            *|
+|*                     The LLVM Compiler Infrastructure                       *|
+|*                                                                            *|
+|* This file is distributed under the University of Illinois Open Source      *|
+|* License. See LICENSE.TXT for details.                                      *|
+|*                                                                            *|
+|*===----------------------------------------------------------------------===*|
+|*                                                                            *|
+|* This file declares the interface of the Cilkscale runtime, which measures  *|
+|* the work and span of a program instrumented by the -cilkscale pass.  The   *|
+|* pass calls the hooks below with CSI IDs.  The runtime measures the time    *|
+|* between consecutive hooks and combines it along the series-parallel        *|
+|* structure of the execution.  The measurements follow the serial order of   *|
+|* the program, so the program must run on a single worker.  At exit, the     *|
+|* runtime prints the work, span, and parallelism of the program, and those   *|
+|* of the tasks spawned at each spawn site, to standard error.                *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#ifndef CILKSCALE_CILKSCALE_H
+#define CILKSCALE_CILKSCALE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The hooks that the -cilkscale pass inserts into functions that spawn. */
+void __cilkscale_func_entry(int64_t func_id);
+void __cilkscale_func_exit(int64_t func_exit_id, int64_t func_id);
+void __cilkscale_detach(int64_t detach_id);
+void __cilkscale_task(int64_t task_id, int64_t detach_id);
+void __cilkscale_task_exit(int64_t task_exit_id, int64_t task_id,
+                           int64_t detach_id);
+void __cilkscale_detach_continue(int64_t detach_continue_id,
+                                 int64_t detach_id);
+void __cilkscale_sync(int64_t sync_id);
+
+/* Work and span, in ticks of the clock of the runtime. */
+typedef struct {
+  uint64_t work;
+  uint64_t span;
+} cilkscale_measurement_t;
+
+/* Get the work and span of the outermost calls to spawning functions that
+ * have returned so far, which run one after the other.  Serial code outside of
+ * those calls is not measured. */
+cilkscale_measurement_t __cilkscale_get_program_measurement(void);
+
+/* Get the total work and span of the tasks spawned so far at the spawn site
+ * with the given detach ID, and store the number of those tasks in *count. */
+cilkscale_measurement_t __cilkscale_get_site_measurement(int64_t detach_id,
+                                                         uint64_t *count);
+
+/* Replace the clock of the runtime, which by default counts processor cycles
+ * where a cycle counter is available, and nanoseconds otherwise.  The clock
+ * must be replaced before the first hook runs. */
+void __cilkscale_set_clock(uint64_t (*clock)(void));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CILKSCALE_CILKSCALE_H */
@@ -0,0 +1,246 @@
+/*===- cilkscale.c - Work and span measurement for Cilkscale ------*- C -*-===*\
+|*                                                                            *|
+|*                     The LLVM Compiler Infrastructure                       *|
+|*                                                                            *|
+|* This file is distributed under the University of Illinois Open Source      *|
+|* License. See LICENSE.TXT for details.                                      *|
+|*                                                                            *|
+|*===----------------------------------------------------------------------===*|
+|*                                                                            *|
+|* This file implements the Cilkscale runtime.  It keeps a shadow stack with  *|
+|* a frame for each active spawning function and task.  A frame holds the    *|
+|* work under it, the span up to its last sync, the span of its continuation  *|
+|* since that sync, and the longest span through a task it spawned since that *|
+|* sync.  The time of each strand is added to the work and continuation of    *|
+|* the frame on top.  A sync takes the longer of the continuation and the     *|
+|* longest spawned path.  A returning call adds its span to the continuation  *|
+|* of its caller, whereas a returning task only competes with it.  The time   *|
+|* spent in the runtime is excluded from the measurements.                    *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#include "cilkscale/cilkscale.h"
+#include "csi/csirt_compressed.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+typedef struct {
+  uint64_t work;
+  uint64_t prefix;
+  uint64_t contin;
+  uint64_t child;
+} frame;
+
+typedef struct {
+  uint64_t count;
+  uint64_t work;
+  uint64_t span;
+} site;
+
+static frame *stack;
+static int64_t depth, stack_capacity;
+static site *sites;
+static int64_t num_sites;
+static cilkscale_measurement_t program;
+static uint64_t last_time;
+
+static _Atomic int num_threads;
+static _Thread_local int thread_seen;
+
+static uint64_t default_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static uint64_t (*read_clock)(void) = default_clock;
+
+static void fatal(const char *msg) {
+  fprintf(stderr, "cilkscale: %s\n", msg);
+  abort();
+}
+
+static void *checked_realloc(void *mem, size_t size) {
+  mem = realloc(mem, size);
+  if (!mem)
+    fatal("out of memory");
+  return mem;
+}
+
+/* Start a hook: add the time since the previous hook to the frame on top. */
+static void begin_hook(void) {
+  uint64_t now = read_clock();
+  if (!thread_seen) {
+    thread_seen = 1;
+    if (atomic_fetch_add(&num_threads, 1) != 0)
+      fatal("the program must run on a single worker, e.g. with "
+            "CILK_NWORKERS=1");
+  }
+  if (depth) {
+    uint64_t strand = now - last_time;
+    stack[depth - 1].work += strand;
+    stack[depth - 1].contin += strand;
+  }
+}
+
+/* End a hook, so that the next strand starts now. */
+static void end_hook(void) { last_time = read_clock(); }
+
+static void push_frame(void) {
+  if (depth == stack_capacity) {
+    stack_capacity = stack_capacity ? 2 * stack_capacity : 64;
+    stack = checked_realloc(stack, stack_capacity * sizeof(frame));
+  }
+  frame zero = {0, 0, 0, 0};
+  stack[depth++] = zero;
+}
+
+static void sync_frame(frame *f) {
+  if (f->child > f->contin)
+    f->contin = f->child;
+  f->prefix += f->contin;
+  f->contin = 0;
+  f->child = 0;
+}
+
+/* Pop the frame on top, after its implicit sync. */
+static frame pop_frame(void) {
+  frame *f = &stack[depth - 1];
+  sync_frame(f);
+  --depth;
+  return *f;
+}
+
+static site *get_site(int64_t detach_id) {
+  if (detach_id < 0)
+    return NULL;
+  if (detach_id >= num_sites) {
+    int64_t n = num_sites ? num_sites : 64;
+    while (n <= detach_id)
+      n *= 2;
+    sites = checked_realloc(sites, n * sizeof(site));
+    for (int64_t i = num_sites; i < n; ++i) {
+      site zero = {0, 0, 0};
+      sites[i] = zero;
+    }
+    num_sites = n;
+  }
+  return &sites[detach_id];
+}
+
+void __cilkscale_func_entry(int64_t func_id) {
+  begin_hook();
+  push_frame();
+  end_hook();
+}
+
+void __cilkscale_func_exit(int64_t func_exit_id, int64_t func_id) {
+  begin_hook();
+  if (depth) {
+    frame callee = pop_frame();
+    if (depth) {
+      stack[depth - 1].work += callee.work;
+      stack[depth - 1].contin += callee.prefix;
+    } else {
+      program.work += callee.work;
+      program.span += callee.prefix;
+    }
+  }
+  end_hook();
+}
+
+void __cilkscale_detach(int64_t detach_id) {
+  begin_hook();
+  end_hook();
+}
+
+void __cilkscale_task(int64_t task_id, int64_t detach_id) {
+  begin_hook();
+  push_frame();
+  end_hook();
+}
+
+void __cilkscale_task_exit(int64_t task_exit_id, int64_t task_id,
+                           int64_t detach_id) {
+  begin_hook();
+  if (depth > 1) {
+    frame task = pop_frame();
+    frame *parent = &stack[depth - 1];
+    parent->work += task.work;
+    if (parent->contin + task.prefix > parent->child)
+      parent->child = parent->contin + task.prefix;
+    site *s = get_site(detach_id);
+    if (s) {
+      ++s->count;
+      s->work += task.work;
+      s->span += task.prefix;
+    }
+  }
+  end_hook();
+}
+
+void __cilkscale_detach_continue(int64_t detach_continue_id,
+                                 int64_t detach_id) {
+  begin_hook();
+  end_hook();
+}
+
+void __cilkscale_sync(int64_t sync_id) {
+  begin_hook();
+  if (depth)
+    sync_frame(&stack[depth - 1]);
+  end_hook();
+}
+
+cilkscale_measurement_t __cilkscale_get_program_measurement(void) {
+  return program;
+}
+
+cilkscale_measurement_t __cilkscale_get_site_measurement(int64_t detach_id,
+                                                         uint64_t *count) {
+  cilkscale_measurement_t m = {0, 0};
+  *count = 0;
+  if (detach_id >= 0 && detach_id < num_sites) {
+    *count = sites[detach_id].count;
+    m.work = sites[detach_id].work;
+    m.span = sites[detach_id].span;
+  }
+  return m;
+}
+
+void __cilkscale_set_clock(uint64_t (*clock)(void)) { read_clock = clock; }
+
+static double parallelism(uint64_t work, uint64_t span) {
+  return span ? (double)work / (double)span : 0.0;
+}
+
+__attribute__((destructor)) static void report(void) {
+  if (!program.work && !num_sites)
+    return;
+  fprintf(stderr, "cilkscale: work %llu, span %llu, parallelism %.2f\n",
+          (unsigned long long)program.work, (unsigned long long)program.span,
+          parallelism(program.work, program.span));
+  for (int64_t id = 0; id < num_sites; ++id) {
+    const site *s = &sites[id];
+    if (!s->count)
+      continue;
+    const csirt_source_loc_t *loc = __csi_get_detach_source_loc(id);
+    fprintf(stderr, "cilkscale: %s:%d:%d: %llu tasks, work %llu, span %llu, "
+                    "parallelism %.2f\n",
+            loc && loc->filename ? loc->filename : "<unknown>",
+            loc ? loc->line : -1, loc ? loc->column : -1,
+            (unsigned long long)s->count, (unsigned long long)s->work,
+            (unsigned long long)s->span, parallelism(s->work, s->span));
+  }
+}
@@ -0,0 +1,142 @@
+/*===- csirt_compressed.h - Compressed CSI tables -----------------*- C -*-===*\
+|*                                                                            *|
+|*                     The LLVM Compiler Infrastructure                       *|
+|*                                                                            *|
+|* This file is distributed under the University of Illinois Open Source      *|
+|* License. See LICENSE.TXT for details.                                      *|
+|*                                                                            *|
+|*===----------------------------------------------------------------------===*|
+|*                                                                            *|
+|* This file declares the layout of the compressed front-end data (FED) and   *|
+|* size tables that the CSI pass emits under -csi-compress-tables, and the    *|
+|* part of the CSI runtime that registers the tables of each unit and looks   *|
+|* their entries up for tools.                                                *|
+|*                                                                            *|
+|* A compressed table is a stream of LEB128 numbers, grouped in blocks of     *|
+|* CSIRT_TABLE_BLOCK_SIZE entries, with the byte offset of each block.  An    *|
+|* entry is decoded starting from the beginning of its block, so looking up   *|
+|* any entry decodes at most one block.  A FED entry is the offset plus one   *|
+|* of its name in the string pool of the unit, the signed difference between  *|
+|* its line and that of the previous entry of the block, its column plus      *|
+|* one, and the offset plus one of its file name in the string pool.  Zero    *|
+|* stands for a missing name, column, or file name.  A size entry is its      *|
+|* full IR size followed by its non-empty IR size.                            *|
+|*                                                                            *|
+|* Registering a unit only records where its tables are.  A block is decoded  *|
+|* the first time a tool looks up one of its entries, and is kept for later   *|
+|* lookups.                                                                   *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#ifndef CSI_CSIRT_COMPRESSED_H
+#define CSI_CSIRT_COMPRESSED_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of entries in each block of a compressed table.  This must match
+ * CsiTableBlockSize in llvm/Transforms/CSI.h. */
+#define CSIRT_TABLE_BLOCK_SIZE 64
+
+/* Number of FED tables of a unit, one per kind of CSI ID, in the order of
+ * CSIImpl::collectUnitFEDTables. */
+#define CSIRT_NUM_FED_TABLES 11
+
+/* Index of the FED table of basic blocks, whose IDs the size tables share. */
+#define CSIRT_BB_FED_TABLE 2
+
+/* Number of size tables of a unit. */
+#define CSIRT_NUM_SIZE_TABLES 1
+
+typedef int64_t csirt_id_t;
+
+/* A source location, laid out like source_loc_t of csi.h. */
+typedef struct {
+  char *name;
+  int32_t line;
+  int32_t column;
+  char *filename;
+} csirt_source_loc_t;
+
+/* The sizes of a basic block, laid out like sizeinfo_t of csi.h. */
+typedef struct {
+  int32_t full_ir_size;
+  int32_t non_empty_ir_size;
+} csirt_sizeinfo_t;
+
+/* The number of IDs of each kind in a unit, laid out like
+ * instrumentation_counts_t of csi.h. */
+typedef struct {
+  csirt_id_t num[CSIRT_NUM_FED_TABLES];
+} csirt_instrumentation_counts_t;
+
+/* A compressed FED table of a unit. */
+typedef struct {
+  int64_t num_entries;
+  int64_t *id_base;
+  const uint8_t *data;
+  const uint32_t *blocks;
+} unit_compressed_fed_table_t;
+
+/* A compressed size table of a unit. */
+typedef struct {
+  int64_t num_entries;
+  const uint8_t *data;
+  const uint32_t *blocks;
+} unit_compressed_size_table_t;
+
+/* An uncompressed FED table of a unit, as units built without
+ * -csi-compress-tables pass it. */
+typedef struct {
+  int64_t num_entries;
+  int64_t *id_base;
+  csirt_source_loc_t *entries;
+} unit_fed_table_t;
+
+/* An uncompressed size table of a unit. */
+typedef struct {
+  int64_t num_entries;
+  csirt_sizeinfo_t *entries;
+} unit_size_table_t;
+
+/* The entry point that the constructor of a unit compiled with
+ * -csi-compress-tables calls.  It assigns the base IDs of the unit, records
+ * its tables, and calls the __csi_unit_init hook of the tool. */
+void __csirt_unit_init_compressed(const char *name,
+                                  unit_compressed_fed_table_t *fed_tables,
+                                  unit_compressed_size_table_t *size_tables,
+                                  const char *strings,
+                                  void (*callsite_to_func_init)(void));
+
+/* The entry point that the constructor of a unit compiled without
+ * -csi-compress-tables calls, so that such units can be linked into the same
+ * program. */
+void __csirt_unit_init(const char *name, unit_fed_table_t *fed_tables,
+                       unit_size_table_t *size_tables,
+                       void (*callsite_to_func_init)(void));
+
+/* The accessors of csi.h, which tools call to look up the entry of an ID.  The
+ * entry stays valid for the rest of the execution.  An ID that no unit has
+ * registered yields null. */
+const csirt_source_loc_t *__csi_get_func_source_loc(const csirt_id_t id);
+const csirt_source_loc_t *__csi_get_func_exit_source_loc(const csirt_id_t id);
+const csirt_source_loc_t *__csi_get_bb_source_loc(const csirt_id_t id);
+const csirt_source_loc_t *__csi_get_callsite_source_loc(const csirt_id_t id);
+const csirt_source_loc_t *__csi_get_load_source_loc(const csirt_id_t id);
+const csirt_source_loc_t *__csi_get_store_source_loc(const csirt_id_t id);
+const csirt_source_loc_t *__csi_get_detach_source_loc(const csirt_id_t id);
+const csirt_source_loc_t *__csi_get_task_source_loc(const csirt_id_t id);
+const csirt_source_loc_t *__csi_get_task_exit_source_loc(const csirt_id_t id);
+const csirt_source_loc_t *
+__csi_get_detach_continue_source_loc(const csirt_id_t id);
+const csirt_source_loc_t *__csi_get_sync_source_loc(const csirt_id_t id);
+const csirt_sizeinfo_t *__csi_get_bb_sizeinfo(const csirt_id_t id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSI_CSIRT_COMPRESSED_H */
@@ -0,0 +1,307 @@
+/*===- csirt_compressed.c - CSI tables decoded on demand ----------*- C -*-===*\
+|*                                                                            *|
+|*                     The LLVM Compiler Infrastructure                       *|
+|*                                                                            *|
+|* This file is distributed under the University of Illinois Open Source      *|
+|* License. See LICENSE.TXT for details.                                      *|
+|*                                                                            *|
+|*===----------------------------------------------------------------------===*|
+|*                                                                            *|
+|* This file implements the part of the CSI runtime that keeps the tables of  *|
+|* the units of a program.  A unit registers where its tables are, and gets   *|
+|* the first ID of each kind in return.  A lookup finds the unit of an ID by  *|
+|* binary search, and decodes the block of a compressed entry the first time  *|
+|* the block is needed.  Registration is serialized by a lock, while lookups  *|
+|* only read atomics, so that tools can look IDs up from any thread.          *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#include "csi/csirt_compressed.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* The hooks of the tool.  A tool need not define them. */
+void __csi_init(void) __attribute__((weak));
+void __csi_unit_init(const char *name,
+                     const csirt_instrumentation_counts_t counts)
+    __attribute__((weak));
+
+/* The table of one kind of one unit.  Exactly one of entries and data is set.
+ * The array of decoded blocks of a compressed table, and each block, are
+ * allocated on first lookup. */
+typedef struct {
+  csirt_id_t base;
+  int64_t num_entries;
+  void *entries;
+  const uint8_t *data;
+  const uint32_t *offsets;
+  const char *strings;
+  _Atomic(void *) blocks;
+} table;
+
+/* The tables of one kind, in increasing order of base.  The array only grows;
+ * a lookup that reads the count before the array sees at least that many
+ * tables, since the array is published before the count and the arrays that
+ * it replaces are kept. */
+typedef struct {
+  _Atomic(table **) tables;
+  _Atomic int64_t count;
+  int64_t capacity;
+  csirt_id_t next_id;
+} registry;
+
+static registry fed_registries[CSIRT_NUM_FED_TABLES];
+static registry size_registry;
+static pthread_mutex_t registration_lock = PTHREAD_MUTEX_INITIALIZER;
+static int initialized;
+
+static void *checked_calloc(int64_t count, size_t size) {
+  void *mem = calloc(count ? (size_t)count : 1, size);
+  if (!mem) {
+    fprintf(stderr, "csirt: cannot allocate the tables of a unit\n");
+    abort();
+  }
+  return mem;
+}
+
+/* Record a table of the given registry, which must be locked. */
+static table *add_table(registry *r, csirt_id_t base, int64_t num_entries) {
+  table *t = checked_calloc(1, sizeof(table));
+  t->base = base;
+  t->num_entries = num_entries;
+  table **tables = atomic_load_explicit(&r->tables, memory_order_relaxed);
+  int64_t count = atomic_load_explicit(&r->count, memory_order_relaxed);
+  if (count == r->capacity) {
+    r->capacity = r->capacity ? 2 * r->capacity : 16;
+    table **grown = checked_calloc(r->capacity, sizeof(table *));
+    for (int64_t i = 0; i < count; ++i)
+      grown[i] = tables[i];
+    atomic_store_explicit(&r->tables, grown, memory_order_release);
+    tables = grown;
+  }
+  tables[count] = t;
+  atomic_store_explicit(&r->count, count + 1, memory_order_release);
+  return t;
+}
+
+static table *find_table(registry *r, csirt_id_t id) {
+  int64_t count = atomic_load_explicit(&r->count, memory_order_acquire);
+  table **tables = atomic_load_explicit(&r->tables, memory_order_acquire);
+  int64_t lo = 0, hi = count;
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    if (tables[mid]->base + tables[mid]->num_entries <= id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == count || id < tables[lo]->base)
+    return NULL;
+  return tables[lo];
+}
+
+/* Publish a freshly allocated object in *slot, or return the one that another
+ * thread published first. */
+static void *publish(_Atomic(void *) *slot, void *mem) {
+  void *expected = NULL;
+  if (atomic_compare_exchange_strong_explicit(slot, &expected, mem,
+                                              memory_order_acq_rel,
+                                              memory_order_acquire))
+    return mem;
+  free(mem);
+  return expected;
+}
+
+static uint64_t decode_uleb128(const uint8_t **p) {
+  uint64_t value = 0;
+  unsigned shift = 0;
+  uint8_t byte;
+  do {
+    byte = *(*p)++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return value;
+}
+
+static int64_t decode_sleb128(const uint8_t **p) {
+  int64_t value = 0;
+  unsigned shift = 0;
+  uint8_t byte;
+  do {
+    byte = *(*p)++;
+    value |= (int64_t)(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  /* Sign-extend a negative value. */
+  if (shift < 64 && (byte & 0x40))
+    value |= -((int64_t)1 << shift);
+  return value;
+}
+
+static char *pool_string(const char *strings, uint64_t offset_plus_one) {
+  return offset_plus_one ? (char *)strings + offset_plus_one - 1 : NULL;
+}
+
+static void decode_fed_block(const table *t, const uint8_t *p, int64_t count,
+                             csirt_source_loc_t *locs) {
+  int32_t line = 0;
+  for (int64_t i = 0; i < count; ++i) {
+    locs[i].name = pool_string(t->strings, decode_uleb128(&p));
+    locs[i].line = line + (int32_t)decode_sleb128(&p);
+    locs[i].column = (int32_t)decode_uleb128(&p) - 1;
+    locs[i].filename = pool_string(t->strings, decode_uleb128(&p));
+    line = locs[i].line;
+  }
+}
+
+static void decode_size_block(const uint8_t *p, int64_t count,
+                              csirt_sizeinfo_t *sizes) {
+  for (int64_t i = 0; i < count; ++i) {
+    sizes[i].full_ir_size = (int32_t)decode_uleb128(&p);
+    sizes[i].non_empty_ir_size = (int32_t)decode_uleb128(&p);
+  }
+}
+
+/* Return the entry of the given ID, decoding its block if no lookup has done
+ * so yet. */
+static void *lookup(registry *r, csirt_id_t id, size_t entry_size) {
+  table *t = find_table(r, id);
+  if (!t)
+    return NULL;
+  int64_t local_id = id - t->base;
+  if (t->entries)
+    return (char *)t->entries + local_id * entry_size;
+
+  int64_t block = local_id / CSIRT_TABLE_BLOCK_SIZE;
+  _Atomic(void *) *blocks =
+      atomic_load_explicit(&t->blocks, memory_order_acquire);
+  if (!blocks) {
+    int64_t num_blocks = (t->num_entries + CSIRT_TABLE_BLOCK_SIZE - 1) /
+                         CSIRT_TABLE_BLOCK_SIZE;
+    blocks = publish(&t->blocks,
+                     checked_calloc(num_blocks, sizeof(_Atomic(void *))));
+  }
+  void *decoded = atomic_load_explicit(&blocks[block], memory_order_acquire);
+  if (!decoded) {
+    int64_t first = block * CSIRT_TABLE_BLOCK_SIZE;
+    int64_t count = t->num_entries - first < CSIRT_TABLE_BLOCK_SIZE
+                        ? t->num_entries - first
+                        : CSIRT_TABLE_BLOCK_SIZE;
+    void *mem = checked_calloc(count, entry_size);
+    const uint8_t *p = t->data + t->offsets[block];
+    if (r == &size_registry)
+      decode_size_block(p, count, mem);
+    else
+      decode_fed_block(t, p, count, mem);
+    decoded = publish(&blocks[block], mem);
+  }
+  return (char *)decoded + (local_id % CSIRT_TABLE_BLOCK_SIZE) * entry_size;
+}
+
+/* Assign the base IDs of a unit, and return the table of each kind and the
+ * number of IDs of each kind.  The registration lock must be held. */
+static void add_unit(const int64_t num_entries[CSIRT_NUM_FED_TABLES],
+                     int64_t *const id_bases[CSIRT_NUM_FED_TABLES],
+                     int64_t num_sizes, table *fed[CSIRT_NUM_FED_TABLES],
+                     table **size, csirt_instrumentation_counts_t *counts) {
+  for (int i = 0; i < CSIRT_NUM_FED_TABLES; ++i) {
+    registry *r = &fed_registries[i];
+    *id_bases[i] = r->next_id;
+    fed[i] = add_table(r, r->next_id, num_entries[i]);
+    r->next_id += num_entries[i];
+    counts->num[i] = num_entries[i];
+  }
+  *size = add_table(&size_registry, *id_bases[CSIRT_BB_FED_TABLE], num_sizes);
+}
+
+/* Initialize the tool on the first unit, and hand it the unit once the
+ * callsite-to-function map of the unit refers to its final IDs. */
+static void finish_unit(const char *name, void (*callsite_to_func_init)(void),
+                        const csirt_instrumentation_counts_t counts) {
+  if (!initialized) {
+    initialized = 1;
+    if (__csi_init)
+      __csi_init();
+  }
+  callsite_to_func_init();
+  if (__csi_unit_init)
+    __csi_unit_init(name, counts);
+}
+
+void __csirt_unit_init_compressed(const char *name,
+                                  unit_compressed_fed_table_t *fed_tables,
+                                  unit_compressed_size_table_t *size_tables,
+                                  const char *strings,
+                                  void (*callsite_to_func_init)(void)) {
+  int64_t num_entries[CSIRT_NUM_FED_TABLES];
+  int64_t *id_bases[CSIRT_NUM_FED_TABLES];
+  for (int i = 0; i < CSIRT_NUM_FED_TABLES; ++i) {
+    num_entries[i] = fed_tables[i].num_entries;
+    id_bases[i] = fed_tables[i].id_base;
+  }
+  table *fed[CSIRT_NUM_FED_TABLES], *size;
+  csirt_instrumentation_counts_t counts;
+
+  pthread_mutex_lock(&registration_lock);
+  add_unit(num_entries, id_bases, size_tables[0].num_entries, fed, &size,
+           &counts);
+  for (int i = 0; i < CSIRT_NUM_FED_TABLES; ++i) {
+    fed[i]->data = fed_tables[i].data;
+    fed[i]->offsets = fed_tables[i].blocks;
+    fed[i]->strings = strings;
+  }
+  size->data = size_tables[0].data;
+  size->offsets = size_tables[0].blocks;
+  finish_unit(name, callsite_to_func_init, counts);
+  pthread_mutex_unlock(&registration_lock);
+}
+
+void __csirt_unit_init(const char *name, unit_fed_table_t *fed_tables,
+                       unit_size_table_t *size_tables,
+                       void (*callsite_to_func_init)(void)) {
+  int64_t num_entries[CSIRT_NUM_FED_TABLES];
+  int64_t *id_bases[CSIRT_NUM_FED_TABLES];
+  for (int i = 0; i < CSIRT_NUM_FED_TABLES; ++i) {
+    num_entries[i] = fed_tables[i].num_entries;
+    id_bases[i] = fed_tables[i].id_base;
+  }
+  table *fed[CSIRT_NUM_FED_TABLES], *size;
+  csirt_instrumentation_counts_t counts;
+
+  pthread_mutex_lock(&registration_lock);
+  add_unit(num_entries, id_bases, size_tables[0].num_entries, fed, &size,
+           &counts);
+  for (int i = 0; i < CSIRT_NUM_FED_TABLES; ++i)
+    fed[i]->entries = fed_tables[i].entries;
+  size->entries = size_tables[0].entries;
+  finish_unit(name, callsite_to_func_init, counts);
+  pthread_mutex_unlock(&registration_lock);
+}
+
+#define DEFINE_FED_ACCESSOR(NAME, KIND)                                        \
+  const csirt_source_loc_t *__csi_get_##NAME##_source_loc(                     \
+      const csirt_id_t id) {                                                   \
+    return lookup(&fed_registries[KIND], id, sizeof(csirt_source_loc_t));      \
+  }
+
+DEFINE_FED_ACCESSOR(func, 0)
+DEFINE_FED_ACCESSOR(func_exit, 1)
+DEFINE_FED_ACCESSOR(bb, 2)
+DEFINE_FED_ACCESSOR(callsite, 3)
+DEFINE_FED_ACCESSOR(load, 4)
+DEFINE_FED_ACCESSOR(store, 5)
+DEFINE_FED_ACCESSOR(detach, 6)
+DEFINE_FED_ACCESSOR(task, 7)
+DEFINE_FED_ACCESSOR(task_exit, 8)
+DEFINE_FED_ACCESSOR(detach_continue, 9)
+DEFINE_FED_ACCESSOR(sync, 10)
+
+#undef DEFINE_FED_ACCESSOR
+
+const csirt_sizeinfo_t *__csi_get_bb_sizeinfo(const csirt_id_t id) {
+  return lookup(&size_registry, id, sizeof(csirt_sizeinfo_t));
+}
@@ -0,0 +1,52 @@
+/*===- tapir_tbb.h - Interface of the Tapir shim over TBB ---------*- C -*-===*\
+|*                                                                            *|
+|*                     The LLVM Compiler Infrastructure                       *|
+|*                                                                            *|
+|* This file is distributed under the University of Illinois Open Source      *|
+|* License. See LICENSE.TXT for details.                                      *|
+|*                                                                            *|
+|*===----------------------------------------------------------------------===*|
+|*                                                                            *|
+|* This file declares the C interface that the tbb Tapir target lowers to.    *|
+|* It is implemented over the task_group and task_arena classes of Intel TBB, *|
+|* so that Tapir code shares the TBB scheduler with the rest of the program.  *|
+|* Each sync region keeps a pointer to a task_group on the stack, which is    *|
+|* null until the first spawn in the region and is reset to null by each      *|
+|* sync.                                                                      *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#ifndef TAPIR_TBB_TAPIR_TBB_H
+#define TAPIR_TBB_TAPIR_TBB_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Create the task_arena in which all tasks run and are waited for.  Its
+ * concurrency is read from the CILK_NWORKERS environment variable, if set, and
+ * otherwise is the default of TBB.  Calling it again has no effect, and the
+ * other entry points call it if the program has not. */
+void __tapir_tbb_initialize(void);
+
+/* Run a task that calls fn on a copy of the size bytes at args in the
+ * task_group at *group, creating the task_group if *group is null.  The copy
+ * is made before __tapir_tbb_spawn returns, so args may be reused
+ * afterwards. */
+void __tapir_tbb_spawn(void **group, void (*fn)(void *), void *args,
+                       size_t size);
+
+/* Wait for the tasks of the task_group at *group, destroy it, and set *group
+ * to null. */
+void __tapir_tbb_sync(void **group);
+
+/* Return the maximum concurrency of the task_arena. */
+int __tapir_tbb_max_concurrency(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TAPIR_TBB_TAPIR_TBB_H */
@@ -0,0 +1,77 @@
+//===- tapir_tbb.cpp - Tapir shim over TBB task groups --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the C interface of tapir_tbb.h.  Each spawn and wait
+// enters the task_arena of the shim, which is cheap on the threads of the
+// arena, where nearly all of them happen.  A task owns a heap copy of its
+// arguments, which it frees once it has run.
+//
+//===----------------------------------------------------------------------===//
+
+#include "tapir-tbb/tapir_tbb.h"
+
+#include "tbb/task_arena.h"
+#include "tbb/task_group.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+tbb::task_arena &getArena() {
+  static tbb::task_arena Arena([] {
+    const char *Env = std::getenv("CILK_NWORKERS");
+    int NWorkers = Env ? std::atoi(Env) : 0;
+    return NWorkers > 0 ? NWorkers : int(tbb::task_arena::automatic);
+  }());
+  return Arena;
+}
+
+// The functor passed to task_group::run.  TBB may copy it before it runs, but
+// runs it exactly once, so the copy of the arguments is freed after that run.
+struct Task {
+  void (*Fn)(void *);
+  void *Args;
+
+  void operator()() const {
+    Fn(Args);
+    std::free(Args);
+  }
+};
+
+} // end anonymous namespace
+
+extern "C" {
+
+void __tapir_tbb_initialize(void) { getArena().initialize(); }
+
+void __tapir_tbb_spawn(void **group, void (*fn)(void *), void *args,
+                       size_t size) {
+  Task T = {fn, std::malloc(size ? size : 1)};
+  if (!T.Args)
+    std::abort();
+  std::memcpy(T.Args, args, size);
+  if (!*group)
+    *group = new tbb::task_group();
+  tbb::task_group *Group = static_cast<tbb::task_group *>(*group);
+  getArena().execute([&] { Group->run(T); });
+}
+
+void __tapir_tbb_sync(void **group) {
+  tbb::task_group *Group = static_cast<tbb::task_group *>(*group);
+  if (!Group)
+    return;
+  getArena().execute([&] { Group->wait(); });
+  delete Group;
+  *group = nullptr;
+}
+
+int __tapir_tbb_max_concurrency(void) { return getArena().max_concurrency(); }
+
+} // extern "C"
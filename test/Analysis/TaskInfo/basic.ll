@@ -0,0 +1,58 @@
+; RUN: opt < %s -tasks -analyze | FileCheck %s
+; RUN: opt < %s -passes='print<tasks>' -disable-output 2>&1 | FileCheck %s
+
+; The continuation of a detach and the blocks after a sync stay in the spawning
+; task, and a nested detach starts a task one level deeper.
+
+; CHECK-LABEL: function{{.*}}nested
+; CHECK: Task at depth 0 with entry %entry: %entry,%det.cont,%sync.continue
+; CHECK: Task at depth 1 with entry %det.achd spawned by %entry within %syncreg: %det.achd,%loop,%inner.cont,%inner.sync,%det.reattach
+; CHECK: Task at depth 2 with entry %inner.achd spawned by %det.achd within %inner.syncreg: %inner.achd
+
+define void @nested(i32* %a, i32 %n) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  %inner.syncreg = call token @llvm.syncregion.start()
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %det.achd ], [ %inc, %inner.cont ]
+  detach within %inner.syncreg, label %inner.achd, label %inner.cont
+
+inner.achd:
+  store i32 %i, i32* %a, align 4
+  reattach within %inner.syncreg, label %inner.cont
+
+inner.cont:
+  %inc = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %inc, %n
+  br i1 %cmp, label %loop, label %inner.sync
+
+inner.sync:
+  sync within %inner.syncreg, label %det.reattach
+
+det.reattach:
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  store i32 0, i32* %a, align 4
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+; CHECK-LABEL: function{{.*}}serial
+; CHECK: Task at depth 0 with entry %entry: %entry
+; CHECK-NOT: Task at depth 1
+
+define void @serial(i32* %a) {
+entry:
+  store i32 0, i32* %a, align 4
+  ret void
+}
+
+declare token @llvm.syncregion.start()
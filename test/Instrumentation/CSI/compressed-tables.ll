@@ -0,0 +1,54 @@
+; Test the compressed front-end data and size tables that CSI emits under
+; -csi-compress-tables, and the runtime entry point that receives them.
+;
+; RUN: opt < %s -csi -csi-compress-tables -S | FileCheck %s
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; Each string is stored once in the pool of the unit.
+; CHECK-DAG: @__csi_unit_fed_strings = private constant [11 x i8] c"f\00/tmp/t.c\00"
+
+; The function entry has name "f" (offset 0), line 3, no column, and file name
+; "/tmp/t.c" (offset 2), each offset and the column plus one.
+; CHECK-DAG: @__csi_unit_fed_table__csi_unit_func_base_id.data = private constant [4 x i8] c"\01\03\00\03"
+; CHECK-DAG: @__csi_unit_fed_table__csi_unit_func_base_id.blocks = private constant [1 x i32] zeroinitializer
+
+; The load is at line 4, column 7, and the store at line 5, column 3.
+; CHECK-DAG: @__csi_unit_fed_table__csi_unit_load_base_id.data = private constant [4 x i8] c"\01\04\08\03"
+; CHECK-DAG: @__csi_unit_fed_table__csi_unit_store_base_id.data = private constant [4 x i8] c"\01\05\04\03"
+
+; A table without entries has no blocks.
+; CHECK-DAG: @__csi_unit_fed_table__csi_unit_detach_base_id.data = private constant [0 x i8] zeroinitializer
+; CHECK-DAG: @__csi_unit_fed_table__csi_unit_detach_base_id.blocks = private constant [0 x i32] zeroinitializer
+
+; The size table holds the full and non-empty IR sizes of the one block.
+; CHECK-DAG: @__csi_unit_size_table.data = private constant [2 x i8] c"{{.*}}"
+; CHECK-DAG: @__csi_unit_size_table.blocks = private constant [1 x i32] zeroinitializer
+
+; CHECK-DAG: @__csi_unit_fed_tables = internal global [11 x { i64, i8*, i8*, i32* }] [{ i64, i8*, i8*, i32* } { i64 1, i8* bitcast (i64* @__csi_unit_func_base_id to i8*), i8* getelementptr inbounds ([4 x i8], [4 x i8]* @__csi_unit_fed_table__csi_unit_func_base_id.data, i32 0, i32 0), i32* getelementptr inbounds ([1 x i32], [1 x i32]* @__csi_unit_fed_table__csi_unit_func_base_id.blocks, i32 0, i32 0) },
+; CHECK-DAG: @__csi_unit_size_tables = internal global [1 x { i64, i8*, i32* }]
+
+; CHECK-LABEL: define internal void @csirt.unit_ctor()
+; CHECK: call void @__csirt_unit_init_compressed(i8* {{.*}}, { i64, i8*, i8*, i32* }* getelementptr inbounds ([11 x { i64, i8*, i8*, i32* }], [11 x { i64, i8*, i8*, i32* }]* @__csi_unit_fed_tables, i32 0, i32 0), { i64, i8*, i32* }* getelementptr inbounds ([1 x { i64, i8*, i32* }], [1 x { i64, i8*, i32* }]* @__csi_unit_size_tables, i32 0, i32 0), i8* getelementptr inbounds ([11 x i8], [11 x i8]* @__csi_unit_fed_strings, i32 0, i32 0), void ()* @__csi_init_callsite_to_function)
+
+define void @f(i32* %p) !dbg !6 {
+entry:
+  %v = load i32, i32* %p, align 4, !dbg !9
+  store i32 %v, i32* %p, align 4, !dbg !10
+  ret void, !dbg !11
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "t.c", directory: "/tmp")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !DISubroutineType(types: !2)
+!6 = distinct !DISubprogram(name: "f", scope: !1, file: !1, line: 3, type: !5, isLocal: false, isDefinition: true, scopeLine: 3, isOptimized: false, unit: !0, variables: !2)
+!9 = !DILocation(line: 4, column: 7, scope: !6)
+!10 = !DILocation(line: 5, column: 3, scope: !6)
+!11 = !DILocation(line: 6, column: 1, scope: !6)
@@ -0,0 +1,39 @@
+; Test that CSI inserts only the hooks listed in the -csi-tool-hooks file,
+; including the library calls that replace memory intrinsics, and warns about
+; names in the list that are not hooks.
+;
+; RUN: opt < %s -csi -csi-tool-hooks=%S/Inputs/tool-hooks.txt -S 2>%t.err | FileCheck %s
+; RUN: FileCheck %s --check-prefix=WARN < %t.err
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; WARN: CSI: warning: {{.*}}tool-hooks.txt:6: unknown hook '__csi_befor_store'
+
+; CHECK-LABEL: define void @f(i32* %p, i8* %d, i8* %s)
+; CHECK-NOT: call void @__csi_func_entry(
+; CHECK: call void @__csi_before_load(
+; CHECK-NEXT: %v = load i32, i32* %p
+; CHECK-NOT: call void @__csi_after_load(
+; CHECK-NOT: call void @__csi_before_store(
+; CHECK: store i32 %v, i32* %p
+; CHECK: call i8* @memcpy(i8* %d, i8* %s, i64 16)
+; CHECK: call void @llvm.memset.p0i8.i64(i8* %d, i8 0, i64 16, i32 1, i1 false)
+; CHECK-NOT: call void @__csi_func_exit(
+; CHECK: ret void
+define void @f(i32* %p, i8* %d, i8* %s) #0 {
+entry:
+  %v = load i32, i32* %p, align 4
+  store i32 %v, i32* %p, align 4
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %d, i8* %s, i64 16, i32 1, i1 false)
+  call void @llvm.memset.p0i8.i64(i8* %d, i8 0, i64 16, i32 1, i1 false)
+  ret void
+}
+
+; CHECK-NOT: declare void @__csi_before_store(
+; CHECK-NOT: declare i8* @memset(
+
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8* nocapture, i8* nocapture readonly, i64, i32, i1)
+declare void @llvm.memset.p0i8.i64(i8* nocapture, i8, i64, i32, i1)
+
+attributes #0 = { nounwind }
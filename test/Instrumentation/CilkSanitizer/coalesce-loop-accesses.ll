@@ -0,0 +1,43 @@
+; Test that CilkSanitizer instruments the consecutive stores of a serial loop
+; with one range hook in the preheader, instead of one hook per iteration.
+;
+; RUN: opt < %s -csan -S | FileCheck %s
+; RUN: opt < %s -csan -csan-coalesce-loop-accesses -S | FileCheck %s --check-prefix=RANGE
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; CHECK-LABEL: define void @fill(i32* %a, i64 %n)
+; CHECK: for.body:
+; CHECK: call void @__csan_store(i64 {{.*}}, i8* {{.*}}, i32 4, i64
+; CHECK-NEXT: store i32 0, i32* %arrayidx
+
+; RANGE-LABEL: define void @fill(i32* %a, i64 %n)
+; RANGE: for.body.preheader:
+; RANGE: [[SIZE:%.*]] = shl i64 %n, 2
+; RANGE: call void @__csan_large_store(i64 {{.*}}, i8* {{.*}}, i64 [[SIZE]], i64
+; RANGE-NEXT: br label %for.body
+; RANGE: for.body:
+; RANGE-NOT: call void @__csan_store(
+; RANGE: br i1 %exitcond
+define void @fill(i32* %a, i64 %n) #0 {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %for.body.preheader, label %for.end
+
+for.body.preheader:                               ; preds = %entry
+  br label %for.body
+
+for.body:                                         ; preds = %for.body.preheader, %for.body
+  %i = phi i64 [ %inc, %for.body ], [ 0, %for.body.preheader ]
+  %arrayidx = getelementptr inbounds i32, i32* %a, i64 %i
+  store i32 0, i32* %arrayidx, align 4
+  %inc = add nuw nsw i64 %i, 1
+  %exitcond = icmp eq i64 %inc, %n
+  br i1 %exitcond, label %for.end, label %for.body
+
+for.end:                                          ; preds = %for.body, %entry
+  ret void
+}
+
+attributes #0 = { nounwind }
@@ -0,0 +1,85 @@
+; Test that CilkSanitizer only skips accesses that cannot race when asked to,
+; and then keeps the accesses of parallel blocks and of globals whose address
+; escapes.
+;
+; RUN: opt < %s -csan -S | FileCheck %s
+; RUN: opt < %s -csan -csan-prune-race-free -S | FileCheck %s --check-prefix=PRUNE
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@solo = internal global i32 0, align 4
+@shared = internal global i32 0, align 4
+
+; A function visible outside of the module may run in parallel, so its
+; accesses are always instrumented.
+
+; CHECK-LABEL: define void @work(i32* %p)
+; CHECK: call void @__csan_store(
+; PRUNE-LABEL: define void @work(i32* %p)
+; PRUNE: call void @__csan_store(
+define void @work(i32* %p) #0 {
+entry:
+  store i32 2, i32* %p, align 4
+  ret void
+}
+
+; An internal function called only from a serial block of main never runs in
+; parallel with anything.
+
+; CHECK-LABEL: define internal void @serial_helper(i32* %p)
+; CHECK: call void @__csan_store(
+; PRUNE-LABEL: define internal void @serial_helper(i32* %p)
+; PRUNE-NOT: call void @__csan_store(
+; PRUNE: ret void
+define internal void @serial_helper(i32* %p) #0 {
+entry:
+  store i32 3, i32* %p, align 4
+  ret void
+}
+
+; CHECK-LABEL: define i32 @main()
+; CHECK: call void @__csan_store({{.*}}@shared
+; CHECK: call void @__csan_store({{.*}}@solo
+; CHECK: call void @__csan_store({{.*}}@shared
+; CHECK: call void @__csan_load({{.*}}@shared
+; CHECK: call void @__csan_store({{.*}}@shared
+
+; PRUNE-LABEL: define i32 @main()
+; PRUNE-NOT: call void @__csan_store(
+; PRUNE: detach within %syncreg, label %det.achd, label %det.cont
+; PRUNE-NOT: call void @__csan_store({{.*}}@solo
+; PRUNE: call void @__csan_store({{.*}}@shared
+; PRUNE: call void @__csan_load({{.*}}@shared
+; PRUNE: sync within %syncreg
+; PRUNE-NOT: call void @__csan_store(
+; PRUNE: ret i32 0
+define i32 @main() #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  call void @serial_helper(i32* @shared)
+  call void @escape(i32* @shared)
+  store i32 0, i32* @shared, align 4
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %entry
+  store i32 1, i32* @solo, align 4
+  store i32 1, i32* @shared, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %entry
+  %v = load i32, i32* @shared, align 4
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %det.cont
+  store i32 %v, i32* @shared, align 4
+  ret i32 0
+}
+
+declare void @escape(i32*)
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
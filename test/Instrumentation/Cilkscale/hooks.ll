@@ -0,0 +1,61 @@
+; Test that Cilkscale brackets the functions that spawn and their Tapir
+; constructs with its hooks, leaves functions that do not spawn alone, and
+; declares the hooks with the interface that the runtime implements.
+;
+; RUN: opt < %s -cilkscale -S | FileCheck %s
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; CHECK-LABEL: define void @spawner(i32* %p)
+; CHECK: call void @__cilkscale_func_entry(i64 [[FUNC:%.*]])
+; CHECK: call void @__cilkscale_detach(i64
+; CHECK-NEXT: detach within %syncreg, label %det.achd, label %{{.*}}
+; CHECK: det.achd:
+; CHECK: call void @__cilkscale_task(i64 {{.*}}, i64
+; CHECK: call void @__cilkscale_task_exit(i64 {{.*}}, i64 {{.*}}, i64
+; CHECK-NEXT: reattach within %syncreg, label %{{.*}}
+; CHECK: call void @__cilkscale_detach_continue(i64 {{.*}}, i64
+; CHECK: call void @__cilkscale_sync(i64
+; CHECK-NEXT: sync within %syncreg, label %sync.continue
+; CHECK: call void @__cilkscale_func_exit(i64 {{.*}}, i64 [[FUNC]])
+; CHECK-NEXT: ret void
+define void @spawner(i32* %p) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %entry
+  call void @leaf(i32* %p)
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %entry
+  call void @leaf(i32* %p)
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %det.cont
+  ret void
+}
+
+; CHECK-LABEL: define void @leaf(i32* %p)
+; CHECK-NOT: @__cilkscale_
+; CHECK: ret void
+define void @leaf(i32* %p) #0 {
+entry:
+  store i32 0, i32* %p, align 4
+  ret void
+}
+
+; CHECK-DAG: declare void @__cilkscale_func_entry(i64)
+; CHECK-DAG: declare void @__cilkscale_func_exit(i64, i64)
+; CHECK-DAG: declare void @__cilkscale_detach(i64)
+; CHECK-DAG: declare void @__cilkscale_task(i64, i64)
+; CHECK-DAG: declare void @__cilkscale_task_exit(i64, i64, i64)
+; CHECK-DAG: declare void @__cilkscale_detach_continue(i64, i64)
+; CHECK-DAG: declare void @__cilkscale_sync(i64)
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
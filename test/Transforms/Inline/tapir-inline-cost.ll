@@ -0,0 +1,143 @@
+; Test that the inline cost model accounts for the parallel stack frames that
+; inlining merges, and for the serial cutoffs of spawning functions.
+;
+; RUN: opt < %s -inline -inline-threshold=0 -S | FileCheck %s
+; RUN: opt < %s -passes=inline -inline-threshold=0 -S | FileCheck %s
+; RUN: opt < %s -inline -inline-threshold=0 -inline-tapir-frame-merge-bonus=0 -S | FileCheck %s --check-prefix=NOBONUS
+; RUN: opt < %s -inline -inline-tapir-serial-cutoff-threshold=1000 -S | FileCheck %s --check-prefix=NOCUTOFF
+
+; A spawning callee is worth inlining into a spawning caller, whose frame it
+; can share, but not into a serial one.
+; CHECK-LABEL: define void @spawning_caller(
+; CHECK-NOT: call void @spawn_store(
+; CHECK: ret void
+; CHECK-LABEL: define void @serial_caller(
+; CHECK: call void @spawn_store(
+; NOBONUS-LABEL: define void @spawning_caller(
+; NOBONUS: call void @spawn_store(
+
+; The serial clone of a spawning function is not copied into the function at
+; its serial cutoff.
+; CHECK-LABEL: define void @sum(
+; CHECK: call void @sum.serial(
+; NOCUTOFF-LABEL: define void @sum(
+; NOCUTOFF-NOT: call void @sum.serial(
+
+define void @spawn_store(i32* %a, i32 %x) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  store i32 %x, i32* %a, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  %b = getelementptr inbounds i32, i32* %a, i64 1
+  store i32 %x, i32* %b, align 4
+  %x1 = add i32 %x, 1
+  %c = getelementptr inbounds i32, i32* %a, i64 2
+  store i32 %x1, i32* %c, align 4
+  %x2 = add i32 %x, 2
+  %d = getelementptr inbounds i32, i32* %a, i64 3
+  store i32 %x2, i32* %d, align 4
+  %x3 = add i32 %x, 3
+  %e = getelementptr inbounds i32, i32* %a, i64 4
+  store i32 %x3, i32* %e, align 4
+  %x4 = add i32 %x, 4
+  %f = getelementptr inbounds i32, i32* %a, i64 5
+  store i32 %x4, i32* %f, align 4
+  %x5 = add i32 %x, 5
+  %g = getelementptr inbounds i32, i32* %a, i64 6
+  store i32 %x5, i32* %g, align 4
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define void @spawning_caller(i32* %a, i32* %c, i32 %x) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  store i32 %x, i32* %c, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  call void @spawn_store(i32* %a, i32 %x)
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define void @serial_caller(i32* %a, i32 %x) {
+entry:
+  call void @spawn_store(i32* %a, i32 %x)
+  ret void
+}
+
+define void @sum(i32* %a, i64 %n) !tapir.serial !0 {
+entry:
+  %small = icmp ult i64 %n, 64
+  br i1 %small, label %cutoff, label %split
+
+cutoff:
+  call void @sum.serial(i32* %a, i64 %n)
+  ret void
+
+split:
+  %syncreg = call token @llvm.syncregion.start()
+  %half = lshr i64 %n, 1
+  %rest = sub i64 %n, %half
+  %b = getelementptr inbounds i32, i32* %a, i64 %half
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  call void @sum(i32* %a, i64 %half)
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  call void @sum(i32* %b, i64 %rest)
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define void @sum.serial(i32* %a, i64 %n) {
+entry:
+  %cmp = icmp eq i64 %n, 0
+  br i1 %cmp, label %exit, label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %v = load i32, i32* %p, align 4
+  %v1 = mul i32 %v, %v
+  %v2 = xor i32 %v1, %v
+  %v3 = shl i32 %v2, 3
+  %v4 = add i32 %v3, %v1
+  %v5 = mul i32 %v4, %v2
+  %v6 = xor i32 %v5, %v3
+  %v7 = lshr i32 %v6, 5
+  %v8 = add i32 %v7, %v4
+  %v9 = mul i32 %v8, %v5
+  %v10 = xor i32 %v9, %v6
+  %v11 = add i32 %v10, %v7
+  %v12 = mul i32 %v11, %v8
+  %w = add nsw i32 %v12, 1
+  store i32 %w, i32* %p, align 4
+  %inc = add nuw i64 %i, 1
+  %done = icmp eq i64 %inc, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+declare token @llvm.syncregion.start()
+
+!0 = !{void (i32*, i64)* @sum.serial}
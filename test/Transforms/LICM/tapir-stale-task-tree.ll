@@ -0,0 +1,63 @@
+; RUN: opt < %s -S -passes='require<opt-remark-emit>,require<tasks>,loop(rotate,licm)' | FileCheck %s
+; RUN: opt < %s -S -tasks -loop-rotate -licm | FileCheck %s
+
+; The task tree is computed before the loop pipeline runs.  Rotating the inner
+; loop creates %inner.header.inner.exit_crit_edge inside the detached task, and
+; LICM of the inner loop sinks its store there.  LICM of the outer loop must
+; not take the new block for serial code and promote the store out of the
+; detached task.
+
+; CHECK-LABEL: define i32 @outer(
+; CHECK: inner.header.inner.exit_crit_edge:
+; CHECK-NEXT: %[[Y:.+]] = phi i32
+; CHECK-NEXT: store i32 %[[Y]], i32* %p
+; CHECK-NEXT: br label %inner.exit
+; CHECK: inner.exit:
+; CHECK-NEXT: reattach within %syncreg, label %outer.latch
+; CHECK-NOT: store
+; CHECK: ret i32
+
+define i32 @outer(i32 %n, i32 %m) {
+entry:
+  %p = alloca i32, align 4
+  store i32 0, i32* %p, align 4
+  %syncreg = call token @llvm.syncregion.start()
+  br label %outer.header
+
+outer.header:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %v = load i32, i32* %p, align 4
+  detach within %syncreg, label %task, label %outer.latch
+
+task:
+  br label %inner.header
+
+inner.header:
+  %j = phi i32 [ 0, %task ], [ %j.next, %inner.body ]
+  %c = icmp slt i32 %j, %m
+  br i1 %c, label %inner.body, label %inner.exit
+
+inner.body:
+  %x = load i32, i32* %p, align 4
+  %y = add i32 %x, %j
+  store i32 %y, i32* %p, align 4
+  %j.next = add nsw i32 %j, 1
+  br label %inner.header
+
+inner.exit:
+  reattach within %syncreg, label %outer.latch
+
+outer.latch:
+  %i.next = add nsw i32 %i, 1
+  %oc = icmp slt i32 %i.next, %n
+  br i1 %oc, label %outer.header, label %exit
+
+exit:
+  sync within %syncreg, label %ret
+
+ret:
+  %r = load i32, i32* %p, align 4
+  ret i32 %r
+}
+
+declare token @llvm.syncregion.start()
@@ -0,0 +1,22 @@
+; Test that a reducer view lookup that no Tapir target lowered, as in a serial
+; build, reads the leftmost view of the reducer.
+;
+; RUN: opt -pre-isel-intrinsic-lowering -S -o - %s | FileCheck %s
+; RUN: opt -passes='pre-isel-intrinsic-lowering' -S -o - %s | FileCheck %s
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+
+; CHECK: define i32* @view(i8* [[R:%.*]])
+define i32* @view(i8* %r) {
+  ; CHECK: [[BASE:%.*]] = bitcast i8* [[R]] to { i8*, i8*, i8*, i8*, i8*, i64, i64, i64 }*
+  ; CHECK: [[OP:%.*]] = getelementptr inbounds { i8*, i8*, i8*, i8*, i8*, i64, i64, i64 }, { i8*, i8*, i8*, i8*, i8*, i64, i64, i64 }* [[BASE]], i32 0, i32 6
+  ; CHECK: %view.offset = load i64, i64* [[OP]]
+  ; CHECK: %v = getelementptr inbounds i8, i8* [[R]], i64 %view.offset
+  ; CHECK-NOT: @llvm.hyper.lookup(
+  ; CHECK: ret i32* %p
+  %v = call i8* @llvm.hyper.lookup(i8* %r)
+  %p = bitcast i8* %v to i32*
+  ret i32* %p
+}
+
+declare i8* @llvm.hyper.lookup(i8*)
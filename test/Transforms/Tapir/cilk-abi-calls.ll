@@ -15,6 +15,9 @@ entry:
   %cmp = icmp slt i32 %n, 2
   br i1 %cmp, label %return, label %if.end
 ; CHECK-LABEL: define i32 @fib(i32 %n)
+; The stack frame is only entered on the path that spawns.
+; CHECK-NOT: call void @__cilkrts_enter_frame_1(
+; CHECK: if.end:
 ; CHECK: call void @__cilkrts_enter_frame_1(
 
 if.end:                                           ; preds = %entry
@@ -47,7 +50,10 @@ return:                                           ; preds = %entry, %sync.contin
   %retval.0 = phi i32 [ %add, %sync.continue ], [ %n, %entry ]
   ret i32 %retval.0
 ; CHECK: return:
-; CHECK: call void @__cilk_parent_epilogue(
+; CHECK: [[ENTERED:%[a-zA-Z0-9._]+]] = phi i1 [ true, %sync.continue ], [ false, %entry ]
+; CHECK: br i1 [[ENTERED]], label %cilk.epilogue, label %cilk.epilogue.cont
+; CHECK: cilk.epilogue:
+; CHECK-NEXT: call void @__cilk_parent_epilogue(
 }
 
 ; CHECK-LABEL: define internal fastcc void @fib_det.achd.cilk(i32 %n.cilk, i32* align 4 %x.cilk)
@@ -0,0 +1,105 @@
+; Test that a spawned helper reads every input from the frame struct before it
+; detaches, since the parent reuses the frame for the spawn in its next
+; iteration as soon as the helper detaches.  The test relies on the default
+; limit of six helper arguments, which @seven exceeds and @six does not.
+;
+; RUN: opt < %s -tapir2target -tapir-target=cilk -debug-abi-calls -S | FileCheck %s
+
+; CHECK-LABEL: define void @seven(
+; CHECK: entry:
+; CHECK-NEXT: %spawn.frame = alloca %seven_det.achd.frame
+; CHECK: loop:
+; CHECK-DAG: store i32 %i, i32* %{{.+}}
+; CHECK-DAG: store i32* %a, i32** %{{.+}}
+; CHECK-DAG: store i32 %x0, i32* %{{.+}}
+; CHECK-DAG: store i32 %x1, i32* %{{.+}}
+; CHECK-DAG: store i32 %x2, i32* %{{.+}}
+; CHECK-DAG: store i32 %x3, i32* %{{.+}}
+; CHECK-DAG: store i32 %x4, i32* %{{.+}}
+; CHECK: call fastcc void @seven_det.achd.cilk(%seven_det.achd.frame* %spawn.frame)
+; CHECK: det.cont:
+; CHECK: br i1 %exitcond, label %exit, label %loop
+
+; CHECK-LABEL: define void @six(
+; CHECK-NOT: alloca %six_det.achd.frame
+; CHECK: call fastcc void @six_det.achd.cilk(i32 %x0, i32 %x1, i32 %x2, i32 %x3, i32 %i, i32* %a)
+
+; CHECK-LABEL: define internal fastcc void @seven_det.achd.cilk(%seven_det.achd.frame* {{.*}}%spawn.frame.cilk)
+; CHECK-DAG: %x0.cilk = load i32, i32*
+; CHECK-DAG: %x1.cilk = load i32, i32*
+; CHECK-DAG: %x2.cilk = load i32, i32*
+; CHECK-DAG: %x3.cilk = load i32, i32*
+; CHECK-DAG: %x4.cilk = load i32, i32*
+; CHECK-DAG: %i.cilk = load i32, i32*
+; CHECK-DAG: %a.cilk = load i32*, i32**
+; CHECK: call void @__cilkrts_detach(
+; CHECK-NOT: %spawn.frame.cilk
+; CHECK: ret void
+
+define void @seven(i32* %a, i32 %n, i32 %x0, i32 %x1, i32 %x2, i32 %x3,
+                   i32 %x4) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %loop, label %exit
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %det.cont ]
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  %s0 = add i32 %x0, %x1
+  %s1 = add i32 %x2, %x3
+  %s2 = add i32 %x4, %i
+  %s3 = add i32 %s0, %s1
+  %s4 = add i32 %s3, %s2
+  %idx = sext i32 %i to i64
+  %p = getelementptr inbounds i32, i32* %a, i64 %idx
+  store i32 %s4, i32* %p, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  %inc = add nuw nsw i32 %i, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %exit, label %loop
+
+exit:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define void @six(i32* %a, i32 %n, i32 %x0, i32 %x1, i32 %x2, i32 %x3) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %loop, label %exit
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %det.cont ]
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  %s0 = add i32 %x0, %x1
+  %s1 = add i32 %x2, %x3
+  %s2 = add i32 %s0, %s1
+  %s3 = add i32 %s2, %i
+  %idx = sext i32 %i to i64
+  %p = getelementptr inbounds i32, i32* %a, i64 %idx
+  store i32 %s3, i32* %p, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  %inc = add nuw nsw i32 %i, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %exit, label %loop
+
+exit:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+declare token @llvm.syncregion.start()
@@ -0,0 +1,84 @@
+; Test that lowering Tapir to the Cilk Plus target recomputes cheap inputs of a
+; spawned helper in the helper, and packs the inputs of a helper with many of
+; them into a frame struct that the parent allocates once.
+;
+; RUN: opt < %s -tapir2target -tapir-target=cilk -debug-abi-calls -S | FileCheck %s
+
+; CHECK-LABEL: define void @many(
+; CHECK: %spawn.frame = alloca %many_det.achd.frame
+; CHECK: store i32 %x0, i32* %{{.+}}
+; CHECK: store i32 %x7, i32* %{{.+}}
+; CHECK: store i32* %a, i32** %{{.+}}
+; CHECK: call fastcc void @many_det.achd.cilk(%many_det.achd.frame* %spawn.frame)
+; CHECK-NOT: call fastcc void @many_det.achd.cilk(
+
+; CHECK-LABEL: define void @few(
+; CHECK: call fastcc void @few_det.achd.cilk(i32 %x, i32* %a)
+
+; The offset pointer is recomputed in the helper rather than passed.
+; CHECK-LABEL: define internal fastcc void @few_det.achd.cilk(i32 %x.cilk, i32* {{.*}}%a.cilk)
+; CHECK: %p.cilk = getelementptr inbounds i32, i32* %a.cilk, i64 1
+
+; CHECK-LABEL: define internal fastcc void @many_det.achd.cilk(%many_det.achd.frame* {{.*}}%spawn.frame.cilk)
+; CHECK: %x7.cilk = load i32, i32*
+; CHECK: %a.cilk = load i32*, i32**
+; CHECK: %p.cilk = getelementptr inbounds i32, i32* %a.cilk, i64 1
+; CHECK: call void @__cilkrts_detach(
+; CHECK-NEXT: br label %det.achd.cilk
+
+define void @many(i32* %a, i32 %n, i32 %x0, i32 %x1, i32 %x2, i32 %x3, i32 %x4,
+                  i32 %x5, i32 %x6, i32 %x7) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %p = getelementptr inbounds i32, i32* %a, i64 1
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %loop, label %exit
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %det.cont ]
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  %s0 = add i32 %x0, %x1
+  %s1 = add i32 %x2, %x3
+  %s2 = add i32 %x4, %x5
+  %s3 = add i32 %x6, %x7
+  %s4 = add i32 %s0, %s1
+  %s5 = add i32 %s2, %s3
+  %s6 = add i32 %s4, %s5
+  %s7 = add i32 %s6, %i
+  store i32 %s7, i32* %a, align 4
+  store i32 %i, i32* %p, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  %inc = add nuw nsw i32 %i, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %exit, label %loop
+
+exit:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define void @few(i32* %a, i32 %x) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %p = getelementptr inbounds i32, i32* %a, i64 1
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  store i32 %x, i32* %a, align 4
+  store i32 %x, i32* %p, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+declare token @llvm.syncregion.start()
@@ -0,0 +1,99 @@
+; Test that Tapir lowering to the Cilk Plus target looks up the view of a
+; reducer once per strand.
+;
+; RUN: opt < %s -tapir2target -tapir-target=cilk -debug-abi-calls -S | FileCheck %s
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; Function Attrs: nounwind uwtable
+define void @accum(i8* %r, i64 %n) #0 {
+; CHECK-LABEL: define void @accum(i8* %r, i64 %n)
+; The lookup in the serial loop is hoisted to the start of its strand.
+; CHECK: entry:
+; CHECK: %v = call i8* @__cilkrts_hyper_lookup(i8* %r)
+; CHECK: br label %loop
+; CHECK: loop:
+; CHECK-NOT: @__cilkrts_hyper_lookup
+; CHECK: %p = bitcast i8* %v to i32*
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  br label %loop
+
+loop:                                             ; preds = %loop, %entry
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %v = call i8* @llvm.hyper.lookup(i8* %r)
+  %p = bitcast i8* %v to i32*
+  %x = load i32, i32* %p, align 4
+  %add = add nsw i32 %x, 1
+  store i32 %add, i32* %p, align 4
+  %inc = add nuw i64 %i, 1
+  %cmp = icmp ult i64 %inc, %n
+  br i1 %cmp, label %loop, label %spawn
+
+spawn:                                            ; preds = %loop
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %spawn
+  %v2 = call i8* @llvm.hyper.lookup(i8* %r)
+  %p2 = bitcast i8* %v2 to i32*
+  store i32 0, i32* %p2, align 4
+  reattach within %syncreg, label %det.cont
+
+; The continuation of a spawn starts a new strand, and a single lookup serves
+; the whole strand.
+; CHECK: det.cont:
+; CHECK: %v3 = call i8* @__cilkrts_hyper_lookup(i8* %r)
+; CHECK-NOT: @__cilkrts_hyper_lookup
+; CHECK: store i32 2, i32* %p4
+; CHECK: call void @__cilk_sync(
+det.cont:                                         ; preds = %det.achd, %spawn
+  %v3 = call i8* @llvm.hyper.lookup(i8* %r)
+  %p3 = bitcast i8* %v3 to i32*
+  store i32 1, i32* %p3, align 4
+  %v4 = call i8* @llvm.hyper.lookup(i8* %r)
+  %p4 = bitcast i8* %v4 to i32*
+  store i32 2, i32* %p4, align 4
+  sync within %syncreg, label %sync.continue
+
+; The view is looked up again after the sync.
+; CHECK: sync.continue:
+; CHECK: %v5 = call i8* @__cilkrts_hyper_lookup(i8* %r)
+sync.continue:                                    ; preds = %det.cont
+  %v5 = call i8* @llvm.hyper.lookup(i8* %r)
+  %p5 = bitcast i8* %v5 to i32*
+  store i32 3, i32* %p5, align 4
+  ret void
+}
+
+; Functions that use reducers without spawning are lowered as well.
+; CHECK-LABEL: define void @nospawn(i8* %r)
+; CHECK: %v = call i8* @__cilkrts_hyper_lookup(i8* %r)
+; CHECK-NOT: @__cilkrts_hyper_lookup
+; CHECK: ret void
+
+; Function Attrs: nounwind uwtable
+define void @nospawn(i8* %r) #0 {
+entry:
+  %v = call i8* @llvm.hyper.lookup(i8* %r)
+  %p = bitcast i8* %v to i32*
+  store i32 0, i32* %p, align 4
+  %v2 = call i8* @llvm.hyper.lookup(i8* %r)
+  %p2 = bitcast i8* %v2 to i32*
+  store i32 1, i32* %p2, align 4
+  ret void
+}
+
+; The spawned task is its own strand.
+; CHECK-LABEL: define internal fastcc void @accum_det.achd.cilk(
+; CHECK: %v2.cilk = call i8* @__cilkrts_hyper_lookup(i8*
+
+; Function Attrs: nounwind
+declare i8* @llvm.hyper.lookup(i8*) #1
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #2
+
+attributes #0 = { nounwind uwtable }
+attributes #1 = { nounwind }
+attributes #2 = { argmemonly nounwind }
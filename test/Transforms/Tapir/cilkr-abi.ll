@@ -0,0 +1,52 @@
+; Test lowering Tapir to the CilkR runtime: each sync region gets an
+; inline-initialized frame, a detach becomes a spawn of a task that unpacks its
+; arguments, and a sync only calls into the runtime when tasks are pending.
+
+; RUN: opt < %s -tapir2target -tapir-target=cilkr -S | FileCheck %s
+
+; CHECK-LABEL: define void @spawn(i32* %a, i32 %n)
+; CHECK: %[[ARGS:.+]] = alloca %[[ARGSTY:[^ ,]+]]
+; CHECK: %[[FRAME:.+]] = alloca %struct.__cilkr_frame{{$}}
+; CHECK: %syncreg = call token @llvm.syncregion.start()
+; CHECK-NEXT: %[[PENDING:.+]] = getelementptr inbounds %struct.__cilkr_frame, %struct.__cilkr_frame* %[[FRAME]], i32 0, i32 0
+; CHECK-NEXT: store i64 0, i64* %[[PENDING]]
+; CHECK-NEXT: %[[WORKER:.+]] = getelementptr inbounds %struct.__cilkr_frame, %struct.__cilkr_frame* %[[FRAME]], i32 0, i32 1
+; CHECK-NEXT: store i8* null, i8** %[[WORKER]]
+; CHECK-NOT: detach
+; CHECK: %[[ARGSI8:.+]] = bitcast %[[ARGSTY]]* %[[ARGS]] to i8*
+; CHECK: call void @__cilkr_spawn(%struct.__cilkr_frame* %[[FRAME]], void (i8*)* @[[TASK:.+]], i8* %[[ARGSI8]], i64 16)
+; CHECK-NEXT: br label %det.cont
+; CHECK: %pending = load atomic i64, i64* {{.+}} acquire, align 8
+; CHECK-NEXT: %[[OUT:.+]] = icmp ne i64 %pending, 0
+; CHECK-NEXT: br i1 %[[OUT]], label %cilkr.sync, label %cilkr.sync.cont
+; CHECK: cilkr.sync:
+; CHECK-NEXT: call void @__cilkr_sync(%struct.__cilkr_frame* %[[FRAME]])
+; CHECK-NOT: sync within
+; CHECK: ret void
+
+; CHECK: define internal void @[[TASK]](i8* %args)
+; CHECK: call fastcc void @[[HELPER:.+]](i32 %{{.+}}, i32* %{{.+}})
+; CHECK-NEXT: ret void
+
+; CHECK: declare void @__cilkr_spawn(%struct.__cilkr_frame*, void (i8*)*, i8*, i64)
+; CHECK: declare void @__cilkr_sync(%struct.__cilkr_frame*)
+
+define void @spawn(i32* %a, i32 %n) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  store i32 %n, i32* %a, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  %b = getelementptr inbounds i32, i32* %a, i64 1
+  store i32 0, i32* %b, align 4
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+declare token @llvm.syncregion.start()
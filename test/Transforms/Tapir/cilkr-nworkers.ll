@@ -0,0 +1,76 @@
+; Test that the CilkR target computes the worker count once per function, and
+; that it does not assume that the count never changes.
+
+; RUN: opt < %s -loop-spawning -ls-tapir-target=cilkr -S | FileCheck %s
+
+; CHECK-LABEL: define void @twoloops(i32 %n)
+; CHECK: %[[NW:.+]] = call i32 @__cilkr_get_nworkers()
+; CHECK-NEXT: %cilkr_nworker8 = mul i32 %[[NW]], 8
+; CHECK-NOT: call i32 @__cilkr_get_nworkers()
+; CHECK: udiv i32 %{{.+}}, %cilkr_nworker8
+; CHECK-NOT: call i32 @__cilkr_get_nworkers()
+; CHECK: udiv i32 %{{.+}}, %cilkr_nworker8
+; CHECK-NOT: call i32 @__cilkr_get_nworkers()
+; CHECK: ret void
+
+; CHECK: declare i32 @__cilkr_get_nworkers() [[ATTRS:#[0-9]+]]
+; CHECK: attributes [[ATTRS]] = { nounwind }
+
+define void @twoloops(i32 %n) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %pfor.detach, label %exit
+
+pfor.detach:
+  %i = phi i32 [ %inc, %pfor.inc ], [ 0, %entry ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:
+  tail call void @bar(i32 %i) #1
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:
+  %inc = add nuw nsw i32 %i, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.end, label %pfor.detach, !llvm.loop !1
+
+pfor.end:
+  sync within %syncreg, label %pfor2.preheader
+
+pfor2.preheader:
+  %syncreg2 = call token @llvm.syncregion.start()
+  br label %pfor2.detach
+
+pfor2.detach:
+  %j = phi i32 [ %inc2, %pfor2.inc ], [ 0, %pfor2.preheader ]
+  detach within %syncreg2, label %pfor2.body, label %pfor2.inc
+
+pfor2.body:
+  tail call void @bar(i32 %j) #1
+  reattach within %syncreg2, label %pfor2.inc
+
+pfor2.inc:
+  %inc2 = add nuw nsw i32 %j, 1
+  %exitcond2 = icmp eq i32 %inc2, %n
+  br i1 %exitcond2, label %pfor2.end, label %pfor2.detach, !llvm.loop !3
+
+pfor2.end:
+  sync within %syncreg2, label %exit
+
+exit:
+  ret void
+}
+
+declare void @bar(i32) #1
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #2
+
+attributes #0 = { nounwind uwtable }
+attributes #1 = { nounwind }
+attributes #2 = { argmemonly nounwind }
+
+!1 = distinct !{!1, !2}
+!2 = !{!"tapir.loop.spawn.strategy", i32 1}
+!3 = distinct !{!3, !2}
@@ -0,0 +1,70 @@
+; Test that Tapir's loop spawning pass transforms a loop marked for adaptive
+; spawning into a divide-and-conquer recursion whose leaves time themselves and
+; update the grainsize.
+
+; RUN: opt < %s -loop-spawning -S -ls-tapir-target=cilk -ls-adaptive-leaf-cycles=5000 | FileCheck %s
+
+; CHECK: @foo.ls.grainsize = private global i32 0, align 4
+
+; Function Attrs: nounwind uwtable
+define void @foo(i32 %n) local_unnamed_addr #0 {
+; CHECK-LABEL: @foo(
+; CHECK-NOT: @__cilkrts_get_nworkers
+; CHECK: call fastcc void @[[OUTLINED:[a-zA-Z0-9._]+]](i32 0, i32 %{{[0-9]+}}, i32* @foo.ls.grainsize)
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp5 = icmp sgt i32 %n, 0
+  br i1 %cmp5, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:                            ; preds = %entry
+  br label %pfor.detach
+
+pfor.cond.cleanup.loopexit:                       ; preds = %pfor.inc
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:                                ; preds = %pfor.cond.cleanup.loopexit, %entry
+  sync within %syncreg, label %0
+
+; <label>:0:                                      ; preds = %pfor.cond.cleanup
+  ret void
+
+pfor.detach:                                      ; preds = %pfor.detach.preheader, %pfor.inc
+  %i.06 = phi i32 [ %inc, %pfor.inc ], [ 0, %pfor.detach.preheader ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:                                        ; preds = %pfor.detach
+  tail call void @bar(i32 %i.06) #2
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:                                         ; preds = %pfor.body, %pfor.detach
+  %inc = add nuw nsw i32 %i.06, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !1
+}
+
+; CHECK: define internal fastcc void @[[OUTLINED]](i32 [[START:%[a-zA-Z0-9._]+]], i32 [[END:%[a-zA-Z0-9._]+]], i32* [[GRAIN:%[a-zA-Z0-9._]+]])
+; CHECK: [[ITERSTART:%[a-zA-Z0-9._]+]] = phi i32 [{{.*}}[[START]]{{.*}}]
+; CHECK-NEXT: [[ITERCOUNT:%[a-zA-Z0-9._]+]] = sub i32 [[END]], [[ITERSTART]]
+; CHECK-NEXT: [[CURGRAIN:%[a-zA-Z0-9._]+]] = load atomic i32, i32* [[GRAIN]] monotonic, align 4
+; CHECK-NEXT: icmp ugt i32 [[ITERCOUNT]], [[CURGRAIN]]
+; CHECK: call fastcc void @[[OUTLINED]](i32 [[ITERSTART]], i32 %{{[a-zA-Z0-9._]+}}, i32* [[GRAIN]])
+; CHECK: [[T0:%[0-9]+]] = call i64 @llvm.readcyclecounter()
+; CHECK: [[T1:%[0-9]+]] = call i64 @llvm.readcyclecounter()
+; CHECK-NEXT: sub i64 [[T1]], [[T0]]
+; CHECK: mul i64 %{{[a-zA-Z0-9._]+}}, 5000
+; CHECK: store atomic i32 %{{[0-9]+}}, i32* [[GRAIN]] monotonic, align 4
+; CHECK-NEXT: sync
+; CHECK: tail call void @bar(
+
+declare void @bar(i32) local_unnamed_addr #1
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #3
+
+attributes #0 = { nounwind uwtable }
+attributes #1 = { nounwind }
+attributes #2 = { nounwind }
+attributes #3 = { argmemonly nounwind }
+
+!1 = distinct !{!1, !2}
+!2 = !{!"tapir.loop.spawn.strategy", i32 2}
@@ -0,0 +1,201 @@
+; Test that Tapir's loop spawning pass spawns the iterations of a Tapir loop
+; with an unknown trip count in divide-and-conquer fashion, by recording the
+; values each iteration uses in a buffer and spawning over the buffer.
+
+; RUN: opt < %s -loop-spawning -ls-tapir-target=cilk -ls-buffer-loops -S | FileCheck %s
+; RUN: opt < %s -loop-spawning -ls-tapir-target=cilk -ls-buffer-loops -ls-buffer-sequential-loops -S | FileCheck %s --check-prefix=SEQ
+; RUN: opt < %s -loop-spawning -ls-tapir-target=cilk -S | FileCheck %s --check-prefix=OFF
+; RUN: opt < %s -loop-spawning -ls-tapir-target=cilk -ls-buffer-loops -pass-remarks=loop-spawning -pass-remarks-analysis=loop-spawning -disable-output 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; REMARK: remark: <unknown>:0:0: buffering iterations of Tapir loop with unknown trip count
+; REMARK: remark: <unknown>:0:0: spawning iterations using divide-and-conquer
+
+; The walk over the list records each node in the buffer, and spawns the
+; recorded iterations when the buffer fills up or the walk ends.
+; CHECK-LABEL: define void @walk(
+; CHECK: %ls.buffer = alloca [512 x { %struct.node* }]
+; CHECK: pfor.detach:
+; CHECK: %ls.buffered = phi i64
+; CHECK: store %struct.node* %p, %struct.node** %{{.+}}
+; CHECK: %ls.buffered.next = add nuw nsw i64 %ls.buffered, 1
+; CHECK-NOT: detach within
+; CHECK: pfor.inc:
+; CHECK: %ls.buffer.full = icmp eq i64 %ls.buffered.next, 512
+; CHECK: %ls.flush = or i1 %done, %ls.buffer.full
+; CHECK: br i1 %ls.flush, label %ls.flush.preheader, label %ls.buffer.next
+; CHECK: ls.flush.preheader:
+; CHECK: call fastcc void @[[OUTLINED:[a-zA-Z0-9._]+]](
+; CHECK: ls.flush.exit:
+; CHECK-NEXT: br i1 %done, label %pfor.end, label %ls.buffer.next
+; CHECK: ls.buffer.next:
+; CHECK-NEXT: %ls.buffered.reset = phi i64 [ %ls.buffered.next, %pfor.inc ], [ 0, %ls.flush.exit ]
+; CHECK-NEXT: br label %pfor.detach
+
+; A loop without a divide-and-conquer hint is spawned in iteration order unless
+; requested otherwise.
+; CHECK-LABEL: define void @walk_unmarked(
+; CHECK-NOT: ls.buffer
+; CHECK: detach within %syncreg
+; SEQ-LABEL: define void @walk_unmarked(
+; SEQ: %ls.buffer = alloca [512 x { %struct.node* }]
+; SEQ: call fastcc void @{{.+}}(
+
+; Each instance of a walk nested in another Tapir loop gets its own buffer, in
+; the helper that the outer loop is outlined into.
+; CHECK-LABEL: define void @walk_rows(
+; CHECK-NOT: ls.buffer
+; CHECK: call fastcc void @[[ROWS:[a-zA-Z0-9._]+]](
+
+; Buffering is disabled by default.
+; OFF-LABEL: define void @walk(
+; OFF-NOT: ls.buffer
+; OFF: detach within %syncreg
+
+; CHECK: define internal fastcc void @[[OUTLINED]](
+; CHECK: load %struct.node*, %struct.node** %{{.+}}
+; CHECK: getelementptr inbounds %struct.node, %struct.node* %{{.+}}, i64 0, i32 1
+
+; CHECK: define internal fastcc void @[[ROWS]](
+; CHECK-NEXT: {{.+}}:
+; CHECK-NOT: br
+; CHECK: %ls.buffer = alloca [512 x { %struct.node* }]
+
+%struct.node = type { %struct.node*, i32 }
+
+define void @walk(%struct.node* %head) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp eq %struct.node* %head, null
+  br i1 %cmp, label %exit, label %pfor.detach.preheader
+
+pfor.detach.preheader:
+  br label %pfor.detach
+
+pfor.detach:
+  %p = phi %struct.node* [ %head, %pfor.detach.preheader ], [ %next, %pfor.inc ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:
+  %valp = getelementptr inbounds %struct.node, %struct.node* %p, i64 0, i32 1
+  %val = load i32, i32* %valp, align 4
+  %inc = add nsw i32 %val, 1
+  store i32 %inc, i32* %valp, align 4
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:
+  %nextp = getelementptr inbounds %struct.node, %struct.node* %p, i64 0, i32 0
+  %next = load %struct.node*, %struct.node** %nextp, align 8
+  %done = icmp eq %struct.node* %next, null
+  br i1 %done, label %pfor.end, label %pfor.detach, !llvm.loop !1
+
+pfor.end:
+  br label %exit
+
+exit:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define void @walk_unmarked(%struct.node* %head) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp eq %struct.node* %head, null
+  br i1 %cmp, label %exit, label %pfor.detach.preheader
+
+pfor.detach.preheader:
+  br label %pfor.detach
+
+pfor.detach:
+  %p = phi %struct.node* [ %head, %pfor.detach.preheader ], [ %next, %pfor.inc ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:
+  %valp = getelementptr inbounds %struct.node, %struct.node* %p, i64 0, i32 1
+  store i32 0, i32* %valp, align 4
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:
+  %nextp = getelementptr inbounds %struct.node, %struct.node* %p, i64 0, i32 0
+  %next = load %struct.node*, %struct.node** %nextp, align 8
+  %done = icmp eq %struct.node* %next, null
+  br i1 %done, label %pfor.end, label %pfor.detach
+
+pfor.end:
+  br label %exit
+
+exit:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define void @walk_rows(%struct.node** %heads, i32 %n) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:
+  br label %pfor.detach
+
+pfor.detach:
+  %i = phi i32 [ 0, %pfor.detach.preheader ], [ %inc, %pfor.inc ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:
+  %syncreg.inner = call token @llvm.syncregion.start()
+  %i.ext = sext i32 %i to i64
+  %headp = getelementptr inbounds %struct.node*, %struct.node** %heads, i64 %i.ext
+  %head = load %struct.node*, %struct.node** %headp, align 8
+  %empty = icmp eq %struct.node* %head, null
+  br i1 %empty, label %inner.end, label %inner.detach.preheader
+
+inner.detach.preheader:
+  br label %inner.detach
+
+inner.detach:
+  %p = phi %struct.node* [ %head, %inner.detach.preheader ], [ %next, %inner.inc ]
+  detach within %syncreg.inner, label %inner.body, label %inner.inc
+
+inner.body:
+  %valp = getelementptr inbounds %struct.node, %struct.node* %p, i64 0, i32 1
+  store i32 0, i32* %valp, align 4
+  reattach within %syncreg.inner, label %inner.inc
+
+inner.inc:
+  %nextp = getelementptr inbounds %struct.node, %struct.node* %p, i64 0, i32 0
+  %next = load %struct.node*, %struct.node** %nextp, align 8
+  %done = icmp eq %struct.node* %next, null
+  br i1 %done, label %inner.end.loopexit, label %inner.detach, !llvm.loop !1
+
+inner.end.loopexit:
+  br label %inner.end
+
+inner.end:
+  sync within %syncreg.inner, label %inner.sync.continue
+
+inner.sync.continue:
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:
+  %inc = add nuw nsw i32 %i, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !1
+
+pfor.cond.cleanup.loopexit:
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+declare token @llvm.syncregion.start()
+
+!1 = distinct !{!1, !2}
+!2 = !{!"tapir.loop.spawn.strategy", i32 1}
@@ -0,0 +1,177 @@
+; Test that Tapir's loop spawning pass collapses perfectly nested Tapir loops
+; into a single divide-and-conquer recursion over their linearized iteration
+; space, when the loop hints request it.
+
+; RUN: opt < %s -loop-spawning -ls-tapir-target=cilk -S | FileCheck %s
+; RUN: opt < %s -loop-spawning -ls-tapir-target=cilk -pass-remarks=loop-spawning -pass-remarks-analysis=loop-spawning -disable-output 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; REMARK: remark: <unknown>:0:0: collapsed nested Tapir loop
+; REMARK: remark: <unknown>:0:0: cannot collapse nested Tapir loop: code around nested loop has side effects
+
+; The invariant guard of the nested loop is hoisted out of the collapsed loop.
+; CHECK-LABEL: define void @nest(
+; CHECK: pfor.detach.preheader:
+; CHECK: br i1 %cmp.inner, label %[[COLLAPSED:.+]], label %pfor.cond.cleanup.loopexit
+; CHECK: [[COLLAPSED]]:
+; CHECK: call fastcc void @[[OUTLINED:[a-zA-Z0-9._]+]](
+
+; The body of the outer loop stores before the nested loop, so the loops are
+; not collapsed.
+; CHECK-LABEL: define void @notperfect(
+; CHECK: call fastcc void @[[NOTCOLLAPSED:[a-zA-Z0-9._]+]](
+
+; Each serial leaf of the collapsed loop divides its start iteration once, and
+; then steps the indices of both loops.
+; CHECK: define internal fastcc void @[[OUTLINED]](
+; CHECK-NOT: syncreg.inner
+; CHECK: %[[IDXSTART:.+]] = udiv i64 %[[START:.+]], %[[COUNT:.+]]
+; CHECK-NEXT: %[[INNERSTART:.+]] = urem i64 %[[START]], %[[COUNT]]
+; CHECK: %[[IDX:.+]] = phi i64 [ %[[IDXSTART]], %{{.+}} ], [ %[[IDXNEXT:.+]], %{{.+}} ]
+; CHECK-NEXT: %[[INNERIDX:.+]] = phi i64 [ %[[INNERSTART]], %{{.+}} ], [ %[[INNERNEXT:.+]], %{{.+}} ]
+; CHECK-NOT: {{udiv|urem}}
+; CHECK: store i32
+; CHECK: %[[INNERINC:.+]] = add i64 %[[INNERIDX]], 1
+; CHECK-NEXT: %[[WRAP:.+]] = icmp eq i64 %[[INNERINC]], %[[COUNT]]
+; CHECK-NEXT: %[[INNERNEXT]] = select i1 %[[WRAP]], i64 0, i64 %[[INNERINC]]
+; CHECK-NEXT: %[[CARRY:.+]] = zext i1 %[[WRAP]] to i64
+; CHECK-NEXT: %[[IDXNEXT]] = add i64 %[[IDX]], %[[CARRY]]
+
+; CHECK: define internal fastcc void @[[NOTCOLLAPSED]](
+; CHECK-NOT: urem
+; CHECK: store i32 0
+
+define void @nest(i32* %a, i32 %n, i32 %m) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:
+  %cmp.inner = icmp sgt i32 %m, 0
+  %wide.m = sext i32 %m to i64
+  br label %pfor.detach
+
+pfor.detach:
+  %i = phi i32 [ 0, %pfor.detach.preheader ], [ %inc, %pfor.inc ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:
+  %syncreg.inner = call token @llvm.syncregion.start()
+  %i.ext = sext i32 %i to i64
+  %row = mul nsw i64 %i.ext, %wide.m
+  br i1 %cmp.inner, label %inner.detach.preheader, label %inner.cleanup
+
+inner.detach.preheader:
+  br label %inner.detach
+
+inner.detach:
+  %j = phi i32 [ 0, %inner.detach.preheader ], [ %inc.inner, %inner.inc ]
+  detach within %syncreg.inner, label %inner.body, label %inner.inc
+
+inner.body:
+  %j.ext = sext i32 %j to i64
+  %idx = add nsw i64 %row, %j.ext
+  %p = getelementptr inbounds i32, i32* %a, i64 %idx
+  %v = add nsw i32 %i, %j
+  store i32 %v, i32* %p, align 4
+  reattach within %syncreg.inner, label %inner.inc
+
+inner.inc:
+  %inc.inner = add nuw nsw i32 %j, 1
+  %exitcond.inner = icmp eq i32 %inc.inner, %m
+  br i1 %exitcond.inner, label %inner.cleanup.loopexit, label %inner.detach, !llvm.loop !3
+
+inner.cleanup.loopexit:
+  br label %inner.cleanup
+
+inner.cleanup:
+  sync within %syncreg.inner, label %inner.sync.continue
+
+inner.sync.continue:
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:
+  %inc = add nuw nsw i32 %i, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !1
+
+pfor.cond.cleanup.loopexit:
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define void @notperfect(i32* %a, i32 %n, i32 %m) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:
+  %cmp.inner = icmp sgt i32 %m, 0
+  br label %pfor.detach
+
+pfor.detach:
+  %i = phi i32 [ 0, %pfor.detach.preheader ], [ %inc, %pfor.inc ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:
+  %syncreg.inner = call token @llvm.syncregion.start()
+  %i.ext = sext i32 %i to i64
+  %q = getelementptr inbounds i32, i32* %a, i64 %i.ext
+  store i32 0, i32* %q, align 4
+  br i1 %cmp.inner, label %inner.detach.preheader, label %inner.cleanup
+
+inner.detach.preheader:
+  br label %inner.detach
+
+inner.detach:
+  %j = phi i32 [ 0, %inner.detach.preheader ], [ %inc.inner, %inner.inc ]
+  detach within %syncreg.inner, label %inner.body, label %inner.inc
+
+inner.body:
+  %j.ext = sext i32 %j to i64
+  %p = getelementptr inbounds i32, i32* %a, i64 %j.ext
+  store i32 %i, i32* %p, align 4
+  reattach within %syncreg.inner, label %inner.inc
+
+inner.inc:
+  %inc.inner = add nuw nsw i32 %j, 1
+  %exitcond.inner = icmp eq i32 %inc.inner, %m
+  br i1 %exitcond.inner, label %inner.cleanup.loopexit, label %inner.detach, !llvm.loop !3
+
+inner.cleanup.loopexit:
+  br label %inner.cleanup
+
+inner.cleanup:
+  sync within %syncreg.inner, label %inner.sync.continue
+
+inner.sync.continue:
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:
+  %inc = add nuw nsw i32 %i, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !5
+
+pfor.cond.cleanup.loopexit:
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+declare token @llvm.syncregion.start()
+
+!1 = distinct !{!1, !2, !4}
+!2 = !{!"tapir.loop.spawn.strategy", i32 1}
+!3 = distinct !{!3, !2}
+!4 = !{!"tapir.loop.collapse", i32 2}
+!5 = distinct !{!5, !2, !4}
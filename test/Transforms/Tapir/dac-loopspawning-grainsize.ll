@@ -0,0 +1,152 @@
+; Test that Tapir's loop spawning pass bounds the grainsize of a loop by the
+; estimated cost of its body, and records that bound in the loop metadata.
+
+; RUN: opt < %s -loop-spawning -S -ls-tapir-target=cilk | FileCheck %s --check-prefix=DEFAULT
+; RUN: opt < %s -loop-spawning -S -ls-tapir-target=cilk -ls-target-leaf-cost=1 | FileCheck %s --check-prefix=COST
+; RUN: opt < %s -loop-spawning -S -ls-tapir-target=cilk -ls-cost-grainsize=false | FileCheck %s --check-prefix=NOCOST
+
+; Function Attrs: nounwind uwtable
+define void @foo(i32 %n) local_unnamed_addr #0 {
+; DEFAULT-LABEL: @foo(
+; DEFAULT: call i32 @__cilkrts_get_nworkers()
+; DEFAULT: select i1 %{{[0-9]+}}, i32 1667,
+; COST-LABEL: @foo(
+; COST: call i32 @__cilkrts_get_nworkers()
+; COST: select i1 %{{[0-9]+}}, i32 1,
+; NOCOST-LABEL: @foo(
+; NOCOST: call i32 @__cilkrts_get_nworkers()
+; NOCOST: select i1 %{{[0-9]+}}, i32 2048,
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp5 = icmp sgt i32 %n, 0
+  br i1 %cmp5, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:                            ; preds = %entry
+  br label %pfor.detach
+
+pfor.cond.cleanup.loopexit:                       ; preds = %pfor.inc
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:                                ; preds = %pfor.cond.cleanup.loopexit, %entry
+  sync within %syncreg, label %0
+
+; <label>:0:                                      ; preds = %pfor.cond.cleanup
+  ret void
+
+pfor.detach:                                      ; preds = %pfor.detach.preheader, %pfor.inc
+  %i.06 = phi i32 [ %inc, %pfor.inc ], [ 0, %pfor.detach.preheader ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:                                        ; preds = %pfor.detach
+  tail call void @bar(i32 %i.06) #2
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:                                         ; preds = %pfor.body, %pfor.detach
+  %inc = add nuw nsw i32 %i.06, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !1
+}
+
+; A grainsize specified in the loop metadata is used as is.
+
+; Function Attrs: nounwind uwtable
+define void @pinned(i32 %n) local_unnamed_addr #0 {
+; DEFAULT-LABEL: @pinned(
+; DEFAULT-NOT: call i32 @__cilkrts_get_nworkers()
+; DEFAULT: call fastcc void @{{[a-zA-Z0-9._]+}}(i32 0, i32 %{{[0-9]+}}, i32 7)
+; COST-LABEL: @pinned(
+; COST-NOT: call i32 @__cilkrts_get_nworkers()
+; COST: call fastcc void @{{[a-zA-Z0-9._]+}}(i32 0, i32 %{{[0-9]+}}, i32 7)
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp5 = icmp sgt i32 %n, 0
+  br i1 %cmp5, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:                            ; preds = %entry
+  br label %pfor.detach
+
+pfor.cond.cleanup.loopexit:                       ; preds = %pfor.inc
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:                                ; preds = %pfor.cond.cleanup.loopexit, %entry
+  sync within %syncreg, label %0
+
+; <label>:0:                                      ; preds = %pfor.cond.cleanup
+  ret void
+
+pfor.detach:                                      ; preds = %pfor.detach.preheader, %pfor.inc
+  %i.06 = phi i32 [ %inc, %pfor.inc ], [ 0, %pfor.detach.preheader ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:                                        ; preds = %pfor.detach
+  tail call void @bar(i32 %i.06) #2
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:                                         ; preds = %pfor.body, %pfor.detach
+  %inc = add nuw nsw i32 %i.06, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !3
+}
+
+; A maximum grainsize specified in the loop metadata replaces the estimate.
+
+; Function Attrs: nounwind uwtable
+define void @bounded(i32 %n) local_unnamed_addr #0 {
+; DEFAULT-LABEL: @bounded(
+; DEFAULT: call i32 @__cilkrts_get_nworkers()
+; DEFAULT: select i1 %{{[0-9]+}}, i32 5,
+; NOCOST-LABEL: @bounded(
+; NOCOST: call i32 @__cilkrts_get_nworkers()
+; NOCOST: select i1 %{{[0-9]+}}, i32 5,
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp5 = icmp sgt i32 %n, 0
+  br i1 %cmp5, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:                            ; preds = %entry
+  br label %pfor.detach
+
+pfor.cond.cleanup.loopexit:                       ; preds = %pfor.inc
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:                                ; preds = %pfor.cond.cleanup.loopexit, %entry
+  sync within %syncreg, label %0
+
+; <label>:0:                                      ; preds = %pfor.cond.cleanup
+  ret void
+
+pfor.detach:                                      ; preds = %pfor.detach.preheader, %pfor.inc
+  %i.06 = phi i32 [ %inc, %pfor.inc ], [ 0, %pfor.detach.preheader ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:                                        ; preds = %pfor.detach
+  tail call void @bar(i32 %i.06) #2
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:                                         ; preds = %pfor.body, %pfor.detach
+  %inc = add nuw nsw i32 %i.06, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !5
+}
+
+; The estimated maximum grainsize is recorded on the outlined loop, apart from
+; the grainsize hint.
+; COST-NOT: !{!"tapir.loop.grainsize", i32 1}
+; COST: !{!"tapir.loop.grainsize.max", i32 1}
+
+declare void @bar(i32) local_unnamed_addr #1
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #3
+
+attributes #0 = { nounwind uwtable }
+attributes #1 = { nounwind }
+attributes #2 = { nounwind }
+attributes #3 = { argmemonly nounwind }
+
+!1 = distinct !{!1, !2}
+!2 = !{!"tapir.loop.spawn.strategy", i32 1}
+!3 = distinct !{!3, !2, !4}
+!4 = !{!"tapir.loop.grainsize", i32 7}
+!5 = distinct !{!5, !2, !6}
+!6 = !{!"tapir.loop.grainsize.max", i32 5}
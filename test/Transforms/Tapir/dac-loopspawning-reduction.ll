@@ -0,0 +1,90 @@
+; Test that Tapir's loop spawning pass outlines a Tapir loop carrying a
+; reduction, combining the partial results of the recursive calls of the
+; helper.  Targets whose own loop lowering cannot combine reductions fall back
+; to the generic recursion.
+
+; RUN: opt < %s -loop-spawning -S -ls-tapir-target=cilk | FileCheck %s
+; RUN: opt < %s -loop-spawning -S -ls-tapir-target=openmp | FileCheck %s --implicit-check-not=__kmpc_fork_call
+; RUN: opt < %s -loop-spawning -S -ls-tapir-target=qthreads | FileCheck %s --implicit-check-not=qt_loop_balance
+
+; Function Attrs: nounwind uwtable
+define i32 @sum(i32* %a, i32 %n, i32 %init) local_unnamed_addr #0 {
+; CHECK-LABEL: @sum(
+; CHECK: %sum.red = alloca i32
+; CHECK: call fastcc void @[[HELPER:[a-zA-Z0-9._]+]](i32 0, i32 %{{.+}}, i32 %{{.+}}, i32* %a, i32* %sum.red)
+; CHECK-NEXT: %[[RESULT:.+]] = load i32, i32* %sum.red
+; CHECK-NEXT: %[[FINAL:.+]] = add i32 %init, %[[RESULT]]
+; CHECK: %add.lcssa = phi i32 {{.*}}[ %[[FINAL]], %pfor.detach.preheader ]
+; CHECK: phi i32 [ %add.lcssa, %{{.+}} ], [ %init, %entry ]
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp5 = icmp sgt i32 %n, 0
+  br i1 %cmp5, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:                            ; preds = %entry
+  br label %pfor.detach
+
+pfor.cond.cleanup.loopexit:                       ; preds = %pfor.inc
+  %add.lcssa = phi i32 [ %add, %pfor.inc ]
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:                                ; preds = %pfor.cond.cleanup.loopexit, %entry
+  %sum.0.lcssa = phi i32 [ %add.lcssa, %pfor.cond.cleanup.loopexit ], [ %init, %entry ]
+  sync within %syncreg, label %0
+
+; <label>:0:                                      ; preds = %pfor.cond.cleanup
+  ret i32 %sum.0.lcssa
+
+pfor.detach:                                      ; preds = %pfor.detach.preheader, %pfor.inc
+  %i.06 = phi i32 [ %inc, %pfor.inc ], [ 0, %pfor.detach.preheader ]
+  %sum = phi i32 [ %add, %pfor.inc ], [ %init, %pfor.detach.preheader ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:                                        ; preds = %pfor.detach
+  tail call void @bar(i32 %i.06) #2
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:                                         ; preds = %pfor.body, %pfor.detach
+  %idxprom = sext i32 %i.06 to i64
+  %arrayidx = getelementptr inbounds i32, i32* %a, i64 %idxprom
+  %1 = load i32, i32* %arrayidx, align 4
+  %add = add i32 %sum, %1
+  %inc = add nuw nsw i32 %i.06, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !1
+}
+
+; The helper spawns the first half of its iterations and calls itself on the
+; second half, and combines the two partial results after the sync.  Each
+; serial leaf accumulates from the identity of the reduction.
+
+; CHECK: define internal fastcc void @[[HELPER]](i32 %{{.+}}, i32 %{{.+}}, i32 %{{.+}}, i32* {{.*}}%a.ls, i32* %sum.out.ls)
+; CHECK: %sum.left = alloca i32
+; CHECK: %sum.right = alloca i32
+; CHECK: store i32 0, i32* %sum.left
+; CHECK: detach within %{{.+}}, label %[[RECURDET:.+]], label %[[RECURCONT:.+]]
+; CHECK: [[RECURDET]]:
+; CHECK-NEXT: call fastcc void @[[HELPER]](i32 %{{.+}}, i32 %miditer, i32 %{{.+}}, i32* %a.ls, i32* %sum.left)
+; CHECK-NEXT: reattach
+; CHECK: [[RECURCONT]]:
+; CHECK: call fastcc void @[[HELPER]](i32 %miditerplusone, i32 %{{.+}}, i32 %{{.+}}, i32* %a.ls, i32* %sum.right)
+; CHECK-NEXT: %[[RIGHT:.+]] = load i32, i32* %sum.right
+; CHECK: %sum.partial = phi i32 [ %{{.+}}, %leaf.end ], [ %[[RIGHT]], %[[RECURCONT]] ]
+; CHECK-NEXT: sync within
+; CHECK: %[[LEFT:.+]] = load i32, i32* %sum.left
+; CHECK-NEXT: %[[RED:.+]] = add i32 %[[LEFT]], %sum.partial
+; CHECK-NEXT: store i32 %[[RED]], i32* %sum.out.ls
+; CHECK-NEXT: ret void
+
+declare void @bar(i32) local_unnamed_addr #1
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #3
+
+attributes #0 = { nounwind uwtable }
+attributes #1 = { nounwind }
+attributes #2 = { nounwind }
+attributes #3 = { argmemonly nounwind }
+
+!1 = distinct !{!1, !2}
+!2 = !{!"tapir.loop.spawn.strategy", i32 1}
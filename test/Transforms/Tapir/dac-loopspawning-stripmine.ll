@@ -0,0 +1,156 @@
+; Test that Tapir's loop spawning pass strip-mines a divide-and-conquer loop,
+; so that the recursion runs whole chunks of iterations in vectorizable leaves
+; and the original loop runs the remaining iterations serially.
+
+; RUN: opt < %s -loop-spawning -ls-tapir-target=cilk -ls-strip-mine-count=8 -S | FileCheck %s
+; RUN: opt < %s -loop-spawning -ls-tapir-target=cilk -ls-strip-mine=false -S | FileCheck %s --check-prefix=NOSM
+
+; CHECK-LABEL: define void @saxpy(
+; CHECK: %haschunk = icmp uge i64 %[[LIMIT:.+]], 7
+; CHECK: %chunkslimit = add i64 %{{.+}}, 7
+; CHECK: %remstart = select i1 %haschunk, i64 %{{.+}}, i64 0
+; CHECK-DAG: %[[NOCHUNK:.+]] = xor i1 %haschunk, true
+; CHECK-DAG: %[[PARTIAL:.+]] = icmp ne i64 %chunkslimit, %[[LIMIT]]
+; CHECK: %hasremainder = or i1 %[[NOCHUNK]], %[[PARTIAL]]
+; CHECK: br i1 %haschunk, label %[[CALL:.+]], label %[[REM:.+]]
+; CHECK: [[CALL]]:
+; CHECK-NEXT: call fastcc void @[[OUTLINED:[a-zA-Z0-9._]+]](i64 0, i64 %chunkslimit,
+; CHECK: [[REM]]:
+; CHECK: br i1 %hasremainder, label %pfor.detach, label %pfor.cond.cleanup
+; CHECK: pfor.detach:
+; CHECK: phi i64 [ %remstart, %{{.+}} ]
+; CHECK-NOT: detach within
+; CHECK: br i1 %{{.+}}, label %pfor.detach, label %pfor.cond.cleanup.loopexit, !llvm.loop ![[REMLOOP:[0-9]+]]
+
+; The iteration count of a loop over a narrow type is zero-extended to the type
+; of the canonical IV.
+
+; CHECK-LABEL: define void @fill256(
+; CHECK: call fastcc void @{{.+}}(i32 0, i32 255,
+; CHECK: br i1 false, label %pfor.detach, label %pfor.cond.cleanup
+
+; The whole chunks of a loop whose limit is the largest i32 cover all of its
+; iterations, so the remainder loop must not run, even though the iteration
+; after the chunks wraps to zero.
+
+; CHECK-LABEL: define void @fillmax(
+; CHECK: call fastcc void @{{.+}}(i32 0, i32 -1,
+; CHECK: br i1 false, label %pfor.detach, label %pfor.cond.cleanup
+
+; CHECK: define internal fastcc void @[[OUTLINED]](
+; CHECK: %halfcount.chunks = add i64 %{{.+}}, 7
+; CHECK: %leafend = add i64 %{{.+}}, %{{.+}}
+; CHECK: load float, float* %{{.+}}, !llvm.mem.parallel_loop_access ![[LEAFLOOP:[0-9]+]]
+; CHECK: store float %{{.+}}, float* %{{.+}}, !llvm.mem.parallel_loop_access ![[LEAFLOOP]]
+; CHECK: icmp ult i64 %{{.+}}, %leafend
+; CHECK: br i1 %{{.+}}, label %{{.+}}, label %{{.+}}, !llvm.loop ![[LEAFLOOP]]
+
+; CHECK-DAG: ![[REMLOOP]] = distinct !{![[REMLOOP]], ![[WIDTH:[0-9]+]], ![[INTERLEAVE:[0-9]+]]}
+; CHECK-DAG: ![[WIDTH]] = !{!"llvm.loop.vectorize.width", i32 1}
+; CHECK-DAG: ![[INTERLEAVE]] = !{!"llvm.loop.interleave.count", i32 1}
+; CHECK-DAG: ![[LEAFLOOP]] = distinct !{![[LEAFLOOP]], ![[ENABLE:[0-9]+]]}
+; CHECK-DAG: ![[ENABLE]] = !{!"llvm.loop.vectorize.enable", i32 1}
+
+; NOSM-LABEL: define void @saxpy(
+; NOSM-NOT: haschunk
+; NOSM: call fastcc void @{{.+}}(i64 0,
+; NOSM-NOT: hasremainder
+; NOSM-NOT: leafend
+
+define void @saxpy(float* noalias %y, float* noalias %x, float %a, i32 %n) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:
+  %wide.n = zext i32 %n to i64
+  br label %pfor.detach
+
+pfor.detach:
+  %i = phi i64 [ 0, %pfor.detach.preheader ], [ %inc, %pfor.inc ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:
+  %px = getelementptr inbounds float, float* %x, i64 %i
+  %vx = load float, float* %px, align 4
+  %mul = fmul float %vx, %a
+  %py = getelementptr inbounds float, float* %y, i64 %i
+  %vy = load float, float* %py, align 4
+  %add = fadd float %mul, %vy
+  store float %add, float* %py, align 4
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:
+  %inc = add nuw nsw i64 %i, 1
+  %exitcond = icmp eq i64 %inc, %wide.n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !1
+
+pfor.cond.cleanup.loopexit:
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define void @fill256(i32* noalias %y) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  br label %pfor.detach
+
+pfor.detach:
+  %i = phi i8 [ 0, %entry ], [ %inc, %pfor.inc ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:
+  %idx = zext i8 %i to i64
+  %py = getelementptr inbounds i32, i32* %y, i64 %idx
+  store i32 0, i32* %py, align 4
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:
+  %inc = add i8 %i, 1
+  %exitcond = icmp eq i8 %i, -1
+  br i1 %exitcond, label %pfor.cond.cleanup, label %pfor.detach, !llvm.loop !1
+
+pfor.cond.cleanup:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define void @fillmax(i32* noalias %y) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  br label %pfor.detach
+
+pfor.detach:
+  %i = phi i32 [ 0, %entry ], [ %inc, %pfor.inc ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:
+  %idx = zext i32 %i to i64
+  %py = getelementptr inbounds i32, i32* %y, i64 %idx
+  store i32 0, i32* %py, align 4
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:
+  %inc = add i32 %i, 1
+  %exitcond = icmp eq i32 %i, -1
+  br i1 %exitcond, label %pfor.cond.cleanup, label %pfor.detach, !llvm.loop !1
+
+pfor.cond.cleanup:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+declare token @llvm.syncregion.start()
+
+!1 = distinct !{!1, !2}
+!2 = !{!"tapir.loop.spawn.strategy", i32 1}
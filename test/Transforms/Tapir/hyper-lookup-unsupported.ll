@@ -0,0 +1,52 @@
+; Test that Tapir targets without reducers reject reducer view lookups rather
+; than race on the leftmost view of the reducer.
+;
+; RUN: not opt < %s -tapir2target -tapir-target=openmp -disable-output 2>&1 | FileCheck %s
+; RUN: not opt < %s -tapir2target -tapir-target=qthreads -disable-output 2>&1 | FileCheck %s
+; RUN: not opt < %s -tapir2target -tapir-target=cilkr -disable-output 2>&1 | FileCheck %s
+; RUN: not opt < %s -tapir2target -tapir-target=tbb -disable-output 2>&1 | FileCheck %s
+; RUN: opt < %s -tapir2target -tapir-target=cilk -disable-output
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; A function that does not spawn may still run in parallel with others that
+; use the same reducer, so its lookups are rejected as well.
+
+; CHECK: error: {{.*}}in function serial{{.*}}: reducers are not supported by this Tapir target
+define void @serial(i8* %r) #0 {
+entry:
+  %v = call i8* @llvm.hyper.lookup(i8* %r)
+  %p = bitcast i8* %v to i32*
+  store i32 1, i32* %p, align 4
+  ret void
+}
+
+define void @accum(i8* %r) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %entry
+  %v2 = call i8* @llvm.hyper.lookup(i8* %r)
+  %p2 = bitcast i8* %v2 to i32*
+  store i32 0, i32* %p2, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %entry
+  %v = call i8* @llvm.hyper.lookup(i8* %r)
+  %p = bitcast i8* %v to i32*
+  store i32 1, i32* %p, align 4
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %det.cont
+  ret void
+}
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #1
+
+declare i8* @llvm.hyper.lookup(i8*)
+
+attributes #0 = { nounwind uwtable }
+attributes #1 = { argmemonly nounwind }
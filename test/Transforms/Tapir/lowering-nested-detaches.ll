@@ -217,16 +217,22 @@ declare token @llvm.syncregion.start() #1
 ; CHECK-NEXT: br label %loop_latch9.cilk.cilk
 
 
+; The innermost helper has seven inputs, more than -tapir-max-helper-args, so
+; they are packed into a frame.
 ; CHECK-LABEL: define internal fastcc void @kernel_anon_det.achd.cilk_block_exit.cilk.cilk_det.achd12.cilk.cilk.cilk(
+; CHECK: %spawn.frame = alloca %[[FRAME:[a-zA-Z0-9._]+]]
 ; CHECK: %[[CILKSF:.+]] = alloca %struct.__cilkrts_stack_frame
 ; CHECK: call void @__cilkrts_enter_frame_fast_1(%struct.__cilkrts_stack_frame* nonnull %[[CILKSF]])
+; CHECK: store i64 %c31.cilk.cilk.cilk, i64*
 ; CHECK: loop_body14.cilk.cilk.cilk.split:
-; CHECK-NEXT: call fastcc void @kernel_anon_det.achd.cilk_block_exit.cilk.cilk_det.achd12.cilk.cilk.cilk_det.achd18.cilk.cilk.cilk.cilk([24 x [21 x [33 x float]]]* %A.cilk.cilk.cilk, i64 %c06.cilk.cilk.cilk, i64 %c14.cilk.cilk.cilk, i64 %c22.cilk.cilk.cilk, i64 %c31.cilk.cilk.cilk, float %.cilk, float* %.cilk1)
+; CHECK-NEXT: call fastcc void @kernel_anon_det.achd.cilk_block_exit.cilk.cilk_det.achd12.cilk.cilk.cilk_det.achd18.cilk.cilk.cilk.cilk(%[[FRAME]]* nonnull %spawn.frame)
 ; CHECK-NEXT: br label %loop_latch15.cilk.cilk.cilk
 
 
-; CHECK-LABEL: define internal fastcc void @kernel_anon_det.achd.cilk_block_exit.cilk.cilk_det.achd12.cilk.cilk.cilk_det.achd18.cilk.cilk.cilk.cilk(
-; CHECK: getelementptr
+; CHECK: define internal fastcc void @kernel_anon_det.achd.cilk_block_exit.cilk.cilk_det.achd12.cilk.cilk.cilk_det.achd18.cilk.cilk.cilk.cilk(%[[FRAME]]*
+; CHECK: load float*, float**
+; CHECK: call void @__cilkrts_detach
+; CHECK-NEXT: getelementptr
 ; CHECK-NEXT: load
 ; CHECK-NEXT: fmul
 ; CHECK-NEXT: load
@@ -0,0 +1,173 @@
+; Test that Tapir's loop spawning pass shares the iterations of Tapir loops
+; among the threads of an OpenMP parallel region when targeting OpenMP, with
+; the schedule given by the loop's hints.
+
+; RUN: opt < %s -loop-spawning -ls-tapir-target=openmp -S | FileCheck %s
+
+; By default, the threads take chunks of the grainsize in turn.
+
+; CHECK-LABEL: define void @fill_static(
+; CHECK: call void @[[STATICHELPER:[a-zA-Z0-9._]+]].omp.loop(i32 0, i32 %{{.+}}, i32 %{{.+}}, i32* %a{{.*}})
+; CHECK-NOT: detach within
+; CHECK-NOT: sync within
+; CHECK: ret void
+define void @fill_static(i32* %a, i32 %n) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:                            ; preds = %entry
+  br label %pfor.detach
+
+pfor.cond.cleanup.loopexit:                       ; preds = %pfor.inc
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:                                ; preds = %pfor.cond.cleanup.loopexit, %entry
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %pfor.cond.cleanup
+  ret void
+
+pfor.detach:                                      ; preds = %pfor.detach.preheader, %pfor.inc
+  %i = phi i32 [ %inc, %pfor.inc ], [ 0, %pfor.detach.preheader ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:                                        ; preds = %pfor.detach
+  %idxprom = sext i32 %i to i64
+  %arrayidx = getelementptr inbounds i32, i32* %a, i64 %idxprom
+  store i32 %i, i32* %arrayidx, align 4
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:                                         ; preds = %pfor.body, %pfor.detach
+  %inc = add nuw nsw i32 %i, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !0
+}
+
+; CHECK-LABEL: define void @fill_dynamic(
+; CHECK: call void @[[DYNAMICHELPER:[a-zA-Z0-9._]+]].omp.loop(
+define void @fill_dynamic(i32* %a, i64 %n) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:                            ; preds = %entry
+  br label %pfor.detach
+
+pfor.cond.cleanup.loopexit:                       ; preds = %pfor.inc
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:                                ; preds = %pfor.cond.cleanup.loopexit, %entry
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %pfor.cond.cleanup
+  ret void
+
+pfor.detach:                                      ; preds = %pfor.detach.preheader, %pfor.inc
+  %i = phi i64 [ %inc, %pfor.inc ], [ 0, %pfor.detach.preheader ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:                                        ; preds = %pfor.detach
+  %arrayidx = getelementptr inbounds i32, i32* %a, i64 %i
+  store i32 0, i32* %arrayidx, align 4
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:                                         ; preds = %pfor.body, %pfor.detach
+  %inc = add nuw nsw i64 %i, 1
+  %exitcond = icmp eq i64 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !2
+}
+
+; CHECK-LABEL: define void @fill_guided(
+; CHECK: call void @[[GUIDEDHELPER:[a-zA-Z0-9._]+]].omp.loop(
+define void @fill_guided(i32* %a, i32 %n) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:                            ; preds = %entry
+  br label %pfor.detach
+
+pfor.cond.cleanup.loopexit:                       ; preds = %pfor.inc
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:                                ; preds = %pfor.cond.cleanup.loopexit, %entry
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %pfor.cond.cleanup
+  ret void
+
+pfor.detach:                                      ; preds = %pfor.detach.preheader, %pfor.inc
+  %i = phi i32 [ %inc, %pfor.inc ], [ 0, %pfor.detach.preheader ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:                                        ; preds = %pfor.detach
+  %idxprom = sext i32 %i to i64
+  %arrayidx = getelementptr inbounds i32, i32* %a, i64 %idxprom
+  store i32 1, i32* %arrayidx, align 4
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:                                         ; preds = %pfor.body, %pfor.detach
+  %inc = add nuw nsw i32 %i, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !4
+}
+
+; The helpers run their iterations serially.
+
+; CHECK: define internal fastcc void @[[STATICHELPER]](
+; CHECK-NOT: detach within
+; CHECK-NOT: sync within
+; CHECK: ret void
+
+; Outside of a parallel region, the loop forks one.  Inside a region, it
+; spawns its chunks as tasks into the region.
+
+; CHECK: define internal void @[[STATICHELPER]].omp.loop(
+; CHECK: %[[INPARALLEL:.+]] = call i32 @__kmpc_in_parallel(%ident_t* @{{.+}})
+; CHECK: omp.fork:
+; CHECK: call void (%ident_t*, i32, void (i32*, i32*, ...)*, ...) @__kmpc_fork_call(%ident_t* @{{.+}}, i32 1, void (i32*, i32*, ...)* bitcast (void (i32*, i32*, %[[STATICARGS:.+]]*)* @[[STATICHELPER]].OMP to void (i32*, i32*, ...)*), %[[STATICARGS]]* %{{.+}})
+; CHECK: omp.spawn.chunk:
+; CHECK: detach within %syncreg, label %omp.spawn.body, label %omp.spawn.inc
+; CHECK: omp.spawn.body:
+; CHECK-NEXT: call fastcc void @[[STATICHELPER]](i32 %chunk.lb, i32 %chunk.ub, i32 %{{.+}}, i32* %{{.+}})
+; CHECK-NEXT: reattach within %syncreg, label %omp.spawn.inc
+; CHECK: omp.spawn.end:
+; CHECK-NEXT: sync within %syncreg, label %omp.spawn.synced
+
+; CHECK: define internal void @[[STATICHELPER]].OMP(i32* %.global_tid., i32* %.bound_tid., %[[STATICARGS]]* %closure)
+; CHECK: call void @__kmpc_for_static_init_4u(%ident_t* @{{.+}}, i32 %gtid, i32 33, i32* %last, i32* %lb, i32* %ub, i32* %stride, i32 1, i32 %chunk)
+; CHECK: omp.static.body:
+; CHECK: call fastcc void @[[STATICHELPER]](i32 %{{.+}}, i32 %{{.+}}, i32 %{{.+}}, i32* %{{.+}})
+; CHECK: br label %omp.static.cond
+; CHECK: omp.static.exit:
+; CHECK-NEXT: call void @__kmpc_for_static_fini(%ident_t* @{{.+}}, i32 %gtid)
+
+; CHECK: define internal void @[[DYNAMICHELPER]].OMP(
+; CHECK: call void @__kmpc_dispatch_init_8u(%ident_t* @{{.+}}, i32 %gtid, i32 35, i64 0, i64 %{{.+}}, i64 1, i64 %{{.+}})
+; CHECK: omp.dispatch.next:
+; CHECK: call i32 @__kmpc_dispatch_next_8u(%ident_t* @{{.+}}, i32 %gtid, i32* %last, i64* %lb, i64* %ub, i64* %stride)
+; CHECK: omp.dispatch.body:
+; CHECK: call fastcc void @[[DYNAMICHELPER]](i64 %{{.+}}, i64 %{{.+}}, i64 %{{.+}}, i32* %{{.+}})
+; CHECK-NEXT: br label %omp.dispatch.next
+
+; CHECK: define internal void @[[GUIDEDHELPER]].OMP(
+; CHECK: call void @__kmpc_dispatch_init_4u(%ident_t* @{{.+}}, i32 %gtid, i32 36, i32 0, i32 %{{.+}}, i32 1, i32 %{{.+}})
+; CHECK: call i32 @__kmpc_dispatch_next_4u(
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #1
+
+attributes #0 = { nounwind uwtable }
+attributes #1 = { argmemonly nounwind }
+
+!0 = distinct !{!0, !1}
+!1 = !{!"tapir.loop.spawn.strategy", i32 1}
+!2 = distinct !{!2, !1, !3}
+!3 = !{!"tapir.loop.schedule", i32 1}
+!4 = distinct !{!4, !1, !5, !6}
+!5 = !{!"tapir.loop.schedule", i32 2}
+!6 = !{!"tapir.loop.grainsize", i32 8}
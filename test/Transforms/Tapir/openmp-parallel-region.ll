@@ -0,0 +1,264 @@
+; Test that Tapir lowering to OpenMP forks one parallel region around the
+; spawning code of a function, and none for functions that are only called
+; inside a parallel region.  The region of a function whose callers are all
+; known and have no exception handling is hoisted into its callers.
+;
+; RUN: opt < %s -tapir2target -tapir-target=openmp -S | FileCheck %s
+; RUN: opt < %s -tapir2target -tapir-target=openmp -fast-openmp -S | FileCheck %s --check-prefix=FAST
+
+; With -fast-openmp, functions whose callers are not all known assume that they
+; are called inside a parallel region.
+
+; FAST-LABEL: define void @twice(i32* %a)
+; FAST-NOT: @__kmpc_fork_call
+; FAST: call i32 @__kmpc_omp_task(
+; FAST-NOT: @__kmpc_fork_call
+
+; Both spawns of @twice share one parallel region, which is forked only if no
+; parallel region is active.
+
+; CHECK-LABEL: define void @twice(i32* %a)
+; CHECK: %[[INPAR:.+]] = call i32 @__kmpc_in_parallel(
+; CHECK: %[[COND:.+]] = icmp ne i32 %[[INPAR]], 0
+; CHECK: br i1 %[[COND]]
+; CHECK: call void @[[REGION:twice_omp.region]](
+; CHECK: call void (%ident_t*, i32, void (i32*, i32*, ...)*, ...) @__kmpc_fork_call(%ident_t* @{{.+}}, i32 1, void (i32*, i32*, ...)* bitcast (void (i32*, i32*, {{.+}})* @[[REGION]].OMP to void (i32*, i32*, ...)*)
+; CHECK-NOT: @__kmpc_fork_call
+; CHECK: ret void
+define void @twice(i32* %a) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %entry
+  call void @fill(i32* %a)
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %entry
+  call void @fill(i32* %a)
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %det.cont
+  detach within %syncreg, label %det.achd1, label %det.cont1
+
+det.achd1:                                        ; preds = %sync.continue
+  call void @fill(i32* %a)
+  reattach within %syncreg, label %det.cont1
+
+det.cont1:                                        ; preds = %det.achd1, %sync.continue
+  call void @fill(i32* %a)
+  sync within %syncreg, label %sync.continue1
+
+sync.continue1:                                   ; preds = %det.cont1
+  ret void
+}
+
+; @fill is only called from @twice, so it spawns into the region of its
+; caller.
+
+; CHECK-LABEL: define internal void @fill(i32* %a)
+; CHECK-NOT: @__kmpc_fork_call
+; CHECK: call i32 @__kmpc_omp_task(
+; CHECK-NOT: @__kmpc_fork_call
+; CHECK: ret void
+define internal void @fill(i32* %a) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %entry
+  store i32 0, i32* %a, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %entry
+  %b = getelementptr inbounds i32, i32* %a, i64 1
+  store i32 1, i32* %b, align 4
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %det.cont
+  ret void
+}
+
+; @step spawns, and its only caller is @loop, which does not.  The region of
+; @step is hoisted into @loop, which forks the thread team once around the loop
+; rather than once per iteration.
+
+; CHECK-LABEL: define void @loop(i32* %a, i32 %n)
+; CHECK: %[[LOOPINPAR:.+]] = call i32 @__kmpc_in_parallel(
+; CHECK: %[[LOOPCOND:.+]] = icmp ne i32 %[[LOOPINPAR]], 0
+; CHECK: br i1 %[[LOOPCOND]]
+; CHECK: call void @[[LOOPREGION:loop_header.omp.region]](
+; CHECK: call void (%ident_t*, i32, void (i32*, i32*, ...)*, ...) @__kmpc_fork_call(%ident_t* @{{.+}}, i32 {{[0-9]+}}, void (i32*, i32*, ...)* bitcast ({{.+}}* @[[LOOPREGION]].OMP to void (i32*, i32*, ...)*)
+; CHECK-NOT: @__kmpc_fork_call
+; CHECK: exit:
+; CHECK-NEXT: br label %omp.return
+define void @loop(i32* %a, i32 %n) #0 {
+entry:
+  %empty = icmp eq i32 %n, 0
+  br i1 %empty, label %early, label %header
+
+early:                                            ; preds = %entry
+  ret void
+
+header:                                           ; preds = %header, %entry
+  %i = phi i32 [ 0, %entry ], [ %inc, %header ]
+  call void @step(i32* %a)
+  %inc = add nuw i32 %i, 1
+  %more = icmp ult i32 %inc, %n
+  br i1 %more, label %header, label %exit
+
+exit:                                             ; preds = %header
+  ret void
+}
+
+; CHECK-LABEL: define internal void @step(i32* %a)
+; CHECK-NOT: @__kmpc_fork_call
+; CHECK: call i32 @__kmpc_omp_task(
+; CHECK-NOT: @__kmpc_fork_call
+; CHECK: ret void
+define internal void @step(i32* %a) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %entry
+  store i32 0, i32* %a, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %entry
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %det.cont
+  ret void
+}
+
+; Serial code before the first spawn and after the last sync of @around stays
+; outside of its region.
+
+; CHECK-LABEL: define void @around(i32* %a)
+; CHECK: call void @work(i32* %a)
+; CHECK: call i32 @__kmpc_in_parallel(
+; CHECK: call void @[[AROUNDREGION:around_omp.region]](
+; CHECK: call void {{.+}} @__kmpc_fork_call(
+; CHECK: sync.continue:
+; CHECK-NEXT: call void @work(i32* %a)
+; CHECK-NEXT: ret void
+define void @around(i32* %a) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  call void @work(i32* %a)
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %entry
+  store i32 0, i32* %a, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %entry
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %det.cont
+  call void @work(i32* %a)
+  ret void
+}
+
+; @catcher calls @thrower through an invoke, which cannot be extracted into a
+; region.  So @catcher forks no region and @thrower forks its own.
+
+; CHECK-LABEL: define void @catcher(i32* %a)
+; CHECK-NOT: @__kmpc_fork_call
+; CHECK: ret void
+define void @catcher(i32* %a) #2 personality i32 (...)* @__gxx_personality_v0 {
+entry:
+  invoke void @thrower(i32* %a)
+          to label %cont unwind label %lpad
+
+cont:                                             ; preds = %entry
+  ret void
+
+lpad:                                             ; preds = %entry
+  %lp = landingpad { i8*, i32 }
+          cleanup
+  resume { i8*, i32 } %lp
+}
+
+; CHECK-LABEL: define internal void @thrower(i32* %a)
+; CHECK: call i32 @__kmpc_in_parallel(
+; CHECK: @__kmpc_fork_call({{.+}} @thrower_omp.region.OMP
+define internal void @thrower(i32* %a) #2 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %entry
+  store i32 0, i32* %a, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %entry
+  call void @work(i32* %a)
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %det.cont
+  ret void
+}
+
+; The spawning code of @unwinds may unwind, so it forks no region and its tasks
+; run outside of one.
+
+; CHECK-LABEL: define void @unwinds(i32* %a)
+; CHECK-NOT: @__kmpc_fork_call
+; CHECK: call i32 @__kmpc_omp_task(
+; CHECK-NOT: @__kmpc_fork_call
+; CHECK: resume
+define void @unwinds(i32* %a) #2 personality i32 (...)* @__gxx_personality_v0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %entry
+  store i32 0, i32* %a, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %entry
+  invoke void @work(i32* %a)
+          to label %invoke.cont unwind label %lpad
+
+invoke.cont:                                      ; preds = %det.cont
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %invoke.cont
+  ret void
+
+lpad:                                             ; preds = %det.cont
+  %lp = landingpad { i8*, i32 }
+          cleanup
+  sync within %syncreg, label %eh.resume
+
+eh.resume:                                        ; preds = %lpad
+  resume { i8*, i32 } %lp
+}
+
+declare void @work(i32*)
+
+declare i32 @__gxx_personality_v0(...)
+
+; In the microtask, the master thread runs the region.
+
+; CHECK: define internal void @[[AROUNDREGION]]({{.+}})
+; CHECK-NOT: @work
+; CHECK: call i32 @__kmpc_omp_task(
+; CHECK-NOT: @work
+; CHECK: ret void
+
+; CHECK: define internal void @[[REGION]].OMP(i32* %.global_tid., i32* %.bound_tid.,
+; CHECK: %[[MASTER:.+]] = call i32 @__kmpc_master(%ident_t* @{{.+}}, i32 %gtid)
+; CHECK: icmp ne i32 %[[MASTER]], 0
+; CHECK: omp.master:
+; CHECK-NEXT: call void @[[REGION]](
+; CHECK-NEXT: call void @__kmpc_end_master(%ident_t* @{{.+}}, i32 %gtid)
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #1
+
+attributes #0 = { nounwind uwtable }
+attributes #1 = { argmemonly nounwind }
+attributes #2 = { uwtable }
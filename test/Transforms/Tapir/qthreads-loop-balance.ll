@@ -0,0 +1,72 @@
+; Test that Tapir's loop spawning pass hands the iterations of a Tapir loop to
+; qt_loop_balance when targeting Qthreads, passing the captured arguments
+; through one shared frame.
+
+; RUN: opt < %s -loop-spawning -ls-tapir-target=qthreads -S | FileCheck %s
+
+; CHECK-LABEL: define void @fill(
+; CHECK: %[[FRAME:.+]] = alloca %[[FRAMETY:.+]]
+; CHECK: %[[STOP:.+]] = add i64 %{{.+}}, 1
+; CHECK: call void @qt_loop_balance(i64 0, i64 %[[STOP]], void (i64, i64, i8*)* @[[HELPER:.+]].qt, i8* %{{.+}})
+; CHECK-NOT: qt_sinc
+; CHECK-NOT: sync within
+; CHECK: ret void
+define void @fill(double* %a, double %x, i32 %n) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:                            ; preds = %entry
+  br label %pfor.detach
+
+pfor.cond.cleanup.loopexit:                       ; preds = %pfor.inc
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:                                ; preds = %pfor.cond.cleanup.loopexit, %entry
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %pfor.cond.cleanup
+  ret void
+
+pfor.detach:                                      ; preds = %pfor.detach.preheader, %pfor.inc
+  %i = phi i32 [ %inc, %pfor.inc ], [ 0, %pfor.detach.preheader ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:                                        ; preds = %pfor.detach
+  %idxprom = sext i32 %i to i64
+  %arrayidx = getelementptr inbounds double, double* %a, i64 %idxprom
+  store double %x, double* %arrayidx, align 8
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:                                         ; preds = %pfor.body, %pfor.detach
+  %inc = add nuw nsw i32 %i, 1
+  %exitcond = icmp eq i32 %inc, %n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !0
+}
+
+; The helper runs its iterations serially.
+
+; CHECK: define internal fastcc void @[[HELPER]](
+; CHECK-NOT: detach within
+; CHECK-NOT: sync within
+; CHECK: ret void
+
+; Each chunk loads the arguments from the shared frame and runs the
+; iterations [startat, stopat).
+
+; CHECK: define internal void @[[HELPER]].qt(i64 %startat, i64 %stopat, i8* %frame)
+; CHECK: bitcast i8* %frame to %[[FRAMETY]]*
+; CHECK: %[[START:.+]] = trunc i64 %startat to i32
+; CHECK: %[[LAST:.+]] = sub i64 %stopat, 1
+; CHECK: %[[END:.+]] = trunc i64 %[[LAST]] to i32
+; CHECK: call fastcc void @[[HELPER]](i32 %[[START]], i32 %[[END]],
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #1
+
+attributes #0 = { nounwind uwtable }
+attributes #1 = { argmemonly nounwind }
+
+!0 = distinct !{!0, !1}
+!1 = !{!"tapir.loop.spawn.strategy", i32 1}
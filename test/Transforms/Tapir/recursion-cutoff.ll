@@ -0,0 +1,155 @@
+; Test that recursive spawning functions call a serial clone of themselves
+; once the recursion is small enough.
+
+; RUN: opt < %s -recursion-cutoff -S | FileCheck %s
+; RUN: opt < %s -recursion-cutoff -rc-size-cutoff=20 -S | FileCheck %s --check-prefix=SIZE20
+
+; The size argument of fib shrinks on every recursive call.
+
+; CHECK-LABEL: define i32 @fib(i32 %n)
+; CHECK: %size.cutoff = icmp slt i32 %n, 16
+; CHECK: br i1 %size.cutoff, label %serial.cutoff
+; CHECK: serial.cutoff:
+; CHECK-NEXT: %[[RES:.+]] = call i32 @fib.serial(i32 %n)
+; CHECK-NEXT: ret i32 %[[RES]]
+; CHECK: detach within %syncreg
+; CHECK: call i32 @fib(
+
+; SIZE20-LABEL: define i32 @fib(i32 %n)
+; SIZE20: %size.cutoff = icmp slt i32 %n, 20
+
+; Function Attrs: nounwind uwtable
+define i32 @fib(i32 %n) #0 {
+entry:
+  %x = alloca i32, align 4
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp slt i32 %n, 2
+  br i1 %cmp, label %return, label %if.end
+
+if.end:                                           ; preds = %entry
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %if.end
+  %sub = add nsw i32 %n, -1
+  %call = call i32 @fib(i32 %sub)
+  store i32 %call, i32* %x, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %if.end
+  %sub1 = add nsw i32 %n, -2
+  %call2 = call i32 @fib(i32 %sub1)
+  sync within %syncreg, label %sync.continue
+
+sync.continue:                                    ; preds = %det.cont
+  %0 = load i32, i32* %x, align 4
+  %add = add nsw i32 %0, %call2
+  br label %return
+
+return:                                           ; preds = %entry, %sync.continue
+  %retval = phi i32 [ %add, %sync.continue ], [ %n, %entry ]
+  ret i32 %retval
+}
+
+; The size argument of sum is unsigned, so it is compared without a sign.
+
+; CHECK-LABEL: define void @sum(i32* %a, i64 %n)
+; CHECK: %size.cutoff = icmp ult i64 %n, 16
+; CHECK: br i1 %size.cutoff, label %serial.cutoff
+; CHECK: serial.cutoff:
+; CHECK-NEXT: call void @sum.serial(i32* %a, i64 %n)
+
+; Function Attrs: nounwind uwtable
+define void @sum(i32* %a, i64 %n) #0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp ult i64 %n, 2
+  br i1 %cmp, label %return, label %if.end
+
+if.end:                                           ; preds = %entry
+  %half = udiv i64 %n, 2
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %if.end
+  call void @sum(i32* %a, i64 %half)
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %if.end
+  %rest = sub i64 %n, %half
+  %a.rest = getelementptr inbounds i32, i32* %a, i64 %half
+  call void @sum(i32* %a.rest, i64 %rest)
+  sync within %syncreg, label %return
+
+return:                                           ; preds = %det.cont, %entry
+  ret void
+}
+
+; A tree walk has no size argument, so the depth of the recursion is threaded
+; through a clone, with the cutoff taken from the function's metadata.
+
+; CHECK-LABEL: define void @walk(%struct.node* %t)
+; CHECK: detach within %syncreg
+; CHECK: call void @walk.depth(%struct.node* %{{.+}}, i32 1)
+; CHECK: call void @walk.depth(%struct.node* %{{.+}}, i32 1)
+
+%struct.node = type { %struct.node*, %struct.node* }
+
+; Function Attrs: nounwind uwtable
+define void @walk(%struct.node* %t) #0 !tapir.recursion.cutoff !0 {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %tobool = icmp eq %struct.node* %t, null
+  br i1 %tobool, label %return, label %if.end
+
+if.end:                                           ; preds = %entry
+  %left = getelementptr inbounds %struct.node, %struct.node* %t, i64 0, i32 0
+  %0 = load %struct.node*, %struct.node** %left, align 8
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:                                         ; preds = %if.end
+  call void @walk(%struct.node* %0)
+  reattach within %syncreg, label %det.cont
+
+det.cont:                                         ; preds = %det.achd, %if.end
+  %right = getelementptr inbounds %struct.node, %struct.node* %t, i64 0, i32 1
+  %1 = load %struct.node*, %struct.node** %right, align 8
+  call void @walk(%struct.node* %1)
+  sync within %syncreg, label %return
+
+return:                                           ; preds = %det.cont, %entry
+  ret void
+}
+
+; The serial clones recurse into themselves without spawning.
+
+; CHECK-LABEL: define internal i32 @fib.serial(i32 %n)
+; CHECK-NOT: syncregion
+; CHECK-NOT: detach
+; CHECK: call i32 @fib.serial(
+; CHECK-NOT: sync within
+; CHECK: call i32 @fib.serial(
+; CHECK: ret i32
+
+; CHECK-LABEL: define internal void @walk.serial(%struct.node* %t)
+; CHECK-NOT: detach
+; CHECK: call void @walk.serial(
+; CHECK: call void @walk.serial(
+
+; CHECK-LABEL: define internal void @walk.depth(%struct.node* %t, i32 %depth)
+; CHECK: %depth.cutoff = icmp uge i32 %depth, 8
+; CHECK: br i1 %depth.cutoff, label %serial.cutoff
+; CHECK: serial.cutoff:
+; CHECK-NEXT: call void @walk.serial(%struct.node* %t)
+; CHECK-NEXT: ret void
+; CHECK: detach within %syncreg
+; CHECK: %[[D1:.+]] = add i32 %depth, 1
+; CHECK-NEXT: call void @walk.depth(%struct.node* %{{.+}}, i32 %[[D1]])
+; CHECK: %[[D2:.+]] = add i32 %depth, 1
+; CHECK-NEXT: call void @walk.depth(%struct.node* %{{.+}}, i32 %[[D2]])
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #1
+
+attributes #0 = { nounwind uwtable }
+attributes #1 = { argmemonly nounwind }
+
+!0 = !{i32 8}
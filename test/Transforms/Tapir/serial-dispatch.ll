@@ -0,0 +1,146 @@
+; Test that spawning functions call their serial clones when the Tapir target
+; reports that spawns cannot run in parallel and their parallel clones
+; otherwise, and that the serial and parallel clones call each other directly.
+
+; RUN: opt < %s -serial-dispatch -sd-tapir-target=cilk -S | FileCheck %s
+; RUN: opt < %s -serial-dispatch -sd-tapir-target=qthreads -S | FileCheck %s --check-prefix=QTHREADS
+; RUN: opt < %s -serial-dispatch -sd-tapir-target=none -S | FileCheck %s --check-prefix=NONE
+
+; CHECK-LABEL: define void @outer(i32* %a, i32 %n)
+; CHECK: %nworkers = call i32 @__cilkrts_get_nworkers()
+; CHECK-NEXT: %single.worker = icmp sle i32 %nworkers, 1
+; CHECK-NEXT: br i1 %single.worker, label %serial.dispatch
+; CHECK: serial.dispatch:
+; CHECK-NEXT: call void @outer.serial(i32* %a, i32 %n)
+; CHECK-NEXT: ret void
+; CHECK: call void @outer.parallel(i32* %a, i32 %n)
+; CHECK-NEXT: ret void
+; CHECK-NEXT: }
+
+; QTHREADS-LABEL: define void @outer(
+; QTHREADS: %nworkers = call i16 @qthread_num_workers()
+; QTHREADS-NEXT: %single.worker = icmp ule i16 %nworkers, 1
+
+; NONE-LABEL: define void @outer(
+; NONE-NOT: serial.dispatch
+; NONE-NOT: .serial
+
+define void @outer(i32* %a, i32 %n) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  call void @inner(i32* %a)
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  call void @leaf(i32* %a)
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+; CHECK-LABEL: define void @inner(i32* %a)
+; CHECK: br i1 %single.worker, label %serial.dispatch
+; CHECK: call void @inner.serial(i32* %a)
+; CHECK: call void @inner.parallel(i32* %a)
+
+define void @inner(i32* %a) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  store i32 0, i32* %a, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  %b = getelementptr inbounds i32, i32* %a, i64 1
+  store i32 1, i32* %b, align 4
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+; CHECK-LABEL: define void @rec(i32* %a, i32 %n)
+; CHECK: %single.worker = icmp sle i32 %nworkers, 1
+; CHECK: call void @rec.parallel(i32* %a, i32 %n)
+
+define void @rec(i32* %a, i32 %n) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %cmp = icmp slt i32 %n, 1
+  br i1 %cmp, label %return, label %if.end
+
+if.end:
+  %sub = add nsw i32 %n, -1
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  call void @rec(i32* %a, i32 %sub)
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  %b = getelementptr inbounds i32, i32* %a, i32 %n
+  store i32 %n, i32* %b, align 4
+  sync within %syncreg, label %return
+
+return:
+  ret void
+}
+
+; Functions that do not spawn are left alone.
+
+; CHECK-LABEL: define void @leaf(i32* %a)
+; CHECK-NOT: serial.dispatch
+; CHECK: ret void
+
+define void @leaf(i32* %a) {
+entry:
+  store i32 2, i32* %a, align 4
+  ret void
+}
+
+; The serial clones neither spawn nor sync, and call the serial clones of the
+; spawning functions they call.
+
+; CHECK-LABEL: define internal void @outer.serial(i32* %a, i32 %n)
+; CHECK-NOT: detach
+; CHECK-NOT: sync within
+; CHECK: call void @inner.serial(i32* %a)
+; CHECK: call void @leaf(i32* %a)
+; CHECK: ret void
+
+; CHECK-LABEL: define internal void @inner.serial(i32* %a)
+; CHECK-NOT: detach
+; CHECK-NOT: sync within
+; CHECK: ret void
+
+; CHECK-LABEL: define internal void @rec.serial(i32* %a, i32 %n)
+; CHECK-NOT: detach
+; CHECK: call void @rec.serial(i32* %a, i32 %sub)
+
+; The parallel clones hold the original bodies, and call the parallel clones
+; of the spawning functions they call, including themselves, without checking
+; the number of workers again.
+
+; CHECK-LABEL: define internal void @outer.parallel(i32* %a, i32 %n)
+; CHECK-NOT: nworkers
+; CHECK: detach within %syncreg
+; CHECK: call void @inner.parallel(i32* %a)
+; CHECK: call void @leaf(i32* %a)
+; CHECK: sync within %syncreg
+
+; CHECK-LABEL: define internal void @inner.parallel(i32* %a)
+; CHECK-NOT: nworkers
+; CHECK: detach within %syncreg
+
+; CHECK-LABEL: define internal void @rec.parallel(i32* %a, i32 %n)
+; CHECK-NOT: nworkers
+; CHECK: detach within %syncreg
+; CHECK: call void @rec.parallel(i32* %a, i32 %sub)
+
+declare token @llvm.syncregion.start()
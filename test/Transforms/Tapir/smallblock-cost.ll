@@ -0,0 +1,126 @@
+; Test that SmallBlock serializes detached regions whose estimated cost is
+; below the spawn overhead of the Tapir target, including regions with calls
+; and bounded loops.
+
+; RUN: opt < %s -smallblock -sb-tapir-target=cilk -S | FileCheck %s
+; RUN: opt < %s -smallblock -sb-tapir-target=cilk -sb-spawn-cost=2 -S | FileCheck %s --check-prefix=CHEAP
+
+; A region with a small bounded loop is cheaper than a spawn.
+define void @bounded(i32* %a) #0 {
+; CHECK-LABEL: @bounded(
+; CHECK-NOT: detach
+; CHECK: ret void
+; CHEAP-LABEL: @bounded(
+; CHEAP: detach within %syncreg
+entry:
+  %syncreg = tail call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %det.achd ], [ %inc, %loop ]
+  %gep = getelementptr inbounds i32, i32* %a, i64 %i
+  store i32 0, i32* %gep
+  %inc = add nuw nsw i64 %i, 1
+  %cmp = icmp ult i64 %inc, 4
+  br i1 %cmp, label %loop, label %loop.end
+
+loop.end:
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  tail call void @c()
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+; A region with a loop of unknown trip count is left alone.
+define void @unbounded(i32* %a, i64 %n) #0 {
+; CHECK-LABEL: @unbounded(
+; CHECK: detach within %syncreg
+entry:
+  %syncreg = tail call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %det.achd ], [ %inc, %loop ]
+  %gep = getelementptr inbounds i32, i32* %a, i64 %i
+  store i32 0, i32* %gep
+  %inc = add nuw nsw i64 %i, 1
+  %cmp = icmp ult i64 %inc, %n
+  br i1 %cmp, label %loop, label %loop.end
+
+loop.end:
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  tail call void @c()
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+; A call to a small function is cheaper than a spawn.
+define void @smallcall(i32* %a, i32 %x) #0 {
+; CHECK-LABEL: @smallcall(
+; CHECK-NOT: detach
+; CHECK: call void @small(
+; CHECK: ret void
+entry:
+  %syncreg = tail call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  call void @small(i32* %a, i32 %x)
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  tail call void @c()
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define void @small(i32* %a, i32 %x) #0 {
+entry:
+  %y = mul i32 %x, 3
+  store i32 %y, i32* %a
+  ret void
+}
+
+; A call to an external function cannot be costed.
+define void @externcall() #0 {
+; CHECK-LABEL: @externcall(
+; CHECK: detach within %syncreg
+entry:
+  %syncreg = tail call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  tail call void @c()
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  tail call void @c()
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+declare void @c()
+
+; Function Attrs: argmemonly nounwind
+declare token @llvm.syncregion.start() #1
+
+attributes #0 = { nounwind uwtable }
+attributes #1 = { argmemonly nounwind }
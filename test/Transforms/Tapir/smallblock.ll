@@ -1,4 +1,4 @@
-; RUN: opt < %s -smallblock -S | FileCheck %s
+; RUN: opt < %s -smallblock -sb-tapir-target=cilk -S | FileCheck %s
 
 ; Function Attrs: nounwind uwtable
 define void @foo(i32 %x, i32 %y) local_unnamed_addr #0 {
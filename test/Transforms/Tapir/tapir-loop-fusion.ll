@@ -0,0 +1,180 @@
+; Test that adjacent Tapir loops with the same trip count, separated only by a
+; sync, are fused when each iteration of the second loop depends only on the
+; same iteration of the first.
+
+; RUN: opt < %s -tapir-loop-fusion -S | FileCheck %s
+; RUN: opt < %s -tapir-loop-fusion -pass-remarks=tapir-loop-fusion -pass-remarks-missed=tapir-loop-fusion -disable-output 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; REMARK: remark: <unknown>:0:0: fused Tapir loop with the next Tapir loop
+; REMARK: remark: <unknown>:0:0: cannot fuse Tapir loop with the preceding Tapir loop: iterations of the second loop depend on other iterations of the first loop
+
+; The second loop reads only the element of %a that the same iteration of the
+; first loop writes.
+; CHECK-LABEL: define void @fuse(
+; CHECK-NOT: %syncreg2
+; CHECK: pfor.detach.preheader:
+; CHECK: %m.fused = shl i32 %n, 1
+; CHECK: pfor.body:
+; CHECK: store i32 %t, i32* %p
+; CHECK-NEXT: br label %pfor2.body
+; CHECK: pfor.inc:
+; CHECK: br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop
+; CHECK: sync within %syncreg, label %sync.continue
+; CHECK: sync.continue:
+; CHECK-NEXT: br i1 %cmp, label %pfor2.detach.preheader, label %pfor2.cond.cleanup
+; CHECK: pfor2.detach.preheader:
+; CHECK: br label %pfor2.cond.cleanup.loopexit
+; CHECK: pfor2.body:
+; CHECK-NEXT: %q = getelementptr inbounds i32, i32* %a, i64 %i
+; CHECK: %add = add nsw i32 %v, %m.fused
+; CHECK: reattach within %syncreg, label %pfor.inc
+; CHECK-NOT: detach within
+; CHECK-NOT: sync within
+; CHECK: ret void
+
+; The second loop reads the element of %a that the next iteration of the first
+; loop writes.
+; CHECK-LABEL: define void @nofuse(
+; CHECK: detach within %syncreg,
+; CHECK: sync within %syncreg,
+; CHECK: detach within %syncreg2,
+; CHECK: sync within %syncreg2,
+
+define void @fuse(i32* noalias %a, i32* noalias %b, i32 %n) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %syncreg2 = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:
+  %wide.n = zext i32 %n to i64
+  br label %pfor.detach
+
+pfor.detach:
+  %i = phi i64 [ 0, %pfor.detach.preheader ], [ %inc, %pfor.inc ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %t = trunc i64 %i to i32
+  store i32 %t, i32* %p, align 4
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:
+  %inc = add nuw nsw i64 %i, 1
+  %exitcond = icmp eq i64 %inc, %wide.n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !1
+
+pfor.cond.cleanup.loopexit:
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  br i1 %cmp, label %pfor2.detach.preheader, label %pfor2.cond.cleanup
+
+pfor2.detach.preheader:
+  %wide.n2 = zext i32 %n to i64
+  %m = shl i32 %n, 1
+  br label %pfor2.detach
+
+pfor2.detach:
+  %j = phi i64 [ 0, %pfor2.detach.preheader ], [ %inc2, %pfor2.inc ]
+  detach within %syncreg2, label %pfor2.body, label %pfor2.inc
+
+pfor2.body:
+  %q = getelementptr inbounds i32, i32* %a, i64 %j
+  %v = load i32, i32* %q, align 4
+  %add = add nsw i32 %v, %m
+  %r = getelementptr inbounds i32, i32* %b, i64 %j
+  store i32 %add, i32* %r, align 4
+  reattach within %syncreg2, label %pfor2.inc
+
+pfor2.inc:
+  %inc2 = add nuw nsw i64 %j, 1
+  %exitcond2 = icmp eq i64 %inc2, %wide.n2
+  br i1 %exitcond2, label %pfor2.cond.cleanup.loopexit, label %pfor2.detach, !llvm.loop !3
+
+pfor2.cond.cleanup.loopexit:
+  br label %pfor2.cond.cleanup
+
+pfor2.cond.cleanup:
+  sync within %syncreg2, label %sync.continue2
+
+sync.continue2:
+  ret void
+}
+
+define void @nofuse(i32* noalias %a, i32 %n) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  %syncreg2 = call token @llvm.syncregion.start()
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %pfor.detach.preheader, label %pfor.cond.cleanup
+
+pfor.detach.preheader:
+  %wide.n = zext i32 %n to i64
+  br label %pfor.detach
+
+pfor.detach:
+  %i = phi i64 [ 0, %pfor.detach.preheader ], [ %inc, %pfor.inc ]
+  detach within %syncreg, label %pfor.body, label %pfor.inc
+
+pfor.body:
+  %p = getelementptr inbounds i32, i32* %a, i64 %i
+  %t = trunc i64 %i to i32
+  store i32 %t, i32* %p, align 4
+  reattach within %syncreg, label %pfor.inc
+
+pfor.inc:
+  %inc = add nuw nsw i64 %i, 1
+  %exitcond = icmp eq i64 %inc, %wide.n
+  br i1 %exitcond, label %pfor.cond.cleanup.loopexit, label %pfor.detach, !llvm.loop !1
+
+pfor.cond.cleanup.loopexit:
+  br label %pfor.cond.cleanup
+
+pfor.cond.cleanup:
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  br i1 %cmp, label %pfor2.detach.preheader, label %pfor2.cond.cleanup
+
+pfor2.detach.preheader:
+  %wide.n2 = zext i32 %n to i64
+  br label %pfor2.detach
+
+pfor2.detach:
+  %j = phi i64 [ 0, %pfor2.detach.preheader ], [ %inc2, %pfor2.inc ]
+  detach within %syncreg2, label %pfor2.body, label %pfor2.inc
+
+pfor2.body:
+  %j.next = add nuw nsw i64 %j, 1
+  %q = getelementptr inbounds i32, i32* %a, i64 %j.next
+  %v = load i32, i32* %q, align 4
+  %r = getelementptr inbounds i32, i32* %a, i64 %j
+  store i32 %v, i32* %r, align 4
+  reattach within %syncreg2, label %pfor2.inc
+
+pfor2.inc:
+  %inc2 = add nuw nsw i64 %j, 1
+  %exitcond2 = icmp eq i64 %inc2, %wide.n2
+  br i1 %exitcond2, label %pfor2.cond.cleanup.loopexit, label %pfor2.detach, !llvm.loop !3
+
+pfor2.cond.cleanup.loopexit:
+  br label %pfor2.cond.cleanup
+
+pfor2.cond.cleanup:
+  sync within %syncreg2, label %sync.continue2
+
+sync.continue2:
+  ret void
+}
+
+declare token @llvm.syncregion.start()
+
+!1 = distinct !{!1, !2}
+!2 = !{!"tapir.loop.spawn.strategy", i32 1}
+!3 = distinct !{!3, !2}
@@ -0,0 +1,57 @@
+; Test lowering Tapir to the TBB shim: each sync region keeps a lazily created
+; task_group, a detach runs a task in the group, a sync waits on the group only
+; if it exists, and main sets up the task_arena.
+
+; RUN: opt < %s -tapir2target -tapir-target=tbb -S | FileCheck %s
+
+; CHECK-LABEL: define void @spawn(i32* %a, i32 %n)
+; CHECK: %[[ARGS:.+]] = alloca %[[ARGSTY:[^ ,]+]]
+; CHECK: %tbb.task_group = alloca i8*
+; CHECK: %syncreg = call token @llvm.syncregion.start()
+; CHECK-NEXT: store i8* null, i8** %tbb.task_group
+; CHECK-NOT: detach
+; CHECK: %[[ARGSI8:.+]] = bitcast %[[ARGSTY]]* %[[ARGS]] to i8*
+; CHECK: call void @__tapir_tbb_spawn(i8** %tbb.task_group, void (i8*)* @[[TASK:.+]], i8* %[[ARGSI8]], i64 16)
+; CHECK-NEXT: br label %det.cont
+; CHECK: %[[GROUP:.+]] = load i8*, i8** %tbb.task_group
+; CHECK-NEXT: %tbb.spawned = icmp ne i8* %[[GROUP]], null
+; CHECK-NEXT: br i1 %tbb.spawned, label %tbb.wait, label %tbb.wait.cont
+; CHECK: tbb.wait:
+; CHECK-NEXT: call void @__tapir_tbb_sync(i8** %tbb.task_group)
+; CHECK-NOT: sync within
+; CHECK: ret void
+
+; CHECK-LABEL: define i32 @main()
+; CHECK-NEXT: entry:
+; CHECK-NEXT: call void @__tapir_tbb_initialize()
+
+; CHECK: define internal void @[[TASK]](i8* %args)
+; CHECK: call fastcc void @{{.+}}(i32 %{{.+}}, i32* %{{.+}})
+; CHECK-NEXT: ret void
+
+define void @spawn(i32* %a, i32 %n) {
+entry:
+  %syncreg = call token @llvm.syncregion.start()
+  detach within %syncreg, label %det.achd, label %det.cont
+
+det.achd:
+  store i32 %n, i32* %a, align 4
+  reattach within %syncreg, label %det.cont
+
+det.cont:
+  %b = getelementptr inbounds i32, i32* %a, i64 1
+  store i32 0, i32* %b, align 4
+  sync within %syncreg, label %sync.continue
+
+sync.continue:
+  ret void
+}
+
+define i32 @main() {
+entry:
+  %x = alloca i32, align 4
+  call void @spawn(i32* %x, i32 1)
+  ret i32 0
+}
+
+declare token @llvm.syncregion.start()
@@ -0,0 +1,193 @@
+//===- CSIRTCompressedTest.cpp - Tests of the compressed CSI tables -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "csi/csirt_compressed.h"
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int NumInits = 0;
+const char *LastUnit = nullptr;
+csirt_instrumentation_counts_t LastCounts;
+
+void noCallsites() {}
+
+void appendULEB128(std::vector<uint8_t> &Out, uint64_t Value) {
+  do {
+    uint8_t Byte = Value & 0x7f;
+    Value >>= 7;
+    Out.push_back(Value ? Byte | 0x80 : Byte);
+  } while (Value);
+}
+
+void appendSLEB128(std::vector<uint8_t> &Out, int64_t Value) {
+  bool More;
+  do {
+    uint8_t Byte = Value & 0x7f;
+    Value >>= 7;
+    More = !((Value == 0 && !(Byte & 0x40)) || (Value == -1 && (Byte & 0x40)));
+    Out.push_back(More ? Byte | 0x80 : Byte);
+  } while (More);
+}
+
+// The string pool of the units below: "fn" at offset 0 and "a.c" at offset 3.
+const char Strings[] = "fn\0a.c";
+
+// A compressed unit with NumFuncs functions, where function I is "fn" on line
+// 10 + I, column I % 3, in "a.c", and NumBBs basic blocks, where block I has
+// full size I and non-empty size I / 2.
+struct CompressedUnit {
+  std::vector<uint8_t> FuncData, SizeData;
+  std::vector<uint32_t> FuncBlocks, SizeBlocks;
+  int64_t Bases[CSIRT_NUM_FED_TABLES];
+  unit_compressed_fed_table_t Fed[CSIRT_NUM_FED_TABLES];
+  unit_compressed_size_table_t Size[CSIRT_NUM_SIZE_TABLES];
+
+  CompressedUnit(int64_t NumFuncs, int64_t NumBBs) {
+    int32_t Line = 0;
+    for (int64_t I = 0; I < NumFuncs; ++I) {
+      if (I % CSIRT_TABLE_BLOCK_SIZE == 0) {
+        FuncBlocks.push_back(FuncData.size());
+        Line = 0;
+      }
+      appendULEB128(FuncData, 1);
+      appendSLEB128(FuncData, 10 + I - Line);
+      appendULEB128(FuncData, I % 3 + 1);
+      appendULEB128(FuncData, 4);
+      Line = 10 + I;
+    }
+    for (int64_t I = 0; I < NumBBs; ++I) {
+      if (I % CSIRT_TABLE_BLOCK_SIZE == 0)
+        SizeBlocks.push_back(SizeData.size());
+      appendULEB128(SizeData, I);
+      appendULEB128(SizeData, I / 2);
+    }
+    for (int T = 0; T < CSIRT_NUM_FED_TABLES; ++T)
+      Fed[T] = {0, &Bases[T], nullptr, nullptr};
+    Fed[0] = {NumFuncs, &Bases[0], FuncData.data(), FuncBlocks.data()};
+    Fed[CSIRT_BB_FED_TABLE].num_entries = NumBBs;
+    Size[0] = {NumBBs, SizeData.data(), SizeBlocks.data()};
+  }
+
+  void init(const char *Name) {
+    __csirt_unit_init_compressed(Name, Fed, Size, Strings, noCallsites);
+  }
+};
+
+TEST(CSIRTCompressedTest, LooksUpEntriesAcrossBlocks) {
+  CompressedUnit Unit(150, 70);
+  Unit.init("blocks");
+  EXPECT_STREQ("blocks", LastUnit);
+  EXPECT_EQ(150, LastCounts.num[0]);
+  EXPECT_EQ(70, LastCounts.num[CSIRT_BB_FED_TABLE]);
+
+  for (int64_t I : {149, 0, 63, 64, 100}) {
+    const csirt_source_loc_t *Loc =
+        __csi_get_func_source_loc(Unit.Bases[0] + I);
+    ASSERT_NE(nullptr, Loc);
+    EXPECT_STREQ("fn", Loc->name);
+    EXPECT_EQ(10 + I, Loc->line);
+    EXPECT_EQ(I % 3, Loc->column);
+    EXPECT_STREQ("a.c", Loc->filename);
+  }
+  for (int64_t I : {69, 0, 64}) {
+    const csirt_sizeinfo_t *Size =
+        __csi_get_bb_sizeinfo(Unit.Bases[CSIRT_BB_FED_TABLE] + I);
+    ASSERT_NE(nullptr, Size);
+    EXPECT_EQ(I, Size->full_ir_size);
+    EXPECT_EQ(I / 2, Size->non_empty_ir_size);
+  }
+  EXPECT_EQ(nullptr, __csi_get_func_source_loc(Unit.Bases[0] + 150));
+  EXPECT_EQ(nullptr, __csi_get_func_source_loc(-1));
+}
+
+TEST(CSIRTCompressedTest, DecodesOnFirstLookupOnly) {
+  CompressedUnit Unit(3, 0);
+  Unit.init("lazy");
+
+  // Registration must not read the table, so a change made after it shows up
+  // in the first lookup.
+  Unit.FuncData[1] = 42;
+  const csirt_source_loc_t *Loc = __csi_get_func_source_loc(Unit.Bases[0]);
+  ASSERT_NE(nullptr, Loc);
+  EXPECT_EQ(42, Loc->line);
+
+  // Later lookups reuse the decoded block.
+  Unit.FuncData[1] = 7;
+  EXPECT_EQ(Loc, __csi_get_func_source_loc(Unit.Bases[0]));
+  EXPECT_EQ(42, Loc->line);
+  EXPECT_EQ(43, __csi_get_func_source_loc(Unit.Bases[0] + 1)->line);
+}
+
+TEST(CSIRTCompressedTest, NumbersUnitsConsecutively) {
+  CompressedUnit First(5, 2);
+  First.init("first");
+
+  csirt_source_loc_t Locs[2] = {{nullptr, 1, 2, nullptr},
+                                {nullptr, 3, 4, nullptr}};
+  csirt_sizeinfo_t Sizes[1] = {{5, 6}};
+  int64_t Bases[CSIRT_NUM_FED_TABLES];
+  unit_fed_table_t Fed[CSIRT_NUM_FED_TABLES];
+  for (int T = 0; T < CSIRT_NUM_FED_TABLES; ++T)
+    Fed[T] = {0, &Bases[T], nullptr};
+  Fed[0] = {2, &Bases[0], Locs};
+  Fed[CSIRT_BB_FED_TABLE].num_entries = 1;
+  unit_size_table_t Size[CSIRT_NUM_SIZE_TABLES] = {{1, Sizes}};
+  __csirt_unit_init("plain", Fed, Size, noCallsites);
+
+  CompressedUnit Last(1, 0);
+  Last.init("last");
+
+  EXPECT_EQ(First.Bases[0] + 5, Bases[0]);
+  EXPECT_EQ(Bases[0] + 2, Last.Bases[0]);
+  EXPECT_EQ(First.Bases[CSIRT_BB_FED_TABLE] + 2, Bases[CSIRT_BB_FED_TABLE]);
+  EXPECT_EQ(&Locs[1], __csi_get_func_source_loc(Bases[0] + 1));
+  EXPECT_EQ(&Sizes[0], __csi_get_bb_sizeinfo(Bases[CSIRT_BB_FED_TABLE]));
+  EXPECT_EQ(14, __csi_get_func_source_loc(First.Bases[0] + 4)->line);
+  EXPECT_EQ(10, __csi_get_func_source_loc(Last.Bases[0])->line);
+  EXPECT_EQ(1, NumInits);
+}
+
+TEST(CSIRTCompressedTest, ThreadsShareDecodedBlocks) {
+  CompressedUnit Unit(1000, 0);
+  Unit.init("shared");
+
+  std::vector<const csirt_source_loc_t *> Seen(4 * 1000);
+  std::vector<std::thread> Threads;
+  for (int T = 0; T < 4; ++T)
+    Threads.emplace_back([&, T] {
+      for (int64_t I = 0; I < 1000; ++I)
+        Seen[T * 1000 + I] = __csi_get_func_source_loc(Unit.Bases[0] + I);
+    });
+  for (std::thread &T : Threads)
+    T.join();
+
+  for (int64_t I = 0; I < 1000; ++I) {
+    ASSERT_NE(nullptr, Seen[I]);
+    EXPECT_EQ(10 + I, Seen[I]->line);
+    for (int T = 1; T < 4; ++T)
+      EXPECT_EQ(Seen[I], Seen[T * 1000 + I]);
+  }
+}
+
+} // end anonymous namespace
+
+// The hooks of the tool, which the runtime calls as each unit registers.
+extern "C" void __csi_init(void) { ++NumInits; }
+
+extern "C" void __csi_unit_init(const char *Name,
+                                const csirt_instrumentation_counts_t Counts) {
+  LastUnit = Name;
+  LastCounts = Counts;
+}
@@ -0,0 +1,108 @@
+//===- CilkRTest.cpp - Tests of the CilkR runtime -------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "cilkr/cilkr.h"
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// The arguments of fib, copied into the task at each spawn the way the cilkr
+// target copies the inputs of a detached task.
+struct FibArgs {
+  int N;
+  long *Result;
+};
+
+long fib(int N);
+
+void fibTask(void *Args) {
+  FibArgs *A = static_cast<FibArgs *>(Args);
+  *A->Result = fib(A->N);
+}
+
+long fib(int N) {
+  if (N < 2)
+    return N;
+  __cilkr_frame F = {};
+  long X, Y;
+  FibArgs A = {N - 1, &X};
+  __cilkr_spawn(&F, fibTask, &A, sizeof(A));
+  Y = fib(N - 2);
+  if (__atomic_load_n(&F.pending, __ATOMIC_ACQUIRE))
+    __cilkr_sync(&F);
+  return X + Y;
+}
+
+TEST(CilkRTest, Fib) {
+  EXPECT_EQ(832040, fib(30));
+}
+
+void addTask(void *Args) {
+  long *Sum;
+  std::memcpy(&Sum, Args, sizeof(Sum));
+  __atomic_fetch_add(Sum, 1, __ATOMIC_RELAXED);
+}
+
+// Spawn far more tasks in one frame than fit in the initial deque, so that the
+// deque grows and later frees the arrays it replaced.
+TEST(CilkRTest, ManyTasksInOneFrame) {
+  __cilkr_frame F = {};
+  long Sum = 0;
+  long *P = &Sum;
+  for (int I = 0; I < 100000; ++I)
+    __cilkr_spawn(&F, addTask, &P, sizeof(P));
+  __cilkr_sync(&F);
+  EXPECT_EQ(100000, Sum);
+}
+
+struct LargeArgs {
+  char Bytes[1000];
+  long *Sum;
+};
+
+void largeTask(void *Args) {
+  LargeArgs *A = static_cast<LargeArgs *>(Args);
+  long S = 0;
+  for (char C : A->Bytes)
+    S += C;
+  __atomic_fetch_add(A->Sum, S, __ATOMIC_RELAXED);
+}
+
+// Tasks whose arguments do not fit in a pooled block.
+TEST(CilkRTest, LargeArguments) {
+  __cilkr_frame F = {};
+  long Sum = 0;
+  LargeArgs A;
+  std::memset(A.Bytes, 1, sizeof(A.Bytes));
+  A.Sum = &Sum;
+  for (int I = 0; I < 100; ++I)
+    __cilkr_spawn(&F, largeTask, &A, sizeof(A));
+  __cilkr_sync(&F);
+  EXPECT_EQ(100 * 1000, Sum);
+}
+
+// Each thread that spawns claims a worker, and gives it back when it exits.
+// Many more threads than there are worker slots spawn over the life of the
+// process, a few at a time.
+TEST(CilkRTest, ThreadsGiveBackTheirWorkers) {
+  for (int Round = 0; Round < 256; ++Round) {
+    std::vector<std::thread> Threads;
+    for (int I = 0; I < 4; ++I)
+      Threads.emplace_back([] { EXPECT_EQ(6765, fib(20)); });
+    for (std::thread &T : Threads)
+      T.join();
+  }
+}
+
+} // end anonymous namespace
@@ -0,0 +1,149 @@
+//===- CilkscaleTest.cpp - Tests of the Cilkscale runtime -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "cilkscale/cilkscale.h"
+#include "csi/csirt_compressed.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// A clock that only moves when a test advances it, so that the measurements
+// are exact and exclude the runtime.
+uint64_t Now = 0;
+uint64_t fakeClock() { return Now; }
+
+void noCallsites() {}
+
+class CilkscaleTest : public ::testing::Test {
+protected:
+  cilkscale_measurement_t Before;
+
+  void SetUp() override {
+    __cilkscale_set_clock(fakeClock);
+    Before = __cilkscale_get_program_measurement();
+  }
+
+  cilkscale_measurement_t measured() {
+    cilkscale_measurement_t After = __cilkscale_get_program_measurement();
+    return {After.work - Before.work, After.span - Before.span};
+  }
+
+  // Spawn a task at DetachID that does Work, as the hooks of a detach do.
+  void spawn(int64_t DetachID, uint64_t Work) {
+    __cilkscale_detach(DetachID);
+    __cilkscale_task(0, DetachID);
+    Now += Work;
+    __cilkscale_task_exit(0, 0, DetachID);
+    __cilkscale_detach_continue(0, DetachID);
+  }
+};
+
+TEST_F(CilkscaleTest, CombinesSpawnAndContinuation) {
+  __cilkscale_func_entry(0);
+  Now += 10;
+  spawn(100, 30);
+  Now += 5;
+  __cilkscale_sync(0);
+  Now += 2;
+  __cilkscale_func_exit(0, 0);
+
+  cilkscale_measurement_t M = measured();
+  EXPECT_EQ(47u, M.work);
+  EXPECT_EQ(42u, M.span);
+
+  uint64_t Count;
+  cilkscale_measurement_t Site = __cilkscale_get_site_measurement(100, &Count);
+  EXPECT_EQ(1u, Count);
+  EXPECT_EQ(30u, Site.work);
+  EXPECT_EQ(30u, Site.span);
+}
+
+TEST_F(CilkscaleTest, LongerContinuationWins) {
+  __cilkscale_func_entry(0);
+  spawn(101, 3);
+  Now += 20;
+  __cilkscale_sync(0);
+  __cilkscale_func_exit(0, 0);
+
+  cilkscale_measurement_t M = measured();
+  EXPECT_EQ(23u, M.work);
+  EXPECT_EQ(20u, M.span);
+}
+
+TEST_F(CilkscaleTest, CallsAddToSpanAndTasksNest) {
+  __cilkscale_func_entry(0);
+  // A task that itself spawns two tasks of 8 and 6 and then works for 1.
+  __cilkscale_detach(102);
+  __cilkscale_task(0, 102);
+  spawn(103, 8);
+  spawn(103, 6);
+  __cilkscale_sync(0);
+  Now += 1;
+  __cilkscale_task_exit(0, 0, 102);
+  __cilkscale_detach_continue(0, 102);
+  // A call to a spawning function, whose span adds to the continuation.
+  __cilkscale_func_entry(1);
+  spawn(104, 4);
+  Now += 4;
+  __cilkscale_func_exit(1, 1);
+  Now += 1;
+  __cilkscale_func_exit(0, 0);
+
+  cilkscale_measurement_t M = measured();
+  EXPECT_EQ(24u, M.work);
+  EXPECT_EQ(9u, M.span);
+
+  uint64_t Count;
+  cilkscale_measurement_t Site = __cilkscale_get_site_measurement(103, &Count);
+  EXPECT_EQ(2u, Count);
+  EXPECT_EQ(14u, Site.work);
+  EXPECT_EQ(14u, Site.span);
+  Site = __cilkscale_get_site_measurement(102, &Count);
+  EXPECT_EQ(1u, Count);
+  EXPECT_EQ(15u, Site.work);
+  EXPECT_EQ(9u, Site.span);
+  __cilkscale_get_site_measurement(105, &Count);
+  EXPECT_EQ(0u, Count);
+}
+
+TEST_F(CilkscaleTest, ExcludesSerialCodeOutsideSpawningFunctions) {
+  Now += 50;
+  __cilkscale_func_entry(0);
+  Now += 1;
+  __cilkscale_func_exit(0, 0);
+  Now += 50;
+
+  cilkscale_measurement_t M = measured();
+  EXPECT_EQ(1u, M.work);
+  EXPECT_EQ(1u, M.span);
+}
+
+TEST_F(CilkscaleTest, FindsSpawnSitesInTheCSITables) {
+  // The runtime reports the site at exit, so its entry must outlive the test.
+  static csirt_source_loc_t Loc = {nullptr, 12, 3, const_cast<char *>("a.c")};
+  int64_t Bases[CSIRT_NUM_FED_TABLES];
+  unit_fed_table_t Fed[CSIRT_NUM_FED_TABLES];
+  for (int T = 0; T < CSIRT_NUM_FED_TABLES; ++T)
+    Fed[T] = {0, &Bases[T], nullptr};
+  Fed[6] = {1, &Bases[6], &Loc};
+  unit_size_table_t Size[CSIRT_NUM_SIZE_TABLES] = {{0, nullptr}};
+  __csirt_unit_init("unit", Fed, Size, noCallsites);
+
+  __cilkscale_func_entry(Bases[0]);
+  spawn(Bases[6], 1);
+  __cilkscale_func_exit(Bases[0], Bases[0]);
+
+  uint64_t Count;
+  __cilkscale_get_site_measurement(Bases[6], &Count);
+  EXPECT_EQ(1u, Count);
+  EXPECT_EQ(&Loc, __csi_get_detach_source_loc(Bases[6]));
+}
+
+} // end anonymous namespace